@@ -59,6 +59,30 @@ crc_t crc_init(void);
 crc_t crc_update(crc_t crc, const void *data, size_t data_len);
 
 
+/**
+ * Update the crc value with new data, one byte at a time.
+ *
+ * The original table-driven implementation, kept as the reference.
+ *****************************************************************************/
+crc_t crc_update_table(crc_t crc, const void *data, size_t data_len);
+
+
+/**
+ * Update the crc value with new data, eight bytes at a time.
+ *
+ * Portable slicing-by-8, what crc_update() uses without cpu support.
+ *****************************************************************************/
+crc_t crc_update_slice8(crc_t crc, const void *data, size_t data_len);
+
+
+/**
+ * Name of the implementation crc_update() uses.
+ *
+ * \return     "pclmul", "armv8" or "slice8".
+ *****************************************************************************/
+const char *crc_implementation(void);
+
+
 /**
  * Calculate the final crc value.
  *
@@ -169,13 +169,14 @@ handle_truncated_send:
 		/* what we just sent went out cleanly */
 		return n;
 
-	if (n && wsi->u.ws.clean_buffer)
+	if (n && wsi->u.ws.clean_buffer && n >= wsi->u.ws.tx_header_len)
 		/*
 		 * This buffer unaffected by extension rewriting.
 		 * It means the user code is expected to deal with
 		 * partial sends.  (lws knows the header was already
 		 * sent, so on next send will just resume sending
-		 * payload)
+		 * payload)  If not even the header made it, the
+		 * rest is buffered below as the user can't resume.
 		 */
 		 return n;
 
@@ -459,6 +460,7 @@ send_raw:
 	 * return to the user code how much OF THE USER BUFFER was consumed.
 	 */
 
+	wsi->u.ws.tx_header_len = pre;
 	n = lws_issue_raw_ext_access(wsi, buf - pre, len + pre + post);
 	if (n <= 0)
 		return n;
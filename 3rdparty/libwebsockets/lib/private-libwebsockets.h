@@ -555,6 +555,7 @@ struct _lws_websocket_related {
 	unsigned int this_frame_masked:1;
 	unsigned int inside_frame:1; /* next write will be more of frame */
 	unsigned int clean_buffer:1; /* buffer not rewritten by extension */
+	unsigned char tx_header_len; /* frame header in front of the payload */
 };
 
 struct libwebsocket {
@@ -60,6 +60,16 @@ int lws_context_init_server(struct lws_context_creation_info *info,
 	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR,
 				      (const void *)&opt, sizeof(opt));
 
+#ifdef SO_REUSEPORT
+	/*
+	 * several contexts listening on the same port, the kernel spreads
+	 * the incoming connections between them
+	 */
+	if (info->options & LWS_SERVER_OPTION_REUSEPORT)
+		setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT,
+				      (const void *)&opt, sizeof(opt));
+#endif
+
 	lws_plat_set_socket_options(context, sockfd);
 
 #ifdef LWS_USE_IPV6
@@ -14,6 +14,10 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // recvmmsg & sendmmsg
+#endif
+
 #ifdef MEMORY_CHECK
 #include <assert.h>
 #define MEMCHECK(x) x
@@ -58,6 +62,21 @@ limitations under the License.
 
 #define INET_SOCKADDR_LENGTH(x) ((x==AF_INET6?sizeof(struct sockaddr_in6):sizeof(struct sockaddr_in)))
 
+// Datagram batching is only available where the kernel has recvmmsg/sendmmsg
+#if defined(__linux__) && defined(_POSIX) && !defined(MICROSTACK_NO_MMSG)
+#define MICROSTACK_MMSG
+#include <netinet/udp.h>
+#endif
+
+#ifdef MICROSTACK_MMSG
+// Most datagrams handled by a single recvmmsg/sendmmsg call
+#define ILibAsyncSocket_MAX_BATCH 32
+// Receive slots are allocated up to this many bytes in total
+#define ILibAsyncSocket_BATCH_BUFFER_SIZE 262144
+// Largest payload sent as one GSO super datagram, below the 64K UDP limit
+#define ILibAsyncSocket_GSO_MAX_SIZE 65000
+#endif
+
 #if defined(WIN32) && !defined(snprintf) && (_MSC_PLATFORM_TOOLSET <= 120)
 #define snprintf(dst, len, frm, ...) _snprintf_s(dst, len, _TRUNCATE, frm, __VA_ARGS__)
 #endif
@@ -108,6 +127,14 @@ struct ILibAsyncSocket_SendData
 	struct ILibAsyncSocket_SendData *Next;
 };
 
+#ifdef MICROSTACK_MMSG
+struct ILibAsyncSocket_Datagram
+{
+	int length; // -1 if the datagram was truncated
+	struct sockaddr_in6 source;
+};
+#endif
+
 struct ILibAsyncSocketModule
 {
 	void (*PreSelect)(void* object,fd_set *readset, fd_set *writeset, fd_set *errorset, int* blocktime);
@@ -178,6 +205,19 @@ struct ILibAsyncSocketModule
 	int MaxBufferSizeExceeded;
 	void *MaxBufferSizeUserObject;
 
+	ILibAsyncSocket_IOStats Stats;
+
+	#ifdef MICROSTACK_MMSG
+	// Datagram batching, see ILibAsyncSocket_SetDatagramBatching
+	int Batching;
+	int BatchSlots;
+	int BatchSlotSize;
+	int BatchNext;
+	int BatchCount;
+	char* BatchBuffer;
+	struct ILibAsyncSocket_Datagram *BatchInfo;
+	#endif
+
 	// Added for TLS support
 	#ifndef MICROSTACK_NOTLS
 	int SSLConnect;
@@ -302,6 +342,16 @@ void ILibAsyncSocket_Destroy(void *socketModule)
 		current = temp;
 	}
 
+	#ifdef MICROSTACK_MMSG
+	// Free the receive slots used for batching
+	if (module->BatchInfo != NULL)
+	{
+		free(module->BatchInfo);
+		module->BatchInfo = NULL;
+		module->BatchBuffer = NULL;
+	}
+	#endif
+
 	module->FinConnect = 0;
 	module->user = NULL;
 	#ifndef MICROSTACK_NOTLS
@@ -400,6 +450,114 @@ void ILibAsyncSocket_ClearPendingSend(ILibAsyncSocket_SocketModule socketModule)
 	}
 }
 
+#ifdef MICROSTACK_MMSG
+//
+// Sends the queued datagrams with as few sendmmsg calls as possible. SendLock must be held.
+// Runs of equally sized datagrams to the same destination go out as one GSO datagram if enabled.
+// Returns 0 if everything was sent or the socket would block, -1 if the socket failed.
+//
+static int ILibAsyncSocket_FlushDatagrams(struct ILibAsyncSocketModule *module)
+{
+	struct mmsghdr msgs[ILibAsyncSocket_MAX_BATCH];
+	struct iovec iov[ILibAsyncSocket_MAX_BATCH];
+	#ifdef UDP_SEGMENT
+	char control[ILibAsyncSocket_MAX_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+	struct cmsghdr *cmsg;
+	int total;
+	#endif
+	struct ILibAsyncSocket_SendData *data, *next;
+	int count, packets, segments, sent, i, j;
+
+	while (module->PendingSend_Head != NULL)
+	{
+		count = 0;
+		packets = 0;
+		data = module->PendingSend_Head;
+		memset(msgs, 0, sizeof(msgs));
+
+		// Only whole datagrams can be batched, anything else is left to the regular write path
+		while (data != NULL && packets < ILibAsyncSocket_MAX_BATCH && data->remoteAddress.sin6_family != 0 && data->bytesSent == 0)
+		{
+			iov[packets].iov_base = data->buffer;
+			iov[packets].iov_len = data->bufferSize;
+			segments = 1;
+			next = data->Next;
+
+			#ifdef UDP_SEGMENT
+			if ((module->Batching & ILibAsyncSocket_DatagramBatching_GSO) != 0)
+			{
+				// Every segment but the last one must have the same size
+				total = data->bufferSize;
+				while (next != NULL && packets + segments < ILibAsyncSocket_MAX_BATCH && next->bytesSent == 0 &&
+					next->bufferSize <= data->bufferSize && total + next->bufferSize <= ILibAsyncSocket_GSO_MAX_SIZE &&
+					memcmp(&(next->remoteAddress), &(data->remoteAddress), sizeof(struct sockaddr_in6)) == 0)
+				{
+					iov[packets + segments].iov_base = next->buffer;
+					iov[packets + segments].iov_len = next->bufferSize;
+					total += next->bufferSize;
+					++segments;
+					next = next->Next;
+					if (iov[packets + segments - 1].iov_len < (size_t)data->bufferSize) break;
+				}
+				if (segments > 1)
+				{
+					msgs[count].msg_hdr.msg_control = control[count];
+					msgs[count].msg_hdr.msg_controllen = sizeof(control[count]);
+					cmsg = CMSG_FIRSTHDR(&(msgs[count].msg_hdr));
+					cmsg->cmsg_level = SOL_UDP;
+					cmsg->cmsg_type = UDP_SEGMENT;
+					cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+					*((uint16_t*)CMSG_DATA(cmsg)) = (uint16_t)data->bufferSize;
+				}
+			}
+			#endif
+
+			msgs[count].msg_hdr.msg_name = &(data->remoteAddress);
+			msgs[count].msg_hdr.msg_namelen = INET_SOCKADDR_LENGTH(data->remoteAddress.sin6_family);
+			msgs[count].msg_hdr.msg_iov = &iov[packets];
+			msgs[count].msg_hdr.msg_iovlen = segments;
+			packets += segments;
+			++count;
+			data = next;
+		}
+		if (count == 0) return 0;
+
+		sent = sendmmsg(module->internalSocket, msgs, count, MSG_NOSIGNAL);
+		++module->Stats.SendCalls;
+		if (sent < 0)
+		{
+			if (errno == EWOULDBLOCK || errno == EAGAIN) return 0;
+			#ifdef UDP_SEGMENT
+			if (msgs[0].msg_hdr.msg_controllen != 0 && (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP))
+			{
+				// The kernel (or the route) can't segment this, retry the datagrams one by one
+				module->Batching &= ~ILibAsyncSocket_DatagramBatching_GSO;
+				continue;
+			}
+			#endif
+			return -1;
+		}
+
+		// Release everything that went out, a failing datagram is reported by the next call
+		for (i = 0; i < sent; ++i)
+		{
+			for (j = 0; j < (int)msgs[i].msg_hdr.msg_iovlen; ++j)
+			{
+				data = module->PendingSend_Head;
+				module->PendingSend_Head = data->Next;
+				if (module->PendingSend_Head == NULL) module->PendingSend_Tail = NULL;
+				module->PendingBytesToSend -= data->bufferSize;
+				module->TotalBytesSent += data->bufferSize;
+				++module->Stats.PacketsSent;
+				if (data->UserFree == 0) free(data->buffer);
+				free(data);
+			}
+		}
+	}
+	return 0;
+}
+#endif
+
 /*! \fn ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketModule socketModule, char* buffer, int length, int remoteAddress, unsigned short remotePort, enum ILibAsyncSocket_MemoryOwnership UserFree)
 \brief Sends data on an AsyncSocket module to a specific destination. (Valid only for <B>UDP</B>)
 \param socketModule The ILibAsyncSocket module to send data on
@@ -415,6 +573,7 @@ enum ILibAsyncSocket_SendStatus ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketMod
 	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
 	struct ILibAsyncSocket_SendData *data;
 	int bytesSent = 0;
+	int batched = 0;
 	enum ILibAsyncSocket_SendStatus retVal = ILibAsyncSocket_ALL_DATA_SENT;
 
 	// If the socket is empty, return now.
@@ -446,8 +605,13 @@ enum ILibAsyncSocket_SendStatus ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketMod
 		return ILibAsyncSocket_SEND_ON_CLOSED_SOCKET_ERROR;
 	}
 
+	#ifdef MICROSTACK_MMSG
+	// Datagrams sent while the chain is iterating are flushed together with one sendmmsg before the chain blocks again
+	batched = (module->Batching & ILibAsyncSocket_DatagramBatching_MMSG) != 0 && remoteAddress != NULL && module->FinConnect > 0 && ILibIsChainRunning(module->Chain) != 0 && ILibIsRunningOnChainThread(module->Chain) != 0;
+	#endif
+
 	module->PendingBytesToSend += length;
-	if (module->PendingSend_Tail != NULL || module->FinConnect == 0)
+	if (batched != 0 || module->PendingSend_Tail != NULL || module->FinConnect == 0)
 	{
 		// There are still bytes that are pending to be sent, or pending connection, so we need to queue this up
 		if (module->PendingSend_Tail == NULL)
@@ -461,7 +625,8 @@ enum ILibAsyncSocket_SendStatus ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketMod
 			module->PendingSend_Tail = data;
 		}
 		
-		retVal = ILibAsyncSocket_NOT_ALL_DATA_SENT_YET;
+		// A batched datagram is as good as sent, the chain is going to flush it without waiting on anything
+		retVal = batched != 0 ? ILibAsyncSocket_ALL_DATA_SENT : ILibAsyncSocket_NOT_ALL_DATA_SENT_YET;
 
 		if (UserFree == ILibAsyncSocket_MemoryOwnership_USER)
 		{
@@ -509,9 +674,11 @@ enum ILibAsyncSocket_SendStatus ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketMod
 		}
 		#endif
 
+		++module->Stats.SendCalls;
 		if (bytesSent > 0)
 		{
 			// We were able to send something, so lets increment the counters
+			++module->Stats.PacketsSent;
 			module->PendingSend_Head->bytesSent += bytesSent;
 			module->PendingBytesToSend -= bytesSent;
 			module->TotalBytesSent += bytesSent;
@@ -875,6 +1042,95 @@ void ILibAsyncSocket_ConnectToProxy(void* socketModule, struct sockaddr *localIn
 // Internal method called when data is ready to be processed on an ILibAsyncSocket
 //
 // <param name="Reader">The ILibAsyncSocket with pending data</param>
+#ifdef MICROSTACK_MMSG
+//
+// Hands the datagrams of the last recvmmsg to the user, until the user pauses or closes the socket
+//
+static void ILibAsyncSocket_DeliverDatagrams(struct ILibAsyncSocketModule *Reader)
+{
+	struct ILibAsyncSocket_Datagram *datagram;
+	char *buffer;
+	int iPointer;
+
+	while (Reader->BatchNext < Reader->BatchCount && Reader->internalSocket != ~0 && Reader->PAUSE <= 0)
+	{
+		datagram = &(Reader->BatchInfo[Reader->BatchNext]);
+		buffer = Reader->BatchBuffer + (Reader->BatchNext * Reader->BatchSlotSize);
+		++Reader->BatchNext;
+
+		// If a UDP packet is larger than the buffer, drop it.
+		if (datagram->length <= 0) continue;
+
+		memcpy(&(Reader->SourceAddress), &(datagram->source), sizeof(struct sockaddr_in6));
+		ILib6to4((struct sockaddr*)&(Reader->SourceAddress));
+
+		iPointer = 0;
+		if (Reader->OnData != NULL) Reader->OnData(Reader, buffer, &iPointer, datagram->length, &(Reader->OnInterrupt), &(Reader->user), &(Reader->PAUSE));
+	}
+}
+
+//
+// Reads up to ILibAsyncSocket_MAX_BATCH datagrams with one recvmmsg.
+// Returns non-zero if the regular, one datagram at a time, path should handle the socket instead.
+//
+static int ILibAsyncSocket_ProcessDatagrams(struct ILibAsyncSocketModule *Reader, int pendingRead)
+{
+	struct mmsghdr msgs[ILibAsyncSocket_MAX_BATCH];
+	struct iovec iov[ILibAsyncSocket_MAX_BATCH];
+	int i, received;
+
+	// The user may have paused in the middle of the previous batch, finish that one first
+	ILibAsyncSocket_DeliverDatagrams(Reader);
+	if (Reader->BatchNext < Reader->BatchCount || Reader->internalSocket == ~0 || Reader->PAUSE > 0) return 0;
+	if ((Reader->Batching & ILibAsyncSocket_DatagramBatching_MMSG) == 0) return 1;
+	if (!pendingRead) return 0;
+
+	if (Reader->BatchInfo == NULL)
+	{
+		Reader->BatchSlotSize = Reader->MallocSize;
+		Reader->BatchSlots = ILibAsyncSocket_BATCH_BUFFER_SIZE / Reader->BatchSlotSize;
+		if (Reader->BatchSlots > ILibAsyncSocket_MAX_BATCH) Reader->BatchSlots = ILibAsyncSocket_MAX_BATCH;
+		if (Reader->BatchSlots < 1) Reader->BatchSlots = 1;
+		if ((Reader->BatchInfo = (struct ILibAsyncSocket_Datagram*)malloc(Reader->BatchSlots * (sizeof(struct ILibAsyncSocket_Datagram) + Reader->BatchSlotSize))) == NULL) ILIBCRITICALEXIT(254);
+		Reader->BatchBuffer = (char*)(Reader->BatchInfo + Reader->BatchSlots);
+	}
+
+	memset(msgs, 0, sizeof(struct mmsghdr) * Reader->BatchSlots);
+	for (i = 0; i < Reader->BatchSlots; ++i)
+	{
+		iov[i].iov_base = Reader->BatchBuffer + (i * Reader->BatchSlotSize);
+		iov[i].iov_len = Reader->BatchSlotSize;
+		msgs[i].msg_hdr.msg_name = &(Reader->BatchInfo[i].source);
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	received = recvmmsg(Reader->internalSocket, msgs, Reader->BatchSlots, MSG_DONTWAIT, NULL);
+	if (received < 0)
+	{
+		// Real errors go through the regular path, which takes care of closing the socket
+		if (errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR) return 1;
+		++Reader->Stats.ReceiveCalls;
+		return 0;
+	}
+
+	++Reader->Stats.ReceiveCalls;
+	Reader->Stats.PacketsReceived += received;
+	ILibRemoteLogging_printf(ILibChainGetLogger(Reader->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_2, "AsyncSocket[%p] recvmmsg returned %d", (void*)Reader, received);
+
+	for (i = 0; i < received; ++i)
+	{
+		Reader->BatchInfo[i].length = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0 ? -1 : (int)msgs[i].msg_len;
+	}
+	Reader->BatchNext = 0;
+	Reader->BatchCount = received;
+
+	ILibAsyncSocket_DeliverDatagrams(Reader);
+	return 0;
+}
+#endif
+
 void ILibProcessAsyncSocket(struct ILibAsyncSocketModule *Reader, int pendingRead)
 {
 	#ifndef MICROSTACK_NOTLS
@@ -890,6 +1146,10 @@ void ILibProcessAsyncSocket(struct ILibAsyncSocketModule *Reader, int pendingRea
 	int len;
 	char *temp;
 
+	#ifdef MICROSTACK_MMSG
+	if ((Reader->Batching != 0 || Reader->BatchNext < Reader->BatchCount) && ILibAsyncSocket_ProcessDatagrams(Reader, pendingRead) == 0) return;
+	#endif
+
 	//
 	// If the thing isn't paused, and the user set the pointers such that we still have data
 	// in our buffers, we need to call the user back with that data, before we attempt to read
@@ -1112,6 +1372,8 @@ void ILibProcessAsyncSocket(struct ILibAsyncSocketModule *Reader, int pendingRea
 		bytesReceived = recvfrom(Reader->internalSocket, Reader->buffer+Reader->EndPointer, Reader->MallocSize-Reader->EndPointer, 0, (struct sockaddr*)&(Reader->SourceAddress), (socklen_t*)&len);
 #endif
 		ILib6to4((struct sockaddr*)&(Reader->SourceAddress));
+		++Reader->Stats.ReceiveCalls;
+		if (bytesReceived > 0) ++Reader->Stats.PacketsReceived;
 		ILibRemoteLogging_printf(ILibChainGetLogger(Reader->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_2, "AsyncSocket[%p] recv (NON-TLS) returned %d", (void*)Reader, bytesReceived);
 	}
 
@@ -1343,6 +1605,15 @@ void ILibAsyncSocket_PreSelect(void* socketModule,fd_set *readset, fd_set *write
 			}
 		}
 
+		#ifdef MICROSTACK_MMSG
+		// Flush the datagrams queued since our PostSelect, before the chain goes to sleep
+		if (module->Batching != 0 && module->FinConnect > 0 && module->PendingSend_Head != NULL && ILibAsyncSocket_FlushDatagrams(module) != 0)
+		{
+			ILibAsyncSocket_ClearPendingSend(module);
+			ILibLifeTime_Add(module->LifeTime, socketModule, 0, &ILibAsyncSocket_Disconnect, NULL);
+		}
+		#endif
+
 		if (module->PendingSend_Head != NULL)
 		{
 			// If there is pending data to be sent, then we need to check when the socket is writable
@@ -1625,6 +1896,22 @@ void ILibAsyncSocket_PostSelect(void* socketModule, int slct, fd_set *readset, f
 
 	SEM_TRACK(AsyncSocket_TrackLock("ILibAsyncSocket_PostSelect", 1, module);)
 	sem_wait(&(module->SendLock));
+	#ifdef MICROSTACK_MMSG
+	// Flush the datagrams queued while the received ones were handled
+	if (module->Batching != 0 && module->FinConnect > 0 && module->internalSocket != ~0 && module->PendingSend_Head != NULL)
+	{
+		if (ILibAsyncSocket_FlushDatagrams(module) != 0)
+		{
+			ILibAsyncSocket_ClearPendingSend(socketModule);
+			ILibLifeTime_Add(module->LifeTime, socketModule, 0, &ILibAsyncSocket_Disconnect, NULL);
+		}
+		else if (fd_write != 0 && module->PendingSend_Head == NULL)
+		{
+			// This also finished sends that were waiting on the socket to become writable
+			TriggerSendOK = 1;
+		}
+	}
+	#endif
 	// Write Handling
 	if (module->FinConnect > 0 && module->internalSocket != ~0 && fd_write != 0 && module->PendingSend_Head != NULL)
 	{
@@ -1651,8 +1938,10 @@ void ILibAsyncSocket_PostSelect(void* socketModule, int slct, fd_set *readset, f
 				bytesSent = sendto(module->internalSocket, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize - module->PendingSend_Head->bytesSent, MSG_NOSIGNAL, (struct sockaddr*)&module->PendingSend_Head->remoteAddress, INET_SOCKADDR_LENGTH(module->PendingSend_Head->remoteAddress.sin6_family)); // Klocwork reports that this could block while holding a lock... This socket has been set to O_NONBLOCK, so that will never happen
 			}
 
+			++module->Stats.SendCalls;
 			if (bytesSent > 0)
 			{
+				++module->Stats.PacketsSent;
 				module->PendingBytesToSend -= bytesSent;
 				module->TotalBytesSent += bytesSent;
 				module->PendingSend_Head->bytesSent += bytesSent;
@@ -1722,6 +2011,7 @@ void ILibAsyncSocket_PostSelect(void* socketModule, int slct, fd_set *readset, f
 	{
 		SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_PostSelect", 2, module);)
 		sem_post(&(module->SendLock));
+		if (TriggerSendOK != 0 && module->OnSendOK != NULL) module->OnSendOK(module, module->user);
 	}
 
 	ILibRemoteLogging_printf(ILibChainGetLogger(module->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_5, "...AsyncSocket[%p] exited PostSelect", (void*)module);
@@ -2066,6 +2356,51 @@ int ILibAsyncSocket_WasClosedBecauseBufferSizeExceeded(ILibAsyncSocket_SocketMod
 	return(sm->MaxBufferSizeExceeded);
 }
 
+/*! \fn ILibAsyncSocket_SetDatagramBatching(ILibAsyncSocket_SocketModule socketModule, int flags)
+\brief Batches the system calls of a datagram socket
+\par
+Only valid for datagram sockets whose OnData handler consumes every datagram it is given, like \a ILibAsyncUDPSocket.
+Datagrams sent from the chain thread while the chain is iterating are queued, and flushed with one sendmmsg
+at the end of the iteration.
+\param socketModule The ILibAsyncSocket to configure
+\param flags The \a ILibAsyncSocket_DatagramBatching flags to enable
+\returns The flags supported on this platform, which are the ones that were enabled
+*/
+int ILibAsyncSocket_SetDatagramBatching(ILibAsyncSocket_SocketModule socketModule, int flags)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+
+	#ifdef MICROSTACK_MMSG
+	#ifndef UDP_SEGMENT
+	flags &= ~ILibAsyncSocket_DatagramBatching_GSO;
+	#endif
+	if ((flags & ILibAsyncSocket_DatagramBatching_MMSG) == 0) flags = ILibAsyncSocket_DatagramBatching_NONE;
+
+	sem_wait(&(module->SendLock));
+	module->Batching = flags;
+	sem_post(&(module->SendLock));
+	return flags;
+	#else
+	UNREFERENCED_PARAMETER( module );
+	UNREFERENCED_PARAMETER( flags );
+	return ILibAsyncSocket_DatagramBatching_NONE;
+	#endif
+}
+
+/*! \fn ILibAsyncSocket_GetIOStats(ILibAsyncSocket_SocketModule socketModule, ILibAsyncSocket_IOStats *stats)
+\brief Returns the system call counters of an ILibAsyncSocket
+\param socketModule The ILibAsyncSocket to query
+\param[out] stats The counters
+*/
+void ILibAsyncSocket_GetIOStats(ILibAsyncSocket_SocketModule socketModule, ILibAsyncSocket_IOStats *stats)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+
+	sem_wait(&(module->SendLock));
+	memcpy(stats, &(module->Stats), sizeof(ILibAsyncSocket_IOStats));
+	sem_post(&(module->SendLock));
+}
+
 #ifndef MICROSTACK_NOTLS
 X509 *ILibAsyncSocket_SslGetCert(ILibAsyncSocket_SocketModule socketModule)
 {
@@ -73,6 +73,27 @@ enum ILibAsyncSocket_MemoryOwnership
 	ILibAsyncSocket_MemoryOwnership_USER = 2 /*!< The Microstack doesn't own this memory, so if necessary the memory will be copied */
 };
 
+/*! \enum ILibAsyncSocket_DatagramBatching
+\brief Flags for \a ILibAsyncSocket_SetDatagramBatching
+*/
+enum ILibAsyncSocket_DatagramBatching
+{
+	ILibAsyncSocket_DatagramBatching_NONE = 0x00, /*!< One system call per datagram */
+	ILibAsyncSocket_DatagramBatching_MMSG = 0x01, /*!< Receive with recvmmsg, and flush datagrams sent from the chain thread with sendmmsg */
+	ILibAsyncSocket_DatagramBatching_GSO = 0x02 /*!< Coalesce equally sized datagrams to the same destination with UDP GSO */
+};
+
+/*! \struct ILibAsyncSocket_IOStats
+\brief System call counters of an ILibAsyncSocket
+*/
+typedef struct ILibAsyncSocket_IOStats
+{
+	unsigned long long ReceiveCalls; /*!< Number of receive system calls */
+	unsigned long long PacketsReceived; /*!< Number of datagrams (or stream reads) received */
+	unsigned long long SendCalls; /*!< Number of send system calls */
+	unsigned long long PacketsSent; /*!< Number of datagrams (or stream writes) sent */
+}ILibAsyncSocket_IOStats;
+
 /*! \typedef ILibAsyncSocket_SocketModule
 \brief The handle for an ILibAsyncSocket module
 */
@@ -215,6 +236,9 @@ void ILibAsyncSocket_SetSendOK(ILibAsyncSocket_SocketModule module, ILibAsyncSoc
 int ILibAsyncSocket_IsIPv6LinkLocal(struct sockaddr *LocalAddress);
 int ILibAsyncSocket_IsModuleIPv6LinkLocal(ILibAsyncSocket_SocketModule module);
 
+int ILibAsyncSocket_SetDatagramBatching(ILibAsyncSocket_SocketModule module, int flags);
+void ILibAsyncSocket_GetIOStats(ILibAsyncSocket_SocketModule module, ILibAsyncSocket_IOStats *stats);
+
 #ifndef MICROSTACK_NOTLS
 X509 *ILibAsyncSocket_SslGetCert(ILibAsyncSocket_SocketModule socketModule);
 STACK_OF(X509) *ILibAsyncSocket_SslGetCerts(ILibAsyncSocket_SocketModule socketModule);
@@ -157,6 +157,7 @@ ILibAsyncUDPSocket_SocketModule ILibAsyncUDPSocket_CreateEx(void *Chain, int Buf
 		return NULL;
 	}
 	ILibAsyncSocket_UseThisSocket(RetVal, sock, &ILibAsyncUDPSocket_OnDisconnect, data);
+	ILibAsyncSocket_SetDatagramBatching(RetVal, ILibAsyncSocket_DatagramBatching_MMSG | ILibAsyncSocket_DatagramBatching_GSO);
 	return RetVal; // Klockwork claims we could be losing the resource acquired with the call to socket(), however, we aren't becuase we are saving it with the above call to ILibAsyncSocket_UseThisSocket()
 }
 
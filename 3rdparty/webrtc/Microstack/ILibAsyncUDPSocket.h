@@ -113,6 +113,19 @@ void ILibAsyncUDPSocket_SetMulticastLoopback(ILibAsyncUDPSocket_SocketModule mod
 	\param socketModule The ILibAsyncUDPSocket_SocketModule handle to reset
 */
 #define ILibAsyncUDPSocket_ResetTotalBytesSent(socketModule) ILibAsyncSocket_ResetTotalBytesSent(socketModule)
+/*! \def ILibAsyncUDPSocket_SetBatching
+	\brief Sets how system calls are batched, recvmmsg/sendmmsg and GSO are enabled by default where supported
+	\param socketModule The ILibAsyncUDPSocket_SocketModule handle to configure
+	\param flags The ILibAsyncSocket_DatagramBatching flags to enable
+	\returns The flags that were enabled
+*/
+#define ILibAsyncUDPSocket_SetBatching(socketModule, flags) ILibAsyncSocket_SetDatagramBatching(socketModule, flags)
+/*! \def ILibAsyncUDPSocket_GetIOStats
+	\brief Returns the number of system calls made, and datagrams handled by them
+	\param socketModule The ILibAsyncUDPSocket_SocketModule handle to query
+	\param stats The ILibAsyncSocket_IOStats to fill in
+*/
+#define ILibAsyncUDPSocket_GetIOStats(socketModule, stats) ILibAsyncSocket_GetIOStats(socketModule, stats)
 
 
 /*! \def ILibAsyncUDPSocket_SendTo
@@ -149,11 +149,32 @@ public static class HumbleNet {
 			return NativeMethods.humblenet_p2p_unregister_alias(name);
 		}
 
+		public static AliasStatus GetAliasStatus(string name, out PeerId owner)
+		{
+			UInt32 peer;
+			AliasStatus ret = NativeMethods.humblenet_p2p_alias_status(name, out peer);
+			owner = (PeerId)peer;
+			return ret;
+		}
+
 		public static PeerId VirtualPeerForAlias(string name)
 		{
 			return (PeerId)NativeMethods.humblenet_p2p_virtual_peer_for_alias(name);
 		}
 
+		public static bool LookupAlias(string name, out PeerId peer)
+		{
+			UInt32 id;
+			bool ret = NativeMethods.humblenet_p2p_lookup_alias(name, out id);
+			peer = (PeerId)id;
+			return ret;
+		}
+
+		public static bool Preconnect(PeerId peer)
+		{
+			return NativeMethods.humblenet_p2p_preconnect((UInt32)peer);
+		}
+
 		public static int SendTo(byte[] message, PeerId toPeer, SendMode mode, byte channel)
 		{
 			return NativeMethods.humblenet_p2p_sendto(message, (uint)message.Length, (UInt32)toPeer, mode, channel);
@@ -7,6 +7,7 @@
 #include "humblenet_p2p_signaling.cpp"
 #include "humblenet_alias.cpp"
 #include "humblepeer.cpp"
+#include "humblepeer_sdp.cpp"
 // socket layer
 #include "libsocket.cpp"
 // WEBRTC wrapper
@@ -2,10 +2,14 @@
 #include <cstdio>
 #include <cstring>
 
+#include <algorithm>
+#include <atomic>
 #include <limits>
+#include <memory>
 
 #include "humblenet.h"
 #include "humblepeer.h"
+#include "humblepeer_sdp.h"
 
 #include "crc.h"
 
@@ -21,6 +25,10 @@
 namespace humblenet {
 	const size_t PEER_OFFSET_SIZE = 8;
 
+	static std::atomic<uint64_t> fbb_builders_created(0);
+	static std::atomic<uint64_t> fbb_buffer_allocations(0);
+	static std::atomic<uint64_t> fbb_buffer_bytes(0);
+
 	class peer_allocator : public flatbuffers::simple_allocator {
 		const size_t _offset;
 	public:
@@ -29,6 +37,8 @@ namespace humblenet {
 		uint8_t *allocate(size_t size) const {
 
 			uint8_t *p = new uint8_t[size + _offset];
+			fbb_buffer_allocations.fetch_add(1, std::memory_order_relaxed);
+			fbb_buffer_bytes.fetch_add(size + _offset, std::memory_order_relaxed);
 			return p ? (p + _offset) : nullptr;
 		}
 		void deallocate(uint8_t *p) const {
@@ -40,6 +50,62 @@ namespace humblenet {
 
 	static peer_allocator peer_fbb_allocator(PEER_OFFSET_SIZE);
 
+	// Builders are kept per thread and Clear()ed between messages, which keeps their
+	// buffer (and the PEER_OFFSET_SIZE prefix in front of it) so steady state encoding
+	// doesn't allocate. A stack rather than a single builder so a send from inside
+	// another send still gets its own.
+	class PooledBuilder {
+		static const size_t MAX_POOLED_BUILDERS = 4;
+		static const size_t MAX_POOLED_SIZE = 64 * 1024;
+
+		typedef std::vector<std::unique_ptr<flatbuffers::FlatBufferBuilder>> Pool;
+
+		static Pool& pool() {
+			static thread_local Pool builders;
+			return builders;
+		}
+
+		std::unique_ptr<flatbuffers::FlatBufferBuilder> builder;
+
+	public:
+		flatbuffers::FlatBufferBuilder& fbb;
+
+		PooledBuilder() : builder(acquire()), fbb(*builder) {}
+
+		~PooledBuilder() {
+			Pool& builders = pool();
+			// don't hold on to the buffer of an unusually large message
+			if (builders.size() < MAX_POOLED_BUILDERS && fbb.GetSize() <= MAX_POOLED_SIZE) {
+				fbb.Clear();
+				builders.push_back(std::move(builder));
+			}
+		}
+
+	private:
+		PooledBuilder(const PooledBuilder&);
+		PooledBuilder& operator=(const PooledBuilder&);
+
+		static std::unique_ptr<flatbuffers::FlatBufferBuilder> acquire() {
+			Pool& builders = pool();
+			if (builders.empty()) {
+				fbb_builders_created.fetch_add(1, std::memory_order_relaxed);
+				return std::unique_ptr<flatbuffers::FlatBufferBuilder>(new flatbuffers::FlatBufferBuilder(DEFAULT_FBB_SIZE, &peer_fbb_allocator));
+			}
+			std::unique_ptr<flatbuffers::FlatBufferBuilder> b = std::move(builders.back());
+			builders.pop_back();
+			return b;
+		}
+	};
+
+	FBBAllocStats getFBBAllocStats()
+	{
+		FBBAllocStats stats;
+		stats.builders = fbb_builders_created.load(std::memory_order_relaxed);
+		stats.allocations = fbb_buffer_allocations.load(std::memory_order_relaxed);
+		stats.bytes = fbb_buffer_bytes.load(std::memory_order_relaxed);
+		return stats;
+	}
+
 	flatbuffers::Offset<flatbuffers::String> CreateFBBStringIfNotEmpty(flatbuffers::FlatBufferBuilder &fbb, const std::string &str)
 	{
 		if (str.empty()) {
@@ -80,55 +146,142 @@ namespace humblenet {
 		return sendP2PMessage(conn, base, size + PEER_OFFSET_SIZE);
 	}
 
-	ha_bool parseMessage(std::vector<uint8_t> &recvBuf, ProcessMsgFunc processFunc, void *user_data)
+	// The size of what follows a message or relay frame header. false if it's a relay frame
+	// and they aren't expected, or too large
+	static bool payloadSize(const uint8_t* header, ProcessRelayFunc relayFunc, size_t& size)
 	{
-		if (recvBuf.empty()) {
-			// nothing to do
-			return 1;
+		uint32_t word = flatbuffers::ReadScalar<uint32_t>(header);
+		size = word & ~RELAY_FRAME_FLAG;
+		return !(word & RELAY_FRAME_FLAG) || (relayFunc && size + RELAY_FRAME_HEADER_SIZE <= MAX_RELAY_FRAME_SIZE);
+	}
+
+	// Parses every complete message at the start of data, consumed is set to the number of bytes they used up.
+	// Whatever is left over is the beginning of a partial message.
+	static ha_bool parseMessages(const uint8_t *data, size_t size, size_t &consumed, ProcessMsgFunc processFunc, void *user_data, ProcessRelayFunc relayFunc)
+	{
+		static_assert(PEER_OFFSET_SIZE == RELAY_FRAME_HEADER_SIZE, "relay frames and messages share the header size");
+		consumed = 0;
+
+		// first PEER_OFFSET_SIZE bytes of each message are our packet header
+		while (size - consumed >= PEER_OFFSET_SIZE) {
+			const uint8_t* header = data + consumed;
+			size_t fbSize;
+			if (!payloadSize(header, relayFunc, fbSize)) {
+				return 0;
+			}
+
+			// make sure we have enough data!
+			if (size - consumed - PEER_OFFSET_SIZE < fbSize) {
+				// partial payload, try again later
+				break;
+			}
+
+			if (flatbuffers::ReadScalar<uint32_t>(header) & RELAY_FRAME_FLAG) {
+				// handed over as it is, no CRC or verifying
+				if (!relayFunc(header, fbSize + RELAY_FRAME_HEADER_SIZE, user_data)) {
+					return 0;
+				}
+				consumed += fbSize + RELAY_FRAME_HEADER_SIZE;
+				continue;
+			}
+
+			const uint8_t* buff = header + PEER_OFFSET_SIZE;
+
+			auto crc = crc_init();
+			crc = crc_update(crc, buff, fbSize);
+			crc = crc_finalize(crc);
+
+			flatbuffers::uoffset_t fbCrc = flatbuffers::ReadScalar<flatbuffers::uoffset_t>(header + sizeof(flatbuffers::uoffset_t));
+
+			if (fbCrc != crc) {
+				// TODO should we disconnect in this case?
+				return 0;
+			}
+
+			// Now validate our buffer based on the expected size
+			flatbuffers::Verifier v(buff, fbSize);
+			if (!HumblePeer::VerifyMessageBuffer(v)) {
+				// TODO should we disconnect in this case?
+				return 0;
+			}
+
+			auto message = HumblePeer::GetMessage(buff);
+
+			// process it
+			ha_bool messageOk = processFunc(message, user_data);
+			if (!messageOk) {
+				// processFunc didn't like this message for some reason
+				return 0;
+			}
+
+			consumed += fbSize + PEER_OFFSET_SIZE;
 		}
 
-		// first PEER_OFFSET_SIZE bytes are our packet header
-		flatbuffers::uoffset_t fbSize = flatbuffers::ReadScalar<flatbuffers::uoffset_t>(recvBuf.data());
-		// make sure we have enough data!
+		return 1;
+	}
 
-		if (recvBuf.size() < (fbSize + PEER_OFFSET_SIZE)) {
-			// partial payload, try again later
-			return 1;
+	ha_bool parseMessage(std::vector<uint8_t> &recvBuf, ProcessMsgFunc processFunc, void *user_data, ProcessRelayFunc relayFunc)
+	{
+		size_t consumed = 0;
+		ha_bool retval = parseMessages(recvBuf.data(), recvBuf.size(), consumed, processFunc, user_data, relayFunc);
+
+		// compact once, not after every message
+		if (retval && consumed > 0) {
+			recvBuf.erase(recvBuf.begin(), recvBuf.begin() + consumed);
 		}
 
-		const uint8_t* buff = recvBuf.data() + PEER_OFFSET_SIZE;
+		return retval;
+	}
 
-		auto crc = crc_init();
-		crc = crc_update(crc, buff, fbSize);
-		crc = crc_finalize(crc);
+	ha_bool parseMessage(std::vector<uint8_t> &recvBuf, const uint8_t *data, size_t length, ProcessMsgFunc processFunc, void *user_data, ProcessRelayFunc relayFunc)
+	{
+		// finish the partial message left over from the previous payload first
+		while (!recvBuf.empty() && length > 0) {
+			size_t needed = PEER_OFFSET_SIZE;
+			size_t payload = 0;
+			if (recvBuf.size() >= PEER_OFFSET_SIZE) {
+				if (!payloadSize(recvBuf.data(), relayFunc, payload)) {
+					return 0;
+				}
+				needed += payload;
+			}
 
-		flatbuffers::uoffset_t fbCrc = flatbuffers::ReadScalar<flatbuffers::uoffset_t>(recvBuf.data() + sizeof(flatbuffers::uoffset_t));
+			size_t take = std::min(needed - recvBuf.size(), length);
+			recvBuf.insert(recvBuf.end(), data, data + take);
+			data += take;
+			length -= take;
 
-		if (fbCrc != crc) {
-			// TODO should we disconnect in this case?
-			return 0;
-		}
+			if (recvBuf.size() < PEER_OFFSET_SIZE) {
+				continue;
+			}
 
-		// Now validate our buffer based on the expected size
-		flatbuffers::Verifier v(buff, fbSize);
-		if (!HumblePeer::VerifyMessageBuffer(v)) {
-			// TODO should we disconnect in this case?
-			return 0;
+			// the header may have just been completed, so the size is only known now
+			if (!payloadSize(recvBuf.data(), relayFunc, payload)) {
+				return 0;
+			}
+			needed = PEER_OFFSET_SIZE + payload;
+			if (recvBuf.size() == needed) {
+				size_t consumed = 0;
+				if (!parseMessages(recvBuf.data(), recvBuf.size(), consumed, processFunc, user_data, relayFunc)) {
+					return 0;
+				}
+				recvBuf.clear();
+			}
 		}
 
-		auto message = HumblePeer::GetMessage(buff);
+		if (length == 0) {
+			return 1;
+		}
 
-		// process it
-		ha_bool messageOk = processFunc(message, user_data);
-		if (!messageOk) {
-			// processFunc didn't like this message for some reason
+		// parse straight out of the payload, only a trailing partial message gets copied
+		size_t consumed = 0;
+		if (!parseMessages(data, length, consumed, processFunc, user_data, relayFunc)) {
 			return 0;
 		}
 
-		recvBuf.erase(recvBuf.begin(), recvBuf.begin() + fbSize + PEER_OFFSET_SIZE);
+		recvBuf.insert(recvBuf.end(), data + consumed, data + length);
 
-		// no need to check if recvBuf is empty since parseMessage will do it
-		return parseMessage(recvBuf, processFunc, user_data);
+		return 1;
 	}
 
 	// ** Peer server connection
@@ -141,7 +294,8 @@ namespace humblenet {
 		assert(!gametoken.empty());
 		assert(!gamesecret.empty());
 
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
 
 		std::vector<flatbuffers::Offset<HumblePeer::Attribute>> tempAttribs;
 
@@ -200,9 +354,10 @@ namespace humblenet {
 	}
 
 
-	ha_bool sendHelloClient(P2PSignalConnection *conn, PeerId peerId, const std::string& reconnectToken, const std::vector<ICEServer>& iceServers)
+	ha_bool sendHelloClient(P2PSignalConnection *conn, PeerId peerId, const std::string& reconnectToken, const std::vector<ICEServer>& iceServers, uint8_t flags)
 	{
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
 
 		std::vector<flatbuffers::Offset<HumblePeer::ICEServer>> tempServers;
 		tempServers.reserve(iceServers.size());
@@ -221,7 +376,8 @@ namespace humblenet {
 
 		auto packet = HumblePeer::CreateHelloClient(fbb, peerId,
 													CreateFBBStringIfNotEmpty(fbb, reconnectToken),
-													CreateFBBVectorIfNotEmpty(fbb, tempServers));
+													CreateFBBVectorIfNotEmpty(fbb, tempServers),
+													flags);
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::HelloClient, packet.Union());
 		fbb.Finish(msg);
 
@@ -232,7 +388,8 @@ namespace humblenet {
 
 	ha_bool sendNoSuchPeer(P2PSignalConnection *conn, PeerId peerId)
 	{
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
 		auto packet = HumblePeer::CreateP2PReject(fbb, peerId, HumblePeer::P2PRejectReason::NotFound);
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::P2PReject, packet.Union());
 		fbb.Finish(msg);
@@ -242,7 +399,8 @@ namespace humblenet {
 
 	ha_bool sendPeerRefused(P2PSignalConnection *conn, PeerId peerId)
 	{
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
 		auto packet = HumblePeer::CreateP2PReject(fbb, peerId, HumblePeer::P2PRejectReason::PeerRefused);
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::P2PReject, packet.Union());
 		fbb.Finish(msg);
@@ -250,39 +408,164 @@ namespace humblenet {
 		return sendP2PMessage(conn, fbb);
 	}
 
-	ha_bool sendP2PConnect(P2PSignalConnection *conn, PeerId peerId, uint8_t flags, const char* offer)
+	// null offsets if there's no exact compact form
+	static flatbuffers::Offset<HumblePeer::SessionDescription> compactDescription(flatbuffers::FlatBufferBuilder& fbb, const char* offer)
 	{
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
-		auto packet = HumblePeer::CreateP2POffer(fbb, peerId, flags, fbb.CreateString(offer));
+		SDPDescription desc;
+		if (!parseSDP(offer, desc)) {
+			return 0;
+		}
+		return buildSessionDescription(fbb, desc);
+	}
+
+	static flatbuffers::Offset<HumblePeer::SessionDescription> compactDescription(flatbuffers::FlatBufferBuilder& fbb, const HumblePeer::SessionDescription* description)
+	{
+		SDPDescription desc;
+		if (!readSessionDescription(description, desc)) {
+			return 0;
+		}
+		return buildSessionDescription(fbb, desc);
+	}
+
+	static flatbuffers::Offset<HumblePeer::Candidate> compactCandidate(flatbuffers::FlatBufferBuilder& fbb, const char* offer)
+	{
+		SDPCandidate candidate;
+		if (!parseCandidate(offer, candidate)) {
+			return 0;
+		}
+		return buildCandidate(fbb, candidate);
+	}
+
+	static flatbuffers::Offset<HumblePeer::Candidate> compactCandidate(flatbuffers::FlatBufferBuilder& fbb, const HumblePeer::Candidate* candidate)
+	{
+		SDPCandidate parsed;
+		if (!readCandidate(candidate, parsed)) {
+			return 0;
+		}
+		return buildCandidate(fbb, parsed);
+	}
+
+	static ha_bool sendP2POffer(P2PSignalConnection *conn, flatbuffers::FlatBufferBuilder& fbb, PeerId peerId, uint8_t flags,
+								flatbuffers::Offset<flatbuffers::String> offer,
+								flatbuffers::Offset<HumblePeer::SessionDescription> description)
+	{
+		auto packet = HumblePeer::CreateP2POffer(fbb, peerId, flags, offer, description);
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::P2POffer, packet.Union());
 		fbb.Finish(msg);
 
 		return sendP2PMessage(conn, fbb);
 	}
 
-	ha_bool sendP2PResponse(P2PSignalConnection *conn, PeerId peerId, const char* offer)
+	static ha_bool sendP2PAnswer(P2PSignalConnection *conn, flatbuffers::FlatBufferBuilder& fbb, PeerId peerId,
+								 flatbuffers::Offset<flatbuffers::String> offer,
+								 flatbuffers::Offset<HumblePeer::SessionDescription> description)
 	{
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
-		auto packet = HumblePeer::CreateP2PAnswer(fbb, peerId, fbb.CreateString(offer));
+		auto packet = HumblePeer::CreateP2PAnswer(fbb, peerId, offer, description);
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::P2PAnswer, packet.Union());
 		fbb.Finish(msg);
 
 		return sendP2PMessage(conn, fbb);
 	}
 
-	ha_bool sendICECandidate(P2PSignalConnection *conn, PeerId peerId, const char* offer)
+	static ha_bool sendICECandidate(P2PSignalConnection *conn, flatbuffers::FlatBufferBuilder& fbb, PeerId peerId,
+									flatbuffers::Offset<flatbuffers::String> offer,
+									flatbuffers::Offset<HumblePeer::Candidate> candidate)
 	{
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
-		auto packet = HumblePeer::CreateICECandidate(fbb, peerId, fbb.CreateString(offer));
+		auto packet = HumblePeer::CreateICECandidate(fbb, peerId, offer, candidate);
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::ICECandidate, packet.Union());
 		fbb.Finish(msg);
 
 		return sendP2PMessage(conn, fbb);
 	}
 
+	ha_bool sendP2PConnect(P2PSignalConnection *conn, PeerId peerId, uint8_t flags, const char* offer, bool compact)
+	{
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+
+		if (compact) {
+			auto description = compactDescription(fbb, offer);
+			// only worth it if it's smaller than the text
+			if (description.o && fbb.GetSize() < strlen(offer)) {
+				return sendP2POffer(conn, fbb, peerId, flags, 0, description);
+			}
+			fbb.Clear();
+		}
+		return sendP2POffer(conn, fbb, peerId, flags, fbb.CreateString(offer), 0);
+	}
+
+	ha_bool sendP2PConnect(P2PSignalConnection *conn, PeerId peerId, uint8_t flags, const HumblePeer::SessionDescription* description)
+	{
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+
+		auto compact = compactDescription(fbb, description);
+		if (!compact.o) {
+			return false;
+		}
+		return sendP2POffer(conn, fbb, peerId, flags, 0, compact);
+	}
+
+	ha_bool sendP2PResponse(P2PSignalConnection *conn, PeerId peerId, const char* offer, bool compact)
+	{
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+
+		if (compact) {
+			auto description = compactDescription(fbb, offer);
+			// only worth it if it's smaller than the text
+			if (description.o && fbb.GetSize() < strlen(offer)) {
+				return sendP2PAnswer(conn, fbb, peerId, 0, description);
+			}
+			fbb.Clear();
+		}
+		return sendP2PAnswer(conn, fbb, peerId, fbb.CreateString(offer), 0);
+	}
+
+	ha_bool sendP2PResponse(P2PSignalConnection *conn, PeerId peerId, const HumblePeer::SessionDescription* description)
+	{
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+
+		auto compact = compactDescription(fbb, description);
+		if (!compact.o) {
+			return false;
+		}
+		return sendP2PAnswer(conn, fbb, peerId, 0, compact);
+	}
+
+	ha_bool sendICECandidate(P2PSignalConnection *conn, PeerId peerId, const char* offer, bool compact)
+	{
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+
+		if (compact) {
+			auto candidate = compactCandidate(fbb, offer);
+			// only worth it if it's smaller than the text
+			if (candidate.o && fbb.GetSize() < strlen(offer)) {
+				return sendICECandidate(conn, fbb, peerId, 0, candidate);
+			}
+			fbb.Clear();
+		}
+		return sendICECandidate(conn, fbb, peerId, fbb.CreateString(offer), 0);
+	}
+
+	ha_bool sendICECandidate(P2PSignalConnection *conn, PeerId peerId, const HumblePeer::Candidate* candidate)
+	{
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+
+		auto compact = compactCandidate(fbb, candidate);
+		if (!compact.o) {
+			return false;
+		}
+		return sendICECandidate(conn, fbb, peerId, 0, compact);
+	}
+
 	ha_bool sendP2PDisconnect(P2PSignalConnection *conn, PeerId peerId)
 	{
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
 		auto packet = HumblePeer::CreateP2PDisconnect(fbb, peerId);
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::P2PDisconnect, packet.Union());
 		fbb.Finish(msg);
@@ -292,7 +575,8 @@ namespace humblenet {
 	}
 
 	ha_bool sendP2PRelayData(humblenet::P2PSignalConnection *conn, PeerId peerId, const void* data, uint16_t length) {
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
 		auto packet = HumblePeer::CreateP2PRelayData(fbb, peerId, fbb.CreateVector((int8_t*)data, length));
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::P2PRelayData, packet.Union());
 		fbb.Finish(msg);
@@ -300,11 +584,36 @@ namespace humblenet {
 		return sendP2PMessage(conn, fbb);
 	}
 
+	ha_bool sendRelayFrame(humblenet::P2PSignalConnection *conn, PeerId peerId, const void* data, size_t length)
+	{
+		assert(RELAY_FRAME_HEADER_SIZE + RELAY_PACKET_HEADER_SIZE + length <= MAX_RELAY_FRAME_SIZE);
+
+		// kept per thread like the builders, it only grows to the largest frame
+		static thread_local std::vector<uint8_t> frame;
+		frame.resize(RELAY_FRAME_HEADER_SIZE);
+		setRelayFramePeer(frame.data(), peerId);
+		appendRelayPacket(frame, 0, data, length);
+
+		return sendP2PMessage(conn, frame.data(), frame.size());
+	}
+
+	ha_bool sendP2PBackpressure(humblenet::P2PSignalConnection *conn, PeerId peerId, bool congested)
+	{
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+		auto packet = HumblePeer::CreateP2PBackpressure(fbb, peerId, congested);
+		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::P2PBackpressure, packet.Union());
+		fbb.Finish(msg);
+
+		return sendP2PMessage(conn, fbb);
+	}
+
 	// ** Name Alias messages
 
 	ha_bool sendAliasRegister(P2PSignalConnection *conn, const std::string& alias)
 	{
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
 		auto packet = HumblePeer::CreateAliasRegister(fbb, fbb.CreateString(alias));
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::AliasRegister, packet.Union());
 		fbb.Finish(msg);
@@ -314,7 +623,8 @@ namespace humblenet {
 
 	ha_bool sendAliasUnregister(P2PSignalConnection *conn, const std::string& alias)
 	{
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
 		auto packet = HumblePeer::CreateAliasUnregister(fbb, CreateFBBStringIfNotEmpty(fbb, alias));
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::AliasUnregister, packet.Union());
 		fbb.Finish(msg);
@@ -324,7 +634,8 @@ namespace humblenet {
 
 	ha_bool sendAliasLookup(P2PSignalConnection *conn, const std::string& alias)
 	{
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
 		auto packet = HumblePeer::CreateAliasLookup(fbb, fbb.CreateString(alias));
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::AliasLookup, packet.Union());
 		fbb.Finish(msg);
@@ -334,11 +645,95 @@ namespace humblenet {
 
 	ha_bool sendAliasResolved(P2PSignalConnection *conn, const std::string& alias, PeerId peer)
 	{
-		flatbuffers::FlatBufferBuilder fbb(DEFAULT_FBB_SIZE, &peer_fbb_allocator);
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
 		auto packet = HumblePeer::CreateAliasResolved(fbb, fbb.CreateString(alias), peer);
 		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::AliasResolved, packet.Union());
 		fbb.Finish(msg);
 
 		return sendP2PMessage(conn, fbb);
 	}
+
+	static flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> createStrings(flatbuffers::FlatBufferBuilder& fbb, std::vector<std::string>::const_iterator begin, std::vector<std::string>::const_iterator end)
+	{
+		std::vector<flatbuffers::Offset<flatbuffers::String>> strings;
+		strings.reserve(end - begin);
+		for (auto it = begin; it != end; ++it) {
+			strings.push_back(fbb.CreateString(*it));
+		}
+		return fbb.CreateVector(strings);
+	}
+
+	ha_bool sendAliasLookup(P2PSignalConnection *conn, const std::vector<std::string>& aliases)
+	{
+		assert(!aliases.empty());
+
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+		// the first one where a server that doesn't batch looks for it
+		auto alias = fbb.CreateString(aliases.front());
+		flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> others = 0;
+		if (aliases.size() > 1) {
+			others = createStrings(fbb, aliases.begin() + 1, aliases.end());
+		}
+		auto packet = HumblePeer::CreateAliasLookup(fbb, alias, others);
+		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::AliasLookup, packet.Union());
+		fbb.Finish(msg);
+
+		return sendP2PMessage(conn, fbb);
+	}
+
+	ha_bool sendAliasResolved(P2PSignalConnection *conn, const std::vector<std::string>& aliases, const std::vector<PeerId>& peers)
+	{
+		assert(!aliases.empty());
+		assert(aliases.size() == peers.size());
+
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+		auto alias = fbb.CreateString(aliases.front());
+		flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> others = 0;
+		flatbuffers::Offset<flatbuffers::Vector<uint32_t>> otherPeers = 0;
+		if (aliases.size() > 1) {
+			others = createStrings(fbb, aliases.begin() + 1, aliases.end());
+			otherPeers = fbb.CreateVector(&peers[1], peers.size() - 1);
+		}
+		auto packet = HumblePeer::CreateAliasResolved(fbb, alias, peers.front(), others, otherPeers);
+		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::AliasResolved, packet.Union());
+		fbb.Finish(msg);
+
+		return sendP2PMessage(conn, fbb);
+	}
+
+	ha_bool sendAliasInvalidated(P2PSignalConnection *conn, const std::vector<std::string>& aliases)
+	{
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+		auto packet = HumblePeer::CreateAliasInvalidated(fbb, createStrings(fbb, aliases.begin(), aliases.end()));
+		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::AliasInvalidated, packet.Union());
+		fbb.Finish(msg);
+
+		return sendP2PMessage(conn, fbb);
+	}
+
+	ha_bool sendAliasRegistered(P2PSignalConnection *conn, const std::string& alias)
+	{
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+		auto packet = HumblePeer::CreateAliasRegistered(fbb, fbb.CreateString(alias));
+		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::AliasRegistered, packet.Union());
+		fbb.Finish(msg);
+
+		return sendP2PMessage(conn, fbb);
+	}
+
+	ha_bool sendAliasRejected(P2PSignalConnection *conn, const std::string& alias, PeerId owner)
+	{
+		PooledBuilder builder;
+		flatbuffers::FlatBufferBuilder& fbb = builder.fbb;
+		auto packet = HumblePeer::CreateAliasRejected(fbb, fbb.CreateString(alias), owner);
+		auto msg = HumblePeer::CreateMessage(fbb, HumblePeer::MessageType::AliasRejected, packet.Union());
+		fbb.Finish(msg);
+
+		return sendP2PMessage(conn, fbb);
+	}
 }  // namespace humblenet
@@ -3,6 +3,7 @@
 
 // HumbleNet internal, do not include
 
+#include <cstring>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -39,6 +40,96 @@ namespace humblenet {
 	struct P2PSignalConnection;
 	ha_bool sendP2PMessage(P2PSignalConnection *conn, const uint8_t *buff, size_t length) WARN_UNUSED_RESULT;
 
+	// messages queued on a signaling connection are coalesced into websocket frames of at most this size
+	const size_t MAX_SIGNAL_FRAME_SIZE = 16 * 1024;
+
+	// HelloServer/HelloClient flag: understands the compact SessionDescription/Candidate
+	// encoding (see humblepeer_sdp.h). Offers, answers and candidates are only sent
+	// compact to a connection whose hello had it set.
+	const uint8_t HELLO_FLAG_COMPACT_SDP = 0x4;
+
+	// HelloServer/HelloClient flag: caches alias lookups. The server answers batched
+	// AliasLookups in one AliasResolved and sends AliasInvalidated when something a
+	// peer looked up changes.
+	const uint8_t HELLO_FLAG_ALIAS_CACHE = 0x8;
+
+	// HelloServer/HelloClient flag: every AliasRegister is answered with an
+	// AliasRegistered or AliasRejected.
+	const uint8_t HELLO_FLAG_ALIAS_ACK = 0x10;
+
+	// HelloServer/HelloClient flag: the server sends P2PBackpressure when it drops
+	// relay data because the peer it's for isn't reading, and when it stops.
+	const uint8_t HELLO_FLAG_BACKPRESSURE = 0x20;
+
+	// HelloServer/HelloClient flag: understands relay frames. Relay data is only sent as
+	// relay frames to a connection whose hello had it set, P2PRelayData otherwise.
+	const uint8_t HELLO_FLAG_RELAY_FRAMES = 0x40;
+
+	/*
+	  Relay frames carry game data through the server like P2PRelayData, but aren't
+	  FlatBuffers, so the server can forward one as it is after putting the sender's
+	  PeerId where the receiver's was. In the stream a relay frame's header has the size
+	  with RELAY_FRAME_FLAG set where a message's header has the size and CRC:
+
+		uint32 size | RELAY_FRAME_FLAG  bytes after the header
+		uint32 peerId                   client->server who it's for, server->client who it's from
+		packets, each a uint32 length and as many bytes of data
+
+	  A frame has at least one packet, a sender can add more to a frame for the same peer
+	  which it hasn't sent yet.
+	*/
+	const uint32_t RELAY_FRAME_FLAG = 0x80000000;
+	const size_t RELAY_FRAME_HEADER_SIZE = 8;
+	const size_t RELAY_PACKET_HEADER_SIZE = 4;
+	// a larger frame is a parse error
+	const size_t MAX_RELAY_FRAME_SIZE = 256 * 1024;
+
+	inline PeerId relayFramePeer(const uint8_t* frame)
+	{
+		return flatbuffers::ReadScalar<uint32_t>(frame + 4);
+	}
+
+	inline void setRelayFramePeer(uint8_t* frame, PeerId peer)
+	{
+		flatbuffers::WriteScalar<uint32_t>(frame + 4, peer);
+	}
+
+	// adds a packet to the frame which starts at offset frame in buf and runs to its end
+	template<typename Buffer>
+	void appendRelayPacket(Buffer& buf, size_t frame, const void* data, size_t length)
+	{
+		size_t end = buf.size();
+		buf.resize(end + RELAY_PACKET_HEADER_SIZE + length);
+		uint8_t* p = reinterpret_cast<uint8_t*>(&buf[0]);
+		flatbuffers::WriteScalar<uint32_t>(p + end, uint32_t(length));
+		memcpy(p + end + RELAY_PACKET_HEADER_SIZE, data, length);
+		flatbuffers::WriteScalar<uint32_t>(p + frame, uint32_t(buf.size() - frame - RELAY_FRAME_HEADER_SIZE) | RELAY_FRAME_FLAG);
+	}
+
+	// calls fn(data, length) for every packet in a whole frame, header included. false
+	// if the packets don't add up to the frame
+	template<typename Fn>
+	bool forEachRelayPacket(const uint8_t* frame, size_t length, Fn fn)
+	{
+		size_t offset = RELAY_FRAME_HEADER_SIZE;
+		if (offset == length) {
+			return false;
+		}
+		while (offset < length) {
+			if (length - offset < RELAY_PACKET_HEADER_SIZE) {
+				return false;
+			}
+			size_t packet = flatbuffers::ReadScalar<uint32_t>(frame + offset);
+			offset += RELAY_PACKET_HEADER_SIZE;
+			if (length - offset < packet) {
+				return false;
+			}
+			fn(frame + offset, packet);
+			offset += packet;
+		}
+		return true;
+	}
+
 	/*
 	  P2POffer contains
 		PeerID
@@ -79,14 +170,35 @@ namespace humblenet {
 
 
 	typedef ha_bool(*ProcessMsgFunc) (const HumblePeer::Message* msg, void *data);
+	// frame is a whole relay frame, header included
+	typedef ha_bool(*ProcessRelayFunc) (const uint8_t* frame, size_t length, void *data);
 
 	/*
 	 returns true if all went wel
 			 false if something is wrong, sync is lost and channel should be closed
 			 TODO: should this be a tristate (process, noprocess, error)?
 			 does anyone care if progress happened or not?
+
+	 relay frames go to relayFunc, without one they're an error
+	 */
+	ha_bool parseMessage(std::vector<uint8_t> &recvBuf, ProcessMsgFunc processFunc, void *user_data, ProcessRelayFunc relayFunc = NULL);
+
+	/*
+	 same as above for a payload that was just received, recvBuf holds the partial
+	 message left over from previous payloads. complete messages are parsed straight
+	 out of data, only a trailing partial message is copied into recvBuf.
 	 */
-	ha_bool parseMessage(std::vector<uint8_t> &recvBuf, ProcessMsgFunc processFunc, void *user_data);
+	ha_bool parseMessage(std::vector<uint8_t> &recvBuf, const uint8_t *data, size_t length, ProcessMsgFunc processFunc, void *user_data, ProcessRelayFunc relayFunc = NULL);
+
+	// Message builders are pooled per thread, these count what the pool had to allocate.
+	// Once every thread has sent its first messages they should stop changing.
+	struct FBBAllocStats {
+		uint64_t builders;     // FlatBufferBuilders created
+		uint64_t allocations;  // builder buffers allocated or grown
+		uint64_t bytes;        // total size of those buffers
+	};
+
+	FBBAllocStats getFBBAllocStats();
 
 	// Peer server connection
 	ha_bool sendHelloServer(humblenet::P2PSignalConnection *conn, uint8_t flags,
@@ -95,22 +207,40 @@ namespace humblenet {
 							const std::map<std::string, std::string>& attributes);
 	ha_bool sendHelloClient(humblenet::P2PSignalConnection *conn, PeerId peerId,
 							const std::string& reconnectToken,
-							const std::vector<ICEServer>& iceServers);
+							const std::vector<ICEServer>& iceServers,
+							uint8_t flags = 0);
 
 	// P2P Handling
 	ha_bool sendNoSuchPeer(humblenet::P2PSignalConnection *conn, PeerId peerId);
 	ha_bool sendPeerRefused(humblenet::P2PSignalConnection *conn, PeerId peerId);
-	ha_bool sendP2PConnect(P2PSignalConnection *conn, PeerId peerId, uint8_t flags, const char* offer);
-	ha_bool sendP2PResponse(P2PSignalConnection *conn, PeerId peerId, const char* offer);
-	ha_bool sendICECandidate(humblenet::P2PSignalConnection *conn, PeerId peerId, const char* offer);
+	// with compact the offer/candidate is sent in the compact encoding when it
+	// round trips exactly and comes out smaller, as the string otherwise
+	ha_bool sendP2PConnect(P2PSignalConnection *conn, PeerId peerId, uint8_t flags, const char* offer, bool compact = false);
+	ha_bool sendP2PResponse(P2PSignalConnection *conn, PeerId peerId, const char* offer, bool compact = false);
+	ha_bool sendICECandidate(humblenet::P2PSignalConnection *conn, PeerId peerId, const char* offer, bool compact = false);
+	// forward an already compact offer/candidate
+	ha_bool sendP2PConnect(P2PSignalConnection *conn, PeerId peerId, uint8_t flags, const HumblePeer::SessionDescription* description);
+	ha_bool sendP2PResponse(P2PSignalConnection *conn, PeerId peerId, const HumblePeer::SessionDescription* description);
+	ha_bool sendICECandidate(humblenet::P2PSignalConnection *conn, PeerId peerId, const HumblePeer::Candidate* candidate);
 	ha_bool sendP2PDisconnect(humblenet::P2PSignalConnection *conn, PeerId peer);
 	ha_bool sendP2PRelayData(humblenet::P2PSignalConnection *conn, PeerId peer, const void* data, uint16_t length);
+	// only to connections with HELLO_FLAG_RELAY_FRAMES. length must be at most MAX_RELAY_FRAME_SIZE - RELAY_PACKET_HEADER_SIZE
+	ha_bool sendRelayFrame(humblenet::P2PSignalConnection *conn, PeerId peer, const void* data, size_t length);
+	// only to connections with HELLO_FLAG_BACKPRESSURE
+	ha_bool sendP2PBackpressure(humblenet::P2PSignalConnection *conn, PeerId peer, bool congested);
 
 	// Name Alias
 	ha_bool sendAliasRegister(P2PSignalConnection *conn, const std::string& alias);
 	ha_bool sendAliasUnregister(P2PSignalConnection *conn, const std::string& alias);
 	ha_bool sendAliasLookup(P2PSignalConnection *conn, const std::string& alias);
 	ha_bool sendAliasResolved(P2PSignalConnection *conn, const std::string& alias, PeerId peer);
+	// batched, only to connections with HELLO_FLAG_ALIAS_CACHE. aliases must not be empty
+	ha_bool sendAliasLookup(P2PSignalConnection *conn, const std::vector<std::string>& aliases);
+	ha_bool sendAliasResolved(P2PSignalConnection *conn, const std::vector<std::string>& aliases, const std::vector<PeerId>& peers);
+	ha_bool sendAliasInvalidated(P2PSignalConnection *conn, const std::vector<std::string>& aliases);
+	// only to connections with HELLO_FLAG_ALIAS_ACK
+	ha_bool sendAliasRegistered(P2PSignalConnection *conn, const std::string& alias);
+	ha_bool sendAliasRejected(P2PSignalConnection *conn, const std::string& alias, PeerId owner);
 
 }  // namespace humblenet
 
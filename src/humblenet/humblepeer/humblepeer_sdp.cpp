@@ -0,0 +1,725 @@
+#include "humblepeer_sdp.h"
+
+#include <cstring>
+
+namespace humblenet {
+
+	// SDPCandidate::flags
+	const uint8_t CANDIDATE_ATTRIBUTE = 0x1;	// "a=candidate:" rather than "candidate:"
+	const uint8_t CANDIDATE_UPPERCASE = 0x2;	// "UDP" rather than "udp"
+	const uint8_t CANDIDATE_RPORT = 0x4;		// has an rport after raddr
+
+	// SDPDescription::flags
+	const uint8_t SDP_LF = 0x1;				// lines end with \n rather than \r\n
+
+	// SDPDescription::layout
+	enum {
+		SDP_LINE = 0,		// next entry of lines
+		SDP_ICE_UFRAG,
+		SDP_ICE_PWD,
+		SDP_FINGERPRINT,
+		SDP_SCTPMAP,
+		SDP_CANDIDATE,		// next entry of candidates
+		SDP_COMMON = 16,	// + index in commonLines
+	};
+
+	// Lines both stacks (and browsers) send as is. This is part of the protocol:
+	// only ever append to it, and only together with a new hello flag.
+	static const char* const commonLines[] = {
+		"v=0",
+		"s=-",
+		"s=SIP Call",
+		"t=0 0",
+		"c=IN IP4 0.0.0.0",
+		"a=msid-semantic: WMS",
+		"a=group:BUNDLE data",
+		"a=mid:data",
+		"a=ice-options:trickle",
+		"a=setup:actpass",
+		"a=setup:active",
+		"a=setup:passive",
+		"m=application 1 DTLS/SCTP 5000",
+		"m=application 9 DTLS/SCTP 5000",
+		"m=application 9 UDP/DTLS/SCTP webrtc-datachannel",
+		"a=sctp-port:5000",
+		"a=max-message-size:262144",
+	};
+	static const size_t COMMON_LINE_COUNT = sizeof(commonLines) / sizeof(commonLines[0]);
+
+	static const char ICE_UFRAG[] = "a=ice-ufrag:";
+	static const char ICE_PWD[] = "a=ice-pwd:";
+	static const char FINGERPRINT[] = "a=fingerprint:sha-256 ";
+	static const char SCTPMAP[] = "a=sctpmap:";
+	static const char SCTPMAP_PROTOCOL[] = " webrtc-datachannel ";
+	static const size_t FINGERPRINT_SIZE = 32;
+
+	SDPCandidate::SDPCandidate()
+	: flags(0), foundation(0), component(1), priority(0), port(0)
+	, type(HumblePeer::CandidateType::Host), relatedPort(0)
+	{
+	}
+
+	SDPDescription::SDPDescription()
+	: flags(0), sctpPort(0), sctpStreams(0)
+	{
+	}
+
+	// Helpers
+
+	static bool startsWith(const std::string& text, const char* prefix, size_t prefixLen)
+	{
+		return text.compare(0, prefixLen, prefix) == 0;
+	}
+
+	template<size_t N>
+	static bool startsWith(const std::string& text, const char (&prefix)[N])
+	{
+		return startsWith(text, prefix, N - 1);
+	}
+
+	// only the canonical form, so formatting it gives the same text back
+	static bool parseNumber(const std::string& text, uint32_t max, uint32_t& value)
+	{
+		if (text.empty() || text.size() > 10 || (text[0] == '0' && text.size() > 1)) {
+			return false;
+		}
+
+		uint64_t v = 0;
+		for (char c : text) {
+			if (c < '0' || c > '9') {
+				return false;
+			}
+			v = v * 10 + (c - '0');
+		}
+		if (v > max) {
+			return false;
+		}
+		value = static_cast<uint32_t>(v);
+		return true;
+	}
+
+	static bool parseAddressBytes(const std::string& text, std::vector<uint8_t>& address)
+	{
+
+		if (text.find(':') == std::string::npos) {
+			size_t start = 0;
+			for (int i = 0; i < 4; ++i) {
+				size_t end = text.find('.', start);
+				if ((end == std::string::npos) != (i == 3)) {
+					return false;
+				}
+				uint32_t part;
+				if (!parseNumber(text.substr(start, end - start), 255, part)) {
+					return false;
+				}
+				address.push_back(static_cast<uint8_t>(part));
+				start = end + 1;
+			}
+			return true;
+		}
+
+		// IPv6, groups of hex digits with at most one ::
+		std::vector<uint16_t> head, tail;
+		std::vector<uint16_t>* groups = &head;
+		size_t pos = 0;
+
+		if (startsWith(text, "::")) {
+			groups = &tail;
+			pos = 2;
+		}
+
+		while (pos < text.size()) {
+			size_t end = text.find(':', pos);
+			std::string group = text.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+			if (group.empty() || group.size() > 4) {
+				return false;
+			}
+
+			uint32_t value = 0;
+			for (char c : group) {
+				value <<= 4;
+				if (c >= '0' && c <= '9') value |= c - '0';
+				else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+				else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+				else return false;
+			}
+			groups->push_back(static_cast<uint16_t>(value));
+
+			if (end == std::string::npos) {
+				break;
+			}
+			pos = end + 1;
+			if (pos < text.size() && text[pos] == ':') {
+				if (groups == &tail) {
+					return false;
+				}
+				groups = &tail;
+				++pos;
+			} else if (pos == text.size()) {
+				return false;
+			}
+		}
+
+		size_t count = head.size() + tail.size();
+		if (count > 8 || (groups == &head && count != 8) || (groups == &tail && count == 8)) {
+			return false;
+		}
+
+		head.resize(8 - tail.size(), 0);
+		head.insert(head.end(), tail.begin(), tail.end());
+		for (uint16_t g : head) {
+			address.push_back(static_cast<uint8_t>(g >> 8));
+			address.push_back(static_cast<uint8_t>(g & 0xff));
+		}
+		return true;
+	}
+
+	// leaves address empty if text isn't a plain IPv4 or IPv6 address
+	static bool parseAddress(const std::string& text, std::vector<uint8_t>& address)
+	{
+		address.clear();
+		if (!parseAddressBytes(text, address)) {
+			address.clear();
+			return false;
+		}
+		return true;
+	}
+
+	// RFC 5952 form for IPv6
+	static void formatAddress(const std::vector<uint8_t>& address, std::string& text)
+	{
+		if (address.size() == 4) {
+			for (size_t i = 0; i < 4; ++i) {
+				if (i) text += '.';
+				text += std::to_string(static_cast<unsigned int>(address[i]));
+			}
+			return;
+		}
+
+		uint16_t groups[8];
+		for (size_t i = 0; i < 8; ++i) {
+			groups[i] = static_cast<uint16_t>((address[2 * i] << 8) | address[2 * i + 1]);
+		}
+
+		// longest run of at least two zero groups, first one wins a tie
+		int bestStart = -1, bestLen = 1;
+		for (int i = 0; i < 8; ) {
+			if (groups[i] != 0) {
+				++i;
+				continue;
+			}
+			int j = i;
+			while (j < 8 && groups[j] == 0) ++j;
+			if (j - i > bestLen) {
+				bestStart = i;
+				bestLen = j - i;
+			}
+			i = j;
+		}
+
+		static const char hex[] = "0123456789abcdef";
+		for (int i = 0; i < 8; ++i) {
+			if (i == bestStart) {
+				text += "::";
+				i += bestLen - 1;
+				continue;
+			}
+			if (i && i != bestStart + bestLen) {
+				text += ':';
+			}
+			bool started = false;
+			for (int shift = 12; shift >= 0; shift -= 4) {
+				int digit = (groups[i] >> shift) & 0xf;
+				if (digit || started || shift == 0) {
+					text += hex[digit];
+					started = true;
+				}
+			}
+		}
+	}
+
+	static void split(const std::string& text, char separator, std::vector<std::string>& parts)
+	{
+		size_t start = 0;
+		for (;;) {
+			size_t end = text.find(separator, start);
+			parts.push_back(text.substr(start, end == std::string::npos ? std::string::npos : end - start));
+			if (end == std::string::npos) {
+				break;
+			}
+			start = end + 1;
+		}
+	}
+
+	static const char* candidateTypeName(HumblePeer::CandidateType type)
+	{
+		switch (type) {
+			case HumblePeer::CandidateType::Host: return "host";
+			case HumblePeer::CandidateType::ServerReflexive: return "srflx";
+			case HumblePeer::CandidateType::PeerReflexive: return "prflx";
+			case HumblePeer::CandidateType::Relay: return "relay";
+		}
+		return NULL;
+	}
+
+	// Candidates
+
+	/*
+	 [a=]candidate:<foundation> <component> udp <priority> <address> <port> typ <type>
+	   [raddr <address> [rport <port>]] [<extensions>]
+	 */
+	bool parseCandidate(const std::string& text, SDPCandidate& candidate)
+	{
+		candidate = SDPCandidate();
+
+		size_t start = 0;
+		if (startsWith(text, "a=")) {
+			candidate.flags |= CANDIDATE_ATTRIBUTE;
+			start = 2;
+		}
+		if (text.compare(start, 10, "candidate:") != 0) {
+			return false;
+		}
+
+		std::vector<std::string> tokens;
+		split(text.substr(start + 10), ' ', tokens);
+		if (tokens.size() < 8 || tokens[6] != "typ") {
+			return false;
+		}
+
+		if (!parseNumber(tokens[0], 0xffffffff, candidate.foundation)) {
+			if (tokens[0].empty()) {
+				return false;
+			}
+			candidate.foundationText = tokens[0];
+		}
+
+		uint32_t value;
+		if (!parseNumber(tokens[1], 255, value)) {
+			return false;
+		}
+		candidate.component = static_cast<uint8_t>(value);
+
+		if (tokens[2] == "UDP") {
+			candidate.flags |= CANDIDATE_UPPERCASE;
+		} else if (tokens[2] != "udp") {
+			return false;
+		}
+
+		if (!parseNumber(tokens[3], 0xffffffff, candidate.priority)
+			|| !parseAddress(tokens[4], candidate.address)
+			|| !parseNumber(tokens[5], 0xffff, value)) {
+			return false;
+		}
+		candidate.port = static_cast<uint16_t>(value);
+
+		if (tokens[7] == "host") candidate.type = HumblePeer::CandidateType::Host;
+		else if (tokens[7] == "srflx") candidate.type = HumblePeer::CandidateType::ServerReflexive;
+		else if (tokens[7] == "prflx") candidate.type = HumblePeer::CandidateType::PeerReflexive;
+		else if (tokens[7] == "relay") candidate.type = HumblePeer::CandidateType::Relay;
+		else return false;
+
+		size_t next = 8;
+		if (tokens.size() >= next + 2 && tokens[next] == "raddr" && parseAddress(tokens[next + 1], candidate.relatedAddress)) {
+			next += 2;
+			if (tokens.size() >= next + 2 && tokens[next] == "rport" && parseNumber(tokens[next + 1], 0xffff, value)) {
+				candidate.flags |= CANDIDATE_RPORT;
+				candidate.relatedPort = static_cast<uint16_t>(value);
+				next += 2;
+			}
+		}
+
+		for (size_t i = next; i < tokens.size(); ++i) {
+			if (i > next) candidate.extensions += ' ';
+			candidate.extensions += tokens[i];
+		}
+
+		std::string check;
+		formatCandidate(candidate, check);
+		return check == text;
+	}
+
+	void formatCandidate(const SDPCandidate& candidate, std::string& text)
+	{
+		text.clear();
+		if (candidate.flags & CANDIDATE_ATTRIBUTE) {
+			text += "a=";
+		}
+		text += "candidate:";
+		text += candidate.foundationText.empty() ? std::to_string(candidate.foundation) : candidate.foundationText;
+		text += ' ';
+		text += std::to_string(static_cast<unsigned int>(candidate.component));
+		text += (candidate.flags & CANDIDATE_UPPERCASE) ? " UDP " : " udp ";
+		text += std::to_string(candidate.priority);
+		text += ' ';
+		formatAddress(candidate.address, text);
+		text += ' ';
+		text += std::to_string(candidate.port);
+		text += " typ ";
+		text += candidateTypeName(candidate.type);
+
+		if (!candidate.relatedAddress.empty()) {
+			text += " raddr ";
+			formatAddress(candidate.relatedAddress, text);
+			if (candidate.flags & CANDIDATE_RPORT) {
+				text += " rport ";
+				text += std::to_string(candidate.relatedPort);
+			}
+		}
+
+		if (!candidate.extensions.empty()) {
+			text += ' ';
+			text += candidate.extensions;
+		}
+	}
+
+	// Session descriptions
+
+	static bool parseFingerprint(const std::string& text, std::vector<uint8_t>& digest)
+	{
+		// uppercase hex bytes separated by colons
+		if (text.size() != FINGERPRINT_SIZE * 3 - 1) {
+			return false;
+		}
+
+		digest.clear();
+		for (size_t i = 0; i < text.size(); i += 3) {
+			uint8_t b = 0;
+			for (size_t j = i; j < i + 2; ++j) {
+				char c = text[j];
+				b <<= 4;
+				if (c >= '0' && c <= '9') b |= c - '0';
+				else if (c >= 'A' && c <= 'F') b |= c - 'A' + 10;
+				else return false;
+			}
+			if (i + 2 < text.size() && text[i + 2] != ':') {
+				return false;
+			}
+			digest.push_back(b);
+		}
+		return true;
+	}
+
+	static bool parseSctpmap(const std::string& text, uint16_t& port, uint16_t& streams)
+	{
+		size_t protocol = text.find(' ');
+		if (protocol == std::string::npos || text.compare(protocol, sizeof(SCTPMAP_PROTOCOL) - 1, SCTPMAP_PROTOCOL) != 0) {
+			return false;
+		}
+
+		uint32_t p, s;
+		if (!parseNumber(text.substr(0, protocol), 0xffff, p)
+			|| !parseNumber(text.substr(protocol + sizeof(SCTPMAP_PROTOCOL) - 1), 0xffff, s)) {
+			return false;
+		}
+		port = static_cast<uint16_t>(p);
+		streams = static_cast<uint16_t>(s);
+		return true;
+	}
+
+	bool parseSDP(const std::string& text, SDPDescription& desc)
+	{
+		desc = SDPDescription();
+
+		if (text.empty() || text.back() != '\n') {
+			return false;
+		}
+
+		std::vector<std::string> lines;
+		split(text.substr(0, text.size() - 1), '\n', lines);
+
+		// all lines have to end the same way
+		bool crlf = !lines[0].empty() && lines[0].back() == '\r';
+		for (auto& line : lines) {
+			bool cr = !line.empty() && line.back() == '\r';
+			if (cr != crlf) {
+				return false;
+			}
+			if (cr) {
+				line.pop_back();
+			}
+		}
+		if (!crlf) {
+			desc.flags |= SDP_LF;
+		}
+
+		bool haveUfrag = false, havePwd = false, haveFingerprint = false, haveSctpmap = false;
+
+		for (const auto& line : lines) {
+			uint8_t kind = SDP_LINE;
+
+			for (size_t i = 0; i < COMMON_LINE_COUNT; ++i) {
+				if (line == commonLines[i]) {
+					kind = static_cast<uint8_t>(SDP_COMMON + i);
+					break;
+				}
+			}
+
+			if (kind != SDP_LINE) {
+				// common line
+			} else if (startsWith(line, ICE_UFRAG)) {
+				std::string value = line.substr(sizeof(ICE_UFRAG) - 1);
+				if (!haveUfrag || value == desc.iceUfrag) {
+					desc.iceUfrag = value;
+					haveUfrag = true;
+					kind = SDP_ICE_UFRAG;
+				}
+			} else if (startsWith(line, ICE_PWD)) {
+				std::string value = line.substr(sizeof(ICE_PWD) - 1);
+				if (!havePwd || value == desc.icePwd) {
+					desc.icePwd = value;
+					havePwd = true;
+					kind = SDP_ICE_PWD;
+				}
+			} else if (startsWith(line, FINGERPRINT)) {
+				std::vector<uint8_t> digest;
+				if (parseFingerprint(line.substr(sizeof(FINGERPRINT) - 1), digest) && (!haveFingerprint || digest == desc.fingerprint)) {
+					desc.fingerprint = digest;
+					haveFingerprint = true;
+					kind = SDP_FINGERPRINT;
+				}
+			} else if (startsWith(line, SCTPMAP)) {
+				uint16_t port, streams;
+				if (parseSctpmap(line.substr(sizeof(SCTPMAP) - 1), port, streams)
+					&& (!haveSctpmap || (port == desc.sctpPort && streams == desc.sctpStreams))) {
+					desc.sctpPort = port;
+					desc.sctpStreams = streams;
+					haveSctpmap = true;
+					kind = SDP_SCTPMAP;
+				}
+			} else if (startsWith(line, "a=candidate:")) {
+				SDPCandidate candidate;
+				if (parseCandidate(line, candidate)) {
+					desc.candidates.push_back(candidate);
+					kind = SDP_CANDIDATE;
+				}
+			}
+
+			if (kind == SDP_LINE) {
+				desc.lines.push_back(line);
+			}
+			desc.layout.push_back(kind);
+		}
+
+		std::string check;
+		return formatSDP(desc, check) && check == text;
+	}
+
+	bool formatSDP(const SDPDescription& desc, std::string& text)
+	{
+		static const char hex[] = "0123456789ABCDEF";
+		const char* eol = (desc.flags & SDP_LF) ? "\n" : "\r\n";
+		size_t line = 0, candidate = 0;
+		std::string candidateLine;
+
+		text.clear();
+		for (uint8_t kind : desc.layout) {
+			switch (kind) {
+				case SDP_LINE:
+					if (line >= desc.lines.size()) {
+						return false;
+					}
+					text += desc.lines[line++];
+					break;
+
+				case SDP_ICE_UFRAG:
+					text += ICE_UFRAG;
+					text += desc.iceUfrag;
+					break;
+
+				case SDP_ICE_PWD:
+					text += ICE_PWD;
+					text += desc.icePwd;
+					break;
+
+				case SDP_FINGERPRINT:
+					if (desc.fingerprint.size() != FINGERPRINT_SIZE) {
+						return false;
+					}
+					text += FINGERPRINT;
+					for (size_t i = 0; i < desc.fingerprint.size(); ++i) {
+						if (i) text += ':';
+						text += hex[desc.fingerprint[i] >> 4];
+						text += hex[desc.fingerprint[i] & 0xf];
+					}
+					break;
+
+				case SDP_SCTPMAP:
+					text += SCTPMAP;
+					text += std::to_string(desc.sctpPort);
+					text += SCTPMAP_PROTOCOL;
+					text += std::to_string(desc.sctpStreams);
+					break;
+
+				case SDP_CANDIDATE:
+					if (candidate >= desc.candidates.size()) {
+						return false;
+					}
+					formatCandidate(desc.candidates[candidate++], candidateLine);
+					text += candidateLine;
+					break;
+
+				default:
+					if (kind < SDP_COMMON || static_cast<size_t>(kind - SDP_COMMON) >= COMMON_LINE_COUNT) {
+						return false;
+					}
+					text += commonLines[kind - SDP_COMMON];
+					break;
+			}
+			text += eol;
+		}
+		return true;
+	}
+
+	// FlatBuffers
+
+	static flatbuffers::Offset<flatbuffers::Vector<uint8_t>> createBytes(flatbuffers::FlatBufferBuilder& fbb, const std::vector<uint8_t>& bytes)
+	{
+		if (bytes.empty()) {
+			return 0;
+		}
+		return fbb.CreateVector(bytes);
+	}
+
+	static flatbuffers::Offset<flatbuffers::String> createString(flatbuffers::FlatBufferBuilder& fbb, const std::string& str)
+	{
+		if (str.empty()) {
+			return 0;
+		}
+		return fbb.CreateString(str);
+	}
+
+	static void readBytes(const flatbuffers::Vector<uint8_t>* bytes, std::vector<uint8_t>& out)
+	{
+		if (bytes) {
+			out.assign(bytes->Data(), bytes->Data() + bytes->size());
+		} else {
+			out.clear();
+		}
+	}
+
+	static void readString(const flatbuffers::String* str, std::string& out)
+	{
+		if (str) {
+			out.assign(str->c_str(), str->size());
+		} else {
+			out.clear();
+		}
+	}
+
+	flatbuffers::Offset<HumblePeer::Candidate> buildCandidate(flatbuffers::FlatBufferBuilder& fbb, const SDPCandidate& candidate)
+	{
+		auto foundationText = createString(fbb, candidate.foundationText);
+		auto address = createBytes(fbb, candidate.address);
+		auto relatedAddress = createBytes(fbb, candidate.relatedAddress);
+		auto extensions = createString(fbb, candidate.extensions);
+
+		return HumblePeer::CreateCandidate(fbb, candidate.flags, candidate.foundation, foundationText,
+										   candidate.component, candidate.priority, address, candidate.port,
+										   candidate.type, relatedAddress, candidate.relatedPort, extensions);
+	}
+
+	bool readCandidate(const HumblePeer::Candidate* msg, SDPCandidate& candidate)
+	{
+		candidate.flags = msg->flags();
+		candidate.foundation = msg->foundation();
+		readString(msg->foundationText(), candidate.foundationText);
+		candidate.component = msg->component();
+		candidate.priority = msg->priority();
+		readBytes(msg->address(), candidate.address);
+		candidate.port = msg->port();
+		candidate.type = msg->type();
+		readBytes(msg->relatedAddress(), candidate.relatedAddress);
+		candidate.relatedPort = msg->relatedPort();
+		readString(msg->extensions(), candidate.extensions);
+
+		// only what formatCandidate can handle
+		return (candidate.address.size() == 4 || candidate.address.size() == 16)
+			&& (candidate.relatedAddress.empty() || candidate.relatedAddress.size() == 4 || candidate.relatedAddress.size() == 16)
+			&& candidateTypeName(candidate.type) != NULL;
+	}
+
+	flatbuffers::Offset<HumblePeer::SessionDescription> buildSessionDescription(flatbuffers::FlatBufferBuilder& fbb, const SDPDescription& desc)
+	{
+		std::vector<flatbuffers::Offset<HumblePeer::Candidate>> candidates;
+		candidates.reserve(desc.candidates.size());
+		for (const auto& it : desc.candidates) {
+			candidates.push_back(buildCandidate(fbb, it));
+		}
+
+		std::vector<flatbuffers::Offset<flatbuffers::String>> lines;
+		lines.reserve(desc.lines.size());
+		for (const auto& it : desc.lines) {
+			lines.push_back(fbb.CreateString(it));
+		}
+
+		auto layout = createBytes(fbb, desc.layout);
+		auto linesVector = lines.empty() ? 0 : fbb.CreateVector(lines);
+		auto iceUfrag = createString(fbb, desc.iceUfrag);
+		auto icePwd = createString(fbb, desc.icePwd);
+		auto fingerprint = createBytes(fbb, desc.fingerprint);
+		auto candidatesVector = candidates.empty() ? 0 : fbb.CreateVector(candidates);
+
+		return HumblePeer::CreateSessionDescription(fbb, desc.flags, layout, linesVector, iceUfrag, icePwd,
+													fingerprint, desc.sctpPort, desc.sctpStreams, candidatesVector);
+	}
+
+	bool readSessionDescription(const HumblePeer::SessionDescription* msg, SDPDescription& desc)
+	{
+		desc.flags = msg->flags();
+		readBytes(msg->layout(), desc.layout);
+		readString(msg->iceUfrag(), desc.iceUfrag);
+		readString(msg->icePwd(), desc.icePwd);
+		readBytes(msg->fingerprint(), desc.fingerprint);
+		desc.sctpPort = msg->sctpPort();
+		desc.sctpStreams = msg->sctpStreams();
+
+		desc.lines.clear();
+		if (msg->lines()) {
+			for (auto line : *msg->lines()) {
+				desc.lines.emplace_back(line->c_str(), line->size());
+			}
+		}
+
+		desc.candidates.clear();
+		if (msg->candidates()) {
+			for (auto candidate : *msg->candidates()) {
+				desc.candidates.emplace_back();
+				if (!readCandidate(candidate, desc.candidates.back())) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	bool offerText(const flatbuffers::String* offer, const HumblePeer::SessionDescription* desc, std::string& text)
+	{
+		if (desc) {
+			SDPDescription parsed;
+			return readSessionDescription(desc, parsed) && formatSDP(parsed, text);
+		}
+		if (offer) {
+			text.assign(offer->c_str(), offer->size());
+			return true;
+		}
+		return false;
+	}
+
+	bool candidateText(const flatbuffers::String* offer, const HumblePeer::Candidate* candidate, std::string& text)
+	{
+		if (candidate) {
+			SDPCandidate parsed;
+			if (!readCandidate(candidate, parsed)) {
+				return false;
+			}
+			formatCandidate(parsed, text);
+			return true;
+		}
+		if (offer) {
+			text.assign(offer->c_str(), offer->size());
+			return true;
+		}
+		return false;
+	}
+}
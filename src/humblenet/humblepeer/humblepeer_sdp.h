@@ -0,0 +1,74 @@
+#ifndef HUMBLEPEER_SDP_H
+#define HUMBLEPEER_SDP_H
+
+// HumbleNet internal, do not include
+
+#include <string>
+#include <vector>
+
+#include "humblepeer_generated.h"
+
+namespace humblenet {
+
+	/*
+	 Compact encoding of the SDP and ICE candidates exchanged while negotiating a
+	 P2P connection.
+
+	 The parts that take most of the space (ICE credentials, DTLS fingerprint,
+	 SCTP port, candidates) become binary fields, common lines become a byte and
+	 everything else is kept as is. Encoding only succeeds if decoding gives back
+	 the exact same text, anything that doesn't survive that round trip is sent
+	 as the plain string instead.
+	 */
+
+	struct SDPCandidate {
+		uint8_t flags;
+		uint32_t foundation;
+		std::string foundationText;
+		uint8_t component;
+		uint32_t priority;
+		std::vector<uint8_t> address;
+		uint16_t port;
+		HumblePeer::CandidateType type;
+		std::vector<uint8_t> relatedAddress;
+		uint16_t relatedPort;
+		std::string extensions;
+
+		SDPCandidate();
+	};
+
+	struct SDPDescription {
+		uint8_t flags;
+		std::vector<uint8_t> layout;
+		std::vector<std::string> lines;
+		std::string iceUfrag;
+		std::string icePwd;
+		std::vector<uint8_t> fingerprint;
+		uint16_t sctpPort;
+		uint16_t sctpStreams;
+		std::vector<SDPCandidate> candidates;
+
+		SDPDescription();
+	};
+
+	// text <-> structure, parse returns false if the text can't be reproduced exactly
+	bool parseCandidate(const std::string& text, SDPCandidate& candidate);
+	void formatCandidate(const SDPCandidate& candidate, std::string& text);
+
+	bool parseSDP(const std::string& text, SDPDescription& desc);
+	// returns false if the layout refers to lines or candidates that aren't there
+	bool formatSDP(const SDPDescription& desc, std::string& text);
+
+	// structure <-> FlatBuffer
+	flatbuffers::Offset<HumblePeer::Candidate> buildCandidate(flatbuffers::FlatBufferBuilder& fbb, const SDPCandidate& candidate);
+	bool readCandidate(const HumblePeer::Candidate* msg, SDPCandidate& candidate);
+
+	flatbuffers::Offset<HumblePeer::SessionDescription> buildSessionDescription(flatbuffers::FlatBufferBuilder& fbb, const SDPDescription& desc);
+	bool readSessionDescription(const HumblePeer::SessionDescription* msg, SDPDescription& desc);
+
+	// the text of a received offer/answer or candidate, whichever way it was sent
+	bool offerText(const flatbuffers::String* offer, const HumblePeer::SessionDescription* desc, std::string& text);
+	bool candidateText(const flatbuffers::String* offer, const HumblePeer::Candidate* candidate, std::string& text);
+}
+
+#endif // HUMBLEPEER_SDP_H
@@ -16,6 +16,20 @@ typedef enum SendMode {
 } SendMode;
 
 
+typedef enum AliasStatus {
+	// Not registered by this peer (or unregistered since)
+	ALIAS_UNKNOWN = 0,
+
+	// Waiting for the peer server to answer
+	ALIAS_PENDING = 1,
+
+	// The alias is ours
+	ALIAS_REGISTERED = 2,
+
+	// Another peer has it
+	ALIAS_REJECTED = 3
+} AliasStatus;
+
 /*
 * Is the peer-to-peer network supported on this platform.
 */
@@ -47,11 +61,38 @@ HUMBLENET_API ha_bool HUMBLENET_CALL humblenet_p2p_register_alias(const char* na
  */
 HUMBLENET_API ha_bool HUMBLENET_CALL humblenet_p2p_unregister_alias(const char* name);
 
+/*
+ * Whether the peer server accepted an alias this peer registered. Registering is
+ * claim-or-fail, when it's ALIAS_REJECTED *owner (if not NULL) is the peer that has it.
+ * humblenet_p2p_wait returns when the answer comes in.
+ */
+HUMBLENET_API AliasStatus HUMBLENET_CALL humblenet_p2p_alias_status(const char* name, PeerId* owner);
+
 /*
  * Create a virtual peer for an alias on the server
  */
 HUMBLENET_API PeerId HUMBLENET_CALL humblenet_p2p_virtual_peer_for_alias(const char* name);
 
+/*
+ * Look up the peer an alias is registered to, without connecting to it.
+ * Returns true with *peer set once the answer is known (0 if nothing is registered
+ * under the name), false while the peer server is being asked; call it again later.
+ * Lookups made together are sent as one request and cached until the server says
+ * they changed.
+ */
+HUMBLENET_API ha_bool HUMBLENET_CALL humblenet_p2p_lookup_alias(const char* name, PeerId* peer);
+
+/*
+ * Start connecting to a peer (or a virtual peer for an alias) in the background, so the
+ * first humblenet_p2p_sendto to it doesn't wait for the handshake. Returns true once the
+ * connection is established, false while it's still connecting (call it again to check)
+ * or if it couldn't be started or has failed (error set, calling it again starts over).
+ * Connections opened this way are closed again when nothing was sent to or received from
+ * them for the "p2p_preconnect_idle" hint (ms, 60000 by default), and at most
+ * "p2p_preconnect_max" (32) are kept, the least recently used being closed first.
+ */
+HUMBLENET_API ha_bool HUMBLENET_CALL humblenet_p2p_preconnect(PeerId peer);
+
 /*
 * Send a message to a peer.
 */
@@ -89,6 +130,35 @@ HUMBLENET_API ha_bool HUMBLENET_CALL humblenet_p2p_wait(int ms);
 
 HUMBLENET_API int HUMBLENET_CALL humblenet_p2p_select(int nfds, fd_set *readfds, fd_set *writefds,
 													  fd_set *exceptfds, struct timeval *timeout);
+
+typedef enum PollMode {
+	// IO runs on a dedicated humblenet thread (default)
+	POLL_THREADED = 0,
+
+	// IO only runs when the application calls humblenet_process
+	POLL_EXTERNAL = 1,
+
+	// As POLL_EXTERNAL but without any locking, all humblenet calls
+	// must be made from the thread calling humblenet_process
+	POLL_INLINE = 2
+} PollMode;
+
+/*
+* Select how IO is driven, must be called before humblenet_init
+*/
+HUMBLENET_API ha_bool HUMBLENET_CALL humblenet_set_poll_mode(PollMode mode);
+
+/*
+* Get a file descriptor that becomes readable whenever humblenet_process has work to do.
+* Only available in POLL_EXTERNAL or POLL_INLINE mode (currently Linux only), returns -1 otherwise.
+*/
+HUMBLENET_API int HUMBLENET_CALL humblenet_get_poll_fd();
+
+/*
+* Run pending IO and timers, waiting at most timeout_ms for something to happen (0 never blocks).
+* Only available in POLL_EXTERNAL or POLL_INLINE mode, must NOT be called within a lock/unlock block.
+*/
+HUMBLENET_API int HUMBLENET_CALL humblenet_process(int timeout_ms);
 #endif
 
 #ifdef __cplusplus
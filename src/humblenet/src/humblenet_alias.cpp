@@ -1,12 +1,26 @@
 
+#include "humblenet_p2p.h"
 #include "humblenet_p2p_internal.h"
+#include "humblenet_alias.h"
 #include "humblenet_utils.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
 #include <map>
 
 #define VIRTUAL_PEER 0x80000000
 
+// lookups made within this many ms of each other go out as one message
+#define ALIAS_LOOKUP_DELAY 2
+#define ALIAS_LOOKUP_BATCH_MAX 256
+
+// how long a lookup is cached when the server will tell us about changes (ms),
+// the "alias_cache_ttl" hint overrides it. Without that it's only kept long
+// enough for humblenet_p2p_lookup_alias to pick it up.
+#define ALIAS_CACHE_TTL 60000
+#define ALIAS_UNWATCHED_TTL 1000
+
 static BidirectionalMap<PeerId, std::string> virtualPeerNames;
 static BidirectionalMap<PeerId, Connection*> virtualPeerConnections;
 
@@ -14,13 +28,106 @@ static PeerId nextVirtualPeer = 0;
 
 static std::string virtualName;
 
+struct AliasCacheEntry {
+	PeerId peer;
+	uint64_t expires;
+};
+
+static std::unordered_map<std::string, AliasCacheEntry> aliasCache;
+
+// our own aliases, as far as the peer server has told us
+struct AliasRegistration {
+	AliasStatus status;
+	PeerId owner;
+};
+
+static std::unordered_map<std::string, AliasRegistration> registrations;
+
+// names waiting for the next lookup message, and the ones sent without an answer yet
+static std::vector<std::string> queuedLookups;
+static std::unordered_set<std::string> sentLookups;
+static bool lookupScheduled = false;
+
+static void send_lookups(void* data) {
+	HUMBLENET_GUARD();
+
+	lookupScheduled = false;
+
+	humblenet::P2PSignalConnection* conn = humbleNetState.p2pConn.get();
+	if (!conn) {
+		// resent once we're connected again, see internal_alias_signaling_ready
+		queuedLookups.clear();
+		return;
+	}
+
+	if (conn->aliasCache) {
+		for (size_t i = 0; i < queuedLookups.size(); i += ALIAS_LOOKUP_BATCH_MAX) {
+			size_t end = std::min(i + ALIAS_LOOKUP_BATCH_MAX, queuedLookups.size());
+			std::vector<std::string> batch(queuedLookups.begin() + i, queuedLookups.begin() + end);
+			if (!humblenet::sendAliasLookup(conn, batch)) {
+				break;
+			}
+		}
+	} else {
+		for (const auto& name : queuedLookups) {
+			if (!humblenet::sendAliasLookup(conn, name)) {
+				break;
+			}
+		}
+	}
+
+	queuedLookups.clear();
+}
+
+static void queue_lookup( const std::string& name ) {
+	if (!sentLookups.insert(name).second) {
+		// already asked
+		return;
+	}
+
+	queuedLookups.push_back(name);
+
+	if (!lookupScheduled) {
+		lookupScheduled = true;
+		humblenet_timer(send_lookups, ALIAS_LOOKUP_DELAY, NULL);
+	}
+}
+
+static const AliasCacheEntry* find_cached( const std::string& name ) {
+	auto it = aliasCache.find(name);
+	if (it == aliasCache.end()) {
+		return NULL;
+	}
+
+	if (it->second.expires <= sys_milliseconds()) {
+		aliasCache.erase(it);
+		return NULL;
+	}
+
+	return &it->second;
+}
+
 ha_bool internal_alias_register( const char* name ) {
 	if( !name || !name[0] ) {
 		humblenet_set_error("No name or empty name provided");
 		return 0;
 	}
 
-	return humblenet::sendAliasRegister(humbleNetState.p2pConn.get(), name);
+	if (!humblenet::sendAliasRegister(humbleNetState.p2pConn.get(), name)) {
+		return 0;
+	}
+
+	// an older server doesn't answer, then all we can do is assume it worked
+	AliasRegistration& reg = registrations[name];
+	if (humbleNetState.p2pConn->aliasAck) {
+		reg.status = ALIAS_PENDING;
+		reg.owner = 0;
+	} else {
+		reg.status = ALIAS_REGISTERED;
+		reg.owner = humbleNetState.myPeerId;
+	}
+
+	return 1;
 }
 
 ha_bool internal_alias_unregister( const char* name ) {
@@ -31,7 +138,53 @@ ha_bool internal_alias_unregister( const char* name ) {
 
 	if (!name) name = "";
 
-	return humblenet::sendAliasUnregister(humbleNetState.p2pConn.get(), name);
+	if (!humblenet::sendAliasUnregister(humbleNetState.p2pConn.get(), name)) {
+		return 0;
+	}
+
+	if (name[0]) {
+		registrations.erase(name);
+	} else {
+		registrations.clear();
+	}
+
+	return 1;
+}
+
+AliasStatus internal_alias_status( const char* name, PeerId* owner ) {
+	if( !name || !name[0] ) {
+		humblenet_set_error("No name or empty name provided");
+		return ALIAS_UNKNOWN;
+	}
+
+	auto it = registrations.find(name);
+	if (it == registrations.end()) {
+		return ALIAS_UNKNOWN;
+	}
+
+	if (owner) {
+		*owner = it->second.owner;
+	}
+	return it->second.status;
+}
+
+void internal_alias_register_answered( const std::string& alias, PeerId owner ) {
+	auto it = registrations.find(alias);
+	if (it == registrations.end()) {
+		// unregistered since
+		return;
+	}
+
+	if (owner == humbleNetState.myPeerId) {
+		it->second.status = ALIAS_REGISTERED;
+	} else {
+		LOG("Alias \"%s\" is already registered to peer %u\n", alias.c_str(), owner);
+		it->second.status = ALIAS_REJECTED;
+	}
+	it->second.owner = owner;
+
+	// wake up humblenet_p2p_wait
+	signal();
 }
 
 PeerId internal_alias_lookup( const char* name ) {
@@ -47,6 +200,73 @@ PeerId internal_alias_lookup( const char* name ) {
 	return vpeer;
 }
 
+ha_bool internal_alias_resolve( const char* name, PeerId* peer ) {
+	if( !name || !name[0] ) {
+		humblenet_set_error("No name or empty name provided");
+		return 0;
+	}
+
+	const AliasCacheEntry* cached = find_cached(name);
+	if (cached) {
+		*peer = cached->peer;
+		return 1;
+	}
+
+	if (!humbleNetState.p2pConn) {
+		humblenet_set_error("Not connected to the peer server");
+		return 0;
+	}
+
+	queue_lookup(name);
+	return 0;
+}
+
+void internal_alias_lookup_answered( const std::string& alias, PeerId peer ) {
+	sentLookups.erase(alias);
+
+	uint64_t ttl = ALIAS_UNWATCHED_TTL;
+	if (humbleNetState.p2pConn && humbleNetState.p2pConn->aliasCache) {
+		const char* hint = humblenet_get_hint("alias_cache_ttl");
+		ttl = hint ? strtoul(hint, NULL, 10) : ALIAS_CACHE_TTL;
+	}
+
+	AliasCacheEntry& entry = aliasCache[alias];
+	entry.peer = peer;
+	entry.expires = sys_milliseconds() + ttl;
+
+	if (humbleNetState.pendingAliasConnectionsOut.count(alias)) {
+		internal_alias_resolved_to(alias, peer);
+	}
+}
+
+void internal_alias_invalidate( const std::string& alias ) {
+	aliasCache.erase(alias);
+}
+
+void internal_alias_signaling_ready() {
+	// whatever we cached came from the last session, and its answers may never come
+	aliasCache.clear();
+
+	// a new session doesn't have our aliases, and a resumed one answers again
+	for (auto& it : registrations) {
+		if (it.second.status == ALIAS_REJECTED) {
+			continue;
+		}
+		if (humbleNetState.p2pConn->aliasAck) {
+			it.second.status = ALIAS_PENDING;
+		}
+		if (!humblenet::sendAliasRegister(humbleNetState.p2pConn.get(), it.first)) {
+			break;
+		}
+	}
+
+	std::vector<std::string> names(sentLookups.begin(), sentLookups.end());
+	sentLookups.clear();
+	for (const auto& name : names) {
+		queue_lookup(name);
+	}
+}
+
 void internal_alias_resolved_to( const std::string& alias, PeerId peer ) {
 	Connection* connection = NULL;
 
@@ -136,7 +356,7 @@ Connection* internal_alias_create_connection( PeerId peer ) {
 
 		std::string name = nit->second;
 
-		if (!sendAliasLookup(humbleNetState.p2pConn.get(), name)) {
+		if (!humbleNetState.p2pConn) {
 			return NULL;
 		}
 
@@ -147,6 +367,14 @@ Connection* internal_alias_create_connection( PeerId peer ) {
 		LOG("Establishing a connection to \"%s\"...\n", nit->second.c_str() );
 
 		virtualPeerConnections.insert( peer, conn );
+
+		// only trust the cache if the server tells us when it goes stale
+		const AliasCacheEntry* cached = humbleNetState.p2pConn->aliasCache ? find_cached(name) : NULL;
+		if (cached) {
+			internal_alias_resolved_to(name, cached->peer);
+		} else {
+			queue_lookup(name);
+		}
 	}
 
 	return conn;
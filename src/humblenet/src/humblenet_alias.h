@@ -13,6 +13,18 @@
  */
 ha_bool internal_alias_register(const char* alias );
 
+/**
+ * Whether the peer server accepted an alias, and which peer has it if not.
+ *
+ */
+AliasStatus internal_alias_status( const char* alias, PeerId* owner );
+
+/**
+ * Called on AliasRegistered (owner is us) or AliasRejected
+ *
+ */
+void internal_alias_register_answered( const std::string& alias, PeerId owner );
+
 /**
  * Unregister an alias for this peer.
  *
@@ -63,4 +75,30 @@ void internal_alias_remove_connection( Connection* conn );
  */
 void internal_alias_resolved_to( const std::string& alias, PeerId peer );
 
+/**
+ * Find the peer an alias belongs to without connecting to it.
+ *
+ * Returns true with *peer set (0 if the alias isn't registered) if the answer is cached,
+ * otherwise asks the peer server and returns false.
+ */
+ha_bool internal_alias_resolve( const char* alias, PeerId* peer );
+
+/**
+ * Called for every alias in an AliasResolved, caches it and continues any connection waiting on it
+ *
+ */
+void internal_alias_lookup_answered( const std::string& alias, PeerId peer );
+
+/**
+ * Called when the peer server says a cached alias changed
+ *
+ */
+void internal_alias_invalidate( const std::string& alias );
+
+/**
+ * Called on every HelloClient, drops the cache, resends unanswered lookups and registers our aliases again
+ *
+ */
+void internal_alias_signaling_ready();
+
 #endif // HUMBLENET_ALIAS_H
@@ -97,6 +97,21 @@ bool is_peer_blacklisted( PeerId peer_id ) {
 	return true;
 }
 
+/*
+ * Determine if our candidates are sent as they're found, rather than in the description.
+ *
+ * The browser gathers all of them before handing us the description, so only native trickles.
+ * Set the hint "p2p_trickle_ice" to 0 to wait for gathering there too.
+ */
+bool trickle_ice() {
+#ifdef EMSCRIPTEN
+	return false;
+#else
+	const char* trickle = humblenet_get_hint("p2p_trickle_ice");
+	return !(trickle && *trickle == '0');
+#endif
+}
+
 /*
  * See if we can try a connection to this peer
  *
@@ -176,7 +191,7 @@ ha_bool humblenet_connection_is_readable(Connection *connection) {
 ha_bool humblenet_connection_is_writable(Connection *connection) {
 	assert(connection != NULL);
 	if (connection->status == HUMBLENET_CONNECTION_CONNECTED) {
-		return connection->writable;
+		return connection->writable && !connection->relayCongested;
 	}
 	return false;
 }
@@ -200,7 +215,11 @@ int humblenet_connection_write(Connection *connection, const void *buf, uint32_t
 
 			const char* use_relay = humblenet_get_hint("p2p_use_relay");
 			if( use_relay && *use_relay == '1' ) {
-				if( ! sendP2PRelayData( humbleNetState.p2pConn.get(), connection->otherPeer, buf, bufsize ) ) {
+				if( connection->relayCongested ) {
+					// it would be dropped, wait for the server to say the peer caught up
+					return 0;
+				}
+				if( ! sendRelayPacket( humbleNetState.p2pConn.get(), connection->otherPeer, buf, bufsize ) ) {
 					return -1;
 				}
 				return bufsize;
@@ -312,6 +331,95 @@ PeerId humblenet_connection_get_peer_id(Connection *connection) {
 }
 
 
+// how long a held description waits for the end of candidates, which may never come
+const int GATHER_TIMEOUT = 3000;	// ms
+
+// adds the "a=candidate:...\r\n" lines of candidates to sdp, except those it has already.
+// Microstack puts its reflexive candidate into its own description too
+static void append_candidates( std::string& sdp, const std::string& candidates ) {
+	size_t start = 0;
+	while( start < candidates.size() ) {
+		size_t end = candidates.find( "\r\n", start );
+		if( end == std::string::npos )
+			end = candidates.size();
+		std::string line = candidates.substr( start, end - start );
+		start = end + 2;
+
+		// foundation component transport priority address port typ ...
+		std::vector<std::string> fields;
+		size_t pos = 0;
+		while( fields.size() < 6 && pos < line.size() ) {
+			size_t next = line.find( ' ', pos );
+			if( next == std::string::npos )
+				next = line.size();
+			fields.push_back( line.substr( pos, next - pos ) );
+			pos = next + 1;
+		}
+		if( fields.size() == 6 && sdp.find( " " + fields[4] + " " + fields[5] + " typ" ) != std::string::npos )
+			continue;
+
+		sdp += line;
+		sdp += "\r\n";
+	}
+}
+
+static int send_sdp( Connection* conn, const char* offer ) {
+	int flags = trickle_ice() ? 0 : 0x2;
+	bool compact = humbleNetState.p2pConn && humbleNetState.p2pConn->compactSDP;
+
+	std::string sdp = offer;
+	append_candidates( sdp, conn->heldCandidates );
+	conn->heldCandidates.clear();
+	conn->sdpSent = true;
+
+	if( conn->inOrOut == Incoming ) {
+		LOG("P2PConnect SDP sent %u response offer = \"%s\"\n", conn->otherPeer, sdp.c_str());
+		if( ! sendP2PResponse(humbleNetState.p2pConn.get(), conn->otherPeer, sdp.c_str(), compact) ) {
+			return -1;
+		}
+	} else {
+		LOG("outgoing SDP sent %u offer: \"%s\"\n", conn->otherPeer, sdp.c_str());
+		if( ! sendP2PConnect(humbleNetState.p2pConn.get(), conn->otherPeer, flags, sdp.c_str(), compact) ) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int send_held_sdp( Connection* conn ) {
+	std::string sdp;
+	sdp.swap( conn->heldSdp );
+	return send_sdp( conn, sdp.c_str() );
+}
+
+#ifndef EMSCRIPTEN
+template <typename Map>
+static void find_gather_expired( const Map& connections, uint64_t now, std::vector<Connection*>& expired ) {
+	for( auto& it : connections ) {
+		if( ! it.second->heldSdp.empty() && it.second->gatherDeadline <= now )
+			expired.push_back( it.second );
+	}
+}
+
+// sends the descriptions whose end of candidates didn't come in time with what there is
+static void gather_timeout( void* data ) {
+	HUMBLENET_GUARD();
+
+	std::vector<Connection*> expired;
+	uint64_t now = sys_milliseconds();
+	find_gather_expired( humbleNetState.pendingPeerConnectionsOut, now, expired );
+	find_gather_expired( humbleNetState.pendingPeerConnectionsIn, now, expired );
+	find_gather_expired( humbleNetState.pendingAliasConnectionsOut, now, expired );
+
+	for( Connection* conn : expired ) {
+		LOG("ICE gathering for peer %u timed out, sending the candidates there are\n", conn->otherPeer );
+		if( send_held_sdp( conn ) != 0 ) {
+			LOG("Unable to send the sdp to peer %u\n", conn->otherPeer );
+		}
+	}
+}
+#endif
+
 // called to return the sdp offer
 int on_sdp( internal_socket_t* s, const char* offer, void* user_data ) {
 	HUMBLENET_GUARD();
@@ -325,24 +433,20 @@ int on_sdp( internal_socket_t* s, const char* offer, void* user_data ) {
 
 	assert( conn->status == HUMBLENET_CONNECTION_CONNECTING );
 
-	// no trickle ICE
-	int flags = 0x2;
-
-	if( conn->inOrOut == Incoming ) {
-		LOG("P2PConnect SDP sent %u response offer = \"%s\"\n", conn->otherPeer, offer);
-		if( ! sendP2PResponse(humbleNetState.p2pConn.get(), conn->otherPeer, offer) ) {
-			return -1;
-		}
-	} else {
-		LOG("outgoing SDP sent %u offer: \"%s\"\n", conn->otherPeer, offer);
-		if( ! sendP2PConnect(humbleNetState.p2pConn.get(), conn->otherPeer, flags, offer) ) {
-			return -1;
-		}
+#ifndef EMSCRIPTEN
+	if( ! trickle_ice() && ! conn->candidatesGathered ) {
+		// sent along with the remaining candidates once they're found
+		conn->heldSdp = offer;
+		conn->gatherDeadline = sys_milliseconds() + GATHER_TIMEOUT;
+		humblenet_timer( gather_timeout, GATHER_TIMEOUT, NULL );
+		return 0;
 	}
-	return 0;
+#endif
+
+	return send_sdp( conn, offer );
 }
 
-// called to send a candidate
+// called to send a candidate, NULL when there are no more
 int on_ice_candidate( internal_socket_t* s, const char* offer, void* user_data ) {
 	HUMBLENET_GUARD();
 
@@ -355,8 +459,25 @@ int on_ice_candidate( internal_socket_t* s, const char* offer, void* user_data )
 
 	assert( conn->status == HUMBLENET_CONNECTION_CONNECTING );
 
+	if( offer == NULL ) {
+		conn->candidatesGathered = true;
+		if( conn->heldSdp.empty() ) {
+			return 0;
+		}
+		return send_held_sdp( conn );
+	}
+
+	if( ! conn->sdpSent ) {
+		// goes into the description, held or yet to come, rather than ahead of it
+		conn->heldCandidates += "a=";
+		conn->heldCandidates += offer;
+		conn->heldCandidates += "\r\n";
+		return 0;
+	}
+
 	LOG("Sending ice candidate to peer: %u, %s\n", conn->otherPeer, offer );
-	if( ! sendICECandidate(humbleNetState.p2pConn.get(), conn->otherPeer, offer) ) {
+	bool compact = humbleNetState.p2pConn && humbleNetState.p2pConn->compactSDP;
+	if( ! sendICECandidate(humbleNetState.p2pConn.get(), conn->otherPeer, offer, compact) ) {
 		return -1;
 	}
 
@@ -791,8 +912,9 @@ void humblenet_unlock() {
 	poll_unlock();
 }
 
+// wake up anyone blocked in humblenet_p2p_wait
 void signal() {
-	poll_interrupt();
+	poll_signal_event();
 }
 
 void humblenet_timer( timer_callback_t callback, int timeout, void* data)
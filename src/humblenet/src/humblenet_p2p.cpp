@@ -3,16 +3,123 @@
 #include "humblenet_datagram.h"
 #include "humblenet_alias.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <string>
 #include <map>
+#include <vector>
 
 #define P2P_INIT_GUARD( ... )    INIT_GUARD( "humblenet_p2p_init has not been called", initialized, __VA_ARGS__ )
 
+// pre-connected peers nothing was sent to or received from for this long are
+// disconnected again (ms, "p2p_preconnect_idle" hint), and only this many are
+// kept ("p2p_preconnect_max" hint)
+#define PRECONNECT_IDLE 60000
+#define PRECONNECT_MAX 32
+#define PRECONNECT_CHECK_INTERVAL 1000
+
 // These are the connections managed by p2p...
 std::map<PeerId, Connection*> p2pconnections;
 
+// the ones opened by humblenet_p2p_preconnect, with when they were last used
+static std::map<PeerId, uint64_t> preconnectPool;
+static bool preconnectCheckScheduled = false;
+
 static bool initialized = false;
 
+static int hint_value( const char* name, int value ) {
+	const char* hint = humblenet_get_hint( name );
+	return hint ? atoi( hint ) : value;
+}
+
+/*
+ * Find or open the connection to a peer or virtual peer
+ */
+static Connection* get_connection( PeerId topeer ) {
+	auto cit = p2pconnections.find( topeer );
+	if( cit != p2pconnections.end() ) {
+		// we have an active connection
+		return cit->second;
+	}
+
+	Connection* conn = NULL;
+
+	if( internal_alias_is_virtual_peer( topeer ) ) {
+		// lookup/create a connection to the virutal peer.
+		conn = internal_alias_find_connection( topeer );
+		if( conn == NULL )
+			conn = internal_alias_create_connection( topeer );
+	} else {
+		// create a new connection to the peer
+		conn = humblenet_connect_peer( topeer );
+	}
+
+	if( conn == NULL ) {
+		humblenet_set_error("Unable to get a connection for peer");
+		return NULL;
+	}
+
+	p2pconnections.insert( std::make_pair( topeer, conn ) );
+	LOG("Connection to peer opened: %u\n", topeer );
+
+	return conn;
+}
+
+static void close_connection( PeerId peer, Connection* conn ) {
+	p2pconnections.erase( conn->otherPeer );
+	p2pconnections.erase( peer );
+	preconnectPool.erase( conn->otherPeer );
+	preconnectPool.erase( peer );
+	humblenet_connection_close(conn);
+}
+
+static void preconnect_used( PeerId peer ) {
+	if( preconnectPool.empty() )
+		return;
+
+	auto it = preconnectPool.find( peer );
+	if( it != preconnectPool.end() )
+		it->second = sys_milliseconds();
+}
+
+static void preconnect_evict( PeerId peer ) {
+	auto it = p2pconnections.find( peer );
+	if( it != p2pconnections.end() ) {
+		close_connection( peer, it->second );
+	} else {
+		preconnectPool.erase( peer );
+	}
+}
+
+static void preconnect_check( void* data ) {
+	HUMBLENET_GUARD();
+
+	preconnectCheckScheduled = false;
+
+	if( !initialized ) {
+		preconnectPool.clear();
+		return;
+	}
+
+	uint64_t idleSince = sys_milliseconds() - hint_value( "p2p_preconnect_idle", PRECONNECT_IDLE );
+
+	std::vector<PeerId> idle;
+	for( auto& it : preconnectPool ) {
+		if( it.second <= idleSince || p2pconnections.find( it.first ) == p2pconnections.end() )
+			idle.push_back( it.first );
+	}
+
+	for( PeerId peer : idle ) {
+		LOG("Closing idle pre-connection to peer %u\n", peer );
+		preconnect_evict( peer );
+	}
+
+	if( !preconnectPool.empty() ) {
+		preconnectCheckScheduled = true;
+		humblenet_timer( preconnect_check, PRECONNECT_CHECK_INTERVAL, NULL );
+	}
+}
+
 /*
  * Is the peer-to-peer network initialized.
  */
@@ -73,6 +180,8 @@ void humblenet_p2p_shutdown() {
 	}
 	internal_deinit(humbleNetState.context);
 	humbleNetState.context = NULL;
+
+	preconnectPool.clear();
 }
 
 /*
@@ -107,6 +216,17 @@ ha_bool HUMBLENET_CALL humblenet_p2p_unregister_alias(const char* name) {
 	return internal_alias_unregister( name );
 }
 
+/*
+ * Registration state of one of our aliases.
+ */
+AliasStatus HUMBLENET_CALL humblenet_p2p_alias_status(const char* name, PeerId* owner) {
+	P2P_INIT_GUARD( ALIAS_UNKNOWN );
+
+	HUMBLENET_GUARD();
+
+	return internal_alias_status( name, owner );
+}
+
 /*
  * Find the PeerId of a named peer (registered on the server)
  */
@@ -118,6 +238,17 @@ PeerId HUMBLENET_CALL humblenet_p2p_virtual_peer_for_alias(const char* name) {
 	return internal_alias_lookup( name );
 }
 
+/*
+ * Find the PeerId an alias is registered to without connecting
+ */
+ha_bool HUMBLENET_CALL humblenet_p2p_lookup_alias(const char* name, PeerId* peer) {
+	P2P_INIT_GUARD( false );
+
+	HUMBLENET_GUARD();
+
+	return internal_alias_resolve( name, peer );
+}
+
 /*
  * Send a message to a peer.
  */
@@ -126,30 +257,13 @@ int HUMBLENET_CALL humblenet_p2p_sendto(const void* message, uint32_t length, Pe
 
 	HUMBLENET_GUARD();
 
-	Connection* conn = NULL;
-
-	auto cit = p2pconnections.find( topeer );
-	if( cit != p2pconnections.end() ) {
-		// we have an active connection
-		conn = cit->second;
-	} else if( internal_alias_is_virtual_peer( topeer ) ) {
-		// lookup/create a connection to the virutal peer.
-		conn = internal_alias_find_connection( topeer );
-		if( conn == NULL )
-			conn = internal_alias_create_connection( topeer );
-	} else {
-		// create a new connection to the peer
-		conn = humblenet_connect_peer( topeer );
-	}
-
+	Connection* conn = get_connection( topeer );
 	if( conn == NULL ) {
-		humblenet_set_error("Unable to get a connection for peer");
 		return -1;
-	} else if( cit == p2pconnections.end() ) {
-		p2pconnections.insert( std::make_pair( topeer, conn ) );
-		LOG("Connection to peer opened: %u\n", topeer );
 	}
 
+	preconnect_used( topeer );
+
 	int flags = 0;
 
 	if( sendmode & SEND_RELIABLE_BUFFERED )
@@ -165,9 +279,7 @@ int HUMBLENET_CALL humblenet_p2p_sendto(const void* message, uint32_t length, Pe
 		if( humblenet_connection_status( conn ) == HUMBLENET_CONNECTION_CLOSED ) {
 			LOG("Peer connection was closed\n");
 
-			p2pconnections.erase( conn->otherPeer );
-			p2pconnections.erase( topeer );
-			humblenet_connection_close(conn);
+			close_connection( topeer, conn );
 
 			humblenet_set_error("Connection to peer was closed");
 			return -1;
@@ -176,6 +288,61 @@ int HUMBLENET_CALL humblenet_p2p_sendto(const void* message, uint32_t length, Pe
 	return ret;
 }
 
+/*
+ * Start connecting to a peer ahead of sending to it.
+ */
+ha_bool HUMBLENET_CALL humblenet_p2p_preconnect(PeerId peer) {
+	P2P_INIT_GUARD( false );
+
+	HUMBLENET_GUARD();
+
+	if( peer == 0 ) {
+		humblenet_set_error("Invalid peer");
+		return false;
+	}
+
+	bool existing = p2pconnections.find( peer ) != p2pconnections.end();
+
+	if( !existing ) {
+		// make room, least recently used first
+		size_t maxPool = std::max( hint_value( "p2p_preconnect_max", PRECONNECT_MAX ), 1 );
+		while( preconnectPool.size() >= maxPool ) {
+			auto oldest = preconnectPool.begin();
+			for( auto it = preconnectPool.begin(); it != preconnectPool.end(); ++it ) {
+				if( it->second < oldest->second )
+					oldest = it;
+			}
+			LOG("Pre-connection pool full, closing the one to peer %u\n", oldest->first );
+			preconnect_evict( oldest->first );
+		}
+	}
+
+	Connection* conn = get_connection( peer );
+	if( conn == NULL ) {
+		return false;
+	}
+
+	if( humblenet_connection_status( conn ) == HUMBLENET_CONNECTION_CLOSED ) {
+		// failed, the next call starts over
+		LOG("Pre-connection to peer %u was closed\n", peer );
+		close_connection( peer, conn );
+		humblenet_set_error("Connection to peer was closed");
+		return false;
+	}
+
+	// connections the game opened itself are left alone
+	if( !existing ) {
+		preconnectPool[peer] = sys_milliseconds();
+
+		if( !preconnectCheckScheduled ) {
+			preconnectCheckScheduled = true;
+			humblenet_timer( preconnect_check, PRECONNECT_CHECK_INTERVAL, NULL );
+		}
+	}
+
+	return conn->status == HUMBLENET_CONNECTION_CONNECTED;
+}
+
 /*
  * See if there is a message available on the specified channel
  */
@@ -221,10 +388,9 @@ int HUMBLENET_CALL humblenet_p2p_recvfrom(void* buffer, uint32_t length, PeerId*
 				LOG("Tracking inbound connection to peer %u(%u)\n", *frompeer, peer );
 				p2pconnections.insert( std::make_pair( *frompeer, conn ) );
 			}
+			preconnect_used( *frompeer );
 		} else {
-			p2pconnections.erase( *frompeer );
-			p2pconnections.erase( peer );
-			humblenet_connection_close(conn);
+			close_connection( *frompeer, conn );
 			LOG("closing connection to peer: %u(%u)\n",*frompeer,peer);
 		}
 	}
@@ -268,33 +434,70 @@ int HUMBLENET_CALL humblenet_p2p_select(int nfds, fd_set *readfds, fd_set *write
 	return poll_select( nfds, readfds, writefds, exceptfds, timeout );
 }
 
+ha_bool HUMBLENET_CALL humblenet_set_poll_mode(PollMode mode) {
+	poll_mode_t pollMode;
+	switch( mode ) {
+		case POLL_THREADED: pollMode = POLL_MODE_THREADED; break;
+		case POLL_EXTERNAL: pollMode = POLL_MODE_EXTERNAL; break;
+		case POLL_INLINE:   pollMode = POLL_MODE_INLINE; break;
+		default:
+			humblenet_set_error("Unknown poll mode");
+			return false;
+	}
+
+	if( poll_set_mode( pollMode ) != 0 ) {
+		humblenet_set_error("Poll mode must be set before humblenet_init");
+		return false;
+	}
+	return true;
+}
+
+int HUMBLENET_CALL humblenet_get_poll_fd() {
+	// not guard needed poll_get_fd is internally init and thread safe.
+	return poll_get_fd();
+}
+
+int HUMBLENET_CALL humblenet_process(int timeout_ms) {
+	if( poll_get_mode() == POLL_MODE_THREADED ) {
+		humblenet_set_error("humblenet_process requires POLL_EXTERNAL or POLL_INLINE mode");
+		return -1;
+	}
+
+	int ret = poll_process( timeout_ms );
+
+	// -2 means we were called from inside the loop (e.g. a callback), nothing to do.
+	return ret == -2 ? 0 : ret;
+}
+
+static bool has_pending_events() {
+	HUMBLENET_GUARD();
+
+	return ! humbleNetState.pendingDataConnections.empty() || ! humbleNetState.pendingNewConnections.empty() || ! humbleNetState.remoteClosedConnections.empty();
+}
+
 ha_bool HUMBLENET_CALL humblenet_p2p_wait(int ms) {
 	P2P_INIT_GUARD( false );
 
-	struct timeval tv;
+	if( poll_get_mode() != POLL_MODE_THREADED ) {
+		// IO only happens when we pump it, so pump it here.
+		if( ms > 0 && has_pending_events() )
+			ms = 0;
 
-	// This is not really needed in a threaded environment,
-	// e.g. if this is being used as a sleep till something is ready,
-	// we need this. If its being used as a "let IO run" (e.g. threaded IO) then we dont.
-	if( ms > 0 ) {
-		HUMBLENET_GUARD();
+		poll_process( ms );
 
-		if( ! humbleNetState.pendingDataConnections.empty() ) {
-			ms = 0;
-		}
+		return has_pending_events();
 	}
 
-	tv.tv_sec = ms / 1000;
-	tv.tv_usec = 1000 * (ms % 1000);
+	// grab the sequence before checking so an event arriving in between still wakes us.
+	uint32_t seq = poll_event_seq();
 
-	if( poll_select( 0, NULL, NULL, NULL, &tv ) > 0 )
+	if( has_pending_events() )
 		return true;
-	else
-	{
-		HUMBLENET_GUARD();
 
-		return ! humbleNetState.pendingDataConnections.empty() || ! humbleNetState.pendingNewConnections.empty() || ! humbleNetState.remoteClosedConnections.empty();
-	}
+	if( poll_wait_event( seq, ms ) == 0 )
+		return false;
+
+	return has_pending_events();
 }
 
 #else
@@ -36,15 +36,30 @@ struct Connection {
 	std::vector<char> recvBuffer;
 
 	ha_bool writable;
+	// the server is dropping what we relay to the other peer
+	bool relayCongested;
 
 	struct internal_socket_t* socket;
 
+	// when not trickling ICE, the description is held here until all candidates are in,
+	// or until gatherDeadline
+	std::string heldSdp;
+	bool candidatesGathered;
+	uint64_t gatherDeadline;
+	// candidates found before the description went out, which are sent in it
+	std::string heldCandidates;
+	bool sdpSent;
+
 	Connection( InOrOut inOrOut_, struct internal_socket_t *s = NULL)
 	: inOrOut(inOrOut_)
 	, status(HUMBLENET_CONNECTION_CONNECTING)
 	, otherPeer(0)
 	, writable(true)
+	, relayCongested(false)
 	, socket(NULL)
+	, candidatesGathered(false)
+	, gatherDeadline(0)
+	, sdpSent(false)
 	{
 	}
 };
@@ -92,12 +107,18 @@ typedef struct HumbleNetState {
 	std::string reconnectToken;
 	std::vector<humblenet::ICEServer> iceServers;
 
+	// signaling reconnect backoff, ms until the next attempt
+	int reconnectDelay;
+	bool reconnectScheduled;
+
 	ha_bool webRTCSupported;
 
 	internal_context_t *context;
 
 	HumbleNetState()
 	:  myPeerId(0)
+	, reconnectDelay(0)
+	, reconnectScheduled(false)
 	, webRTCSupported(false)
 	, context(NULL)
 	{
@@ -118,6 +139,7 @@ void humblenet_connection_set_closed( Connection* conn );
 bool is_peer_blacklisted( PeerId peer );
 void blacklist_peer( PeerId peer );
 void signal();
+bool trickle_ice();
 
 typedef void(*timer_callback_t)(void* data);
 void humblenet_timer( timer_callback_t callback, int timeout, void* data);
@@ -1,5 +1,11 @@
+#include "humblenet_p2p.h"
 #include "humblenet_p2p_internal.h"
 #include "humblenet_alias.h"
+#include "humblepeer_sdp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
 
 #if defined(EMSCRIPTEN)
 	#include <emscripten/emscripten.h>
@@ -16,6 +22,50 @@
 
 
 static ha_bool p2pSignalProcess(const humblenet::HumblePeer::Message *msg, void *user_data);
+static ha_bool p2pSignalRelay(const uint8_t *frame, size_t length, void *user_data);
+
+// signaling reconnect backoff
+const int RECONNECT_DELAY_MIN = 100;	// ms
+const int RECONNECT_DELAY_MAX = 30000;
+
+static void signaling_reconnect(void* data) {
+	HUMBLENET_GUARD();
+
+	humbleNetState.reconnectScheduled = false;
+
+	if (!humblenet_p2p_is_initialized() || humbleNetState.p2pConn) {
+		// shut down, or someone already reconnected
+		return;
+	}
+
+	LOG("reconnecting to signaling server\n");
+	if (!humblenet_signaling_connect()) {
+		humblenet_signaling_schedule_reconnect();
+	}
+}
+
+void humblenet_signaling_schedule_reconnect() {
+	const char* reconnect = humblenet_get_hint("signaling_reconnect");
+	if (reconnect && *reconnect == '0') {
+		return;
+	}
+
+	if (humbleNetState.reconnectScheduled || !humblenet_p2p_is_initialized()) {
+		return;
+	}
+
+	int delay = std::max(humbleNetState.reconnectDelay, RECONNECT_DELAY_MIN);
+	humbleNetState.reconnectDelay = std::min(delay * 2, RECONNECT_DELAY_MAX);
+
+	// +-25% so clients dropped together don't all come back at the same moment. Seeded
+	// per process, and not rand(), which is the same everywhere unless the game seeds it
+	static std::mt19937 random(std::random_device{}() ^ uint32_t(std::chrono::high_resolution_clock::now().time_since_epoch().count()));
+	delay = std::uniform_int_distribution<int>(delay * 3 / 4, delay * 3 / 4 + delay / 2)(random);
+
+	LOG("signaling connection lost, reconnecting in %d ms\n", delay);
+	humbleNetState.reconnectScheduled = true;
+	humblenet_timer(signaling_reconnect, delay, NULL);
+}
 
 ha_bool humblenet_signaling_connect() {
 	using namespace humblenet;
@@ -23,12 +73,22 @@ ha_bool humblenet_signaling_connect() {
 	if (humbleNetState.p2pConn) {
 		humbleNetState.p2pConn->disconnect();
 		humbleNetState.p2pConn.reset();
-		humbleNetState.myPeerId = 0;
 	}
 
+	if (!humbleNetState.reconnectToken.empty()) {
+		LOG("resuming the session of peer %u\n", humbleNetState.myPeerId);
+	}
+	// until the server says hello again
+	humbleNetState.myPeerId = 0;
+
 	LOG("connecting to signaling server \"%s\" with gameToken \"%s\" \n", humbleNetState.signalingServerAddr.c_str(), humbleNetState.gameToken.c_str());
 
 	humbleNetState.p2pConn.reset(new P2PSignalConnection);
+
+	const char* batch = humblenet_get_hint("signaling_batch");
+	humbleNetState.p2pConn->batching = !(batch && *batch == '0');
+	const char* coalesce = humblenet_get_hint("relay_coalesce");
+	humbleNetState.p2pConn->relayCoalesce = !(coalesce && *coalesce == '0');
 	humbleNetState.p2pConn->wsi = internal_connect_websocket(humbleNetState.signalingServerAddr.c_str(), "humblepeer");
 
 	if (humbleNetState.p2pConn->wsi == NULL) {
@@ -61,6 +121,22 @@ namespace humblenet {
 			return false;
 		}
 
+#if !defined(EMSCRIPTEN)
+		// queue it, on_writable sends everything queued until then as one frame.
+		// (the asm.js websocket has no writable callback, it always writes directly)
+		if (conn->batching) {
+			bool wasEmpty = conn->sendBuf.empty();
+			// anything queued after a relay frame means it can't grow anymore
+			conn->relayFrame = P2PSignalConnection::NO_RELAY_FRAME;
+			conn->sendBuf.insert(conn->sendBuf.end(), buff, buff + length);
+			if (wasEmpty) {
+				HUMBLENET_UNGUARD();
+				internal_request_writable(conn->wsi);
+			}
+			return true;
+		}
+#endif
+
 		{
 			HUMBLENET_UNGUARD();
 
@@ -70,6 +146,48 @@ namespace humblenet {
 		}
 	}
 
+	ha_bool sendRelayPacket(P2PSignalConnection *conn, PeerId peer, const void *data, size_t length)
+	{
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+
+		if (conn == NULL || !conn->relayFrames) {
+			// P2PRelayData lengths are 16 bit
+			do {
+				uint16_t chunk = uint16_t(std::min<size_t>(length, UINT16_MAX));
+				if (!sendP2PRelayData(conn, peer, bytes, chunk)) {
+					return false;
+				}
+				bytes += chunk;
+				length -= chunk;
+			} while (length);
+			return true;
+		}
+
+		const size_t maxPacket = MAX_RELAY_FRAME_SIZE - RELAY_FRAME_HEADER_SIZE - RELAY_PACKET_HEADER_SIZE;
+		do {
+			size_t chunk = std::min(length, maxPacket);
+
+			// the frame still waiting in sendBuf gets it, saves the server a frame
+			if (conn->relayFrame != P2PSignalConnection::NO_RELAY_FRAME && conn->relayPeer == peer
+				&& conn->sendBuf.size() - conn->relayFrame + RELAY_PACKET_HEADER_SIZE + chunk <= MAX_RELAY_FRAME_SIZE) {
+				appendRelayPacket(conn->sendBuf, conn->relayFrame, bytes, chunk);
+			} else {
+				size_t frame = conn->sendBuf.size();
+				if (!sendRelayFrame(conn, peer, bytes, chunk)) {
+					return false;
+				}
+				if (conn->batching && conn->relayCoalesce) {
+					conn->relayFrame = frame;
+					conn->relayPeer = peer;
+				}
+			}
+
+			bytes += chunk;
+			length -= chunk;
+		} while (length);
+		return true;
+	}
+
 	// called for incoming connections to indicate the connection process is completed.
 	int on_accept (internal_socket_t* s, void* user_data) {
 		// we dont accept incoming connections
@@ -151,9 +269,22 @@ namespace humblenet {
 
 		uint8_t flags = 0;
 		if (humbleNetState.webRTCSupported) {
-			// No trickle ICE on native
-			flags = (0x1 | 0x2);
+			flags = 0x1;
+			if (!trickle_ice()) {
+				flags |= 0x2;
+			}
+		}
+		const char* compact = humblenet_get_hint("signaling_compact_sdp");
+		if (!(compact && *compact == '0')) {
+			flags |= HELLO_FLAG_COMPACT_SDP;
+		}
+		const char* aliasCache = humblenet_get_hint("alias_cache");
+		if (!(aliasCache && *aliasCache == '0')) {
+			flags |= HELLO_FLAG_ALIAS_CACHE;
 		}
+		flags |= HELLO_FLAG_ALIAS_ACK;
+		flags |= HELLO_FLAG_BACKPRESSURE;
+		flags |= HELLO_FLAG_RELAY_FRAMES;
 		std::map<std::string, std::string> attributes;
 		attributes.emplace("platform", pinfo);
 		ha_bool helloSuccess = sendHelloServer(conn, flags, humbleNetState.gameToken, humbleNetState.gameSecret, humbleNetState.authToken, humbleNetState.reconnectToken, attributes);
@@ -161,6 +292,7 @@ namespace humblenet {
 			// something went wrong, close the connection
 			// don't humblenet_set_error, sendHelloServer should have done that
 			humbleNetState.p2pConn.reset();
+			humblenet_signaling_schedule_reconnect();
 			return -1;
 		}
 		return 0;
@@ -188,13 +320,11 @@ namespace humblenet {
 
 		//        LOG("Data: %d -> %s\n", len, std::string((const char*)data,len).c_str());
 
-		conn->recvBuf.insert(conn->recvBuf.end()
-							 , reinterpret_cast<const char *>(data)
-							 , reinterpret_cast<const char *>(data) + len);
-		ha_bool retval = parseMessage(conn->recvBuf, p2pSignalProcess, NULL);
+		ha_bool retval = parseMessage(conn->recvBuf, reinterpret_cast<const uint8_t *>(data), len, p2pSignalProcess, NULL, p2pSignalRelay);
 		if (!retval) {
 			// error while parsing a message, close the connection
 			humbleNetState.p2pConn.reset();
+			humblenet_signaling_schedule_reconnect();
 			return -1;
 		}
 		return 0;
@@ -224,16 +354,22 @@ namespace humblenet {
 			return 0;
 		}
 
-		int retval = internal_write_socket( conn->wsi, &conn->sendBuf[0], conn->sendBuf.size() );
+		// a successful write asks for another writable callback, which sends the rest
+		size_t frameSize = std::min(conn->sendBuf.size(), MAX_SIGNAL_FRAME_SIZE);
+		int retval = internal_write_socket( conn->wsi, &conn->sendBuf[0], frameSize );
 		if (retval < 0) {
-			// error while sending, close the connection
-			// TODO: should try to reopen after some time
+			// error while sending, close the connection and try again later
 			humbleNetState.p2pConn.reset();
+			humblenet_signaling_schedule_reconnect();
 			return -1;
 		}
 
 		// successful write
 		conn->sendBuf.erase(conn->sendBuf.begin(), conn->sendBuf.begin() + retval);
+		if (conn->relayFrame != P2PSignalConnection::NO_RELAY_FRAME) {
+			// a frame that's started going out can't grow
+			conn->relayFrame = (size_t(retval) <= conn->relayFrame) ? conn->relayFrame - retval : P2PSignalConnection::NO_RELAY_FRAME;
+		}
 
 		return 0;
 	}
@@ -245,9 +381,11 @@ namespace humblenet {
 		if( humbleNetState.p2pConn ) {
 			if( s == humbleNetState.p2pConn->wsi ) {
 
-				// handle retry...
 				humbleNetState.p2pConn.reset();
 
+				// the server holds our session for a while, resume it with the reconnect token
+				humblenet_signaling_schedule_reconnect();
+
 				return 0;
 			}
 		}
@@ -272,6 +410,39 @@ namespace humblenet {
 	}
 }
 
+// the connection relayed data from peer goes to
+static Connection* relayConnection(PeerId peer)
+{
+	// Sequentially look for the other peer
+	for( auto& it : humbleNetState.connections ) {
+		if( it.second->otherPeer == peer )
+			return it.second;
+	}
+	LOG("Peer %u does not exist\n", peer);
+	return NULL;
+}
+
+static ha_bool p2pSignalRelay(const uint8_t *frame, size_t length, void *user_data)
+{
+	PeerId peer = humblenet::relayFramePeer(frame);
+	Connection* conn = relayConnection(peer);
+	if( !conn ) {
+		return true;
+	}
+
+	bool valid = humblenet::forEachRelayPacket(frame, length, [conn](const uint8_t* data, size_t size) {
+		conn->recvBuffer.insert(conn->recvBuffer.end(), data, data + size);
+	});
+	if( !valid ) {
+		LOG("Malformed relay frame from peer %u\n", peer);
+		return false;
+	}
+
+	humbleNetState.pendingDataConnections.insert( conn );
+	signal();
+	return true;
+}
+
 static ha_bool p2pSignalProcess(const humblenet::HumblePeer::Message *msg, void *user_data)
 {
 	using namespace humblenet;
@@ -309,13 +480,13 @@ static ha_bool p2pSignalProcess(const humblenet::HumblePeer::Message *msg, void
 
 			humbleNetState.pendingPeerConnectionsIn.insert(std::make_pair(peer, connection));
 
-			auto offer = p2p->offer();
+			std::string offer;
+			int ret = offerText(p2p->offer(), p2p->description(), offer);
 
-			LOG("P2PConnect SDP got %u's offer = \"%s\"\n", peer, offer->c_str());
-			int ret;
-			{
+			LOG("P2PConnect SDP got %u's offer = \"%s\"\n", peer, offer.c_str());
+			if (ret) {
 				HUMBLENET_UNGUARD();
-				ret = internal_set_offer( connection->socket, offer->c_str() );
+				ret = internal_set_offer( connection->socket, offer.c_str() );
 			}
 			if( ! ret )
 			{
@@ -345,13 +516,13 @@ static ha_bool p2pSignalProcess(const humblenet::HumblePeer::Message *msg, void
 			// TODO: deal with _CLOSED
 			assert(conn->status == HUMBLENET_CONNECTION_CONNECTING);
 
-			auto offer = p2p->offer();
+			std::string offer;
+			int ret = offerText(p2p->offer(), p2p->description(), offer);
 
-			LOG("P2PResponse SDP got %u's response offer = \"%s\"\n", peer, offer->c_str());
-			int ret;
-			{
+			LOG("P2PResponse SDP got %u's response offer = \"%s\"\n", peer, offer.c_str());
+			if (ret) {
 				HUMBLENET_UNGUARD();
-				ret = internal_set_answer( conn->socket, offer->c_str() );
+				ret = internal_set_answer( conn->socket, offer.c_str() );
 			}
 			if( !ret ) {
 				humblenet_connection_set_closed( conn );
@@ -370,6 +541,16 @@ static ha_bool p2pSignalProcess(const humblenet::HumblePeer::Message *msg, void
 			}
 			LOG("My peer id is %u\n", peer);
 			humbleNetState.myPeerId = peer;
+			humbleNetState.reconnectDelay = 0;
+
+			// used when the connection drops, a token only works once so this replaces the last one
+			auto reconnectToken = hello->reconnectToken();
+			humbleNetState.reconnectToken = reconnectToken ? reconnectToken->str() : "";
+			humbleNetState.p2pConn->compactSDP = (hello->flags() & HELLO_FLAG_COMPACT_SDP) != 0;
+			humbleNetState.p2pConn->aliasCache = (hello->flags() & HELLO_FLAG_ALIAS_CACHE) != 0;
+			humbleNetState.p2pConn->aliasAck = (hello->flags() & HELLO_FLAG_ALIAS_ACK) != 0;
+			humbleNetState.p2pConn->relayFrames = (hello->flags() & HELLO_FLAG_RELAY_FRAMES) != 0;
+			internal_alias_signaling_ready();
 
 			humbleNetState.iceServers.clear();
 
@@ -397,7 +578,20 @@ static ha_bool p2pSignalProcess(const humblenet::HumblePeer::Message *msg, void
 				}
 			}
 			internal_set_stun_servers(humbleNetState.context, stunServers.data(), stunServers.size());
-			//            internal_set_turn_server( server.c_str(), username.c_str(), password.c_str() );
+
+			// the server hands out one TURN server at most
+			const ICEServer* turn = NULL;
+			for (auto& it : humbleNetState.iceServers) {
+				if (it.type == HumblePeer::ICEServerType::TURNServer) {
+					turn = &it;
+					break;
+				}
+			}
+			if (turn) {
+				internal_set_turn_server(humbleNetState.context, turn->server.c_str(), turn->username.c_str(), turn->password.c_str());
+			} else {
+				internal_set_turn_server(humbleNetState.context, NULL, NULL, NULL);
+			}
 		}
 			break;
 
@@ -419,13 +613,17 @@ static ha_bool p2pSignalProcess(const humblenet::HumblePeer::Message *msg, void
 			}
 
 			if( it->second->socket && it->second->status == HUMBLENET_CONNECTION_CONNECTING ) {
-				auto offer = iceCandidate->offer();
-				LOG("Got ice candidate from peer: %d, %s\n", it->second->otherPeer, offer->c_str() );
+				std::string offer;
+				if (!candidateText(iceCandidate->offer(), iceCandidate->candidate(), offer)) {
+					LOG("Invalid ice candidate from peer: %d\n", it->second->otherPeer);
+					return true;
+				}
+				LOG("Got ice candidate from peer: %d, %s\n", it->second->otherPeer, offer.c_str() );
 
 				{
 					HUMBLENET_UNGUARD();
 
-					internal_add_ice_candidate( it->second->socket, offer->c_str() );
+					internal_add_ice_candidate( it->second->socket, offer.c_str() );
 				}
 			}
 		}
@@ -481,17 +679,8 @@ static ha_bool p2pSignalProcess(const humblenet::HumblePeer::Message *msg, void
 			
 			LOG("Got %d bytes relayed from peer %u\n", data->Length(), peer );
 
-			// Sequentially look for the other peer
-			auto it = humbleNetState.connections.begin();
-			for( ; it != humbleNetState.connections.end(); ++it ) {
-				if( it->second->otherPeer == peer )
-					break;
-			}
-			if( it == humbleNetState.connections.end() ) {
-				LOG("Peer %u does not exist\n", peer);
-			} else {
-				Connection* conn = it->second;
-				
+			Connection* conn = relayConnection(peer);
+			if( conn ) {
 				conn->recvBuffer.insert(conn->recvBuffer.end()
 										, reinterpret_cast<const char *>(data->Data())
 										, reinterpret_cast<const char *>(data->Data()) + data->Length());
@@ -501,11 +690,62 @@ static ha_bool p2pSignalProcess(const humblenet::HumblePeer::Message *msg, void
 			}
 		}
 			break;
+
+		case HumblePeer::MessageType::P2PBackpressure:
+		{
+			auto backpressure = reinterpret_cast<const HumblePeer::P2PBackpressure*>(msg->message());
+			auto peer = backpressure->peerId();
+
+			LOG("Relay to peer %u is %s\n", peer, backpressure->congested() ? "congested" : "flowing again");
+
+			for (auto& it : humbleNetState.connections) {
+				if (it.second->otherPeer == peer) {
+					it.second->relayCongested = backpressure->congested();
+				}
+			}
+		}
+			break;
+
 		case HumblePeer::MessageType::AliasResolved:
 		{
 			auto resolved = reinterpret_cast<const HumblePeer::AliasResolved*>(msg->message());
 			
-			internal_alias_resolved_to( resolved->alias()->c_str(), resolved->peerId() );
+			internal_alias_lookup_answered( resolved->alias()->c_str(), resolved->peerId() );
+
+			auto aliases = resolved->aliases();
+			auto peers = resolved->peerIds();
+			if (aliases && peers) {
+				flatbuffers::uoffset_t count = std::min(aliases->size(), peers->size());
+				for (flatbuffers::uoffset_t i = 0; i < count; ++i) {
+					internal_alias_lookup_answered( aliases->Get(i)->c_str(), peers->Get(i) );
+				}
+			}
+		}
+			break;
+
+		case HumblePeer::MessageType::AliasRegistered:
+		{
+			auto registered = reinterpret_cast<const HumblePeer::AliasRegistered*>(msg->message());
+
+			internal_alias_register_answered( registered->alias()->str(), humbleNetState.myPeerId );
+		}
+			break;
+
+		case HumblePeer::MessageType::AliasRejected:
+		{
+			auto rejected = reinterpret_cast<const HumblePeer::AliasRejected*>(msg->message());
+
+			internal_alias_register_answered( rejected->alias()->str(), rejected->peerId() );
+		}
+			break;
+
+		case HumblePeer::MessageType::AliasInvalidated:
+		{
+			auto invalidated = reinterpret_cast<const HumblePeer::AliasInvalidated*>(msg->message());
+
+			for (const auto& alias : *invalidated->aliases()) {
+				internal_alias_invalidate( alias->str() );
+			}
 		}
 			break;
 			
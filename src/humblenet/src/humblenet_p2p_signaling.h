@@ -10,12 +10,30 @@ namespace humblenet {
         internal_socket_t *wsi;
         std::vector<uint8_t> recvBuf;
         std::vector<char> sendBuf;
+        bool batching;
+        bool compactSDP; // the server sends and accepts compact offers/candidates
+        bool aliasCache; // the server batches alias lookups and tells us when they change
+        bool aliasAck; // the server answers alias registrations
+        bool relayFrames; // the server takes and sends relay frames instead of P2PRelayData
+        bool relayCoalesce; // relay packets for the same peer go into the same frame while it waits
+        size_t relayFrame; // offset in sendBuf of the last frame queued, if nothing came after it
+        PeerId relayPeer; // who that frame is for
 
         P2PSignalConnection()
         : wsi(NULL)
+        , batching(true)
+        , compactSDP(false)
+        , aliasCache(false)
+        , aliasAck(false)
+        , relayFrames(false)
+        , relayCoalesce(true)
+        , relayFrame(NO_RELAY_FRAME)
+        , relayPeer(0)
         {
         }
 
+        static const size_t NO_RELAY_FRAME = size_t(-1);
+
         void disconnect() {
             if( wsi )
                 internal_close_socket(wsi);
@@ -24,8 +42,13 @@ namespace humblenet {
     };
     
     void register_protocol( internal_context_t* contet );
+
+    // relays data to peer through the server, as relay frames when it takes them
+    ha_bool sendRelayPacket( P2PSignalConnection* conn, PeerId peer, const void* data, size_t length );
 }
 
 ha_bool humblenet_signaling_connect();
+// retry humblenet_signaling_connect with backoff, unless the "signaling_reconnect" hint is "0"
+void humblenet_signaling_schedule_reconnect();
 
 #endif // HUMBLENET_SIGNALING
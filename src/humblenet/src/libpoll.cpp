@@ -2,13 +2,22 @@
 
 #include "libpoll.h"
 
+#include <atomic>
 #include <cassert>
+#include <climits>
 #include <errno.h>
 
 #ifndef WIN32
 #include <pthread.h>
 #endif
 
+#ifdef __linux__
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
 extern "C" {
 #include <ILibAsyncSocket.h>
 #include <ILibParsers.h>
@@ -33,8 +42,9 @@ void mutex_init(mutex_t* m) {
 void mutex_destroy(mutex_t* m) {
 	DeleteCriticalSection( m );
 }
-void mutex_wait(mutex_t* m) {
+int mutex_wait(mutex_t* m) {
 	EnterCriticalSection( m );
+	return 0;
 }
 
 int mutex_trywait(mutex_t* m) {
@@ -55,150 +65,267 @@ void mutex_post(mutex_t* m) {
 	LeaveCriticalSection( m );
 }
 
-#elif _POSIX_TIMEOUTS > 0
+#else
 
 #include <pthread.h>
+#include <time.h>
 
-#define mutex_t pthread_mutex_t
-void mutex_init(mutex_t* m) {
-	pthread_mutexattr_t attr;
-
-	pthread_mutexattr_init(&attr);
-	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE );
-
-	pthread_mutex_init(m, &attr);
-}
-
-int mutex_timedlock(mutex_t* m, long ms ) {
-	struct timespec ts;
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
-	ts.tv_sec = ms / 1000;
-	ts.tv_nsec = 1000 * (ms % 1000);
+// number of times to spin on a held lock before parking the thread.
+#define MUTEX_SPIN_COUNT 100
 
-	return pthread_mutex_timedlock( m, &ts );
+static inline void cpu_relax() {
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
 }
 
-#define mutex_destroy(x) pthread_mutex_destroy(x)
-#define mutex_wait(x) pthread_mutex_lock(x)
-#define mutex_trywait(x) pthread_mutex_trylock(x)
-#define mutex_post(x) pthread_mutex_unlock(x)
-
-#else
-
-#include <pthread.h>
-
+// Recursive lock built around a single lock word.
+//
+// state is 0 when free, 1 when held and 2 when held with (possible) waiters.
+// Acquisition first spins briefly (the chain thread normally only holds the lock
+// for the duration of a Pre/PostSelect pass) then parks on a futex (Linux) or
+// a condition variable (everyone else) until the owner releases it.
 struct mutex_t {
 	mutex_t()
-	:thread(0)
+	:state(0)
+	,owner(pthread_t())
 	,depth(0)
 	{
-		pthread_mutexattr_t attr;
-
-		pthread_mutexattr_init(&attr);
-		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE );
+#if !defined(__linux__)
+		pthread_mutex_init(&park_lock, NULL);
+		pthread_cond_init(&park_cond, NULL);
+#endif
+	}
 
-		pthread_mutex_init(&m, &attr);
+	~mutex_t() {
+#if !defined(__linux__)
+		pthread_cond_destroy(&park_cond);
+		pthread_mutex_destroy(&park_lock);
+#endif
 	}
 
 	int wait() {
-		return was_locked( pthread_mutex_lock(&m) );
+		return timedwait(-1);
 	}
 
 	int trywait() {
-		return was_locked( pthread_mutex_trylock(&m) );
+		return timedwait(0);
 	}
 
+	// ms < 0 waits forever, ms == 0 never blocks.
 	int timedwait(long ms) {
+		if( owned() ) {
+			++depth;
+			return 0;
+		}
+
+		int c = 0;
+		if( state.compare_exchange_strong(c, 1, std::memory_order_acquire) ) {
+			acquired();
+			return 0;
+		}
+
 		if( ms == 0 )
-			return trywait();
+			return EBUSY;
+
+		for( int i = 0; i < MUTEX_SPIN_COUNT; ++i ) {
+			cpu_relax();
+			c = 0;
+			if( state.load(std::memory_order_relaxed) == 0
+			   && state.compare_exchange_weak(c, 1, std::memory_order_acquire) ) {
+				acquired();
+				return 0;
+			}
+		}
 
-		int ret = 0;
-		do
-		{
-			ret = pthread_mutex_trylock(&m);
-			if( !ret )
-				break;
-			usleep(1000); // 1ms
-		}while( --ms > 0 );
+		struct timespec deadline;
+		if( ms > 0 ) {
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			deadline.tv_sec += ms / 1000;
+			deadline.tv_nsec += (ms % 1000) * 1000000;
+			if( deadline.tv_nsec >= 1000000000 ) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+		}
 
-		return was_locked( ret );
+		// mark the lock contended, whoever releases it will wake us.
+		c = state.exchange(2, std::memory_order_acquire);
+		while( c != 0 ) {
+			if( ms > 0 ) {
+				struct timespec remaining;
+				if( ! time_left(deadline, remaining) )
+					return ETIMEDOUT;
+				park(&remaining);
+			} else {
+				park(NULL);
+			}
+			c = state.exchange(2, std::memory_order_acquire);
+		}
+
+		acquired();
+		return 0;
 	}
 
 	void post() {
-		assert( thread == pthread_self() );
+		assert( owned() );
 		assert( depth > 0 );
 
-		if( ! depth-- ) {
-			thread = 0;
-		}
+		if( --depth > 0 )
+			return;
 
-		int ret = pthread_mutex_unlock(&m);
+		owner.store(pthread_t(), std::memory_order_relaxed);
 
-		assert( ret == 0 );
+		if( state.exchange(0, std::memory_order_release) == 2 )
+			unpark();
 	}
 
-	~mutex_t() {
-		pthread_mutex_destroy(&m);
+private:
+	bool owned() const {
+		return pthread_equal( owner.load(std::memory_order_relaxed), pthread_self() );
 	}
-protected:
-	int was_locked( int ret ) {
-		if( ret == 0 ) {
-			depth ++;
-			thread = pthread_self();
-		} else {
-			char self_name[64] = {0};
-			char other_name[64] = {0};
 
-			get_thread_name( pthread_self(), self_name, sizeof(self_name) );
-			get_thread_name( thread, other_name, sizeof(other_name) );
+	void acquired() {
+		owner.store(pthread_self(), std::memory_order_relaxed);
+		depth = 1;
+	}
 
-			LOG("Lock failed on thread %s, error %s(%d), currently owner by %s", self_name, strerror(ret), ret, other_name );
+	static bool time_left(const struct timespec& deadline, struct timespec& remaining) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+		remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+		if( remaining.tv_nsec < 0 ) {
+			remaining.tv_sec--;
+			remaining.tv_nsec += 1000000000;
 		}
-		return ret;
+		return remaining.tv_sec >= 0;
 	}
 
-	static void get_thread_name( pthread_t t, char* buf, size_t size ) {
-		if( t == 0 ) {
-			strncpy(buf, "<none>", size);
-		} else {
-			pthread_getname_np( t, buf, size );
-			if( ! buf[0] )
-				strncpy(buf, "Thread",size);
-
-			int len = strlen(buf);
-			// add the id..
+#if defined(__linux__)
+	void park(const struct timespec* timeout) {
+		syscall(SYS_futex, reinterpret_cast<int*>(&state), FUTEX_WAIT_PRIVATE, 2, timeout, NULL, 0);
+	}
 
-			uint64_t id;
-			pthread_threadid_np(t, &id);
-			sprintf(buf+len, "(%lld)", id);
+	void unpark() {
+		syscall(SYS_futex, reinterpret_cast<int*>(&state), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+#else
+	void park(const struct timespec* timeout) {
+		pthread_mutex_lock(&park_lock);
+		// recheck under park_lock, unpark() can only signal once we are waiting.
+		if( state.load(std::memory_order_relaxed) == 2 ) {
+			if( ! timeout ) {
+				pthread_cond_wait(&park_cond, &park_lock);
+			} else {
+#if defined(__APPLE__)
+				pthread_cond_timedwait_relative_np(&park_cond, &park_lock, timeout);
+#else
+				struct timespec abstime;
+				clock_gettime(CLOCK_REALTIME, &abstime);
+				abstime.tv_sec += timeout->tv_sec;
+				abstime.tv_nsec += timeout->tv_nsec;
+				if( abstime.tv_nsec >= 1000000000 ) {
+					abstime.tv_sec++;
+					abstime.tv_nsec -= 1000000000;
+				}
+				pthread_cond_timedwait(&park_cond, &park_lock, &abstime);
+#endif
+			}
 		}
+		pthread_mutex_unlock(&park_lock);
 	}
-private:
-	pthread_mutex_t m;
-	pthread_t thread;
-	volatile int depth;
+
+	void unpark() {
+		pthread_mutex_lock(&park_lock);
+		pthread_cond_signal(&park_cond);
+		pthread_mutex_unlock(&park_lock);
+	}
+
+	pthread_mutex_t park_lock;
+	pthread_cond_t park_cond;
+#endif
+
+	std::atomic<int> state;
+	std::atomic<pthread_t> owner;
+	// only touched by the owning thread
+	int depth;
 };
 
-#define mutex_init(x)           (0)
+#define mutex_init(x)           ((void)0)
 #define mutex_wait(x)           (x)->wait()
 #define mutex_trywait(x)        (x)->trywait()
 #define mutex_timedlock(x,ms)   (x)->timedwait(ms)
 #define mutex_post(x)           (x)->post()
-#define mutex_destroy(x)        (0)
+#define mutex_destroy(x)        ((void)0)
 
 #endif
 
+static uint64_t lock_clock_ns() {
+#if defined(WIN32)
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64_t)(count.QuadPart * (1000000000.0 / freq.QuadPart));
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
 static mutex_t PollLock;
 
-#define LOCK_INIT()     mutex_init(&PollLock)
-#define LOCK_WAIT()     mutex_wait(&PollLock)
-#define LOCK_TRY_WAIT() (mutex_trywait(&PollLock) == 0)
-#define LOCK_TIMED_WAIT( ms ) (mutex_timedlock(&PollLock, ms) == 0)
-#define LOCK_RELEASE()  mutex_post(&PollLock)
-#define LOCK_DESTROY()  mutex_destroy(&PollLock)
+// Contention counters, only written by the thread holding PollLock.
+static std::atomic<uint64_t> PollLockAcquisitions(0);
+static std::atomic<uint64_t> PollLockContended(0);
+static std::atomic<uint64_t> PollLockWaitNs(0);
 
+static inline void lock_count(std::atomic<uint64_t>& counter, uint64_t value) {
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
 
-#define FULL_ASYNC
+// ms < 0 waits forever, ms == 0 only tries once.
+static int lock_acquire(long ms) {
+	int ret = mutex_trywait(&PollLock);
+	if( ret == 0 ) {
+		lock_count(PollLockAcquisitions, 1);
+		return 0;
+	} else if( ms == 0 ) {
+		return ret;
+	}
+
+	uint64_t start = lock_clock_ns();
+
+	ret = (ms < 0) ? mutex_wait(&PollLock) : mutex_timedlock(&PollLock, ms);
+	if( ret == 0 ) {
+		lock_count(PollLockAcquisitions, 1);
+		lock_count(PollLockContended, 1);
+		lock_count(PollLockWaitNs, lock_clock_ns() - start);
+	}
+	return ret;
+}
+
+static poll_mode_t g_mode = POLL_MODE_THREADED;
+
+// inline mode is single threaded by contract, so the lock is skipped entirely.
+#define LOCK_ELIDED()   (g_mode == POLL_MODE_INLINE)
+
+#define LOCK_INIT()     mutex_init(&PollLock)
+#define LOCK_WAIT()     (LOCK_ELIDED() ? 0 : lock_acquire(-1))
+#define LOCK_TRY_WAIT() (LOCK_ELIDED() || lock_acquire(0) == 0)
+#define LOCK_TIMED_WAIT( ms ) (LOCK_ELIDED() || lock_acquire(ms) == 0)
+#define LOCK_RELEASE()  do { if( ! LOCK_ELIDED() ) mutex_post(&PollLock); } while(0)
+#define LOCK_DESTROY()  mutex_destroy(&PollLock)
 
 
 //
@@ -260,35 +387,39 @@ typedef struct ILibBaseChain
 }ILibBaseChain;
 
 
-// This sets up an interuptable select call.
-int ILibInterruptibleSelect(void* Chain, int fds, fd_set& readset, fd_set& writeset,
-			   fd_set& errorset, struct timeval& tv ) {
-	
-#if !defined(WIN32) && !defined(_WIN32_WCE)
-	static int TerminatePipe[2] = {0,0};
-	int flags;
-#endif
-
-	
+// Create the pipe used by ILibForceUnBlockChain to interrupt the select, returns its read end.
+static int ILibInterruptibleSelect_Init(void* Chain) {
 #if !defined(WIN32) && !defined(_WIN32_WCE)
-	// Since this routine is not infite anymore, only initialize once
-	//    if( ((struct ILibBaseChain*)Chain)->TerminateReadPipe == NULL ) {
-	if( TerminatePipe[0] == 0 ) {
+	if( ((struct ILibBaseChain*)Chain)->TerminateReadPipe == NULL ) {
+		int TerminatePipe[2];
+		int flags;
 		//
 		// For posix, we need to use a pipe to force unblock the select loop
 		//
-		if (pipe(TerminatePipe) == -1) {} // TODO: Pipe error
-		flags = fcntl(TerminatePipe[0],F_GETFL,0);
+		if (pipe(TerminatePipe) == -1) { return -1; }
 		//
 		// We need to set the pipe to nonblock, so we can blindly empty the pipe
+		// and so that nobody blocks interrupting a chain that is not being pumped.
 		//
+		flags = fcntl(TerminatePipe[0],F_GETFL,0);
 		fcntl(TerminatePipe[0],F_SETFL,O_NONBLOCK|flags);
+		flags = fcntl(TerminatePipe[1],F_GETFL,0);
+		fcntl(TerminatePipe[1],F_SETFL,O_NONBLOCK|flags);
 		((struct ILibBaseChain*)Chain)->TerminateReadPipe = fdopen(TerminatePipe[0],"r");
 		((struct ILibBaseChain*)Chain)->TerminateWritePipe = fdopen(TerminatePipe[1],"w");
-		//    } else {
-		//        TerminatePipe[0] = fileno( ((struct ILibBaseChain*)Chain)->TerminateReadPipe );
-		//        TerminatePipe[1] = fileno( ((struct ILibBaseChain*)Chain)->TerminateWritePipe );
 	}
+	return fileno( ((struct ILibBaseChain*)Chain)->TerminateReadPipe );
+#else
+	return -1;
+#endif
+}
+
+// This sets up an interuptable select call.
+int ILibInterruptibleSelect(void* Chain, int fds, fd_set& readset, fd_set& writeset,
+			   fd_set& errorset, struct timeval& tv ) {
+	
+#if !defined(WIN32) && !defined(_WIN32_WCE)
+	int TerminatePipe = ILibInterruptibleSelect_Init(Chain);
 #endif
 	
 #if defined(WIN32) || defined(_WIN32_WCE)
@@ -310,7 +441,7 @@ int ILibInterruptibleSelect(void* Chain, int fds, fd_set& readset, fd_set& write
 	//
 	// Put the Read end of the Pipe in the FDSET, for ILibForceUnBlockChain
 	//
-	FD_SET(TerminatePipe[0], &readset);
+	FD_SET(TerminatePipe, &readset);
 #endif
 
 	int slct = select(FD_SETSIZE, &readset, &writeset, &errorset, &tv);
@@ -325,7 +456,7 @@ int ILibInterruptibleSelect(void* Chain, int fds, fd_set& readset, fd_set& write
 		((struct ILibBaseChain*)Chain)->Terminate = socket(AF_INET, SOCK_DGRAM, 0);
 	}
 #else
-	if (FD_ISSET(TerminatePipe[0], &readset))
+	if (slct > 0 && FD_ISSET(TerminatePipe, &readset))
 	{
 		//
 		// Empty the pipe
@@ -335,7 +466,7 @@ int ILibInterruptibleSelect(void* Chain, int fds, fd_set& readset, fd_set& write
 		{
 			i++;
 		}
-		LOG("select interupted (%d)\n", i);
+		clearerr(((struct ILibBaseChain*)Chain)->TerminateReadPipe);
 	}
 #endif
 
@@ -343,11 +474,75 @@ int ILibInterruptibleSelect(void* Chain, int fds, fd_set& readset, fd_set& write
 	return slct;
 }
 
+// Iterate through all the PreSelect function pointers in the chain
+static void chain_pre_select(ILibBaseChain* Chain, fd_set& readset, fd_set& writeset,
+							 fd_set& errorset, int& blocktime) {
+	void* node;
+	ILibChain *module;
+
+	node = ILibLinkedList_GetNode_Head(Chain->Links);
+	while(node!=NULL && (module=(ILibChain*)ILibLinkedList_GetDataFromNode(node))!=NULL)
+	{
+		if(module->PreSelect != NULL)
+		{
+			module->PreSelect((void*)module, &readset, &writeset, &errorset, &blocktime);
+		}
+		node = ILibLinkedList_GetNextNode(node);
+	}
+}
+
+// Iterate through all of the PostSelect in the chain
+static void chain_post_select(ILibBaseChain* Chain, int slct, fd_set& readset, fd_set& writeset,
+							  fd_set& errorset) {
+	void* node;
+	ILibChain *module;
+
+	node = ILibLinkedList_GetNode_Head(Chain->Links);
+	while(node!=NULL && (module=(ILibChain*)ILibLinkedList_GetDataFromNode(node))!=NULL)
+	{
+		if (module->PostSelect != NULL)
+		{
+			module->PostSelect((void*)module, slct, &readset, &writeset, &errorset);
+		}
+		node = ILibLinkedList_GetNextNode(node);
+	}
+}
+
+// Destroy the modules that were removed from the chain since the last iteration
+static void chain_purge_pending(ILibBaseChain* Chain) {
+	void* node;
+	ILibChain *module;
+
+	if( ! LOCK_ELIDED() )
+		sem_wait(&ILibChainLock);
+
+	while(ILibLinkedList_GetCount(Chain->LinksPendingDelete) > 0)
+	{
+		node = ILibLinkedList_GetNode_Head(Chain->LinksPendingDelete);
+		module = (ILibChain*)ILibLinkedList_GetDataFromNode(node);
+		ILibLinkedList_Remove_ByData(Chain->Links, module);
+		ILibLinkedList_Remove(node);
+		if(module->Destroy != NULL) {module->Destroy((void*)module);}
+		free(module);
+	}
+
+	if( ! LOCK_ELIDED() )
+		sem_post(&ILibChainLock);
+}
+
+static void chain_set_thread(ILibBaseChain* Chain) {
+#if defined(WIN32)
+	Chain->ChainThreadID = GetCurrentThreadId();
+#else
+	Chain->ChainThreadID = pthread_self();
+#endif
+	
+	if (gILibChain == NULL) {gILibChain = Chain;} // Set the global instance if it's not already set
+}
+
 int ILibIterateChain(void *_Chain, fd_set& readset, fd_set& writeset,
 					 fd_set& errorset, struct timeval& tv ) {
 	ILibBaseChain* Chain = (ILibBaseChain*)_Chain;
-	void* node;
-	ILibChain *module;
 	
 	// Prevent execution if already in the loop.
 	if( ((struct ILibBaseChain*)Chain)->RunningFlag ) {
@@ -361,67 +556,25 @@ int ILibIterateChain(void *_Chain, fd_set& readset, fd_set& writeset,
 	int slct;
 	int v;
 	
-#if defined(WIN32)
-	((ILibBaseChain*)Chain)->ChainThreadID = GetCurrentThreadId();
-#else
-	((ILibBaseChain*)Chain)->ChainThreadID = pthread_self();
-#endif
-	
-	if (gILibChain == NULL) {gILibChain = Chain;} // Set the global instance if it's not already set
+	chain_set_thread(Chain);
 	
 	((struct ILibBaseChain*)Chain)->RunningFlag = 1;
 	
 	// Only run through once
-	//while (((struct ILibBaseChain*)Chain)->TerminateFlag == 0)
 	{
-		slct = 0;
-		//
-		// Iterate through all the PreSelect function pointers in the chain
-		//
-		node = ILibLinkedList_GetNode_Head(((ILibBaseChain*)Chain)->Links);
 		v = (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
-		while(node!=NULL && (module=(ILibChain*)ILibLinkedList_GetDataFromNode(node))!=NULL)
-		{
-			if(module->PreSelect != NULL)
-			{
-#ifdef MEMORY_CHECK
-#ifdef WIN32
-				//_CrtCheckMemory();
-#endif
-#endif
-				module->PreSelect((void*)module, &readset, &writeset, &errorset, &v);
-#ifdef MEMORY_CHECK
-#ifdef WIN32
-				//_CrtCheckMemory();
-#endif
-#endif
-			}
-			node = ILibLinkedList_GetNextNode(node);
-		}
+		chain_pre_select(Chain, readset, writeset, errorset, v);
 		
 		LOCK_RELEASE();
 		
 		tv.tv_sec =  v / 1000;
 		tv.tv_usec = 1000 * (v % 1000);
 		
-		sem_wait(&ILibChainLock);
-		
-		while(ILibLinkedList_GetCount(((ILibBaseChain*)Chain)->LinksPendingDelete) > 0)
-		{
-			node = ILibLinkedList_GetNode_Head(((ILibBaseChain*)Chain)->LinksPendingDelete);
-			module = (ILibChain*)ILibLinkedList_GetDataFromNode(node);
-			ILibLinkedList_Remove_ByData(((ILibBaseChain*)Chain)->Links, module);
-			ILibLinkedList_Remove(node);
-			if(module->Destroy != NULL) {module->Destroy((void*)module);}
-			free(module);
-		}
-		
-		sem_post(&ILibChainLock);
+		chain_purge_pending(Chain);
 		
 		//
 		// The actual Select Statement
 		//
-		//slct = select(FD_SETSIZE, &readset, &writeset, &errorset, &tv);
 		slct = ILibInterruptibleSelect(Chain, FD_SETSIZE, readset, writeset, errorset, tv);
 		if (slct == -1)
 		{
@@ -435,28 +588,7 @@ int ILibIterateChain(void *_Chain, fd_set& readset, fd_set& writeset,
 		
 		LOCK_WAIT();
 		
-		//
-		// Iterate through all of the PostSelect in the chain
-		//
-		node = ILibLinkedList_GetNode_Head(((ILibBaseChain*)Chain)->Links);
-		while(node!=NULL && (module=(ILibChain*)ILibLinkedList_GetDataFromNode(node))!=NULL)
-		{
-			if (module->PostSelect != NULL)
-			{
-#ifdef MEMORY_CHECK
-#ifdef WIN32
-				//_CrtCheckMemory();
-#endif
-#endif
-				module->PostSelect((void*)module, slct, &readset, &writeset, &errorset);
-#ifdef MEMORY_CHECK
-#ifdef WIN32
-				//_CrtCheckMemory();
-#endif
-#endif
-			}
-			node = ILibLinkedList_GetNextNode(node);
-		}
+		chain_post_select(Chain, slct, readset, writeset, errorset);
 		
 		((struct ILibBaseChain*)Chain)->RunningFlag = 0;
 		
@@ -485,7 +617,7 @@ void ILibIterateChain(void *_Chain, int timeout_ms ) {
 	FD_ZERO(&writeset);
 	
 	tv.tv_sec = timeout_ms / 1000;
-	tv.tv_usec = timeout_ms % 1000;
+	tv.tv_usec = 1000 * (timeout_ms % 1000);
 	
 	ILibIterateChain(_Chain, readset, writeset, errorset, tv );
 }
@@ -594,28 +726,248 @@ static void poll_async() {
 	ILibStartChain(g_chain);
 }
 
+//
+// External/inline mode: the chain is pumped by the application through poll_process.
+// The select sets of the chain are prepared once per iteration and mirrored
+// into an epoll instance (together with the interrupt pipe and a timerfd
+// for the chain timers) so the application can wait on a single fd.
+//
+#define POLL_MAX_WAIT_MS (86400 * 1000) // same 24 hours ILibStartChain uses
+
+static fd_set g_readset;
+static fd_set g_writeset;
+static fd_set g_errorset;
+static int g_blocktime;
+static std::atomic<bool> g_prepared(false);
+static std::atomic<bool> g_interrupted(false);
+
+#ifdef __linux__
+static int g_epollfd = -1;
+static int g_timerfd = -1;
+static uint32_t g_epoll_events[FD_SETSIZE];
+
+static void poll_epoll_init() {
+	g_epollfd = epoll_create1(EPOLL_CLOEXEC);
+	g_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	memset(g_epoll_events, 0, sizeof(g_epoll_events));
+
+	if( g_epollfd == -1 || g_timerfd == -1 ) {
+		LOG("Failed to create the poll fd: %s\n", strerror(errno));
+		return;
+	}
+
+	int fds[2] = { ILibInterruptibleSelect_Init(g_chain), g_timerfd };
+	for( int i = 0; i < 2; ++i ) {
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = fds[i];
+		epoll_ctl(g_epollfd, EPOLL_CTL_ADD, fds[i], &ev);
+		g_epoll_events[fds[i]] = EPOLLIN;
+	}
+}
+
+static void poll_epoll_deinit() {
+	if( g_epollfd != -1 )
+		close( g_epollfd );
+	if( g_timerfd != -1 )
+		close( g_timerfd );
+	g_epollfd = -1;
+	g_timerfd = -1;
+}
+
+// bring the epoll registrations in line with the prepared select sets.
+static void poll_epoll_sync() {
+	if( g_epollfd == -1 )
+		return;
+
+	int pipefd = fileno(g_chain->TerminateReadPipe);
+
+	for( int fd = 0; fd < FD_SETSIZE; ++fd ) {
+		if( fd == pipefd || fd == g_timerfd )
+			continue;
+
+		uint32_t events = 0;
+		if( FD_ISSET(fd, &g_readset) )  events |= EPOLLIN;
+		if( FD_ISSET(fd, &g_writeset) ) events |= EPOLLOUT;
+		if( FD_ISSET(fd, &g_errorset) ) events |= EPOLLPRI;
+
+		if( events == g_epoll_events[fd] )
+			continue;
+
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.fd = fd;
+
+		// closed fds are dropped by the kernel, so a stale registration
+		// can show up as ENOENT (and a reused fd as EEXIST).
+		if( events == 0 ) {
+			epoll_ctl(g_epollfd, EPOLL_CTL_DEL, fd, &ev);
+		} else if( g_epoll_events[fd] == 0 ) {
+			if( epoll_ctl(g_epollfd, EPOLL_CTL_ADD, fd, &ev) == -1 && errno == EEXIST )
+				epoll_ctl(g_epollfd, EPOLL_CTL_MOD, fd, &ev);
+		} else {
+			if( epoll_ctl(g_epollfd, EPOLL_CTL_MOD, fd, &ev) == -1 && errno == ENOENT )
+				epoll_ctl(g_epollfd, EPOLL_CTL_ADD, fd, &ev);
+		}
+		g_epoll_events[fd] = events;
+	}
+
+	// re-arming also resets any pending expiration.
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	if( g_blocktime < POLL_MAX_WAIT_MS ) {
+		its.it_value.tv_sec = g_blocktime / 1000;
+		its.it_value.tv_nsec = (g_blocktime % 1000) * 1000000L;
+		// a zero it_value disarms the timer, so round an immediate timeout up.
+		if( g_blocktime <= 0 ) {
+			its.it_value.tv_sec = 0;
+			its.it_value.tv_nsec = 1;
+		}
+	}
+	timerfd_settime(g_timerfd, 0, &its, NULL);
+}
+#endif
+
+// run the chain PreSelect and remember the sets for the next poll_process (lock must be held)
+static void poll_prepare() {
+	FD_ZERO(&g_readset);
+	FD_ZERO(&g_writeset);
+	FD_ZERO(&g_errorset);
+	g_blocktime = POLL_MAX_WAIT_MS;
+
+	g_prepared = true;
+
+	chain_pre_select(g_chain, g_readset, g_writeset, g_errorset, g_blocktime);
+
+#ifdef __linux__
+	poll_epoll_sync();
+#endif
+}
+
+int poll_set_mode( enum poll_mode_t mode ) {
+	if( g_chain )
+		return -1;
+
+	g_mode = mode;
+	return 0;
+}
+
+enum poll_mode_t poll_get_mode() {
+	return g_mode;
+}
+
 struct poll_context_t* poll_init() {
 	if( ! g_chain ) {
 		g_chain = (ILibBaseChain*)ILibCreateChain();
 		LOCK_INIT();
-#ifdef FULL_ASYNC
-		ILibSpawnNormalThread(&poll_async, NULL);
+		if( g_mode == POLL_MODE_THREADED ) {
+			ILibSpawnNormalThread(&poll_async, NULL);
+		} else {
+			g_prepared = false;
+			g_interrupted = false;
+			ILibInterruptibleSelect_Init(g_chain);
+#ifdef __linux__
+			poll_epoll_init();
 #endif
+		}
 	}
 	return (poll_context_t*)g_chain;
 }
 
 void poll_deinit() {
 	if( g_chain ) {
-#ifdef FULL_ASYNC
-		ILibStopChain( g_chain );
-#else
-		ILibDestroyChain( g_chain );
+		if( g_mode == POLL_MODE_THREADED ) {
+			ILibStopChain( g_chain );
+		} else {
+			ILibDestroyChain( g_chain );
+#ifdef __linux__
+			poll_epoll_deinit();
 #endif
+		}
 		g_chain = NULL;
 	}
 }
 
+int poll_get_fd() {
+#ifdef __linux__
+	if( ! g_chain || g_mode == POLL_MODE_THREADED )
+		return -1;
+
+	// make sure the fd reflects the current state of the chain before anyone waits on it.
+	LOCK_WAIT();
+	if( ! g_prepared && ! g_chain->RunningFlag ) {
+		chain_set_thread(g_chain);
+		poll_prepare();
+	}
+	LOCK_RELEASE();
+
+	return g_epollfd;
+#else
+	return -1;
+#endif
+}
+
+int poll_process( int timeout_ms ) {
+	ILibBaseChain* Chain = g_chain;
+
+	if( ! Chain || g_mode == POLL_MODE_THREADED )
+		return -1;
+
+	LOCK_WAIT();
+
+	// Prevent execution if already in the loop (e.g. called from a callback).
+	if( Chain->RunningFlag ) {
+		LOCK_RELEASE();
+		return -2;
+	}
+
+	Chain->RunningFlag = 1;
+	chain_set_thread(Chain);
+
+	if( ! g_prepared )
+		poll_prepare();
+
+	fd_set readset = g_readset;
+	fd_set writeset = g_writeset;
+	fd_set errorset = g_errorset;
+
+	int v = g_blocktime;
+	if( timeout_ms >= 0 && timeout_ms < v )
+		v = timeout_ms;
+
+	LOCK_RELEASE();
+
+	chain_purge_pending(Chain);
+
+	struct timeval tv;
+	tv.tv_sec = v / 1000;
+	tv.tv_usec = 1000 * (v % 1000);
+
+	// interrupts raised from here on will show up on the pipe.
+	g_interrupted = false;
+
+	int slct = ILibInterruptibleSelect(Chain, FD_SETSIZE, readset, writeset, errorset, tv);
+	if (slct == -1)
+	{
+		FD_ZERO(&readset);
+		FD_ZERO(&writeset);
+		FD_ZERO(&errorset);
+	}
+
+	LOCK_WAIT();
+
+	chain_post_select(Chain, slct, readset, writeset, errorset);
+
+	// prepare the next iteration now, so the fd is accurate while the application waits on it.
+	poll_prepare();
+
+	Chain->RunningFlag = 0;
+
+	LOCK_RELEASE();
+
+	return slct;
+}
+
 void* poll_chain() {
 	return g_chain;
 }
@@ -635,6 +987,12 @@ void poll_unlock() {
 	LOCK_RELEASE();
 }
 
+void poll_lock_stats( struct poll_lock_stats_t* stats ) {
+	stats->acquisitions = PollLockAcquisitions.load(std::memory_order_relaxed);
+	stats->contended = PollLockContended.load(std::memory_order_relaxed);
+	stats->wait_ns = PollLockWaitNs.load(std::memory_order_relaxed);
+}
+
 void poll_add_module( poll_module_t* module ) {
 	assert( g_chain != NULL );
 	
@@ -692,16 +1050,19 @@ void poll_destroy_module( poll_module_t* module ) {
 
 int poll_select( int nfds, fd_set *readfds, fd_set *writefds,
 											  fd_set *exceptfds, struct timeval *timeout) {
-#ifdef FULL_ASYNC
-	
-#else
-	struct timeval tv;
-	
-	fd_set readset;
-	fd_set errorset;
-	fd_set writeset;
-	
-	if( g_chain ) {
+	if( g_chain && g_mode != POLL_MODE_THREADED ) {
+		// nothing to pass through, just pump the chain.
+		if( nfds == 0 ) {
+			int ret = poll_process( timeout ? (timeout->tv_sec * 1000 + timeout->tv_usec / 1000) : -1 );
+			return ret == -2 ? 0 : ret;
+		}
+
+		struct timeval tv;
+		
+		fd_set readset;
+		fd_set errorset;
+		fd_set writeset;
+		
 		FD_ZERO(&readset);
 		FD_ZERO(&writeset);
 		FD_ZERO(&errorset);
@@ -716,6 +1077,10 @@ int poll_select( int nfds, fd_set *readfds, fd_set *writefds,
 		
 		// -2 is returned when the chain is not iterated due to locking.
 		if( ret != -2 ) {
+			// the chain sets are no longer what the poll fd is waiting on.
+			LOCK_WAIT();
+			poll_prepare();
+			LOCK_RELEASE();
 			return ret;
 		} else {
 			// pass through select doesnt work in threaded mode (currently)
@@ -725,14 +1090,133 @@ int poll_select( int nfds, fd_set *readfds, fd_set *writefds,
 		}
 	}
 	
-#endif
 	return select( nfds, readfds, writefds, exceptfds, timeout );
 }
 
 void poll_interrupt() {
 	if( g_chain != NULL ) {
+		if( g_mode != POLL_MODE_THREADED ) {
+			g_prepared = false;
+			// one pending wake up is enough until the chain runs again.
+			if( g_interrupted.exchange(true) )
+				return;
+		}
 		ILibForceUnBlockChain(g_chain);
 	}
 }
 
+//
+// Event used to wake up threads blocked in poll_wait_event (e.g. humblenet_p2p_wait)
+// whenever the chain produced something for the application.
+//
+static std::atomic<uint32_t> g_event_seq(0);
+static std::atomic<int> g_event_waiters(0);
+
+#if defined(WIN32)
+static SRWLOCK g_event_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE g_event_cond = CONDITION_VARIABLE_INIT;
+#elif !defined(__linux__)
+static pthread_mutex_t g_event_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_event_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+uint32_t poll_event_seq() {
+	return g_event_seq.load();
+}
+
+void poll_signal_event() {
+	g_event_seq.fetch_add(1);
+
+	// waiters register before they check the sequence, so nobody can miss this.
+	if( g_event_waiters.load() == 0 )
+		return;
+
+#if defined(WIN32)
+	AcquireSRWLockExclusive(&g_event_lock);
+	WakeAllConditionVariable(&g_event_cond);
+	ReleaseSRWLockExclusive(&g_event_lock);
+#elif defined(__linux__)
+	syscall(SYS_futex, reinterpret_cast<int*>(&g_event_seq), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&g_event_lock);
+	pthread_cond_broadcast(&g_event_cond);
+	pthread_mutex_unlock(&g_event_lock);
+#endif
+}
+
+int poll_wait_event( uint32_t seq, int timeout_ms ) {
+	if( g_event_seq.load() != seq )
+		return 1;
+
+	if( timeout_ms == 0 )
+		return 0;
+
+	uint64_t deadline = lock_clock_ns() + (uint64_t)timeout_ms * 1000000ULL;
+	uint64_t remaining = 0;
+
+	g_event_waiters.fetch_add(1);
+
+#if defined(WIN32)
+	AcquireSRWLockExclusive(&g_event_lock);
+	while( g_event_seq.load() == seq ) {
+		DWORD wait = INFINITE;
+		if( timeout_ms > 0 ) {
+			uint64_t now = lock_clock_ns();
+			if( now >= deadline )
+				break;
+			wait = (DWORD)((deadline - now + 999999) / 1000000);
+		}
+		SleepConditionVariableSRW(&g_event_cond, &g_event_lock, wait, 0);
+	}
+	ReleaseSRWLockExclusive(&g_event_lock);
+#elif defined(__linux__)
+	while( g_event_seq.load() == seq ) {
+		struct timespec ts;
+		struct timespec* timeout = NULL;
+		if( timeout_ms > 0 ) {
+			uint64_t now = lock_clock_ns();
+			if( now >= deadline )
+				break;
+			remaining = deadline - now;
+			ts.tv_sec = remaining / 1000000000ULL;
+			ts.tv_nsec = remaining % 1000000000ULL;
+			timeout = &ts;
+		}
+		// the kernel rechecks the sequence, so a signal between the load and here is not lost.
+		syscall(SYS_futex, reinterpret_cast<int*>(&g_event_seq), FUTEX_WAIT_PRIVATE, (int)seq, timeout, NULL, 0);
+	}
+#else
+	pthread_mutex_lock(&g_event_lock);
+	while( g_event_seq.load() == seq ) {
+		if( timeout_ms < 0 ) {
+			pthread_cond_wait(&g_event_cond, &g_event_lock);
+			continue;
+		}
+
+		uint64_t now = lock_clock_ns();
+		if( now >= deadline )
+			break;
+		remaining = deadline - now;
+
+		struct timespec ts;
+#if defined(__APPLE__)
+		ts.tv_sec = remaining / 1000000000ULL;
+		ts.tv_nsec = remaining % 1000000000ULL;
+		pthread_cond_timedwait_relative_np(&g_event_cond, &g_event_lock, &ts);
+#else
+		clock_gettime(CLOCK_REALTIME, &ts);
+		remaining += ts.tv_nsec;
+		ts.tv_sec += remaining / 1000000000ULL;
+		ts.tv_nsec = remaining % 1000000000ULL;
+		pthread_cond_timedwait(&g_event_cond, &g_event_lock, &ts);
+#endif
+	}
+	pthread_mutex_unlock(&g_event_lock);
+#endif
+
+	g_event_waiters.fetch_sub(1);
+
+	return g_event_seq.load() != seq ? 1 : 0;
+}
+
 #endif
@@ -13,6 +13,8 @@
 #include <sys/select.h>
 #endif
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -29,6 +31,30 @@ struct poll_module_t {
 
 typedef void (*poll_timeout_t)(void* data );
 
+enum poll_mode_t {
+    // the polling system runs on its own thread
+    POLL_MODE_THREADED = 0,
+    // the polling system only runs from poll_process (or poll_select)
+    POLL_MODE_EXTERNAL = 1,
+    // as external, but everything runs on the pumping thread so the lock is skipped
+    POLL_MODE_INLINE = 2
+};
+
+struct poll_lock_stats_t {
+    // number of times the poll lock was acquired (including recursive acquisitions)
+    uint64_t acquisitions;
+    // number of acquisitions that had to wait for another thread
+    uint64_t contended;
+    // total time spent waiting on contended acquisitions
+    uint64_t wait_ns;
+};
+
+// select how the polling system is driven, must be called before poll_init
+int poll_set_mode( enum poll_mode_t mode );
+
+// return how the polling system is driven
+enum poll_mode_t poll_get_mode();
+
 // Initialize the polling system
 struct poll_context_t* poll_init();
 
@@ -44,6 +70,9 @@ void poll_lock();
 // unlock the polling system
 void poll_unlock();
 
+// retrieve the contention counters of the polling system lock
+void poll_lock_stats( struct poll_lock_stats_t* stats );
+
 // Wait at most timeout_ms for network IO to occur
 void poll_wait( int timeout_ms );
 
@@ -56,9 +85,26 @@ void poll_destroy_module( poll_module_t* module );
 // poll for triggered FDs (also lets the internal chain run )
 int poll_select( int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
 
+// return an fd that becomes readable when poll_process has work to do (external/inline mode, linux only)
+int poll_get_fd();
+
+// run pending IO and timers waiting at most timeout_ms (-1 waits for the next timer) (external/inline mode only)
+// returns the select result, -1 if in threaded mode and -2 if the chain is already running
+int poll_process( int timeout_ms );
+
 // interrupt any poll select/wait in process.
 void poll_interrupt();
 
+// return the current event sequence, to be passed to poll_wait_event
+uint32_t poll_event_seq();
+
+// wake up everyone waiting in poll_wait_event
+void poll_signal_event();
+
+// wait at most timeout_ms (-1 forever) for poll_signal_event to be called after seq was read.
+// returns 1 when signaled and 0 on timeout.
+int poll_wait_event( uint32_t seq, int timeout_ms );
+
 // register a timeout callback
 void poll_timeout( poll_timeout_t callback, int timeout_ms, void* user_data );
 
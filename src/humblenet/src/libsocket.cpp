@@ -330,6 +330,11 @@ void internal_set_stun_servers( internal_context_t* ctx, const char** servers, i
 	}
 }
 
+void internal_set_turn_server( internal_context_t* ctx, const char* server, const char* username, const char* password ){
+	if( ctx->webrtc )
+		libwebrtc_set_turn_server( ctx->webrtc, server, username, password );
+}
+
 void internal_set_callbacks(internal_socket_t* socket, internal_callbacks_t* callbacks ) {
 	if( ! callbacks ) {
 		socket->callbacks = g_context->callbacks;
@@ -450,6 +455,12 @@ int internal_create_channel( internal_socket_t* socket, const char* name ){
 	return 1;
 }
 
+void internal_request_writable( internal_socket_t* socket ) {
+	if( socket->wsi && !socket->closing ) {
+		libwebsocket_callback_on_writable(g_context->websocket, socket->wsi);
+	}
+}
+
 void internal_close_socket( internal_socket_t* socket ) {
 	if( socket->closing )
 		// socket clos process has already started, ignore the request.
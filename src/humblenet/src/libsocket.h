@@ -48,6 +48,8 @@ void internal_register_protocol( internal_context_t*, const char* protocol, inte
     
 internal_socket_t* internal_connect_websocket( const char* addr, const char* protocol );
 void internal_set_stun_servers( internal_context_t*, const char** servers, int count);
+// NULL server for none
+void internal_set_turn_server( internal_context_t*, const char* server, const char* username, const char* password );
 internal_socket_t* internal_create_webrtc(internal_context_t *);
 int internal_create_offer( internal_socket_t* socket );
 int internal_set_offer( internal_socket_t* socket, const char* offer );
@@ -58,6 +60,7 @@ int internal_add_ice_candidate( internal_socket_t*, const char* candidate );
 void internal_set_data( internal_socket_t*, void* user_data);
 void internal_set_callbacks(internal_socket_t* socket, internal_callbacks_t* callbacks );
 int internal_write_socket( internal_socket_t*, const void* buf, int len );
+void internal_request_writable( internal_socket_t* );
 void internal_close_socket( internal_socket_t* );
     
 #ifdef __cplusplus
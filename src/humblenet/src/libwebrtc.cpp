@@ -89,10 +89,14 @@ void WebRTCOnIceCandidate(ILibWrapper_WebRTC_Connection webRTCConnection, struct
 	libwebrtc_connection* conn = (libwebrtc_connection*)webRTCConnection;
 
 	ILibWrapper_WebRTC_Connection_GetUserData(webRTCConnection, (void**)&ctx, NULL, &user_data);
+	if( ctx == NULL )
+		return;
 	
-	// no additional candidates found.
-	if( candidate == NULL )
+	// no additional candidates found, let the user know gathering is done.
+	if( candidate == NULL ) {
+		ctx->callback(ctx, conn, NULL, LWRTC_CALLBACK_ICE_CANDIDATE, user_data, NULL, 0 );
 		return;
+	}
 	
 	char* offer = ILibWrapper_WebRTC_Connection_AddServerReflexiveCandidateToLocalSDP( webRTCConnection, candidate );
 	if( offer == NULL ) {
@@ -113,6 +117,11 @@ void WebRTCOnIceCandidate(ILibWrapper_WebRTC_Connection webRTCConnection, struct
 	buf[sizeof(buf)-1] = 0;
 	
 	ctx->callback(ctx, conn, NULL, LWRTC_CALLBACK_ICE_CANDIDATE, user_data, buf, strlen(buf) );
+
+	// Microstack stops at the one reflexive candidate and never says so, gathering is done.
+	ILibWrapper_WebRTC_Connection_GetUserData(webRTCConnection, (void**)&ctx, NULL, &user_data);
+	if( ctx != NULL )
+		ctx->callback(ctx, conn, NULL, LWRTC_CALLBACK_ICE_CANDIDATE, user_data, NULL, 0 );
 }
 
 // this is called when a channel receives data.
@@ -222,6 +231,15 @@ void libwebrtc_set_stun_servers( struct libwebrtc_context* ctx, const char** ser
 	}
 }
 
+void libwebrtc_set_turn_server( struct libwebrtc_context* ctx, const char* server, const char* username, const char* password )
+{
+	// the microstack has no TURN client, it only ever uses STUN
+	(void)ctx;
+	(void)server;
+	(void)username;
+	(void)password;
+}
+
 struct libwebrtc_connection* libwebrtc_create_connection_extended( struct libwebrtc_context* ctx, void* user_data )
 {
 	ILibWrapper_WebRTC_Connection conn = ILibWrapper_WebRTC_ConnectionFactory_CreateConnection(ctx->factory, &WebRTCConnectionStatus, &WebRTCDataChannelAccept, &WebRTCConnectionSendOk);
@@ -297,6 +315,7 @@ int libwebrtc_set_offer( struct libwebrtc_connection* conn, const char* sdp ) {
 	
 	// always send this offer, as the callback will only send additianal candidates
 	ctx->callback(ctx, conn, NULL, LWRTC_CALLBACK_LOCAL_DESCRIPTION, user_data, offer, strlen(offer));
+	free(offer);
 	
 	return 1;
 }
@@ -321,36 +340,66 @@ int libwebrtc_set_answer( struct libwebrtc_connection* conn, const char* sdp ) {
 	char* offer = ILibWrapper_WebRTC_Connection_SetOffer(connection, (char*)sdp, strlen(sdp), NULL); // no CB as this is the answer
 	if( offer == NULL )
 		return 0;
+	free(offer);
 
 	return 1;
 }
 
 extern "C" char* ILibWrapper_WebRTC_Connection_AddServerReflexiveCandidateToRemoteSDP(ILibWrapper_WebRTC_Connection connection, const char*address, int port);
 
+// Remote candidates can arrive at any point while the checks are running. Microstack only
+// knows IPv4 UDP candidates for the first component, so anything else is skipped rather than
+// ending up as a bogus entry in the remote description.
 int libwebrtc_add_ice_candidate( struct libwebrtc_connection* conn, const char* candidate ) {
 	ILibWrapper_WebRTC_Connection connection = (ILibWrapper_WebRTC_Connection)conn;
 
-	// updating the block seems to be causing some issues. disabled for now.
-//    if(true)return 1;
-	
 	void* user_data = NULL;
 	libwebrtc_context* ctx = NULL;
 	
 	ILibWrapper_WebRTC_Connection_GetUserData(connection, (void**)&ctx, NULL, &user_data);
-	assert( ctx != NULL );
+	if( ctx == NULL )
+		return 0;
+
+	// browsers send it without the a=, but take it either way
+	if( strncmp(candidate, "a=", 2) == 0 )
+		candidate += 2;
 
+	int component = 0;
+	char transport[16] = {0};
 	char address[255] = {0};
 	int port = 0;
 	
 	// candidate:0 1 UDP 2128609534 0.0.0.0 0 typ host
-	sscanf(candidate, "%*s %*d %*s %*d %s %d %*s %*s", address, &port);
-	
-	// todo, parse candidate into struct sockaddr_in6 and add to the offer...
+	if( sscanf(candidate, "%*s %d %15s %*u %254s %d", &component, transport, address, &port) != 4 ) {
+		LOG("Invalid ice candidate: %s\n", candidate);
+		return 0;
+	}
+
+	struct in_addr addr;
+	if( component != 1 || strcasecmp(transport, "udp") != 0 || ILibInet_pton(AF_INET, address, &addr) != 1
+	   || port <= 0 || port > 0xFFFF ) {
+		LOG("Skipping ice candidate: %s\n", candidate);
+		return 1;
+	}
+
 	char* offer = ILibWrapper_WebRTC_Connection_AddServerReflexiveCandidateToRemoteSDP(connection, address, port );
-	::libwebrtc_set_answer(conn, offer );
+	if( offer == NULL )
+		return 0;
+
+	// the remote description lists it twice if we already had it, in its offer or an earlier candidate
+	char entry[300];
+	snprintf(entry, sizeof(entry), " %s %d typ ", address, port);
+	const char* first = strstr(offer, entry);
+	if( first != NULL && strstr(first + 1, entry) != NULL ) {
+		free(offer);
+		return 1;
+	}
+
+	// re-applying the description keeps the ICE credentials and adds the candidate to the checks
+	int ret = ::libwebrtc_set_answer(conn, offer );
 	free(offer);
 	
-	return 1;
+	return ret;
 }
 
 int libwebrtc_write( struct libwebrtc_data_channel* dc, const void* data, int len ) {
@@ -284,6 +284,25 @@ void libwebrtc_set_stun_servers( struct libwebrtc_context* ctx, const char** ser
 	}
 }
 
+void libwebrtc_set_turn_server( struct libwebrtc_context* ctx, const char* server, const char* username, const char* password )
+{
+	EM_ASM({
+		var servers = Module.__libwebrtc.options.iceServers || [];
+		Module.__libwebrtc.options.iceServers = servers.filter(function(server) { return !server.turn; });
+	});
+
+	if( server ) {
+		EM_ASM_INT({
+			var server = {};
+			server.urls = "turn:" + UTF8ToString($0) + "?transport=udp";
+			server.username = UTF8ToString($1);
+			server.credential = UTF8ToString($2);
+			server.turn = true;
+			Module.__libwebrtc.options.iceServers.push( server );
+		}, server, username, password);
+	}
+}
+
 struct libwebrtc_connection* libwebrtc_create_connection_extended(struct libwebrtc_context* ctx, void* user_data) {
 	return (struct libwebrtc_connection*)EM_ASM_INT({
 		var connection = Module.__libwebrtc.create();
@@ -34,6 +34,9 @@
 struct libwebrtc_context {
     lwrtc_callback_function callback;
     std::vector<std::string> stunServers;
+    std::string turnServer;
+    std::string turnUsername;
+    std::string turnPassword;
 
     std::unique_ptr<rtc::Thread> network_thread;
     std::unique_ptr<rtc::Thread> worker_thread;
@@ -321,6 +324,13 @@ WEBRTC_API void libwebrtc_set_stun_servers( struct libwebrtc_context* ctx, const
     }
 }
 
+WEBRTC_API void libwebrtc_set_turn_server( struct libwebrtc_context* ctx, const char* server, const char* username, const char* password )
+{
+    ctx->turnServer = server ? server : "";
+    ctx->turnUsername = username ? username : "";
+    ctx->turnPassword = password ? password : "";
+}
+
 WEBRTC_API struct libwebrtc_connection* libwebrtc_create_connection_extended( struct libwebrtc_context* ctx, void* user_data )
 {
     webrtc::PeerConnectionInterface::RTCConfiguration config;
@@ -330,6 +340,13 @@ WEBRTC_API struct libwebrtc_connection* libwebrtc_create_connection_extended( st
         ice_server.uri = "stun:" + server;
         config.servers.push_back(ice_server);
     }
+    if( !ctx->turnServer.empty() ) {
+        webrtc::PeerConnectionInterface::IceServer ice_server;
+        ice_server.uri = "turn:" + ctx->turnServer + "?transport=udp";
+        ice_server.username = ctx->turnUsername;
+        ice_server.password = ctx->turnPassword;
+        config.servers.push_back(ice_server);
+    }
 
     webrtc::FakeConstraints constraints;
 
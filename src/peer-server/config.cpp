@@ -23,6 +23,24 @@ void tConfigOptions::parseFile(const std::string& file)
 			port = std::stoul(value);
 		} else if (key == "daemon") {
 			daemon = (value == "yes" || value == "1");
+		} else if (key == "reconnectGracePeriod") {
+			reconnectGracePeriod = std::stoi(value);
+		} else if (key == "negotiationTimeout") {
+			negotiationTimeout = std::stoi(value);
+		} else if (key == "threads") {
+			threads = std::stoi(value);
+		} else if (key == "sendQueueHighWater") {
+			sendQueueHighWater = std::stoi(value);
+		} else if (key == "sendQueueLowWater") {
+			sendQueueLowWater = std::stoi(value);
+		} else if (key == "sendQueueLimit") {
+			sendQueueLimit = std::stoi(value);
+		} else if (key == "turnPort") {
+			turnPort = std::stoi(value);
+		} else if (key == "turnCredentialLifetime") {
+			turnCredentialLifetime = std::stoi(value);
+		} else if (key == "turnAllowLoopback") {
+			turnAllowLoopback = (value == "yes" || value == "1");
 		}
 		CONFIG_STRING(iface)
 		CONFIG_STRING(sslCertFile)
@@ -31,8 +49,12 @@ void tConfigOptions::parseFile(const std::string& file)
 		CONFIG_STRING(sslCipherList)
 		CONFIG_STRING_EX(pidfile, pidFile)
 		CONFIG_STRING_EX(logfile, logFile)
+		CONFIG_STRING_EX(loglevel, logLevel)
 		CONFIG_STRING(stunServerAddress)
 		CONFIG_STRING(gameDB)
+		CONFIG_STRING(metricsPath)
+		CONFIG_STRING(turnRelayAddress)
+		CONFIG_STRING(turnServerAddress)
 	}
 }
 
@@ -12,10 +12,42 @@ struct tConfigOptions {
 	std::string sslCipherList;
 	std::string pidFile;
 	std::string logFile;
+	std::string logLevel;	// error, warning, info or debug
 	std::string stunServerAddress;
 	std::string gameDB;
+	int reconnectGracePeriod;	// seconds a disconnected peer can resume its session, 0 disables
+	int negotiationTimeout;	// seconds a P2P offer can go unanswered, 0 for no limit
+	int threads;	// service threads, games are sharded between them. 0 for one per core
+	std::string metricsPath;	// http path on the port serving Prometheus metrics, e.g. /metrics. Empty for none
+	// bytes waiting to be sent on a websocket: over the high water mark relay data for it is
+	// dropped until it's under the low one, over the limit it's closed. 0 disables either
+	int sendQueueHighWater;
+	int sendQueueLowWater;
+	int sendQueueLimit;
+	// the TURN relay, on this UDP port of turnRelayAddress (an IPv4 address the relayed
+	// ports are on too). Peers are told turnServerAddress, by default the two of them. 0 disables
+	int turnPort;
+	std::string turnRelayAddress;
+	std::string turnServerAddress;
+	int turnCredentialLifetime;	// seconds
+	// peers may be on loopback and other ports of turnRelayAddress, only for testing
+	bool turnAllowLoopback;
 
-	tConfigOptions() : port(8080), daemon(false) {}
+	tConfigOptions()
+	: port(8080)
+	, daemon(false)
+	, logLevel("info")
+	, reconnectGracePeriod(30)
+	, negotiationTimeout(60)
+	, threads(1)
+	, sendQueueHighWater(1024 * 1024)
+	, sendQueueLowWater(256 * 1024)
+	, sendQueueLimit(8 * 1024 * 1024)
+	, turnPort(0)
+	, turnCredentialLifetime(600)
+	, turnAllowLoopback(false)
+	{
+	}
 
 	void parseFile(const std::string& file);
 };
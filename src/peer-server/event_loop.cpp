@@ -0,0 +1,396 @@
+#include "event_loop.h"
+
+#include "logging.h"
+
+#include <libwebsockets.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#if defined(__linux__)
+#	include <poll.h>
+#	include <pthread.h>
+#	include <sys/epoll.h>
+#	include <sys/eventfd.h>
+#	include <sys/signalfd.h>
+#	include <sys/timerfd.h>
+#	include <unistd.h>
+#endif
+
+namespace humblenet {
+
+#if defined(__linux__)
+
+	namespace {
+
+		// what an epoll event is for, in the upper half of its data. The lower half is
+		// the socket, or the timer's or watch's index
+		enum Kind : uint32_t {
+			KIND_SOCKET,
+			KIND_WAKE,
+			KIND_TIMER,
+			KIND_SIGNAL,
+			KIND_WATCH
+		};
+
+		const int MAX_EVENTS = 256;
+
+		uint64_t tag(Kind kind, uint32_t index)
+		{
+			return (uint64_t(kind) << 32) | index;
+		}
+
+		uint32_t epollEvents(int events)
+		{
+			return ((events & POLLIN) ? uint32_t(EPOLLIN) : 0) | ((events & POLLOUT) ? uint32_t(EPOLLOUT) : 0);
+		}
+
+		short pollEvents(uint32_t events)
+		{
+			return ((events & EPOLLIN) ? POLLIN : 0)
+				| ((events & EPOLLOUT) ? POLLOUT : 0)
+				| ((events & EPOLLHUP) ? POLLHUP : 0)
+				| ((events & EPOLLERR) ? POLLERR : 0);
+		}
+
+	}
+
+	EventLoop::EventLoop()
+	: m_epoll(-1)
+	, m_wakeFd(-1)
+	, m_signalFd(-1)
+	, m_context(nullptr)
+	{
+	}
+
+	EventLoop::~EventLoop()
+	{
+		for (auto& timer : m_timers) {
+			close(timer.fd);
+		}
+		if (m_signalFd >= 0) {
+			close(m_signalFd);
+		}
+		if (m_wakeFd >= 0) {
+			close(m_wakeFd);
+		}
+		if (m_epoll >= 0) {
+			close(m_epoll);
+		}
+	}
+
+	bool EventLoop::open()
+	{
+		m_epoll = epoll_create1(EPOLL_CLOEXEC);
+		m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (m_epoll < 0 || m_wakeFd < 0) {
+			LOG_ERROR("Can't create an event loop: %s\n", strerror(errno));
+			return false;
+		}
+
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.u64 = tag(KIND_WAKE, 0);
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeFd, &ev);
+		return true;
+	}
+
+	void EventLoop::addSocket(int fd, int events)
+	{
+		struct epoll_event ev = {};
+		ev.events = epollEvents(events);
+		ev.data.u64 = tag(KIND_SOCKET, uint32_t(fd));
+		if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			LOG_ERROR("Can't watch socket %d: %s\n", fd, strerror(errno));
+		}
+	}
+
+	void EventLoop::changeSocket(int fd, int events)
+	{
+		struct epoll_event ev = {};
+		ev.events = epollEvents(events);
+		ev.data.u64 = tag(KIND_SOCKET, uint32_t(fd));
+		if (epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev) != 0) {
+			LOG_ERROR("Can't watch socket %d: %s\n", fd, strerror(errno));
+		}
+	}
+
+	void EventLoop::removeSocket(int fd)
+	{
+		// fails if it's closed already, which took it out too
+		epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, NULL);
+		m_removed.push_back(fd);
+	}
+
+	void EventLoop::every(std::chrono::milliseconds interval, Task task)
+	{
+		int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (fd < 0) {
+			LOG_ERROR("Can't create a timer: %s\n", strerror(errno));
+			return;
+		}
+
+		struct itimerspec spec = {};
+		spec.it_interval.tv_sec = interval.count() / 1000;
+		spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+		spec.it_value = spec.it_interval;
+		timerfd_settime(fd, 0, &spec, NULL);
+
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.u64 = tag(KIND_TIMER, uint32_t(m_timers.size()));
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+
+		Timer timer;
+		timer.fd = fd;
+		timer.interval = interval;
+		timer.task = std::move(task);
+		m_timers.push_back(std::move(timer));
+	}
+
+	void EventLoop::watch(int fd, Task task)
+	{
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.u64 = tag(KIND_WATCH, uint32_t(m_watches.size()));
+		if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			LOG_ERROR("Can't watch %d: %s\n", fd, strerror(errno));
+			return;
+		}
+
+		Watch entry;
+		entry.fd = fd;
+		entry.task = std::move(task);
+		m_watches.push_back(std::move(entry));
+	}
+
+	void EventLoop::holdSignals(const std::vector<int>& signals)
+	{
+		sigset_t set;
+		sigemptyset(&set);
+		for (int signal : signals) {
+			sigaddset(&set, signal);
+		}
+		pthread_sigmask(SIG_BLOCK, &set, NULL);
+	}
+
+	void EventLoop::onSignal(int signal, Task task)
+	{
+		Signal entry;
+		entry.signal = signal;
+		entry.task = std::move(task);
+		m_signals.push_back(std::move(entry));
+
+		sigset_t set;
+		sigemptyset(&set);
+		for (auto& it : m_signals) {
+			sigaddset(&set, it.signal);
+		}
+		pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+		// an existing signalfd takes the new set
+		bool created = (m_signalFd < 0);
+		m_signalFd = signalfd(m_signalFd, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (m_signalFd < 0) {
+			LOG_ERROR("Can't take signal %d: %s\n", signal, strerror(errno));
+			return;
+		}
+		if (created) {
+			struct epoll_event ev = {};
+			ev.events = EPOLLIN;
+			ev.data.u64 = tag(KIND_SIGNAL, 0);
+			epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_signalFd, &ev);
+		}
+	}
+
+	void EventLoop::service(struct libwebsocket_context* context)
+	{
+		m_context = context;
+
+		struct epoll_event events[MAX_EVENTS];
+		int n = epoll_wait(m_epoll, events, MAX_EVENTS, -1);
+		m_removed.clear();
+
+		for (int i = 0; i < n; ++i) {
+			uint32_t index = uint32_t(events[i].data.u64);
+
+			switch (Kind(events[i].data.u64 >> 32)) {
+				case KIND_SOCKET:
+				{
+					if (std::find(m_removed.begin(), m_removed.end(), int(index)) != m_removed.end()) {
+						// closed by an earlier event, whatever has the number now is
+						// still polled and comes up next time if it's ready
+						break;
+					}
+					struct libwebsocket_pollfd pfd;
+					pfd.fd = int(index);
+					pfd.events = pollEvents(events[i].events);
+					pfd.revents = pfd.events;
+					libwebsocket_service_fd(context, &pfd);
+				}
+					break;
+
+				case KIND_WAKE:
+				{
+					uint64_t count;
+					if (read(m_wakeFd, &count, sizeof(count)) < 0) {
+						// another event took it
+					}
+				}
+					break;
+
+				case KIND_TIMER:
+				{
+					uint64_t expirations;
+					if (read(m_timers[index].fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+						m_timers[index].task();
+					}
+				}
+					break;
+
+				case KIND_SIGNAL:
+				{
+					struct signalfd_siginfo info;
+					while (read(m_signalFd, &info, sizeof(info)) == sizeof(info)) {
+						for (auto& it : m_signals) {
+							if (it.signal == int(info.ssi_signo)) {
+								it.task();
+							}
+						}
+					}
+				}
+					break;
+
+				case KIND_WATCH:
+					m_watches[index].task();
+					break;
+			}
+		}
+	}
+
+	void EventLoop::wake()
+	{
+		uint64_t one = 1;
+		if (write(m_wakeFd, &one, sizeof(one)) < 0) {
+			// the counter is full, it's woken anyway
+		}
+	}
+
+#else
+
+	namespace {
+
+		// the signals the handler saw, as bits, and the loop that runs their tasks
+		std::atomic<uint32_t> pendingSignals(0);
+		std::atomic<EventLoop*> signalLoop(nullptr);
+
+		void signalHandler(int signal)
+		{
+			pendingSignals.fetch_or(1u << signal);
+			if (EventLoop* loop = signalLoop.load()) {
+				loop->wake();
+			}
+		}
+
+	}
+
+	EventLoop::EventLoop()
+	: m_epoll(-1)
+	, m_wakeFd(-1)
+	, m_signalFd(-1)
+	, m_context(nullptr)
+	{
+	}
+
+	EventLoop::~EventLoop()
+	{
+	}
+
+	bool EventLoop::open()
+	{
+		return true;
+	}
+
+	// libwebsockets polls its sockets itself
+	void EventLoop::addSocket(int fd, int events)
+	{
+	}
+
+	void EventLoop::changeSocket(int fd, int events)
+	{
+	}
+
+	void EventLoop::removeSocket(int fd)
+	{
+	}
+
+	void EventLoop::every(std::chrono::milliseconds interval, Task task)
+	{
+		Timer timer;
+		timer.fd = -1;
+		timer.interval = interval;
+		timer.due = std::chrono::steady_clock::now() + interval;
+		timer.task = std::move(task);
+		m_timers.push_back(std::move(timer));
+	}
+
+	void EventLoop::watch(int fd, Task task)
+	{
+		LOG_ERROR("Can't watch %d, there is no epoll here\n", fd);
+	}
+
+	void EventLoop::holdSignals(const std::vector<int>& signals)
+	{
+	}
+
+	void EventLoop::onSignal(int signal, Task task)
+	{
+		Signal entry;
+		entry.signal = signal;
+		entry.task = std::move(task);
+		m_signals.push_back(std::move(entry));
+
+		signalLoop = this;
+		::signal(signal, signalHandler);
+	}
+
+	void EventLoop::service(struct libwebsocket_context* context)
+	{
+		m_context = context;
+
+		// until the next timer
+		auto now = std::chrono::steady_clock::now();
+		auto timeout = std::chrono::milliseconds(1000);
+		for (auto& timer : m_timers) {
+			timeout = std::min(timeout, std::chrono::duration_cast<std::chrono::milliseconds>(timer.due - now));
+		}
+		libwebsocket_service(context, int(std::max<long long>(0, timeout.count())));
+
+		now = std::chrono::steady_clock::now();
+		for (auto& timer : m_timers) {
+			if (timer.due <= now) {
+				timer.due = now + timer.interval;
+				timer.task();
+			}
+		}
+
+		uint32_t signals = pendingSignals.exchange(0);
+		for (auto& it : m_signals) {
+			if (signals & (1u << it.signal)) {
+				it.task();
+			}
+		}
+	}
+
+	void EventLoop::wake()
+	{
+		if (struct libwebsocket_context* context = m_context.load()) {
+			libwebsocket_cancel_service(context);
+		}
+	}
+
+#endif
+
+}
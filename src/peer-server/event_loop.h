@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+struct libwebsocket_context;
+
+namespace humblenet {
+
+	// What a shard's thread waits in. Its libwebsockets context tells the loop about its
+	// sockets through the poll fd callbacks of the default protocol, and the loop hands
+	// them back when they are ready. On Linux it's an epoll set with those sockets, a
+	// timerfd for every timer, an eventfd other threads wake it with and a signalfd, so
+	// the thread sleeps until there is something to do and no longer. Elsewhere it falls
+	// back to libwebsocket_service, waiting until the next timer is due.
+	class EventLoop {
+	public:
+		typedef std::function<void()> Task;
+
+		EventLoop();
+		~EventLoop();
+
+		// before the context is created, it adds its listening socket. false if it can't
+		bool open();
+
+		// the poll fd callbacks, events are POLLIN and POLLOUT
+		void addSocket(int fd, int events);
+		void changeSocket(int fd, int events);
+		void removeSocket(int fd);
+
+		// runs task every interval, on the loop's thread
+		void every(std::chrono::milliseconds interval, Task task);
+		// runs task on the loop's thread whenever fd is readable, task has to read it.
+		// Only where there is epoll
+		void watch(int fd, Task task);
+		// runs task on the loop's thread when the process gets the signal, instead of
+		// what it would do. Only for one loop, the signal has to be held
+		void onSignal(int signal, Task task);
+		// keeps signals from the calling thread and the threads it starts from then on, so
+		// they are left to onSignal. Before any thread is started
+		static void holdSignals(const std::vector<int>& signals);
+
+		// waits for and handles what is ready: sockets of context, timers and signals.
+		// Returns early when woken
+		void service(struct libwebsocket_context* context);
+		// cuts service short, from any thread
+		void wake();
+
+	private:
+		struct Timer {
+			int fd;
+			// when there's no timerfd
+			std::chrono::steady_clock::duration interval;
+			std::chrono::steady_clock::time_point due;
+			Task task;
+		};
+
+		struct Signal {
+			int signal;
+			Task task;
+		};
+
+		struct Watch {
+			int fd;
+			Task task;
+		};
+
+		int m_epoll;
+		int m_wakeFd;
+		int m_signalFd;
+
+		// sockets removed since epoll_wait returned, their numbers may be taken again by
+		// new ones which the events aren't for
+		std::vector<int> m_removed;
+
+		std::vector<Timer> m_timers;
+		std::vector<Signal> m_signals;
+		std::vector<Watch> m_watches;
+
+		// the context last serviced, which wake interrupts where there's no eventfd
+		std::atomic<struct libwebsocket_context*> m_context;
+
+		EventLoop(const EventLoop&) = delete;
+		EventLoop& operator=(const EventLoop&) = delete;
+	};
+
+}
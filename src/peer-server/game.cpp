@@ -2,11 +2,75 @@
 #include "p2p_connection.h"
 #include "humblenet_utils.h"
 
+#include <map>
+
 namespace humblenet {
 
 	void Game::erasePeerAliases(PeerId p)
 	{
-		erase_value(aliases, p);
+		std::vector<std::string> names;
+		for (auto it = aliases.begin(); it != aliases.end(); ) {
+			if (it->second == p) {
+				names.push_back(it->first);
+				it = aliases.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		invalidateAliases(names);
+	}
+
+	void Game::watchAlias(const std::string& alias, PeerId p)
+	{
+		aliasWatchers[alias].insert(p);
+	}
+
+	void Game::eraseAliasWatcher(PeerId p)
+	{
+		for (auto it = aliasWatchers.begin(); it != aliasWatchers.end(); ) {
+			it->second.erase(p);
+			if (it->second.empty()) {
+				it = aliasWatchers.erase(it);
+			} else {
+				++it;
+			}
+		}
 	}
-}
 
+	void Game::invalidateAliases(const std::vector<std::string>& names)
+	{
+		// one message per watcher, however many of its aliases changed
+		std::unordered_map<PeerId, std::vector<std::string>> changed;
+
+		for (const auto& name : names) {
+			auto it = aliasWatchers.find(name);
+			if (it == aliasWatchers.end()) {
+				continue;
+			}
+
+			for (PeerId watcher : it->second) {
+				changed[watcher].push_back(name);
+			}
+			aliasWatchers.erase(it);
+		}
+
+		// watchers of the same aliases get the same message, encoded once
+		std::map<std::vector<std::string>, OutMessageRef> encoded;
+
+		for (const auto& it : changed) {
+			auto peer = peers.find(it.first);
+			if (peer == peers.end() || !peer->second->aliasCache) {
+				continue;
+			}
+
+			OutMessageRef& msg = encoded[it.second];
+			if (!msg) {
+				msg = peer->second->encodeMessage([&it](P2PSignalConnection* conn) {
+					sendAliasInvalidated(conn, it.second);
+				});
+			}
+			peer->second->sendMessage(msg);
+		}
+	}
+}
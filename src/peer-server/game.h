@@ -3,7 +3,9 @@
 #include "humblenet.h"
 
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
+#include <vector>
 
 namespace humblenet {
 
@@ -27,8 +29,18 @@ namespace humblenet {
 
 		std::unordered_map<std::string, PeerId> aliases;
 
+		// peers which looked up an alias (whether or not it existed) and want to
+		// hear when it changes. cleared once they've been told
+		std::unordered_map<std::string, std::unordered_set<PeerId>> aliasWatchers;
+
 		Game(GameId game_id) : gameId(game_id), nextPeerId(1) { }
 
+		// unregisters all aliases of the peer and tells whoever looked them up
 		void erasePeerAliases(PeerId p);
+
+		void watchAlias(const std::string& alias, PeerId p);
+		void eraseAliasWatcher(PeerId p);
+		// sends AliasInvalidated to the peers watching any of these aliases
+		void invalidateAliases(const std::vector<std::string>& names);
 	};
 }
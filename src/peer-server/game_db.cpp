@@ -1,12 +1,24 @@
 #include "game_db.h"
 
+#include "logging.h"
+
+#include <cstring>
 #include <fstream>
+#include <stdexcept>
+
+#if defined(__linux__)
+#	include <errno.h>
+#	include <sys/inotify.h>
+#	include <unistd.h>
+#endif
 
 namespace humblenet {
 	// Anonymous DB
 
 	bool GameDBAnonymous::findByToken(const std::string &token, humblenet::GameRecord &record)
 	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
 		auto it = m_games.find(token);
 		if (it == m_games.end()) {
 			record.game_id = ++m_lastGameId;
@@ -21,22 +33,58 @@ namespace humblenet {
 
 	// Flat File DB
 
+	thread_local GameDBFlatFile::Cache GameDBFlatFile::t_cache;
+
 	GameDBFlatFile::GameDBFlatFile(const std::string& filename)
 	: m_filename(filename)
+	, m_inotify(-1)
+	, m_version(1)
 	{
-		loadFile();
+		m_games = loadFile();
+		if (!m_games) {
+			LOG_WARNING("Can't read the games from %s\n", m_filename.c_str());
+			m_games = std::make_shared<const Games>();
+		}
+
+#if defined(__linux__)
+		// the directory, editors and deployments tend to replace the file
+		size_t slash = m_filename.rfind('/');
+		std::string directory = (slash == std::string::npos) ? "." : m_filename.substr(0, slash + 1);
+
+		m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (m_inotify < 0 || inotify_add_watch(m_inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+			LOG_WARNING("Can't watch %s for changes, the games won't be reloaded: %s\n", m_filename.c_str(), strerror(errno));
+			if (m_inotify >= 0) {
+				close(m_inotify);
+				m_inotify = -1;
+			}
+		}
+#endif
 	}
 
-	void GameDBFlatFile::loadFile()
+	GameDBFlatFile::~GameDBFlatFile()
+	{
+#if defined(__linux__)
+		if (m_inotify >= 0) {
+			close(m_inotify);
+		}
+#endif
+	}
+
+	std::shared_ptr<const GameDBFlatFile::Games> GameDBFlatFile::loadFile()
 	{
-		m_games.clear();
 		std::ifstream in(m_filename.c_str());
 
-		if (!in) return;
+		if (!in) return NULL;
+
+		std::shared_ptr<Games> games = std::make_shared<Games>();
 
 		std::string line;
+		unsigned lineNumber = 0;
 		for (std::getline(in, line); in; std::getline(in, line))
 		{
+			++lineNumber;
+
 			// skip comments
 			if (line[0] == '#') continue;
 
@@ -50,25 +98,88 @@ namespace humblenet {
 			if (valEnd == line.npos) continue;
 
 			GameRecord record;
-			bool active = std::stoi(line.substr(valEnd + 1)) != 0;
-			if (!active) continue;
+			std::string token;
+			try {
+				bool active = std::stoi(line.substr(valEnd + 1)) != 0;
+				if (!active) continue;
 
-			record.game_id = (GameId)std::stoul(line.substr(0, gameEnd));
-			std::string token = line.substr(gameEnd+1, tokEnd - gameEnd - 1);
-			record.secret = line.substr(tokEnd+1, secEnd - tokEnd - 1);
-			record.verify = std::stoi(line.substr(secEnd+1, valEnd - secEnd - 1)) != 0;
+				record.game_id = (GameId)std::stoul(line.substr(0, gameEnd));
+				token = line.substr(gameEnd+1, tokEnd - gameEnd - 1);
+				record.secret = line.substr(tokEnd+1, secEnd - tokEnd - 1);
+				record.verify = std::stoi(line.substr(secEnd+1, valEnd - secEnd - 1)) != 0;
+			} catch (const std::logic_error&) {
+				LOG_WARNING("Skipping line %u of %s, it isn't a game\n", lineNumber, m_filename.c_str());
+				continue;
+			}
+			HMACInit(&record.hmac, reinterpret_cast<const uint8_t*>(record.secret.data()), unsigned(record.secret.size()));
 
-			m_games.emplace(token, record);
+			games->emplace(token, record);
 		}
+		return games;
+	}
+
+	const GameDBFlatFile::Games& GameDBFlatFile::games()
+	{
+		Cache& cache = t_cache;
+		if (cache.db != this || cache.version != m_version.load(std::memory_order_acquire)) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			cache.db = this;
+			cache.version = m_version.load(std::memory_order_relaxed);
+			cache.games = m_games;
+		}
+		return *cache.games;
 	}
 
 	bool GameDBFlatFile::findByToken(const std::string &token, humblenet::GameRecord &record)
 	{
-		auto it = m_games.find(token);
-		if (it != m_games.end()) {
+		const Games& games = this->games();
+		auto it = games.find(token);
+		if (it != games.end()) {
 			record = it->second;
 			return true;
 		}
 		return false;
 	}
+
+	int GameDBFlatFile::changeFd()
+	{
+		return m_inotify;
+	}
+
+	void GameDBFlatFile::reload()
+	{
+#if defined(__linux__)
+		size_t slash = m_filename.rfind('/');
+		std::string name = (slash == std::string::npos) ? m_filename : m_filename.substr(slash + 1);
+
+		// anything else in the directory doesn't matter
+		bool changed = false;
+		alignas(struct inotify_event) char buf[4096];
+		ssize_t n;
+		while ((n = read(m_inotify, buf, sizeof(buf))) > 0) {
+			for (char* p = buf; p < buf + n; ) {
+				const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+				if (event->len && name == event->name) {
+					changed = true;
+				}
+				p += sizeof(struct inotify_event) + event->len;
+			}
+		}
+		if (!changed) {
+			return;
+		}
+
+		std::shared_ptr<const Games> games = loadFile();
+		if (!games) {
+			LOG_WARNING("Can't read the games from %s, keeping the ones there were\n", m_filename.c_str());
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_games = games;
+			m_version.fetch_add(1, std::memory_order_release);
+		}
+		LOG_INFO("Reloaded %zu games from %s\n", games->size(), m_filename.c_str());
+#endif
+	}
 }
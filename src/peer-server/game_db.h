@@ -1,7 +1,12 @@
 #pragma once
 
 #include "game.h"
+#include "hmac.h"
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <string>
 
@@ -10,19 +15,28 @@ namespace humblenet {
 		GameId game_id;
 		std::string secret;
 		bool verify;
+		// keyed with secret, a copy of it only has to hash the signed message
+		HMACContext hmac;
 
-		GameRecord() : game_id(0), verify(false) {}
+		GameRecord() : game_id(0), verify(false), hmac() {}
 	};
 
+	// findByToken is called from every shard's thread
 	class GameDB {
 	public:
 		GameDB() {};
 		virtual ~GameDB() {};
 
 		virtual bool findByToken(const std::string& token, GameRecord& record) = 0;
+
+		// a descriptor which is readable when the games changed, reload is called on one
+		// thread then. -1 if they don't change
+		virtual int changeFd() { return -1; }
+		virtual void reload() {}
 	};
 
 	class GameDBAnonymous : public GameDB {
+		std::mutex m_mutex;
 		GameId m_lastGameId;
 		std::unordered_map<std::string, GameRecord> m_games;
 	public:
@@ -30,13 +44,40 @@ namespace humblenet {
 		virtual bool findByToken(const std::string& token, GameRecord& record);
 	};
 
+	// The games of a CSV file, a line of game id, token, secret, verify and active each.
+	// On Linux the file is read again when it's written or replaced, into a new table
+	// the lookups switch to, so they never wait for it. A file which can't be read leaves
+	// the games as they were.
 	class GameDBFlatFile : public GameDB {
+		typedef std::unordered_map<std::string, GameRecord> Games;
+
+		// the table a thread looked up in last, which it keeps using until m_version
+		// changes. That's all a lookup checks otherwise
+		struct Cache {
+			const GameDBFlatFile* db;
+			uint64_t version;
+			std::shared_ptr<const Games> games;
+
+			Cache() : db(NULL), version(0) {}
+		};
+		static thread_local Cache t_cache;
+
 		std::string m_filename;
-		std::unordered_map<std::string, GameRecord> m_games;
+		int m_inotify;
+
+		// replaced whole, never changed
+		std::mutex m_mutex;
+		std::shared_ptr<const Games> m_games;
+		std::atomic<uint64_t> m_version;
 
-		void loadFile();
+		const Games& games();
+		// NULL if the file can't be read
+		std::shared_ptr<const Games> loadFile();
 	public:
 		GameDBFlatFile(const std::string& filename);
+		virtual ~GameDBFlatFile();
 		virtual bool findByToken(const std::string &token, humblenet::GameRecord &record);
+		virtual int changeFd();
+		virtual void reload();
 	};
 }
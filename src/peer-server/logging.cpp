@@ -1,10 +1,19 @@
 #include "logging.h"
 
 #include <libwebsockets.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <cstdarg>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-static FILE* logFP = NULL;
+std::atomic<int> logLevels(LLL_ERR | LLL_WARN | LLL_NOTICE);
 
 const char* logLevel(int level)
 {
@@ -23,34 +32,339 @@ const char* logLevel(int level)
 	}
 }
 
-std::string logTime()
-{
+namespace {
+
+	const size_t LOG_RING_SIZE = 1024 * 1024;	// a power of two
+	const size_t LOG_MAX_LINE = 1024;	// longer lines are cut short
+	// how long the writer sleeps when nothing wakes it, what waits for that is freeing
+	// the rings of threads that are gone
+	const std::chrono::seconds LOG_WRITER_IDLE(1);
+
+	struct LogRecord {
+		uint64_t timeMs;
+		uint32_t length;
+		int32_t level;
+	};
+
+	// The lines one thread logged and the writer hasn't written yet. Only the owning
+	// thread pushes and only the writer pops, head and tail are byte counts that never wrap.
+	struct LogRing {
+		std::atomic<size_t> head;
+		std::atomic<size_t> tail;
+		std::atomic<uint32_t> dropped;	// lines that didn't fit
+		std::atomic<bool> closed;	// the thread is gone, freed by the writer once empty
+		char data[LOG_RING_SIZE];
+
+		LogRing() : head(0), tail(0), dropped(0), closed(false) {}
+
+		void copyIn(size_t pos, const void* src, size_t length)
+		{
+			size_t offset = pos & (LOG_RING_SIZE - 1);
+			size_t first = std::min(length, LOG_RING_SIZE - offset);
+			memcpy(data + offset, src, first);
+			memcpy(data, static_cast<const char*>(src) + first, length - first);
+		}
+
+		void copyOut(size_t pos, void* dst, size_t length) const
+		{
+			size_t offset = pos & (LOG_RING_SIZE - 1);
+			size_t first = std::min(length, LOG_RING_SIZE - offset);
+			memcpy(dst, data + offset, first);
+			memcpy(static_cast<char*>(dst) + first, data, length - first);
+		}
+
+		// returns how full the ring is now, or 0 if the line didn't fit
+		size_t push(const LogRecord& record, const char* text)
+		{
+			size_t h = head.load(std::memory_order_relaxed);
+			size_t t = tail.load(std::memory_order_acquire);
+			if (LOG_RING_SIZE - (h - t) < sizeof(record) + record.length) {
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return 0;
+			}
+			copyIn(h, &record, sizeof(record));
+			copyIn(h + sizeof(record), text, record.length);
+			h += sizeof(record) + record.length;
+			head.store(h, std::memory_order_release);
+			return h - t;
+		}
+
+		bool pop(LogRecord& record, char* text)
+		{
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (head.load(std::memory_order_acquire) == t) {
+				return false;
+			}
+			copyOut(t, &record, sizeof(record));
+			copyOut(t + sizeof(record), text, record.length);
+			tail.store(t + sizeof(record) + record.length, std::memory_order_release);
+			return true;
+		}
+	};
+
+	// registered the first time a thread logs
+	struct LogRingOwner {
+		LogRing* ring;
+
+		LogRingOwner() : ring(NULL) {}
+		~LogRingOwner()
+		{
+			if (ring) {
+				ring->closed.store(true, std::memory_order_release);
+			}
+		}
+	};
+
+	thread_local LogRingOwner threadRing;
+
+	std::mutex ringsMutex;
+	std::vector<LogRing*> rings;
+
+	FILE* logFP = NULL;
+
+	std::thread writer;
+	std::mutex writerMutex;
+	std::condition_variable writerWake;
+	bool writerStop = false;
+
+	// the writer's, the date is only formatted when the second changes
+	struct LogStamp {
+		uint64_t second;
+		uint64_t ms;
+		char text[40];
+
+		LogStamp() : second(UINT64_MAX), ms(UINT64_MAX) { text[0] = '\0'; }
+
+		const char* at(uint64_t timeMs)
+		{
+			if (timeMs == ms) {
+				return text;
+			}
+			if (timeMs / 1000 != second) {
+				second = timeMs / 1000;
+				time_t t = time_t(second);
+				struct tm tparts;
 #ifdef _WIN32
-	return std::string("");
+				gmtime_s(&tparts, &t);
 #else
-	struct tm tparts;
-	struct timeval t;
-	gettimeofday(&t, NULL);
-	gmtime_r(&t.tv_sec, &tparts);
-	char buff[100], buff2[40];
-	strftime(buff2, sizeof(buff2), "%y-%m-%d %H:%M:%S", &tparts);
-	snprintf(buff, sizeof(buff), "%s.%03d", buff2, t.tv_usec / 1000);
-	return std::string(buff);
+				gmtime_r(&t, &tparts);
 #endif
+				strftime(text, sizeof(text), "%y-%m-%d %H:%M:%S", &tparts);
+			}
+			ms = timeMs;
+			snprintf(text + 17, sizeof(text) - 17, ".%03u", unsigned(ms % 1000));
+			return text;
+		}
+	};
+
+	LogRing* ownRing()
+	{
+		if (!threadRing.ring) {
+			threadRing.ring = new LogRing();
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			rings.push_back(threadRing.ring);
+		}
+		return threadRing.ring;
+	}
+
+	// taking the lock first, the line is either seen by the writer's last look before it
+	// waits or wakes it
+	void wakeWriter()
+	{
+		std::lock_guard<std::mutex> lock(writerMutex);
+		writerWake.notify_one();
+	}
+
+	void logPush(int level, const char* text, size_t length)
+	{
+		LogRecord record;
+		record.timeMs = logTimeMs();
+		record.length = uint32_t(std::min(length, LOG_MAX_LINE));
+		record.level = level;
+		size_t used = ownRing()->push(record, text);
+
+		// the writer only sleeps once every ring is empty, so the line that starts one
+		// wakes it and the ones after it are drained without waking anyone. Crossing the
+		// half wakes it too, should it have gone to sleep as this ring filled
+		size_t size = sizeof(record) + record.length;
+		if (used == size || (used >= LOG_RING_SIZE / 2 && used - size < LOG_RING_SIZE / 2)) {
+			wakeWriter();
+		}
+	}
+
+	// Lines are put together here and written in large pieces
+	struct LogOutput {
+		std::vector<char> buffer;
+		size_t length;
+
+		LogOutput() : buffer(64 * 1024), length(0) {}
+
+		void append(const char* text, size_t count)
+		{
+			memcpy(&buffer[length], text, count);
+			length += count;
+		}
+
+		void line(const char* stamp, int level, const char* text, size_t count)
+		{
+			const char* name = logLevel(level);
+			size_t stampLength = strlen(stamp);
+			size_t nameLength = strlen(name);
+			if (length + stampLength + nameLength + count + 8 > buffer.size()) {
+				flush();
+			}
+			append("[", 1);
+			append(stamp, stampLength);
+			append("]: ", 3);
+			append(name, nameLength);
+			append(": ", 2);
+			append(text, count);
+		}
+
+		void flush()
+		{
+			if (length) {
+				fwrite(buffer.data(), 1, length, logFP);
+				length = 0;
+			}
+		}
+	};
+
+	// returns whether anything was written
+	bool drainRings(LogStamp& stamp, LogOutput& out)
+	{
+		char text[LOG_MAX_LINE];
+		LogRecord record;
+		bool wrote = false;
+
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		for (auto it = rings.begin(); it != rings.end(); ) {
+			LogRing* ring = *it;
+			// what's there now, a busy thread doesn't keep the writer to itself
+			size_t end = ring->head.load(std::memory_order_acquire);
+
+			uint32_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+			if (dropped) {
+				int n = snprintf(text, sizeof(text), "%u log lines dropped, the writer couldn't keep up\n", dropped);
+				out.line(stamp.at(logTimeMs()), LLL_WARN, text, n);
+				wrote = true;
+			}
+
+			while (ring->tail.load(std::memory_order_relaxed) != end && ring->pop(record, text)) {
+				out.line(stamp.at(record.timeMs), record.level, text, record.length);
+				wrote = true;
+			}
+
+			if (ring->closed.load(std::memory_order_acquire) && ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire)) {
+				delete ring;
+				it = rings.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		if (wrote) {
+			out.flush();
+			fflush(logFP);
+		}
+		return wrote;
+	}
+
+	// whether a ring has lines the writer hasn't taken yet
+	bool ringsPending()
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		for (LogRing* ring : rings) {
+			if (ring->head.load(std::memory_order_acquire) != ring->tail.load(std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void writeLog()
+	{
+		LogStamp stamp;
+		LogOutput out;
+		std::unique_lock<std::mutex> lock(writerMutex);
+		while (!writerStop) {
+			lock.unlock();
+			bool wrote = drainRings(stamp, out);
+			lock.lock();
+			// looked at again with the lock held, a line that came in since the drain
+			// either shows up here or its wakeWriter waits for the wait to start
+			if (!wrote && !writerStop && !ringsPending()) {
+				writerWake.wait_for(lock, LOG_WRITER_IDLE);
+			}
+		}
+		lock.unlock();
+		drainRings(stamp, out);
+	}
+
+}  // namespace
+
+uint64_t logTimeMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool LogRateLimit::allow(uint32_t& suppressed)
+{
+	uint64_t second = logTimeMs() / 1000;
+	uint64_t current = m_second.load(std::memory_order_relaxed);
+	if (second != current && m_second.compare_exchange_strong(current, second, std::memory_order_relaxed)) {
+		m_count.store(0, std::memory_order_relaxed);
+	}
+
+	if (m_count.fetch_add(1, std::memory_order_relaxed) < LOG_RATE_LIMIT) {
+		suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+		return true;
+	}
+	m_suppressed.fetch_add(1, std::memory_order_relaxed);
+	return false;
 }
 
 void log_func_var(int level, const char* fmt, ...)
 {
+	char text[LOG_MAX_LINE];
 	va_list vl;
 	va_start(vl, fmt);
-	fprintf(logFP, "[%s]: %s: ", logTime().c_str(), logLevel(level));
-	vfprintf(logFP, fmt, vl);
+	int n = vsnprintf(text, sizeof(text), fmt, vl);
 	va_end(vl);
+	if (n < 0) {
+		return;
+	}
+	if (size_t(n) >= sizeof(text)) {
+		// cut short, still ends the line
+		n = sizeof(text) - 1;
+		text[n - 1] = '\n';
+	}
+	logPush(level, text, n);
 }
 
 void log_func(int level, const char* message)
 {
-	fprintf(logFP, "[%s]: %s: %s", logTime().c_str(), logLevel(level), message);
+	logPush(level, message, strlen(message));
+}
+
+bool logSetLevel(const std::string& level)
+{
+	int levels;
+	if (level == "error") {
+		levels = LLL_ERR;
+	} else if (level == "warning") {
+		levels = LLL_ERR | LLL_WARN;
+	} else if (level == "info") {
+		levels = LLL_ERR | LLL_WARN | LLL_NOTICE;
+	} else if (level == "debug") {
+		levels = LLL_ERR | LLL_WARN | LLL_NOTICE | LLL_DEBUG;
+	} else {
+		return false;
+	}
+
+	logLevels.store(levels, std::memory_order_relaxed);
+	lws_set_log_level(levels & (LLL_ERR | LLL_WARN | LLL_NOTICE), &log_func);
+	return true;
 }
 
 void logFileOpen(const std::string& logFile)
@@ -63,8 +377,25 @@ void logFileOpen(const std::string& logFile)
 #else
 		logFP = fopen(logFile.c_str(), "a");
 #endif
-		setvbuf(logFP, NULL, _IOLBF, BUFSIZ);
+		// the writer puts its own batches together
+		setvbuf(logFP, NULL, _IONBF, 0);
 	}
-	lws_set_log_level(LLL_ERR | LLL_WARN | LLL_NOTICE, &log_func);
+	lws_set_log_level(logLevels.load(std::memory_order_relaxed) & (LLL_ERR | LLL_WARN | LLL_NOTICE), &log_func);
+
+	writer = std::thread(writeLog);
+	atexit(logFileClose);
 }
 
+void logFileClose()
+{
+	if (!writer.joinable()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(writerMutex);
+		writerStop = true;
+	}
+	writerWake.notify_one();
+	writer.join();
+}
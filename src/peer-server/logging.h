@@ -1,12 +1,65 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <libwebsockets.h>
 
+// Log lines are formatted into a ring owned by the logging thread and written to the
+// file by a background thread, so logging neither allocates nor waits on the file or on
+// other threads. Lines of a level that isn't enabled are skipped before any formatting.
+
+extern std::atomic<int> logLevels;
+
+inline bool logEnabled(int level)
+{
+	return (logLevels.load(std::memory_order_relaxed) & level) != 0;
+}
+
 void log_func_var(int level, const char* fmt, ...);
 void logFileOpen(const std::string& logFile);
+// writes out whatever is still queued and stops the writer, also done at exit
+void logFileClose();
+// error, warning, info or debug, each includes the ones before it
+bool logSetLevel(const std::string& level);
+
+// milliseconds since the epoch, what log lines are stamped with
+uint64_t logTimeMs();
+
+// Lets a call site log LOG_RATE_LIMIT lines a second, for messages that come with
+// traffic. The next line let through says how many were suppressed in between.
+class LogRateLimit {
+public:
+	static const uint32_t LOG_RATE_LIMIT = 10;
+
+	constexpr LogRateLimit() : m_second(0), m_count(0), m_suppressed(0) {}
+
+	bool allow(uint32_t& suppressed);
+
+private:
+	std::atomic<uint64_t> m_second;
+	std::atomic<uint32_t> m_count;
+	std::atomic<uint32_t> m_suppressed;
+};
+
+#define LOG_AT(level, msg, ...) do { \
+	if (logEnabled(level)) log_func_var(level, msg, ##__VA_ARGS__); \
+} while (0)
+
+#define LOG_LIMITED(level, msg, ...) do { \
+	static LogRateLimit logLimit_; \
+	uint32_t logSuppressed_; \
+	if (logEnabled(level) && logLimit_.allow(logSuppressed_)) { \
+		if (logSuppressed_) log_func_var(level, "(%u lines like the next one suppressed)\n", logSuppressed_); \
+		log_func_var(level, msg, ##__VA_ARGS__); \
+	} \
+} while (0)
 
-#define LOG_ERROR(msg, ...)   log_func_var(LLL_ERR, msg, ##__VA_ARGS__)
-#define LOG_WARNING(msg, ...) log_func_var(LLL_WARN, msg, ##__VA_ARGS__)
-#define LOG_INFO(msg, ...)    log_func_var(LLL_NOTICE, msg, ##__VA_ARGS__)
+#define LOG_ERROR(msg, ...)   LOG_AT(LLL_ERR, msg, ##__VA_ARGS__)
+#define LOG_WARNING(msg, ...) LOG_AT(LLL_WARN, msg, ##__VA_ARGS__)
+#define LOG_INFO(msg, ...)    LOG_AT(LLL_NOTICE, msg, ##__VA_ARGS__)
+#define LOG_DEBUG(msg, ...)   LOG_AT(LLL_DEBUG, msg, ##__VA_ARGS__)
 
+// for messages sent or received with every relayed packet or candidate
+#define LOG_WARNING_LIMITED(msg, ...) LOG_LIMITED(LLL_WARN, msg, ##__VA_ARGS__)
+#define LOG_INFO_LIMITED(msg, ...)    LOG_LIMITED(LLL_NOTICE, msg, ##__VA_ARGS__)
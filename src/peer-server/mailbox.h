@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+namespace humblenet {
+
+	// Work handed to a shard by the other shards. Any thread can post, only the
+	// shard's own thread runs it. A lock-free intrusive queue (Dmitry Vyukov's
+	// MPSC), tasks from one producer run in the order they were posted.
+	class Mailbox {
+	public:
+		typedef std::function<void()> Task;
+
+		Mailbox()
+		: m_head(&m_stub)
+		, m_tail(&m_stub)
+		, m_signaled(false)
+		{
+			m_stub.next.store(nullptr, std::memory_order_relaxed);
+		}
+
+		~Mailbox()
+		{
+			// whatever is left is dropped, the shards are going away
+			while (Node* node = pop()) {
+				delete node;
+			}
+		}
+
+		// returns true if the consumer has to be woken up to see it
+		bool post(Task task)
+		{
+			Node* node = new Node;
+			node->task = std::move(task);
+			push(node);
+
+			return !m_signaled.exchange(true, std::memory_order_acq_rel);
+		}
+
+		// runs everything posted up to now, returns how many tasks ran
+		size_t run()
+		{
+			// an exchange, not a store: a store could be delayed past the pops below, and a
+			// producer pushing in between would still see true and not wake us. Exchanges on
+			// m_signaled are ordered, so either it sees false or we see its task
+			m_signaled.exchange(false, std::memory_order_acq_rel);
+
+			size_t count = 0;
+			while (Node* node = pop()) {
+				node->task();
+				delete node;
+				++count;
+			}
+			return count;
+		}
+
+	private:
+		struct Node {
+			std::atomic<Node*> next;
+			Task task;
+		};
+
+		void push(Node* node)
+		{
+			node->next.store(nullptr, std::memory_order_relaxed);
+			Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+			prev->next.store(node, std::memory_order_release);
+		}
+
+		Node* pop()
+		{
+			for (;;) {
+				Node* tail = m_tail;
+				Node* next = tail->next.load(std::memory_order_acquire);
+
+				if (tail == &m_stub) {
+					if (!next) {
+						return nullptr;
+					}
+					m_tail = next;
+					tail = next;
+					next = next->next.load(std::memory_order_acquire);
+				}
+
+				if (next) {
+					m_tail = next;
+					return tail;
+				}
+
+				if (tail != m_head.load(std::memory_order_acquire)) {
+					// a producer is half way through pushing, it's only a few instructions
+					std::this_thread::yield();
+					continue;
+				}
+
+				push(&m_stub);
+
+				next = tail->next.load(std::memory_order_acquire);
+				if (next) {
+					m_tail = next;
+					return tail;
+				}
+
+				// raced with a producer, which has yet to link its node after the stub
+				std::this_thread::yield();
+			}
+		}
+
+		std::atomic<Node*> m_head;
+		Node* m_tail;
+		Node m_stub;
+		std::atomic<bool> m_signaled;
+
+		Mailbox(const Mailbox&) = delete;
+		Mailbox& operator=(const Mailbox&) = delete;
+	};
+
+}
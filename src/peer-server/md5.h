@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define MD5_DIGEST_SIZE 16
+
+// RFC 1321. Only for TURN, whose long-term credential keys are MD5 digests
+void md5(const void* data, size_t length, uint8_t digest[MD5_DIGEST_SIZE]);
@@ -0,0 +1,185 @@
+#include "metrics.h"
+
+#include "humblepeer.h"
+#include "server.h"
+#include "turn_server.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace humblenet {
+
+	const uint64_t Histogram::BOUNDS[Histogram::BUCKETS] = {
+		50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000
+	};
+
+	void Histogram::observe(std::chrono::steady_clock::duration duration)
+	{
+		uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+		size_t i = std::lower_bound(BOUNDS, BOUNDS + BUCKETS, us) - BOUNDS;
+		m_buckets[i].add();
+		m_count.add();
+		m_sum.add(us);
+	}
+
+	void ShardMetrics::publish(ShardGauges gauges)
+	{
+		std::lock_guard<std::mutex> lock(m_gaugesMutex);
+		std::swap(m_gauges, gauges);
+	}
+
+	ShardGauges ShardMetrics::gauges()
+	{
+		std::lock_guard<std::mutex> lock(m_gaugesMutex);
+		return m_gauges;
+	}
+
+	namespace {
+
+		struct MetricsText {
+			std::string text;
+
+			void header(const char* name, const char* type, const char* help)
+			{
+				text += "# HELP ";
+				text += name;
+				text += " ";
+				text += help;
+				text += "\n# TYPE ";
+				text += name;
+				text += " ";
+				text += type;
+				text += "\n";
+			}
+
+			void sample(const char* name, const std::string& labels, uint64_t value)
+			{
+				text += name;
+				if (!labels.empty()) {
+					text += "{" + labels + "}";
+				}
+				text += " " + std::to_string(value) + "\n";
+			}
+
+			// one number summed over the shards
+			template<typename Value>
+			void total(const char* name, const char* type, const char* help, const std::vector<Server*>& shards, Value value)
+			{
+				uint64_t sum = 0;
+				for (auto shard : shards) {
+					sum += value(shard);
+				}
+				header(name, type, help);
+				sample(name, "", sum);
+			}
+		};
+
+	}
+
+	std::string formatMetrics(const std::vector<Server*>& shards)
+	{
+		MetricsText out;
+
+		std::vector<ShardGauges> gauges;
+		for (auto shard : shards) {
+			gauges.push_back(shard->metrics.gauges());
+		}
+
+		// a game lives on one shard only
+		out.header("humblenet_peers", "gauge", "Peers connected, by game.");
+		for (auto& g : gauges) {
+			for (auto& game : g.peersPerGame) {
+				out.sample("humblenet_peers", "game=\"" + std::to_string(game.first) + "\"", game.second);
+			}
+		}
+
+		size_t sockets = 0, detached = 0, queued = 0, longest = 0;
+		for (auto& g : gauges) {
+			sockets += g.sockets;
+			detached += g.detachedPeers;
+			queued += g.sendQueueBytes;
+			longest = std::max(longest, g.sendQueueMaxBytes);
+		}
+		out.header("humblenet_sockets", "gauge", "Open websockets.");
+		out.sample("humblenet_sockets", "", sockets);
+		out.header("humblenet_detached_peers", "gauge", "Peers whose websocket closed, held on to until they resume or time out.");
+		out.sample("humblenet_detached_peers", "", detached);
+		out.header("humblenet_send_queue_bytes", "gauge", "Bytes waiting for websockets to be writable.");
+		out.sample("humblenet_send_queue_bytes", "", queued);
+		out.header("humblenet_send_queue_max_bytes", "gauge", "Bytes waiting for the websocket with the longest send queue.");
+		out.sample("humblenet_send_queue_max_bytes", "", longest);
+
+		out.header("humblenet_messages_received_total", "counter", "Messages received, by type.");
+		for (size_t type = 0; type < 256; ++type) {
+			uint64_t count = 0;
+			for (auto shard : shards) {
+				count += shard->metrics.messagesReceived[type].value();
+			}
+			if (count) {
+				const char* name = HumblePeer::EnumNameMessageType(static_cast<HumblePeer::MessageType>(type));
+				out.sample("humblenet_messages_received_total", std::string("type=\"") + name + "\"", count);
+			}
+		}
+
+		out.total("humblenet_received_bytes_total", "counter", "Bytes received on websockets.", shards, [](Server* s) {
+			return s->metrics.bytesReceived.value();
+		});
+		out.total("humblenet_sent_bytes_total", "counter", "Bytes sent on websockets.", shards, [](Server* s) {
+			return s->metrics.bytesSent.value();
+		});
+		out.total("humblenet_relay_bytes_total", "counter", "Bytes of P2PRelayData relayed between peers.", shards, [](Server* s) {
+			return s->metrics.relayBytes.value();
+		});
+		out.total("humblenet_relay_frames_total", "counter", "Relay frames received, each forwarded as it is.", shards, [](Server* s) {
+			return s->metrics.relayFrames.value();
+		});
+		out.total("humblenet_relay_dropped_bytes_total", "counter", "Bytes of P2PRelayData dropped because the peer it was for wasn't reading.", shards, [](Server* s) {
+			return s->metrics.relayDroppedBytes.value();
+		});
+		out.total("humblenet_slow_consumer_disconnects_total", "counter", "Websockets closed because their send queue went over the limit.", shards, [](Server* s) {
+			return s->metrics.slowConsumerDisconnects.value();
+		});
+		out.total("humblenet_parse_failures_total", "counter", "Messages that couldn't be parsed, each closed its websocket.", shards, [](Server* s) {
+			return s->metrics.parseFailures.value();
+		});
+		out.total("humblenet_hmac_failures_total", "counter", "Hellos with a game signature that didn't verify.", shards, [](Server* s) {
+			return s->metrics.hmacFailures.value();
+		});
+
+		// one relay for all the shards
+		TurnServer* turn = shards.empty() ? NULL : shards[0]->turnServer;
+		if (turn) {
+			out.header("humblenet_turn_allocations", "gauge", "TURN allocations, each a relayed UDP port.");
+			out.sample("humblenet_turn_allocations", "", turn->allocationCount.load(std::memory_order_relaxed));
+			out.header("humblenet_turn_relayed_bytes_total", "counter", "Bytes the TURN relay passed on, either way.");
+			out.sample("humblenet_turn_relayed_bytes_total", "", turn->relayedBytes.value());
+			out.header("humblenet_turn_relayed_packets_total", "counter", "Datagrams the TURN relay passed on, either way.");
+			out.sample("humblenet_turn_relayed_packets_total", "", turn->relayedPackets.value());
+			out.header("humblenet_turn_auth_failures_total", "counter", "TURN requests whose credentials didn't check out.");
+			out.sample("humblenet_turn_auth_failures_total", "", turn->authFailures.value());
+		}
+
+		out.header("humblenet_service_loop_seconds", "histogram", "How long a service loop iteration was busy, by shard.");
+		for (auto shard : shards) {
+			const Histogram& h = shard->metrics.serviceLoop;
+			std::string index = "shard=\"" + std::to_string(shard->shardIndex) + "\"";
+			uint64_t cumulative = 0;
+			char le[32];
+			for (size_t i = 0; i < Histogram::BUCKETS; ++i) {
+				cumulative += h.bucket(i);
+				snprintf(le, sizeof(le), "%g", Histogram::BOUNDS[i] / 1e6);
+				out.sample("humblenet_service_loop_seconds_bucket", index + ",le=\"" + le + "\"", cumulative);
+			}
+			cumulative += h.bucket(Histogram::BUCKETS);
+			out.sample("humblenet_service_loop_seconds_bucket", index + ",le=\"+Inf\"", cumulative);
+
+			char sum[32];
+			snprintf(sum, sizeof(sum), "%.6f", h.sumMicroseconds() / 1e6);
+			out.text += "humblenet_service_loop_seconds_sum{" + index + "} " + sum + "\n";
+			out.sample("humblenet_service_loop_seconds_count", index, h.count());
+		}
+
+		return out.text;
+	}
+
+}
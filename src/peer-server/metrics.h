@@ -0,0 +1,119 @@
+#pragma once
+
+#include "game.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace humblenet {
+	struct Server;
+
+	// Only ever added to by the thread of the shard that owns it, so adding is a relaxed
+	// load and store with no locked instruction. Any thread can read it, a scrape is
+	// served by whichever shard accepted it.
+	class Counter {
+	public:
+		Counter() : m_value(0) {}
+
+		void add(uint64_t n = 1)
+		{
+			m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<uint64_t> m_value;
+	};
+
+	// Durations in fixed buckets, from 50 us up to a second
+	class Histogram {
+	public:
+		static const size_t BUCKETS = 13;
+		// upper bounds in microseconds, the last bucket has none
+		static const uint64_t BOUNDS[BUCKETS];
+
+		void observe(std::chrono::steady_clock::duration duration);
+
+		uint64_t bucket(size_t i) const { return m_buckets[i].value(); }
+		uint64_t count() const { return m_count.value(); }
+		uint64_t sumMicroseconds() const { return m_sum.value(); }
+
+	private:
+		Counter m_buckets[BUCKETS + 1];
+		Counter m_count;
+		Counter m_sum;
+	};
+
+	// What the shard has seen as of the last time it looked, once a second
+	struct ShardGauges {
+		std::vector<std::pair<GameId, size_t>> peersPerGame;
+		size_t sockets;
+		size_t detachedPeers;
+		size_t sendQueueBytes;	// all the sockets' together
+		size_t sendQueueMaxBytes;	// the longest one's
+
+		ShardGauges()
+		: sockets(0)
+		, detachedPeers(0)
+		, sendQueueBytes(0)
+		, sendQueueMaxBytes(0)
+		{
+		}
+	};
+
+	struct ShardMetrics {
+		// by HumblePeer::MessageType
+		Counter messagesReceived[256];
+		Counter bytesReceived;
+		Counter bytesSent;
+		Counter relayBytes;
+		Counter relayFrames;
+		Counter relayDroppedBytes;
+		Counter slowConsumerDisconnects;
+		Counter parseFailures;
+		Counter hmacFailures;
+
+		// how long an iteration of the service loop was busy, from the first event it
+		// handled to its end. Iterations that only waited aren't counted
+		Histogram serviceLoop;
+
+		ShardMetrics() : m_busy(false) {}
+
+		// something is being handled, the iteration is busy from here
+		void serviceEvent()
+		{
+			if (!m_busy) {
+				m_busy = true;
+				m_busySince = std::chrono::steady_clock::now();
+			}
+		}
+
+		// the iteration is over
+		void serviceDone()
+		{
+			if (m_busy) {
+				serviceLoop.observe(std::chrono::steady_clock::now() - m_busySince);
+				m_busy = false;
+			}
+		}
+
+		void publish(ShardGauges gauges);
+		ShardGauges gauges();
+
+	private:
+		bool m_busy;
+		std::chrono::steady_clock::time_point m_busySince;
+
+		std::mutex m_gaugesMutex;
+		ShardGauges m_gauges;
+	};
+
+	// The Prometheus text format of all the shards' metrics
+	std::string formatMetrics(const std::vector<Server*>& shards);
+}
@@ -0,0 +1,96 @@
+#include "out_queue.h"
+
+#include "humblenet.h"
+#include "humblepeer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <new>
+
+namespace humblenet {
+
+	OutMessageRef OutMessage::create(const uint8_t* data, size_t length)
+	{
+		uint8_t* p = new uint8_t[sizeof(OutMessage) + LWS_SEND_BUFFER_PRE_PADDING + length + LWS_SEND_BUFFER_POST_PADDING];
+		OutMessage* msg = new (p) OutMessage(length);
+		memcpy(msg->data(), data, length);
+		return OutMessageRef(msg);
+	}
+
+	void OutMessage::release()
+	{
+		if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			this->~OutMessage();
+			delete[] reinterpret_cast<uint8_t*>(this);
+		}
+	}
+
+	void OutQueue::push(OutMessageRef msg)
+	{
+		m_size += msg->size();
+		m_messages.push_back(std::move(msg));
+	}
+
+	OutMessageRef OutQueue::pop()
+	{
+		assert(m_offset == 0 && !m_frame);
+
+		if (m_messages.empty()) {
+			return OutMessageRef();
+		}
+
+		OutMessageRef msg = std::move(m_messages.front());
+		m_messages.pop_front();
+		m_size -= msg->size();
+		return msg;
+	}
+
+	void OutQueue::clear()
+	{
+		m_messages.clear();
+		m_offset = 0;
+		m_frame = OutMessageRef();
+		m_frameOffset = 0;
+		m_frameEnd = 0;
+		m_size = 0;
+	}
+
+	size_t OutQueue::coalesce(std::vector<uint8_t>& scratch, OutMessageRef& source, size_t& sourceOffset)
+	{
+		size_t capacity = std::min(m_size, MAX_SIGNAL_FRAME_SIZE);
+		if (scratch.size() < LWS_SEND_BUFFER_PRE_PADDING + capacity + LWS_SEND_BUFFER_POST_PADDING) {
+			scratch.resize(LWS_SEND_BUFFER_PRE_PADDING + capacity + LWS_SEND_BUFFER_POST_PADDING);
+		}
+		uint8_t* frame = &scratch[LWS_SEND_BUFFER_PRE_PADDING];
+
+		size_t length = 0;
+		while (!m_messages.empty() && length < capacity) {
+			OutMessageRef& msg = m_messages.front();
+			if (length > 0 && msg->size() >= MIN_IN_PLACE_SIZE && !msg->shared()) {
+				// goes out on its own
+				break;
+			}
+
+			if (length == 0) {
+				source = msg;
+				sourceOffset = m_offset;
+			} else {
+				source = OutMessageRef();
+			}
+
+			size_t count = std::min(msg->size() - m_offset, capacity - length);
+			memcpy(frame + length, msg->data() + m_offset, count);
+			length += count;
+			m_offset += count;
+
+			if (m_offset == msg->size()) {
+				m_messages.pop_front();
+				m_offset = 0;
+			}
+		}
+
+		m_size -= length;
+		return length;
+	}
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <libwebsockets.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+namespace humblenet {
+
+	class OutMessageRef;
+
+	// An encoded message on its way to one or more websockets. Allocated once, with room
+	// for the libwebsockets frame header in front and trailer behind so it can be written
+	// in place. Reference counted and immutable once created, so it can be queued on any
+	// number of sockets, on any shard.
+	class OutMessage {
+	public:
+		static OutMessageRef create(const uint8_t* data, size_t length);
+
+		uint8_t* data() { return reinterpret_cast<uint8_t*>(this + 1) + LWS_SEND_BUFFER_PRE_PADDING; }
+		size_t size() const { return m_size; }
+
+		// queued on more than one socket, so two threads could be writing it. libwebsockets
+		// puts the frame header into the padding, only a message with one owner is written in place
+		bool shared() const { return m_refs.load(std::memory_order_acquire) > 1; }
+
+	private:
+		friend class OutMessageRef;
+
+		OutMessage(size_t size) : m_refs(1), m_size(size) {}
+
+		void release();
+
+		std::atomic<uint32_t> m_refs;
+		size_t m_size;
+	};
+
+	class OutMessageRef {
+	public:
+		OutMessageRef() : m_msg(nullptr) {}
+		OutMessageRef(const OutMessageRef& other) : m_msg(other.m_msg)
+		{
+			if (m_msg) {
+				m_msg->m_refs.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		OutMessageRef(OutMessageRef&& other) : m_msg(other.m_msg)
+		{
+			other.m_msg = nullptr;
+		}
+		~OutMessageRef()
+		{
+			if (m_msg) {
+				m_msg->release();
+			}
+		}
+
+		OutMessageRef& operator=(OutMessageRef other)
+		{
+			std::swap(m_msg, other.m_msg);
+			return *this;
+		}
+
+		OutMessage* operator->() const { return m_msg; }
+		explicit operator bool() const { return m_msg != nullptr; }
+
+	private:
+		friend class OutMessage;
+
+		explicit OutMessageRef(OutMessage* msg) : m_msg(msg) {}
+
+		OutMessage* m_msg;
+	};
+
+	// The messages waiting for a websocket to be writable. Small messages are coalesced
+	// into one frame (the humblepeer stream doesn't care where frames end), anything of
+	// MIN_IN_PLACE_SIZE or more goes out as a frame of its own straight from its buffer.
+	// A frame the socket only took part of is finished before anything else is written.
+	class OutQueue {
+	public:
+		static const size_t MIN_IN_PLACE_SIZE = 1024;
+
+		OutQueue() : m_offset(0), m_frameOffset(0), m_frameEnd(0), m_size(0) {}
+
+		void push(OutMessageRef msg);
+
+		// takes the next whole message, only for queues that are never written
+		OutMessageRef pop();
+
+		bool empty() const { return m_messages.empty() && !m_frame; }
+		// bytes waiting
+		size_t size() const { return m_size; }
+		// the socket took part of a frame, the rest has to go before anything else
+		bool inFrame() const { return bool(m_frame); }
+
+		void clear();
+
+		// Writes the next frame, or the rest of the one in progress. write is called with
+		// a buffer that has the libwebsockets padding around it and returns how much of it
+		// went out (libwebsocket_write with no_buffer_all_partial_tx), or -1. scratch is
+		// where small messages are coalesced. Returns write's result.
+		template<typename Write>
+		int writeFrame(Write write, std::vector<uint8_t>& scratch);
+
+	private:
+		// copies queued bytes into scratch, up to MAX_SIGNAL_FRAME_SIZE and stopping at a
+		// message that goes in place. Returns the length of the frame. If it all came from
+		// one message, that's source and the frame starts at sourceOffset in it
+		size_t coalesce(std::vector<uint8_t>& scratch, OutMessageRef& source, size_t& sourceOffset);
+
+		std::deque<OutMessageRef> m_messages;
+		size_t m_offset;	// into the first message
+
+		// the frame the socket took part of, the rest is m_frameOffset to m_frameEnd in it
+		OutMessageRef m_frame;
+		size_t m_frameOffset;
+		size_t m_frameEnd;
+
+		size_t m_size;
+	};
+
+	template<typename Write>
+	int OutQueue::writeFrame(Write write, std::vector<uint8_t>& scratch)
+	{
+		if (!m_frame) {
+			if (m_messages.empty()) {
+				return 0;
+			}
+
+			OutMessageRef& head = m_messages.front();
+			if (head->size() - m_offset < MIN_IN_PLACE_SIZE || head->shared()) {
+				OutMessageRef source;
+				size_t sourceOffset = 0;
+				size_t length = coalesce(scratch, source, sourceOffset);
+				uint8_t* frame = &scratch[LWS_SEND_BUFFER_PRE_PADDING];
+
+				int n = write(frame, length);
+				if (n >= 0 && size_t(n) < length) {
+					// scratch is reused by the next socket, the rest of the frame is kept. Past the
+					// header it's fine to continue from a shared message
+					if (source) {
+						m_frame = std::move(source);
+						m_frameOffset = sourceOffset + n;
+						m_frameEnd = sourceOffset + length;
+					} else {
+						m_frame = OutMessage::create(frame + n, length - n);
+						m_frameOffset = 0;
+						m_frameEnd = length - n;
+					}
+					m_size += length - n;
+				}
+				return n;
+			}
+
+			// in place, as a frame of its own
+			m_frame = std::move(head);
+			m_frameOffset = m_offset;
+			m_frameEnd = m_frame->size();
+			m_messages.pop_front();
+			m_offset = 0;
+		}
+
+		int n = write(m_frame->data() + m_frameOffset, m_frameEnd - m_frameOffset);
+		if (n < 0) {
+			return n;
+		}
+
+		m_size -= n;
+		m_frameOffset += n;
+		if (m_frameOffset == m_frameEnd) {
+			m_frame = OutMessageRef();
+		}
+		return n;
+	}
+
+}
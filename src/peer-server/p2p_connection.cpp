@@ -5,12 +5,14 @@
 #include "server.h"
 
 #include "humblenet_utils.h"
+#include "humblepeer_sdp.h"
 
 
 namespace humblenet {
 	ha_bool P2PSignalConnection::processMsg(const HumblePeer::Message* msg)
 	{
 		auto msgType = msg->message_type();
+		peerServer->metrics.messagesReceived[static_cast<uint8_t>(msgType)].add();
 
 		// we don't accept anything but HelloServer from a peer which hasn't sent one yet
 		if (!this->peerId) {
@@ -32,9 +34,8 @@ namespace humblenet {
 
 				bool emulated = (p2p->flags() & 0x1);
 
-				LOG_INFO("P2POffer from peer %u (%s) to peer %u", this->peerId, url.c_str(), peer);
 				if (emulated) {
-					LOG_INFO(", emulated connections not allowed\n");
+					LOG_INFO_LIMITED("P2POffer from peer %u (%s) to peer %u, emulated connections not allowed\n", this->peerId, url.c_str(), peer);
 					// TODO: better error message
 					sendNoSuchPeer(this, peer);
 					return true;
@@ -42,7 +43,7 @@ namespace humblenet {
 
 				auto it = game->peers.find(peer);
 				if (it == game->peers.end()) {
-					LOG_WARNING(", no such peer\n");
+					LOG_WARNING_LIMITED("P2POffer from peer %u (%s) to peer %u, no such peer\n", this->peerId, url.c_str(), peer);
 					sendNoSuchPeer(this, peer);
 				} else {
 					P2PSignalConnection *otherPeer = it->second;
@@ -52,18 +53,28 @@ namespace humblenet {
 					// to avoid unnecessary round trip
 					if (!emulated && !otherPeer->webRTCsupport) {
 						// webrtc connections not supported
-						LOG_INFO("(%s), refusing because target doesn't support WebRTC\n", otherPeer->url.c_str());
+						LOG_INFO_LIMITED("P2POffer from peer %u (%s) to peer %u (%s), refusing because target doesn't support WebRTC\n", this->peerId, url.c_str(), peer, otherPeer->url.c_str());
 						sendPeerRefused(this, peer);
 						return true;
 					}
 
-					LOG_INFO("(%s)\n", otherPeer->url.c_str());
+					LOG_INFO_LIMITED("P2POffer from peer %u (%s) to peer %u (%s)\n", this->peerId, url.c_str(), peer, otherPeer->url.c_str());
 
 					// TODO: should check that it doesn't exist already
 					this->connectedPeers.insert(otherPeer);
+					this->unansweredOffers[otherPeer] = std::chrono::steady_clock::now();
 
 					// set peer id to originator so target knows who wants to connect
-					sendP2PConnect(otherPeer, this->peerId, p2p->flags(), p2p->offer()->c_str());
+					if (p2p->description() && otherPeer->compactSDP) {
+						sendP2PConnect(otherPeer, this->peerId, p2p->flags(), p2p->description());
+					} else {
+						std::string offer;
+						if (!offerText(p2p->offer(), p2p->description(), offer)) {
+							LOG_WARNING("P2POffer from peer %u (%s) has no usable offer\n", this->peerId, this->url.c_str());
+							return false;
+						}
+						sendP2PConnect(otherPeer, this->peerId, p2p->flags(), offer.c_str(), otherPeer->compactSDP);
+					}
 				}
 
 			}
@@ -98,11 +109,22 @@ namespace humblenet {
 						return true;
 					}
 
+					otherPeer->unansweredOffers.erase(this);
+
 					// TODO: should assert it's not there yet
 					this->connectedPeers.insert(otherPeer);
 
 					// set peer id to originator so target knows who wants to connect
-					sendP2PResponse(otherPeer, this->peerId, p2p->offer()->c_str());
+					if (p2p->description() && otherPeer->compactSDP) {
+						sendP2PResponse(otherPeer, this->peerId, p2p->description());
+					} else {
+						std::string offer;
+						if (!offerText(p2p->offer(), p2p->description(), offer)) {
+							LOG_WARNING("P2PResponse from peer %u (%s) has no usable answer\n", this->peerId, this->url.c_str());
+							return false;
+						}
+						sendP2PResponse(otherPeer, this->peerId, offer.c_str(), otherPeer->compactSDP);
+					}
 				}
 			}
 				break;
@@ -118,12 +140,21 @@ namespace humblenet {
 				auto it = game->peers.find(peer);
 
 				if (it == game->peers.end()) {
-					LOG_WARNING(", no such peer\n");
+					LOG_WARNING_LIMITED("ICECandidate from peer %u (%s) to peer %u, no such peer\n", this->peerId, url.c_str(), peer);
 					sendNoSuchPeer(this, peer);
 				} else {
 					P2PSignalConnection *otherPeer = it->second;
 					assert(otherPeer != NULL);
-					sendICECandidate(otherPeer, this->peerId, p2p->offer()->c_str());
+					if (p2p->candidate() && otherPeer->compactSDP) {
+						sendICECandidate(otherPeer, this->peerId, p2p->candidate());
+					} else {
+						std::string candidate;
+						if (!candidateText(p2p->offer(), p2p->candidate(), candidate)) {
+							LOG_WARNING("ICECandidate from peer %u (%s) has no usable candidate\n", this->peerId, this->url.c_str());
+							return false;
+						}
+						sendICECandidate(otherPeer, this->peerId, candidate.c_str(), otherPeer->compactSDP);
+					}
 				}
 
 			}
@@ -194,24 +225,65 @@ namespace humblenet {
 					}
 				}
 
-				// generate peer id for this peer
-				peerId = this->game->generateNewPeerId();
-				LOG_INFO("Got hello from \"%s\" (peer %u, game %u, platform: %s)\n", url.c_str(), peerId, this->game->gameId, platform ? platform->c_str(): "");
+				P2PSignalConnection* previous = NULL;
+				auto reconnect = hello->reconnectToken();
+				if (reconnect && reconnect->size() && peerServer->reconnectGracePeriod.count() > 0) {
+					previous = peerServer->findReconnectable(this->game, reconnect->str());
+				}
+
+				if (previous) {
+					// resuming, keeps the PeerId, aliases and P2P state
+					peerId = previous->peerId;
+					LOG_INFO("Got hello from \"%s\" (resumed peer %u, game %u, platform: %s)\n", url.c_str(), peerId, this->game->gameId, platform ? platform->c_str(): "");
+				} else {
+					// generate peer id for this peer
+					peerId = this->game->generateNewPeerId();
+					LOG_INFO("Got hello from \"%s\" (peer %u, game %u, platform: %s)\n", url.c_str(), peerId, this->game->gameId, platform ? platform->c_str(): "");
+
+					game->peers.insert(std::make_pair(peerId, this));
+				}
 
-				game->peers.insert(std::make_pair(peerId, this));
 				this->webRTCsupport = true;
 				this->trickleICE = !(hello->flags() & 0x2);
+				this->compactSDP = (hello->flags() & HELLO_FLAG_COMPACT_SDP) != 0;
+				this->aliasCache = (hello->flags() & HELLO_FLAG_ALIAS_CACHE) != 0;
+				this->aliasAck = (hello->flags() & HELLO_FLAG_ALIAS_ACK) != 0;
+				this->backpressure = (hello->flags() & HELLO_FLAG_BACKPRESSURE) != 0;
+				this->relayFrames = (hello->flags() & HELLO_FLAG_RELAY_FRAMES) != 0;
 
 				// send STUN/TURN server credential if client supports webrtc
 				// ';' separator between server, username and password, like this:
 				// "server;username;password"
 				std::vector<ICEServer> iceServers;
-				peerServer->populateStunServers(iceServers);
+				peerServer->populateIceServers(iceServers, peerId);
+
+				// a new token on every hello, so a token can only be used once
+				if (peerServer->reconnectGracePeriod.count() > 0) {
+					this->reconnectToken = peerServer->createReconnectToken(this->game, peerId);
+				}
 
 				// send hello to client
-				std::string reconnectToken = "";
-	#pragma message ("TODO implement reconnect tokens")
-				sendHelloClient(this, peerId, reconnectToken, iceServers);
+				uint8_t flags = 0;
+				if (this->compactSDP) {
+					flags |= HELLO_FLAG_COMPACT_SDP;
+				}
+				if (this->aliasCache) {
+					flags |= HELLO_FLAG_ALIAS_CACHE;
+				}
+				if (this->aliasAck) {
+					flags |= HELLO_FLAG_ALIAS_ACK;
+				}
+				if (this->backpressure) {
+					flags |= HELLO_FLAG_BACKPRESSURE;
+				}
+				if (this->relayFrames) {
+					flags |= HELLO_FLAG_RELAY_FRAMES;
+				}
+				sendHelloClient(this, peerId, this->reconnectToken, iceServers, flags);
+
+				if (previous) {
+					peerServer->resumePeer(this, previous);
+				}
 			}
 				break;
 
@@ -235,17 +307,25 @@ namespace humblenet {
 				auto peer = relay->peerId();
 				auto data = relay->data();
 
-				LOG_INFO("P2PRelayData relaying %d bytes from peer %u to %u\n", data->Length(), this->peerId, peer );
+				peerServer->metrics.relayBytes.add(data->Length());
+				LOG_DEBUG("P2PRelayData relaying %d bytes from peer %u to %u\n", data->Length(), this->peerId, peer );
 
 				auto it = game->peers.find(peer);
 
 				if (it == game->peers.end()) {
-					LOG_WARNING(", no such peer\n");
+					LOG_WARNING_LIMITED("P2PRelayData from peer %u to %u, no such peer\n", this->peerId, peer);
 					sendNoSuchPeer(this, peer);
 				} else {
 					P2PSignalConnection *otherPeer = it->second;
 					assert(otherPeer != NULL);
-					sendP2PRelayData(otherPeer, this->peerId, data->Data(), data->Length() );
+					if (shedRelay(otherPeer, data->Length())) {
+						break;
+					}
+					if (otherPeer->relayFrames) {
+						sendRelayFrame(otherPeer, this->peerId, data->Data(), data->Length());
+					} else {
+						sendP2PRelayData(otherPeer, this->peerId, data->Data(), data->Length() );
+					}
 				}
 			}
 				break;
@@ -256,17 +336,22 @@ namespace humblenet {
 				auto reg = reinterpret_cast<const HumblePeer::AliasRegister*>(msg->message());
 				auto alias = reg->alias();
 
-				auto existing = game->aliases.find( alias->c_str() );
+				// claim it unless someone else already has, in one step
+				auto claim = game->aliases.emplace( alias->str(), peerId );
 
-				if( existing != game->aliases.end() && existing->second != peerId ) {
-					LOG_INFO("Rejecting peer %u's request to register alias '%s' which is already registered to peer %u\n", peerId, alias->c_str(), existing->second );
-	#pragma message ("TODO implement registration failure")
+				if( !claim.second && claim.first->second != peerId ) {
+					LOG_INFO("Rejecting peer %u's request to register alias '%s' which is already registered to peer %u\n", peerId, alias->c_str(), claim.first->second );
+					if (this->aliasAck) {
+						sendAliasRejected(this, alias->str(), claim.first->second);
+					}
 				} else {
-					if( existing == game->aliases.end() ) {
-						game->aliases.insert( std::make_pair( alias->c_str(), peerId ) );
+					if( claim.second ) {
+						game->invalidateAliases( { alias->str() } );
 					}
 					LOG_INFO("Registering alias '%s' to peer %u\n", alias->c_str(), peerId );
-	#pragma message ("TODO implement registration success")
+					if (this->aliasAck) {
+						sendAliasRegistered(this, alias->str());
+					}
 				}
 			}
 				break;
@@ -281,6 +366,7 @@ namespace humblenet {
 
 					if( existing != game->aliases.end() && existing->second == peerId ) {
 						game->aliases.erase( existing );
+						game->invalidateAliases( { alias->str() } );
 
 						LOG_INFO("Unregistring alias '%s' for peer %u\n", alias->c_str(), peerId );
 	#pragma message ("TODO implement unregister sucess")
@@ -289,7 +375,7 @@ namespace humblenet {
 	#pragma message ("TODO implement unregister failure")
 					}
 				} else {
-					erase_value(game->aliases, peerId);
+					game->erasePeerAliases(peerId);
 
 					LOG_INFO("Unregistring all aliases for peer for peer %u\n", peerId );
 	#pragma message ("TODO implement unregister sucess")
@@ -302,6 +388,30 @@ namespace humblenet {
 				auto lookup = reinterpret_cast<const HumblePeer::AliasLookup*>(msg->message());
 				auto alias = lookup->alias();
 
+				if (this->aliasCache) {
+					// batched, and the peer hears about it if any of them change
+					std::vector<std::string> names;
+					std::vector<PeerId> peers;
+
+					names.push_back(alias->str());
+					if (lookup->aliases()) {
+						for (const auto& other : *lookup->aliases()) {
+							names.push_back(other->str());
+						}
+					}
+
+					peers.reserve(names.size());
+					for (const auto& name : names) {
+						auto existing = game->aliases.find( name );
+						peers.push_back( existing != game->aliases.end() ? existing->second : 0 );
+						game->watchAlias( name, peerId );
+					}
+
+					LOG_INFO("Lookup of %u aliases for peer %u\n", (unsigned)names.size(), peerId );
+					sendAliasResolved(this, names, peers);
+					break;
+				}
+
 				auto existing = game->aliases.find( alias->c_str() );
 
 				if( existing != game->aliases.end() ) {
@@ -323,11 +433,132 @@ namespace humblenet {
 	}
 
 
+	ha_bool P2PSignalConnection::processRelayFrame(const uint8_t* frame, size_t length)
+	{
+		if (!this->peerId) {
+			LOG_WARNING("Got a relay frame from non-authenticated peer \"%s\"\n", this->url.c_str());
+			return false;
+		}
+
+		// only the lengths, so the receiver doesn't get a frame it can't parse
+		size_t packets = 0;
+		if (!forEachRelayPacket(frame, length, [&packets](const uint8_t*, size_t) { ++packets; })) {
+			LOG_WARNING("Malformed relay frame from peer %u (%s)\n", this->peerId, this->url.c_str());
+			return false;
+		}
+
+		size_t bytes = length - RELAY_FRAME_HEADER_SIZE - packets * RELAY_PACKET_HEADER_SIZE;
+		peerServer->metrics.relayFrames.add();
+		peerServer->metrics.relayBytes.add(bytes);
+
+		PeerId peer = relayFramePeer(frame);
+		LOG_DEBUG("Relay frame relaying %zu bytes from peer %u to %u\n", bytes, this->peerId, peer);
+
+		auto it = game->peers.find(peer);
+		if (it == game->peers.end()) {
+			LOG_WARNING_LIMITED("Relay frame from peer %u to %u, no such peer\n", this->peerId, peer);
+			sendNoSuchPeer(this, peer);
+			return true;
+		}
+
+		P2PSignalConnection *otherPeer = it->second;
+		if (shedRelay(otherPeer, bytes)) {
+			return true;
+		}
+
+		if (!otherPeer->relayFrames) {
+			// the other end only knows P2PRelayData, whose length is 16 bit
+			forEachRelayPacket(frame, length, [this, otherPeer](const uint8_t* data, size_t size) {
+				while (size) {
+					uint16_t chunk = uint16_t(std::min<size_t>(size, UINT16_MAX));
+					sendP2PRelayData(otherPeer, this->peerId, data, chunk);
+					data += chunk;
+					size -= chunk;
+				}
+			});
+			return true;
+		}
+
+		// the one copy, and the sender's peer id in place of the receiver's
+		OutMessageRef msg = OutMessage::create(frame, length);
+		setRelayFramePeer(msg->data(), this->peerId);
+		otherPeer->sendMessage(msg);
+		return true;
+	}
+
+	bool P2PSignalConnection::shedRelay(P2PSignalConnection* otherPeer, size_t length)
+	{
+		if (!otherPeer->congested) {
+			return false;
+		}
+
+		// not reading, piling it up would only grow the server
+		peerServer->metrics.relayDroppedBytes.add(length);
+		if (this->backpressure && otherPeer->backpressured.insert(this->peerId).second) {
+			LOG_INFO("Dropping relay data from peer %u to congested peer %u\n", this->peerId, otherPeer->peerId);
+			sendP2PBackpressure(this, otherPeer->peerId, true);
+		}
+		return true;
+	}
+
+	void P2PSignalConnection::drained() {
+		this->congested = false;
+		if (!game) {
+			return;
+		}
+
+		for (PeerId sender : this->backpressured) {
+			auto it = game->peers.find(sender);
+			if (it != game->peers.end()) {
+				sendP2PBackpressure(it->second, this->peerId, false);
+			}
+		}
+		this->backpressured.clear();
+	}
+
 	void P2PSignalConnection::sendMessage(const uint8_t *buff, size_t length) {
-		bool wasEmpty = this->sendBuf.empty();
-		this->sendBuf.insert(this->sendBuf.end(), buff, buff + length);
-		if (wasEmpty) {
-			peerServer->triggerWrite(this->wsi);
+		// the one copy, out of the encoder into a buffer ready for the websocket
+		OutMessageRef msg = OutMessage::create(buff, length);
+		if (this->capture) {
+			*this->capture = std::move(msg);
+			return;
+		}
+
+		sendMessage(msg);
+	}
+
+	void P2PSignalConnection::sendMessage(const OutMessageRef& msg) {
+		if (!this->socketId) {
+			// detached, keep it for when the peer resumes unless too much piles up
+			if (this->sendQueue.size() + msg->size() > MAX_DETACHED_QUEUE_SIZE) {
+				LOG_WARNING_LIMITED("Dropping message for disconnected peer %u\n", this->peerId);
+				return;
+			}
+			this->sendQueue.push(msg);
+			return;
+		}
+
+		if (this->state == Closing) {
+			// the socket is on its way out
+			return;
+		}
+
+		size_t queued = this->socketQueued->load(std::memory_order_relaxed) + msg->size();
+		if (peerServer->sendQueueLimit && queued > peerServer->sendQueueLimit) {
+			// relay data isn't sent anymore and still it piles up, the peer stopped reading
+			LOG_WARNING_LIMITED("Closing peer %u (%s), %zu bytes waiting to be sent\n", this->peerId, this->url.c_str(), queued);
+			peerServer->metrics.slowConsumerDisconnects.add();
+			this->state = Closing;
+			peerServer->closeSocket(this->socketShard, this->socketId);
+			return;
+		}
+
+		this->socketQueued->fetch_add(msg->size(), std::memory_order_relaxed);
+		peerServer->sendToSocket(this->socketShard, this->socketId, msg);
+
+		if (peerServer->sendQueueHighWater && !this->congested && queued >= peerServer->sendQueueHighWater) {
+			this->congested = true;
+			peerServer->watchDrain(this->socketShard, this->socketId);
 		}
 	}
 
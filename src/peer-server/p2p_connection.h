@@ -3,8 +3,12 @@
 #include "humblenet.h"
 #include "humblepeer.h"
 #include "game.h"
+#include "out_queue.h"
 
-struct libwebsocket;
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
 
 namespace humblenet {
 	struct Game;
@@ -17,41 +21,100 @@ namespace humblenet {
 		, Closed
 	};
 
+	// messages queued for a detached connection past this are dropped
+	const size_t MAX_DETACHED_QUEUE_SIZE = 64 * 1024;
+
 	struct P2PSignalConnection {
 		Server* peerServer;
 
 		std::vector<uint8_t> recvBuf;
-		std::vector<char> sendBuf;
-		struct libwebsocket *wsi;
+		OutQueue sendQueue;	// only while detached, messages for when the peer resumes
+
+		// the SignalSocket this peer is on, socketId is 0 while detached, waiting for the peer to reconnect
+		Server* socketShard;
+		uint64_t socketId;
+		// what's waiting to be sent on it, see SignalSocket
+		std::shared_ptr<std::atomic<size_t>> socketQueued;
 		PeerId peerId;
 		HumblePeerState state;
 
 		bool webRTCsupport;
 		bool trickleICE;
+		bool compactSDP;
+		bool aliasCache;
+		bool aliasAck;
+		bool backpressure;
+		bool relayFrames;
 
 		Game *game;
 
 		std::string url;
 
+		// the token the peer can resume this session with, and how long it
+		// is held after the websocket closed
+		std::string reconnectToken;
+		std::chrono::steady_clock::time_point detachedUntil;
+
 		// peers which have a P2P connection with this one
 		// pointer not owned
 		std::unordered_set<P2PSignalConnection *> connectedPeers;
+		// the ones this peer made an offer to which hasn't been answered, and when. Past
+		// the server's negotiationTimeout they are dropped from connectedPeers too
+		std::unordered_map<P2PSignalConnection *, std::chrono::steady_clock::time_point> unansweredOffers;
 
+		// more than the high water mark is waiting to be sent on the websocket, relay data
+		// for this peer is dropped until it's back under the low one
+		bool congested;
+		// the peers told their relay data to this one is being dropped
+		std::unordered_set<PeerId> backpressured;
 
 		P2PSignalConnection(Server* s)
 		: peerServer(s)
-		, wsi(NULL)
+		, socketShard(NULL)
+		, socketId(0)
 		, peerId (0)
 		, state(Opening)
 		, webRTCsupport(false)
 		, trickleICE(true)
+		, compactSDP(false)
+		, aliasCache(false)
+		, aliasAck(false)
+		, backpressure(false)
+		, relayFrames(false)
 		, game(NULL)
+		, congested(false)
+		, capture(NULL)
 		{
 		}
 
 		ha_bool processMsg(const HumblePeer::Message* msg);
+		// a whole relay frame, forwarded with only the peer id changed
+		ha_bool processRelayFrame(const uint8_t* frame, size_t length);
+
+		// the websocket's queue is under the low water mark, the peers which were told their
+		// relay data to this one was dropped hear it isn't anymore
+		void drained();
+
+		// true if relay data to otherPeer has to be dropped, it isn't reading
+		bool shedRelay(P2PSignalConnection* otherPeer, size_t length);
 
 		void sendMessage(const uint8_t *buff, size_t length);
+		void sendMessage(const OutMessageRef& msg);
+
+		// Encodes a message once, to send the same to several peers. send is a humblepeer
+		// send function, which is called with this connection but doesn't send on it
+		template<typename Send>
+		OutMessageRef encodeMessage(Send send)
+		{
+			OutMessageRef msg;
+			capture = &msg;
+			send(this);
+			capture = NULL;
+			return msg;
+		}
+
+		// where sendMessage puts the message while encodeMessage runs
+		OutMessageRef* capture;
 	};
 
 }
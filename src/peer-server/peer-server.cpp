@@ -7,9 +7,13 @@
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 #ifdef _WIN32
 #	define WIN32_LEAN_AND_MEAN
@@ -35,7 +39,9 @@
 #include "server.h"
 #include "logging.h"
 #include "config.h"
+#include "event_loop.h"
 #include "game_db.h"
+#include "turn_server.h"
 
 using namespace humblenet;
 
@@ -48,12 +54,7 @@ namespace humblenet {
 
 }  // namespace humblenet
 
-static std::unique_ptr<Server> peerServer;
-
-
-static ha_bool p2pSignalProcess(const humblenet::HumblePeer::Message *msg, void *user_data) {
-	return reinterpret_cast<P2PSignalConnection *>(user_data)->processMsg(msg);
-}
+static std::vector<std::unique_ptr<Server>> shards;
 
 int callback_default(struct libwebsocket_context *context
 				  , struct libwebsocket *wsi
@@ -62,6 +63,37 @@ int callback_default(struct libwebsocket_context *context
 
 
 	switch (reason) {
+	case LWS_CALLBACK_HTTP:
+		{
+			// anything but the websocket is a scrape of the metrics
+			Server* shard = reinterpret_cast<Server*>(libwebsocket_context_user(context));
+			shard->metrics.serviceEvent();
+
+			std::string path(reinterpret_cast<const char*>(in), len);
+			path = path.substr(0, path.find('?'));
+			if (shard->metricsPath.empty() || path != shard->metricsPath) {
+				libwebsockets_return_http_status(context, wsi, HTTP_STATUS_NOT_FOUND, NULL);
+				return -1;
+			}
+
+			std::string body = formatMetrics(shard->shards);
+			std::string response = "HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4\r\n"
+				"Content-Length: " + std::to_string(body.size()) + "\r\n"
+				"\r\n" + body;
+
+			// what the socket doesn't take now is kept by libwebsockets, and still sent
+			// when the connection is closed right after
+			libwebsocket_write(wsi, (unsigned char*)&response[0], response.size(), LWS_WRITE_HTTP);
+			return -1;
+		}
+
+	case LWS_CALLBACK_FILTER_HTTP_CONNECTION:
+		break;
+
+	case LWS_CALLBACK_CLOSED_HTTP:
+		break;
+
 	case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
 		break;
 
@@ -89,15 +121,32 @@ int callback_default(struct libwebsocket_context *context
 		break;
 
 	case LWS_CALLBACK_ADD_POLL_FD:
+		{
+			// the sockets are polled by the shard's loop
+			Server* shard = reinterpret_cast<Server*>(libwebsocket_context_user(context));
+			struct libwebsocket_pollargs* pa = reinterpret_cast<struct libwebsocket_pollargs*>(in);
+			shard->loop.addSocket(pa->fd, pa->events);
+		}
 		break;
 
 	case LWS_CALLBACK_DEL_POLL_FD:
+		{
+			Server* shard = reinterpret_cast<Server*>(libwebsocket_context_user(context));
+			struct libwebsocket_pollargs* pa = reinterpret_cast<struct libwebsocket_pollargs*>(in);
+			shard->loop.removeSocket(pa->fd);
+		}
 		break;
 
 	case LWS_CALLBACK_CHANGE_MODE_POLL_FD:
+		{
+			Server* shard = reinterpret_cast<Server*>(libwebsocket_context_user(context));
+			struct libwebsocket_pollargs* pa = reinterpret_cast<struct libwebsocket_pollargs*>(in);
+			shard->loop.changeSocket(pa->fd, pa->events);
+		}
 		break;
 
 	case LWS_CALLBACK_LOCK_POLL:
+		// a context is only serviced by its shard's thread
 		break;
 
 	case LWS_CALLBACK_UNLOCK_POLL:
@@ -117,14 +166,14 @@ int callback_humblepeer(struct libwebsocket_context *context
 				  , enum libwebsocket_callback_reasons reason
 				  , void *user, void *in, size_t len) {
 
+	// the shard serving this context
+	Server* shard = reinterpret_cast<Server*>(libwebsocket_context_user(context));
+	shard->metrics.serviceEvent();
 
 	switch (reason) {
 
 	case LWS_CALLBACK_ESTABLISHED:
 		{
-			std::unique_ptr<P2PSignalConnection> conn(new P2PSignalConnection(peerServer.get()));
-			conn->wsi = wsi;
-
 			struct sockaddr_storage addr;
 			socklen_t len = sizeof(addr);
 			size_t bufsize = std::max(INET_ADDRSTRLEN, INET6_ADDRSTRLEN) + 1;
@@ -145,68 +194,36 @@ int callback_humblepeer(struct libwebsocket_context *context
 				inet_ntop(AF_INET6, &s->sin6_addr, &ipstr[0], INET6_ADDRSTRLEN);
 			}
 
-			conn->url = std::string(&ipstr[0]);
-			conn->url += std::string(":");
-			conn->url += std::to_string(port);
+			std::string url = std::string(&ipstr[0]);
+			url += std::string(":");
+			url += std::to_string(port);
 
-			LOG_INFO("New connection from \"%s\"\n", conn->url.c_str());
+			LOG_INFO("New connection from \"%s\"\n", url.c_str());
 
-			peerServer->signalConnections.emplace(wsi, std::move(conn));
+			shard->openSocket(wsi, url);
 		}
 
 		break;
 
 
 	case LWS_CALLBACK_CLOSED:
-		{
-			auto it = peerServer->signalConnections.find(wsi);
-			if (it == peerServer->signalConnections.end()) {
-				// Tried to close nonexistent signal connection
-				LOG_ERROR("Tried to close a signaling connection which doesn't appear to exist\n");
-				return 0;
-			}
-
-			P2PSignalConnection *conn = it->second.get();
-			assert(conn != NULL);
-
-			LOG_INFO("Closing connection to peer %u (%s)\n", conn->peerId, conn->url.c_str());
-
-			if (conn->peerId != 0) {
-				// remove it from list of peers
-				assert(conn->game != NULL);
-				auto it2 = conn->game->peers.find(conn->peerId);
-				// if peerId is valid (nonzero)
-				// this MUST exist
-				assert(it2 != conn->game->peers.end());
-				conn->game->peers.erase(it2);
-
-				// remove any aliases to this peer
-				conn->game->erasePeerAliases(conn->peerId);
-			}
-
-			// and finally remove from list of signal connections
-			// this is unique_ptr so it also destroys the object
-			peerServer->signalConnections.erase(it);
-		}
-
+		shard->socketClosed(wsi);
 		break;
 
 	case LWS_CALLBACK_RECEIVE:
 		{
-			auto it = peerServer->signalConnections.find(wsi);
-			if (it == peerServer->signalConnections.end()) {
+			shard->metrics.bytesReceived.add(len);
+
+			auto it = shard->sockets.find(wsi);
+			if (it == shard->sockets.end()) {
 				// Receive on nonexistent signal connection
 				return 0;
 			}
 
-			char *inBuf = reinterpret_cast<char *>(in);
-			it->second->recvBuf.insert(it->second->recvBuf.end(), inBuf, inBuf + len);
-
-			// function which will parse recvBuf
-			ha_bool retval = parseMessage(it->second->recvBuf, p2pSignalProcess, it->second.get());
-			if (!retval) {
+			// handed to the shard of the peer's game
+			if (!shard->socketReceived(&it->second, reinterpret_cast<const uint8_t *>(in), len)) {
 				// error in parsing, close connection
-				LOG_ERROR("Error in parsing message from \"%s\"\n", it->second->url.c_str());
+				LOG_ERROR("Error in parsing message from \"%s\"\n", it->second.url.c_str());
 				return -1;
 			}
 		}
@@ -216,38 +233,41 @@ int callback_humblepeer(struct libwebsocket_context *context
 	case LWS_CALLBACK_SERVER_WRITEABLE:
 		{
 			assert(wsi != NULL);
-			auto it = peerServer->signalConnections.find(wsi);
-			if (it == peerServer->signalConnections.end()) {
+			auto it = shard->sockets.find(wsi);
+			if (it == shard->sockets.end()) {
 				// nonexistent signal connection, close it
 				return -1;
 			}
 
-			P2PSignalConnection *conn = it->second.get();
-			if (conn->wsi != wsi) {
-				// this connection is not the one currently active in humbleNetState.
-				// this one must be obsolete, close it
+			SignalSocket *sock = &it->second;
+			if (sock->closing) {
+				// failed, or a resumed session took over from this connection
 				return -1;
 			}
 
-			if (conn->sendBuf.empty()) {
-				// no data in sendBuf
-				return 0;
-			}
-
-			size_t bufsize = conn->sendBuf.size();
-			std::vector<unsigned char> sendbuf(LWS_SEND_BUFFER_PRE_PADDING + bufsize + LWS_SEND_BUFFER_POST_PADDING, 0);
-			memcpy(&sendbuf[LWS_SEND_BUFFER_PRE_PADDING], &conn->sendBuf[0], bufsize);
-			int retval = libwebsocket_write(conn->wsi, &sendbuf[LWS_SEND_BUFFER_PRE_PADDING], bufsize, LWS_WRITE_BINARY);
-			if (retval < 0) {
-				// error while sending, close the connection
-				return -1;
+			auto write = [wsi, shard](uint8_t* buf, size_t length) {
+				int n = libwebsocket_write(wsi, buf, length, LWS_WRITE_BINARY);
+				if (n > 0) {
+					shard->metrics.bytesSent.add(n);
+				}
+				return n;
+			};
+
+			// frames until the socket stops taking all of one
+			size_t queued = sock->sendQueue.size();
+			while (!sock->sendQueue.empty()) {
+				if (sock->sendQueue.writeFrame(write, shard->writeBuf) < 0) {
+					// error while sending, close the connection
+					return -1;
+				}
+				if (sock->sendQueue.inFrame() || lws_send_pipe_choked(wsi)) {
+					break;
+				}
 			}
+			shard->socketWritten(sock, queued - sock->sendQueue.size());
 
-			// successful write
-			conn->sendBuf.erase(conn->sendBuf.begin(), conn->sendBuf.begin() + retval);
-			// check if it was only partial
-			if (!conn->sendBuf.empty()) {
-				libwebsocket_callback_on_writable(context, conn->wsi);
+			if (!sock->sendQueue.empty()) {
+				libwebsocket_callback_on_writable(context, wsi);
 			}
 		}
 		break;
@@ -274,7 +294,8 @@ int callback_humblepeer(struct libwebsocket_context *context
 // TODO: would one callback be enough?
 struct libwebsocket_protocols protocols[] = {
 	  { "default", callback_default, 1 }
-	, { "humblepeer", callback_humblepeer, 1 }
+	// partial writes are left to OutQueue, which continues the frame from its own buffer
+	, { "humblepeer", callback_humblepeer, 1, 0, 1 }
 	, { NULL, NULL, 0 }
 };
 
@@ -291,11 +312,43 @@ void help(const std::string& prog, const std::string& error = "")
 		<< std::endl;
 }
 
-static bool keepGoing = true;
+static std::atomic<bool> keepGoing(true);
 
-void sighandler(int sig)
+// on the first shard's thread
+static void stop()
 {
 	keepGoing = false;
+	for (auto& shard : shards) {
+		shard->loop.wake();
+	}
+}
+
+static void serviceShard(Server* shard)
+{
+	while (keepGoing) {
+		// sleeps until a socket, the maintenance timer, a signal or another shard
+		// posting to the mailbox has something
+		shard->loop.service(shard->context);
+
+		if (shard->runMailbox()) {
+			shard->metrics.serviceEvent();
+		}
+
+		shard->metrics.serviceDone();
+	}
+}
+
+// once a second, on the shard's thread
+static void maintainShard(Server* shard)
+{
+	shard->metrics.serviceEvent();
+
+	// libwebsockets' own timeouts, e.g. for handshakes
+	libwebsocket_service_fd(shard->context, NULL);
+
+	shard->expireDetachedConnections();
+	shard->expireNegotiations();
+	shard->publishMetrics();
 }
 
 int main(int argc, char *argv[]) {
@@ -348,7 +401,14 @@ int main(int argc, char *argv[]) {
 #endif // _WIN32
 	}
 
+	// taken by the first shard's loop, none of the threads started from here on gets them
+	EventLoop::holdSignals({ SIGINT, SIGTERM });
+
+	bool knownLogLevel = logSetLevel(config.logLevel);
 	logFileOpen(config.logFile);
+	if (!knownLogLevel) {
+		LOG_WARNING("Unknown log level: %s, logging at info\n", config.logLevel.c_str());
+	}
 
 	if (!config.pidFile.empty()) {
 		std::ofstream ofs(config.pidFile.c_str());
@@ -357,9 +417,6 @@ int main(int argc, char *argv[]) {
 #endif // _WIN32
 	}
 
-	signal(SIGINT, sighandler);
-	signal(SIGTERM, sighandler);
-
 	std::shared_ptr<GameDB> gameDB;
 
 	if (config.gameDB.empty()) {
@@ -371,15 +428,55 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	peerServer.reset(new Server(gameDB));
-	peerServer->stunServerAddress = config.stunServerAddress;
+	std::unique_ptr<TurnServer> turnServer;
+	if (config.turnPort > 0) {
+		turnServer.reset(new TurnServer());
+		turnServer->serverAddress = config.turnServerAddress;
+		turnServer->credentialLifetime = std::chrono::seconds(std::max(60, config.turnCredentialLifetime));
+		turnServer->allowLoopback = config.turnAllowLoopback;
+		if (!turnServer->start(config.turnRelayAddress, config.turnPort)) {
+			exit(1);
+		}
+	}
+
+	int threads = config.threads;
+	if (threads <= 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+#ifndef SO_REUSEPORT
+	if (threads > 1) {
+		LOG_WARNING("Can't share the port between threads here, running just one\n");
+		threads = 1;
+	}
+#endif
+
+	for (int i = 0; i < threads; ++i) {
+		std::unique_ptr<Server> shard(new Server(gameDB));
+		shard->shardIndex = i;
+		shard->stunServerAddress = config.stunServerAddress;
+		shard->turnServer = turnServer.get();
+		shard->reconnectGracePeriod = std::chrono::seconds(config.reconnectGracePeriod);
+		shard->negotiationTimeout = std::chrono::seconds(std::max(0, config.negotiationTimeout));
+		shard->metricsPath = config.metricsPath;
+		shard->sendQueueHighWater = std::max(0, config.sendQueueHighWater);
+		shard->sendQueueLowWater = std::max(0, std::min(config.sendQueueLowWater, config.sendQueueHighWater));
+		shard->sendQueueLimit = std::max(0, config.sendQueueLimit);
+		shards.push_back(std::move(shard));
+	}
+	for (auto& shard : shards) {
+		for (auto& other : shards) {
+			shard->shards.push_back(other.get());
+		}
+	}
 
 	struct lws_context_creation_info info;
 	memset(&info, 0, sizeof(info));
-	info.protocols = protocols;
 	info.port = config.port;
 	info.gid = -1;
 	info.uid = -1;
+	if (threads > 1) {
+		info.options |= LWS_SERVER_OPTION_REUSEPORT;
+	}
 #define WS_OPT(member, var) info.member = (!var.empty()) ? var.c_str() : NULL
 	WS_OPT(iface, config.iface);
 	WS_OPT(ssl_cert_filepath, config.sslCertFile);
@@ -388,20 +485,56 @@ int main(int argc, char *argv[]) {
 	WS_OPT(ssl_cipher_list, config.sslCipherList);
 #undef WS_OPT
 
-	peerServer->context = libwebsocket_create_context(&info);
-	if (peerServer->context == NULL) {
-		// TODO: error message
-		exit(1);
+	// a context for every shard, all listening on the port. Each needs its own
+	// protocols, libwebsockets keeps the owning context in them
+	std::vector<std::vector<struct libwebsocket_protocols>> shardProtocols;
+	for (auto& shard : shards) {
+		// before the context, which adds its listening socket
+		if (!shard->loop.open()) {
+			exit(1);
+		}
+		shardProtocols.emplace_back(std::begin(protocols), std::end(protocols));
+		info.protocols = shardProtocols.back().data();
+		info.user = shard.get();
+		shard->context = libwebsocket_create_context(&info);
+		if (shard->context == NULL) {
+			// TODO: error message
+			exit(1);
+		}
+
+		Server* s = shard.get();
+		shard->loop.every(std::chrono::seconds(1), [s] {
+			maintainShard(s);
+		});
+	}
+	shards[0]->loop.onSignal(SIGINT, stop);
+	shards[0]->loop.onSignal(SIGTERM, stop);
+	if (gameDB->changeFd() >= 0) {
+		GameDB* db = gameDB.get();
+		shards[0]->loop.watch(db->changeFd(), [db] {
+			db->reload();
+		});
 	}
 
-	while (keepGoing) {
-		// use timeout so we will eventually process signals
-		// but relatively long to reduce CPU load
-		// TODO: configurable timeout
-		libwebsocket_service(peerServer->context, 200);
+	LOG_INFO("Serving on port %d with %d threads\n", config.port, threads);
+
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < shards.size(); ++i) {
+		workers.emplace_back(serviceShard, shards[i].get());
+	}
+	if (turnServer) {
+		workers.emplace_back([&turnServer] {
+			turnServer->run(keepGoing);
+		});
+	}
+
+	serviceShard(shards[0].get());
+
+	for (auto& worker : workers) {
+		worker.join();
 	}
 
-	peerServer.reset();
+	shards.clear();
 
 	if (!config.pidFile.empty()) {
 #ifndef _WIN32
@@ -2,12 +2,71 @@
 #include "game_db.h"
 #include "logging.h"
 #include "hmac.h"
+#include "turn_server.h"
+
+#include <libwebsockets.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <random>
 
 namespace humblenet {
+	// unique over all the shards, so a socket id alone finds the connection
+	static std::atomic<uint64_t> nextSocketId(1);
+
+	static ha_bool p2pSignalProcess(const HumblePeer::Message *msg, void *user_data)
+	{
+		return reinterpret_cast<P2PSignalConnection *>(user_data)->processMsg(msg);
+	}
+
+	static ha_bool p2pSignalRelay(const uint8_t *frame, size_t length, void *user_data)
+	{
+		return reinterpret_cast<P2PSignalConnection *>(user_data)->processRelayFrame(frame, length);
+	}
+
+	struct HelloPeek {
+		bool seen;
+		std::string gameToken;
+
+		HelloPeek() : seen(false) {}
+	};
+
+	static ha_bool peekHello(const HumblePeer::Message *msg, void *user_data)
+	{
+		HelloPeek* peek = reinterpret_cast<HelloPeek*>(user_data);
+		if (peek->seen) {
+			return true;
+		}
+		peek->seen = true;
+
+		if (msg->message_type() == HumblePeer::MessageType::HelloServer) {
+			auto hello = reinterpret_cast<const HumblePeer::HelloServer*>(msg->message());
+			if (hello->gameToken()) {
+				peek->gameToken = hello->gameToken()->str();
+			}
+		}
+		return true;
+	}
+
 	Server::Server(std::shared_ptr<GameDB> _gameDB)
 	: context(NULL)
+	, shardIndex(0)
+	, reconnectGracePeriod(0)
+	, negotiationTimeout(0)
+	, sendQueueHighWater(0)
+	, sendQueueLowWater(0)
+	, sendQueueLimit(0)
+	, turnServer(NULL)
 	, m_gameDB(_gameDB)
 	{
+		// tokens only have to survive as long as this process
+		std::random_device random;
+		for (auto& b : m_tokenSecret) {
+			b = static_cast<uint8_t>(random());
+		}
+		m_tokenCounter = (uint64_t(random()) << 32) | random();
 	}
 
 	Game *Server::getVerifiedGame(const HumblePeer::HelloServer* hello)
@@ -29,14 +88,14 @@ namespace humblenet {
 
 		// Verify signature
 		if (record.verify) {
-			HMACContext hmac;
-			HMACInit(&hmac, (const uint8_t*)record.secret.c_str(), record.secret.size());
+			// keyed already
+			HMACContext hmac = record.hmac;
 
 			auto authToken = hello->authToken();
 			if (authToken) {
 				HMACInput(&hmac, authToken->Data(), authToken->size());
 			}
-			auto reconnect = hello->authToken();
+			auto reconnect = hello->reconnectToken();
 			if (reconnect) {
 				HMACInput(&hmac, reconnect->Data(), reconnect->size());
 			}
@@ -59,6 +118,7 @@ namespace humblenet {
 
 			if (signature.compare(gameSignature->c_str()) != 0) {
 				LOG_ERROR("Invalid game signature provided for token: %s\n", gameToken->c_str());
+				metrics.hmacFailures.add();
 				return nullptr;
 			}
 		}
@@ -74,15 +134,490 @@ namespace humblenet {
 		return it->second.get();
 	}
 
-	void Server::triggerWrite(struct libwebsocket *wsi)
+	void Server::post(Server* shard, Mailbox::Task task)
+	{
+		assert(shard != this);
+
+		if (shard->mailbox.post(std::move(task))) {
+			shard->loop.wake();
+		}
+	}
+
+	size_t Server::runMailbox()
+	{
+		return mailbox.run();
+	}
+
+	SignalSocket* Server::openSocket(struct libwebsocket* wsi, const std::string& url)
+	{
+		SignalSocket& sock = sockets[wsi];
+		sock.wsi = wsi;
+		sock.id = nextSocketId++;
+		sock.url = url;
+		sock.queued = std::make_shared<std::atomic<size_t>>(0);
+
+		socketsById.emplace(sock.id, &sock);
+		return &sock;
+	}
+
+	Server* Server::routeHello(SignalSocket* sock, bool& error)
+	{
+		// parse a copy, the game's shard gets helloBuf as it came in
+		std::vector<uint8_t> buf(sock->helloBuf);
+		HelloPeek peek;
+
+		error = !parseMessage(buf, peekHello, &peek);
+		if (error || !peek.seen) {
+			return NULL;
+		}
+
+		GameRecord record;
+		if (peek.gameToken.empty() || !m_gameDB->findByToken(peek.gameToken, record)) {
+			return this;
+		}
+
+		return shards[record.game_id % shards.size()];
+	}
+
+	bool Server::socketReceived(SignalSocket* sock, const uint8_t* data, size_t length)
+	{
+		std::vector<uint8_t> hello;
+		Server* shard = sock->gameShard;
+
+		if (!shard) {
+			sock->helloBuf.insert(sock->helloBuf.end(), data, data + length);
+
+			bool error = false;
+			shard = routeHello(sock, error);
+			if (error) {
+				metrics.parseFailures.add();
+				return false;
+			}
+			if (!shard) {
+				// wait for the rest of the hello
+				return true;
+			}
+
+			sock->gameShard = shard;
+			hello.swap(sock->helloBuf);
+			data = hello.data();
+			length = hello.size();
+
+			if (shard == this) {
+				connectionOpened(this, sock->id, sock->url, sock->queued);
+			} else {
+				Server* socketShard = this;
+				uint64_t socketId = sock->id;
+				std::string url = sock->url;
+				auto queued = sock->queued;
+				post(shard, [shard, socketShard, socketId, url, queued] {
+					shard->connectionOpened(socketShard, socketId, url, queued);
+				});
+			}
+		}
+
+		if (shard == this) {
+			connectionReceived(sock->id, data, length);
+		} else {
+			uint64_t socketId = sock->id;
+			auto bytes = std::make_shared<std::vector<uint8_t>>(data, data + length);
+			post(shard, [shard, socketId, bytes] {
+				shard->connectionReceived(socketId, bytes->data(), bytes->size());
+			});
+		}
+
+		return true;
+	}
+
+	void Server::socketClosed(struct libwebsocket* wsi)
+	{
+		auto it = sockets.find(wsi);
+		if (it == sockets.end()) {
+			// Tried to close nonexistent signal connection
+			LOG_ERROR("Tried to close a signaling connection which doesn't appear to exist\n");
+			return;
+		}
+
+		Server* shard = it->second.gameShard;
+		uint64_t socketId = it->second.id;
+		if (shard == this) {
+			connectionClosed(socketId);
+		} else if (shard) {
+			post(shard, [shard, socketId] {
+				shard->connectionClosed(socketId);
+			});
+		}
+
+		socketsById.erase(socketId);
+		sockets.erase(it);
+	}
+
+	void Server::socketSend(uint64_t socketId, OutMessageRef msg)
+	{
+		auto it = socketsById.find(socketId);
+		if (it == socketsById.end()) {
+			// closed while this was on its way
+			return;
+		}
+
+		SignalSocket* sock = it->second;
+		if (sock->closing) {
+			sock->queued->fetch_sub(msg->size(), std::memory_order_relaxed);
+			return;
+		}
+
+		bool wasEmpty = sock->sendQueue.empty();
+		sock->sendQueue.push(std::move(msg));
+		if (wasEmpty) {
+			libwebsocket_callback_on_writable(context, sock->wsi);
+		}
+	}
+
+	void Server::socketWritten(SignalSocket* sock, size_t written)
+	{
+		size_t queued = sock->queued->fetch_sub(written, std::memory_order_relaxed) - written;
+		if (!sock->drainWatched || queued > sendQueueLowWater) {
+			return;
+		}
+
+		sock->drainWatched = false;
+		Server* shard = sock->gameShard;
+		uint64_t socketId = sock->id;
+		if (shard == this) {
+			connectionDrained(socketId);
+		} else if (shard) {
+			post(shard, [shard, socketId] {
+				shard->connectionDrained(socketId);
+			});
+		}
+	}
+
+	void Server::socketWatchDrain(uint64_t socketId)
+	{
+		auto it = socketsById.find(socketId);
+		if (it == socketsById.end()) {
+			return;
+		}
+
+		it->second->drainWatched = true;
+		// it may have drained already
+		socketWritten(it->second, 0);
+	}
+
+	void Server::socketClose(uint64_t socketId)
+	{
+		auto it = socketsById.find(socketId);
+		if (it == socketsById.end()) {
+			return;
+		}
+
+		it->second->closing = true;
+		libwebsocket_callback_on_writable(context, it->second->wsi);
+		// the other end may have stopped reading, then it never is
+		libwebsocket_set_timeout(it->second->wsi, PENDING_TIMEOUT_CLOSE_ACK, 1);
+	}
+
+	void Server::connectionOpened(Server* socketShard, uint64_t socketId, const std::string& url, const std::shared_ptr<std::atomic<size_t>>& queued)
+	{
+		std::unique_ptr<P2PSignalConnection> conn(new P2PSignalConnection(this));
+		conn->socketShard = socketShard;
+		conn->socketId = socketId;
+		conn->socketQueued = queued;
+		conn->url = url;
+
+		signalConnections.emplace(socketId, std::move(conn));
+	}
+
+	void Server::connectionReceived(uint64_t socketId, const uint8_t* data, size_t length)
+	{
+		auto it = signalConnections.find(socketId);
+		if (it == signalConnections.end()) {
+			return;
+		}
+
+		P2PSignalConnection* conn = it->second.get();
+		if (conn->state == Closing) {
+			// already failed or taken over, the socket is on its way out
+			return;
+		}
+
+		// parses straight from the payload, only partial messages are kept in recvBuf
+		if (!parseMessage(conn->recvBuf, data, length, p2pSignalProcess, conn, p2pSignalRelay)) {
+			// error in parsing, close connection
+			LOG_ERROR("Error in parsing message from \"%s\"\n", conn->url.c_str());
+			metrics.parseFailures.add();
+			conn->state = Closing;
+			closeSocket(conn->socketShard, socketId);
+		}
+	}
+
+	void Server::connectionClosed(uint64_t socketId)
+	{
+		auto it = signalConnections.find(socketId);
+		if (it == signalConnections.end()) {
+			return;
+		}
+
+		P2PSignalConnection *conn = it->second.get();
+		LOG_INFO("Closing connection to peer %u (%s)\n", conn->peerId, conn->url.c_str());
+
+		// a peer which can still resume is held on to, otherwise it's removed from its game
+		closeConnection(std::move(it->second));
+
+		// and finally remove from list of signal connections
+		signalConnections.erase(it);
+	}
+
+	void Server::connectionDrained(uint64_t socketId)
+	{
+		auto it = signalConnections.find(socketId);
+		if (it == signalConnections.end()) {
+			return;
+		}
+
+		it->second->drained();
+	}
+
+	void Server::sendToSocket(Server* socketShard, uint64_t socketId, const OutMessageRef& msg)
+	{
+		if (socketShard == this) {
+			socketSend(socketId, msg);
+			return;
+		}
+
+		// the message itself is shared, not copied
+		post(socketShard, [socketShard, socketId, msg] {
+			socketShard->socketSend(socketId, msg);
+		});
+	}
+
+	void Server::watchDrain(Server* socketShard, uint64_t socketId)
 	{
-		libwebsocket_callback_on_writable(context, wsi);
+		if (socketShard == this) {
+			socketWatchDrain(socketId);
+			return;
+		}
+
+		post(socketShard, [socketShard, socketId] {
+			socketShard->socketWatchDrain(socketId);
+		});
 	}
 
-	void Server::populateStunServers(std::vector<ICEServer> &servers)
+	void Server::closeSocket(Server* socketShard, uint64_t socketId)
+	{
+		if (socketShard == this) {
+			socketClose(socketId);
+			return;
+		}
+
+		post(socketShard, [socketShard, socketId] {
+			socketShard->socketClose(socketId);
+		});
+	}
+
+	void Server::populateIceServers(std::vector<ICEServer> &servers, PeerId peerId)
 	{
 		if( ! stunServerAddress.empty() ) {
 			servers.emplace_back(stunServerAddress);
 		}
+		if (turnServer) {
+			servers.push_back(turnServer->credentials(peerId));
+		}
+	}
+
+	static std::string signToken(const uint8_t* secret, size_t secretSize, GameId gameId, const std::string& token)
+	{
+		std::string game = std::to_string(gameId) + ":";
+
+		HMACContext hmac;
+		HMACInit(&hmac, secret, secretSize);
+		HMACInput(&hmac, (const uint8_t*)game.data(), game.size());
+		HMACInput(&hmac, (const uint8_t*)token.data(), token.size());
+
+		uint8_t hmacresult[HMAC_DIGEST_SIZE];
+		HMACResult(&hmac, hmacresult);
+		std::string signature;
+		HMACResultToHex(hmacresult, signature);
+		return signature;
+	}
+
+	// looks at every byte whatever the first difference, so how long it takes doesn't
+	// tell how much of a forged token was right
+	static bool sameToken(const std::string& a, const std::string& b)
+	{
+		if (a.size() != b.size()) {
+			return false;
+		}
+		uint8_t difference = 0;
+		for (size_t i = 0; i < a.size(); ++i) {
+			difference |= static_cast<uint8_t>(a[i] ^ b[i]);
+		}
+		return difference == 0;
+	}
+
+	// <peer id>.<nonce>.<signature of game id, peer id and nonce>
+	std::string Server::createReconnectToken(Game* game, PeerId peerId)
+	{
+		std::string token = std::to_string(peerId) + "." + std::to_string(m_tokenCounter++);
+		return token + "." + signToken(m_tokenSecret, sizeof(m_tokenSecret), game->gameId, token);
+	}
+
+	P2PSignalConnection* Server::findReconnectable(Game* game, const std::string& token)
+	{
+		size_t nonce = token.find('.');
+		size_t signature = (nonce == std::string::npos) ? nonce : token.find('.', nonce + 1);
+		if (signature == std::string::npos
+			|| !sameToken(token.substr(signature + 1), signToken(m_tokenSecret, sizeof(m_tokenSecret), game->gameId, token.substr(0, signature)))) {
+			LOG_WARNING("Invalid reconnect token for game %u\n", game->gameId);
+			return NULL;
+		}
+
+		PeerId peerId = static_cast<PeerId>(strtoul(token.c_str(), NULL, 10));
+		auto it = game->peers.find(peerId);
+		if (it == game->peers.end() || !sameToken(it->second->reconnectToken, token)) {
+			// expired, or replaced by a newer token
+			return NULL;
+		}
+		return it->second;
+	}
+
+	void Server::resumePeer(P2PSignalConnection* conn, P2PSignalConnection* previous)
+	{
+		Game* game = previous->game;
+		assert(conn->game == game);
+		assert(conn->peerId == previous->peerId);
+
+		game->peers[conn->peerId] = conn;
+
+		conn->connectedPeers.swap(previous->connectedPeers);
+		conn->unansweredOffers.swap(previous->unansweredOffers);
+		for (auto& it : game->peers) {
+			if (it.second->connectedPeers.erase(previous)) {
+				it.second->connectedPeers.insert(conn);
+			}
+			auto offer = it.second->unansweredOffers.find(previous);
+			if (offer != it.second->unansweredOffers.end()) {
+				auto when = offer->second;
+				it.second->unansweredOffers.erase(offer);
+				it.second->unansweredOffers.emplace(conn, when);
+			}
+		}
+
+		// the new websocket's queue is empty
+		previous->drained();
+
+		// messages which arrived while the peer was away
+		while (OutMessageRef msg = previous->sendQueue.pop()) {
+			conn->sendMessage(msg);
+		}
+
+		if (previous->socketId) {
+			// the old websocket hasn't noticed it's gone yet, close it without touching the session
+			previous->peerId = 0;
+			previous->game = NULL;
+			previous->state = Closing;
+			closeSocket(previous->socketShard, previous->socketId);
+		} else {
+			detachedConnections.erase(previous);
+		}
+	}
+
+	void Server::closeConnection(std::unique_ptr<P2PSignalConnection> conn)
+	{
+		if (conn->peerId == 0) {
+			return;
+		}
+
+		if (reconnectGracePeriod.count() > 0 && !conn->reconnectToken.empty()) {
+			LOG_INFO("Holding peer %u for %d s\n", conn->peerId, (int)reconnectGracePeriod.count());
+			conn->socketShard = NULL;
+			conn->socketId = 0;
+			conn->socketQueued.reset();
+			conn->state = Closed;
+			conn->recvBuf.clear();
+			// the detached queue has a limit of its own
+			conn->drained();
+			conn->detachedUntil = std::chrono::steady_clock::now() + reconnectGracePeriod;
+
+			P2PSignalConnection* key = conn.get();
+			detachedConnections.emplace(key, std::move(conn));
+			return;
+		}
+
+		removePeer(conn.get());
+	}
+
+	void Server::expireDetachedConnections()
+	{
+		auto now = std::chrono::steady_clock::now();
+
+		for (auto it = detachedConnections.begin(); it != detachedConnections.end(); ) {
+			if (it->second->detachedUntil <= now) {
+				LOG_INFO("Peer %u did not reconnect in time\n", it->second->peerId);
+				removePeer(it->second.get());
+				it = detachedConnections.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	void Server::expireNegotiations()
+	{
+		if (negotiationTimeout.count() == 0) {
+			return;
+		}
+		auto stale = std::chrono::steady_clock::now() - negotiationTimeout;
+
+		for (auto& game : games) {
+			for (auto& peer : game.second->peers) {
+				P2PSignalConnection* conn = peer.second;
+				for (auto it = conn->unansweredOffers.begin(); it != conn->unansweredOffers.end(); ) {
+					if (it->second <= stale) {
+						LOG_INFO("Peer %u did not answer the offer of peer %u in time\n", it->first->peerId, conn->peerId);
+						conn->connectedPeers.erase(it->first);
+						it = conn->unansweredOffers.erase(it);
+					} else {
+						++it;
+					}
+				}
+			}
+		}
+	}
+
+	void Server::publishMetrics()
+	{
+		ShardGauges gauges;
+		for (auto& game : games) {
+			gauges.peersPerGame.emplace_back(game.first, game.second->peers.size());
+		}
+		gauges.sockets = sockets.size();
+		gauges.detachedPeers = detachedConnections.size();
+		for (auto& sock : sockets) {
+			size_t queued = sock.second.sendQueue.size();
+			gauges.sendQueueBytes += queued;
+			gauges.sendQueueMaxBytes = std::max(gauges.sendQueueMaxBytes, queued);
+		}
+		metrics.publish(std::move(gauges));
+	}
+
+	void Server::removePeer(P2PSignalConnection* conn)
+	{
+		Game* game = conn->game;
+		assert(game != NULL);
+
+		// if peerId is valid (nonzero) this MUST exist
+		auto it = game->peers.find(conn->peerId);
+		assert(it != game->peers.end());
+		game->peers.erase(it);
+
+		// remove any aliases to this peer
+		game->erasePeerAliases(conn->peerId);
+		game->eraseAliasWatcher(conn->peerId);
+
+		for (auto& other : game->peers) {
+			other.second->connectedPeers.erase(conn);
+			other.second->unansweredOffers.erase(conn);
+		}
 	}
-}
\ No newline at end of file
+}
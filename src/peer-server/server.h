@@ -1,38 +1,171 @@
 #pragma once
 
+#include "event_loop.h"
 #include "game.h"
+#include "mailbox.h"
+#include "metrics.h"
+#include "out_queue.h"
 #include "p2p_connection.h"
 
+#include <atomic>
+#include <chrono>
 #include <unordered_map>
 #include <string>
 #include <memory>
+#include <vector>
 
 struct libwebsocket_context;
 struct libwebsocket;
 
 namespace humblenet {
 	class GameDB;
+	class TurnServer;
 
+	// A websocket, owned by the shard whose thread accepted it. The P2PSignalConnection
+	// it carries lives on the shard of its game, which can be another one.
+	struct SignalSocket {
+		struct libwebsocket *wsi;
+		uint64_t id;
+		std::string url;
+
+		// messages waiting for the websocket to be writable
+		OutQueue sendQueue;
+		// the bytes sent to this socket that haven't gone out yet, in sendQueue or still on
+		// their way from the game's shard. That side adds to it, this one takes away
+		std::shared_ptr<std::atomic<size_t>> queued;
+
+		// what came in before the hello said which game (and so shard) this is for
+		std::vector<uint8_t> helloBuf;
+		Server* gameShard;
+
+		// close once writable
+		bool closing;
+		// the game side wants to hear when queued is under the low water mark
+		bool drainWatched;
+
+		SignalSocket()
+		: wsi(NULL)
+		, id(0)
+		, gameShard(NULL)
+		, closing(false)
+		, drainWatched(false)
+		{
+		}
+	};
+
+	// One shard of the peer server. Every shard runs its own libwebsockets context on its
+	// own thread, all listening on the same port, and owns the games whose id maps to it.
+	// Sockets are served by the shard that accepted them, everything about the peer
+	// behind one is handled by its game's shard; the two talk through their mailboxes.
 	struct Server {
 		struct libwebsocket_context *context;
 
-		// we need to be able to lookup connections on both
-		// websocket (for the receive callback) and peer id (when sending stuff)
-		std::unordered_map<struct libwebsocket *, std::unique_ptr<P2PSignalConnection> > signalConnections;
+		// all the shards, indexed by shardIndex
+		std::vector<Server*> shards;
+		size_t shardIndex;
+
+		Mailbox mailbox;
+		// what the shard's thread waits in, posting to the mailbox wakes it
+		EventLoop loop;
+
+		// Socket side, websockets this shard accepted
+		std::unordered_map<struct libwebsocket *, SignalSocket> sockets;
+		std::unordered_map<uint64_t, SignalSocket *> socketsById;
+
+		// Game side, the connections of peers in this shard's games by socket id
+		std::unordered_map<uint64_t, std::unique_ptr<P2PSignalConnection> > signalConnections;
 
 		std::unordered_map<GameId, std::unique_ptr<Game> > games;
 
+		// connections whose websocket closed while they could still be resumed,
+		// they keep their PeerId, aliases and P2P state until reconnectGracePeriod runs out
+		std::unordered_map<P2PSignalConnection *, std::unique_ptr<P2PSignalConnection> > detachedConnections;
+
+		// 0 disables reconnect tokens
+		std::chrono::seconds reconnectGracePeriod;
+		// how long an offer waits for its answer, 0 for as long as both peers are there
+		std::chrono::seconds negotiationTimeout;
+
+		// A socket with more than the high water mark waiting to be sent gets no more relay
+		// data until it's back under the low one. Over the limit, it's closed
+		size_t sendQueueHighWater;
+		size_t sendQueueLowWater;
+		size_t sendQueueLimit;
+
 		std::string stunServerAddress;
+		// shared by all the shards, NULL if there is no TURN relay
+		TurnServer* turnServer;
+
+		// where small messages are coalesced into websocket frames, see OutQueue
+		std::vector<uint8_t> writeBuf;
+
+		ShardMetrics metrics;
+		// the http path the metrics of all shards are served on, empty for none
+		std::string metricsPath;
 
 
 		Server(std::shared_ptr<GameDB> _gameDB);
 
 		Game *getVerifiedGame(const HumblePeer::HelloServer* hello);
-		void populateStunServers(std::vector<ICEServer>& servers);
-		void triggerWrite(struct libwebsocket* wsi);
+		// the STUN server and TURN credentials a peer is told in its HelloClient
+		void populateIceServers(std::vector<ICEServer>& servers, PeerId peerId);
+
+		// Runs task on the thread of another shard
+		void post(Server* shard, Mailbox::Task task);
+		// Runs what the other shards posted, on this shard's thread only
+		size_t runMailbox();
+
+		// Socket side
+		SignalSocket* openSocket(struct libwebsocket* wsi, const std::string& url);
+		// data arrived on the socket, hands it to its game's shard. false closes the socket
+		bool socketReceived(SignalSocket* sock, const uint8_t* data, size_t length);
+		void socketClosed(struct libwebsocket* wsi);
+		// written bytes of the socket's send queue went out
+		void socketWritten(SignalSocket* sock, size_t written);
+
+		// Game side, these can be called for a socket on any shard
+		void sendToSocket(Server* socketShard, uint64_t socketId, const OutMessageRef& msg);
+		void closeSocket(Server* socketShard, uint64_t socketId);
+		// the connection on the socket hears connectionDrained once the socket's queue is
+		// under the low water mark
+		void watchDrain(Server* socketShard, uint64_t socketId);
+
+		// Reconnect tokens
+		std::string createReconnectToken(Game* game, PeerId peerId);
+		// the connection token belongs to, if it is still current
+		P2PSignalConnection* findReconnectable(Game* game, const std::string& token);
+		// move the session of previous (detached or not) over to conn
+		void resumePeer(P2PSignalConnection* conn, P2PSignalConnection* previous);
+		// conn's websocket closed, hold on to it if it can be resumed, destroy it otherwise
+		void closeConnection(std::unique_ptr<P2PSignalConnection> conn);
+		void expireDetachedConnections();
+		// forgets offers which weren't answered in negotiationTimeout
+		void expireNegotiations();
+		// updates the gauges in metrics
+		void publishMetrics();
 
 	private:
+		void removePeer(P2PSignalConnection* conn);
+
+		// the shard owning the game the hello in sock->helloBuf is for. NULL while
+		// the hello is incomplete, this shard if it's unusable so it gets rejected here
+		Server* routeHello(SignalSocket* sock, bool& error);
+
+		// game side of a socket
+		void connectionOpened(Server* socketShard, uint64_t socketId, const std::string& url, const std::shared_ptr<std::atomic<size_t>>& queued);
+		void connectionReceived(uint64_t socketId, const uint8_t* data, size_t length);
+		void connectionClosed(uint64_t socketId);
+		void connectionDrained(uint64_t socketId);
+
+		// socket side
+		void socketSend(uint64_t socketId, OutMessageRef msg);
+		void socketClose(uint64_t socketId);
+		void socketWatchDrain(uint64_t socketId);
+
 		std::shared_ptr<GameDB> m_gameDB;
+
+		uint8_t m_tokenSecret[32];
+		uint64_t m_tokenCounter;
 	};
 
 }
\ No newline at end of file
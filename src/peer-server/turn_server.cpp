@@ -0,0 +1,1090 @@
+#include "turn_server.h"
+
+#include "hmac.h"
+#include "logging.h"
+#include "md5.h"
+
+#include <libwebsockets.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#if defined(__linux__)
+#	include <arpa/inet.h>
+#	include <errno.h>
+#	include <netinet/in.h>
+#	include <sys/epoll.h>
+#	include <sys/socket.h>
+#	include <unistd.h>
+#endif
+
+namespace humblenet {
+
+	namespace {
+
+		const uint32_t MAGIC_COOKIE = 0x2112A442;
+		const size_t STUN_HEADER_SIZE = 20;
+
+		// methods
+		const uint16_t STUN_BINDING = 0x001;
+		const uint16_t TURN_ALLOCATE = 0x003;
+		const uint16_t TURN_REFRESH = 0x004;
+		const uint16_t TURN_SEND = 0x006;
+		const uint16_t TURN_DATA = 0x007;
+		const uint16_t TURN_CREATE_PERMISSION = 0x008;
+		const uint16_t TURN_CHANNEL_BIND = 0x009;
+
+		// classes, as they are in the message type
+		const uint16_t STUN_REQUEST = 0x000;
+		const uint16_t STUN_INDICATION = 0x010;
+		const uint16_t STUN_SUCCESS = 0x100;
+		const uint16_t STUN_ERROR = 0x110;
+
+		// attributes
+		const uint16_t ATTR_USERNAME = 0x0006;
+		const uint16_t ATTR_MESSAGE_INTEGRITY = 0x0008;
+		const uint16_t ATTR_ERROR_CODE = 0x0009;
+		const uint16_t ATTR_UNKNOWN_ATTRIBUTES = 0x000A;
+		const uint16_t ATTR_CHANNEL_NUMBER = 0x000C;
+		const uint16_t ATTR_LIFETIME = 0x000D;
+		const uint16_t ATTR_XOR_PEER_ADDRESS = 0x0012;
+		const uint16_t ATTR_DATA = 0x0013;
+		const uint16_t ATTR_REALM = 0x0014;
+		const uint16_t ATTR_NONCE = 0x0015;
+		const uint16_t ATTR_XOR_RELAYED_ADDRESS = 0x0016;
+		const uint16_t ATTR_REQUESTED_TRANSPORT = 0x0019;
+		const uint16_t ATTR_DONT_FRAGMENT = 0x001A;
+		const uint16_t ATTR_XOR_MAPPED_ADDRESS = 0x0020;
+		const uint16_t ATTR_FINGERPRINT = 0x8028;
+
+		const uint8_t TRANSPORT_UDP = 17;
+		const uint32_t FINGERPRINT_XOR = 0x5354554e;
+
+		const uint16_t CHANNEL_MIN = 0x4000;
+		const uint16_t CHANNEL_MAX = 0x7FFE;
+
+		const std::chrono::seconds ALLOCATION_LIFETIME(600);
+		const std::chrono::seconds MAX_ALLOCATION_LIFETIME(3600);
+		const std::chrono::seconds PERMISSION_LIFETIME(300);
+		const std::chrono::seconds CHANNEL_LIFETIME(600);
+		const uint64_t NONCE_LIFETIME = 3600;	// seconds
+		const size_t MAX_ALLOCATIONS_PER_PEER = 8;
+
+		// datagrams at a time through recvmmsg and sendmmsg
+		const size_t RECEIVE_BATCH = 64;
+		const size_t SEND_BATCH = 128;
+		// larger datagrams are dropped
+		const size_t MAX_DATAGRAM = 4096;
+
+		uint16_t get16(const uint8_t* p) { return uint16_t((p[0] << 8) | p[1]); }
+		uint32_t get32(const uint8_t* p) { return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3]; }
+		void put16(uint8_t* p, uint16_t v) { p[0] = uint8_t(v >> 8); p[1] = uint8_t(v); }
+		void put32(uint8_t* p, uint32_t v) { put16(p, uint16_t(v >> 16)); put16(p + 2, uint16_t(v)); }
+
+		uint64_t unixTime()
+		{
+			return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		}
+
+		// the CRC-32 FINGERPRINT uses, which isn't the one in 3rdparty/crc
+		uint32_t crc32(const uint8_t* data, size_t length)
+		{
+			static struct Table {
+				uint32_t entries[256];
+				Table()
+				{
+					for (uint32_t i = 0; i < 256; ++i) {
+						uint32_t c = i;
+						for (int k = 0; k < 8; ++k) {
+							c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+						}
+						entries[i] = c;
+					}
+				}
+			} table;
+
+			uint32_t c = 0xFFFFFFFF;
+			for (size_t i = 0; i < length; ++i) {
+				c = table.entries[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+			}
+			return c ^ 0xFFFFFFFF;
+		}
+
+		bool knownAttribute(uint16_t type)
+		{
+			switch (type) {
+				case ATTR_USERNAME:
+				case ATTR_MESSAGE_INTEGRITY:
+				case ATTR_CHANNEL_NUMBER:
+				case ATTR_LIFETIME:
+				case ATTR_XOR_PEER_ADDRESS:
+				case ATTR_DATA:
+				case ATTR_REALM:
+				case ATTR_NONCE:
+				case ATTR_REQUESTED_TRANSPORT:
+				case ATTR_DONT_FRAGMENT:
+					return true;
+				default:
+					// comprehension-optional ones can be ignored
+					return type >= 0x8000;
+			}
+		}
+
+		// Builds a STUN message in place
+		struct StunWriter {
+			uint8_t* buf;
+			size_t length;
+
+			StunWriter(uint8_t* _buf, uint16_t type, const uint8_t* txid)
+			: buf(_buf)
+			, length(STUN_HEADER_SIZE)
+			{
+				put16(buf, type);
+				put16(buf + 2, 0);
+				put32(buf + 4, MAGIC_COOKIE);
+				memcpy(buf + 8, txid, 12);
+			}
+
+			uint8_t* attribute(uint16_t type, size_t size)
+			{
+				uint8_t* p = buf + length;
+				put16(p, type);
+				put16(p + 2, uint16_t(size));
+				size_t padded = (size + 3) & ~size_t(3);
+				memset(p + 4 + size, 0, padded - size);
+				length += 4 + padded;
+				put16(buf + 2, uint16_t(length - STUN_HEADER_SIZE));
+				return p + 4;
+			}
+
+			void attribute(uint16_t type, const void* value, size_t size)
+			{
+				memcpy(attribute(type, size), value, size);
+			}
+
+			void u32(uint16_t type, uint32_t value)
+			{
+				put32(attribute(type, 4), value);
+			}
+
+			void address(uint16_t type, const TurnAddress& address)
+			{
+				uint8_t* p = attribute(type, 8);
+				p[0] = 0;
+				p[1] = 0x01;
+				put16(p + 2, address.port ^ uint16_t(MAGIC_COOKIE >> 16));
+				put32(p + 4, address.ip ^ MAGIC_COOKIE);
+			}
+
+			void errorCode(int code, const char* reason)
+			{
+				size_t size = strlen(reason);
+				uint8_t* p = attribute(ATTR_ERROR_CODE, 4 + size);
+				p[0] = 0;
+				p[1] = 0;
+				p[2] = uint8_t(code / 100);
+				p[3] = uint8_t(code % 100);
+				memcpy(p + 4, reason, size);
+			}
+
+			// the length in the header has to count the attribute before it's signed
+			void integrity(const uint8_t key[16])
+			{
+				put16(buf + 2, uint16_t(length - STUN_HEADER_SIZE + 24));
+				HMACContext hmac;
+				HMACInit(&hmac, key, 16);
+				HMACInput(&hmac, buf, unsigned(length));
+				uint8_t digest[HMAC_DIGEST_SIZE];
+				HMACResult(&hmac, digest);
+				attribute(ATTR_MESSAGE_INTEGRITY, digest, sizeof(digest));
+			}
+
+			void fingerprint()
+			{
+				put16(buf + 2, uint16_t(length - STUN_HEADER_SIZE + 8));
+				u32(ATTR_FINGERPRINT, crc32(buf, length) ^ FINGERPRINT_XOR);
+			}
+		};
+
+	}
+
+	struct TurnServer::StunMessage {
+		struct Attribute {
+			uint16_t type;
+			uint16_t length;
+			const uint8_t* value;
+		};
+
+		static const size_t MAX_ATTRIBUTES = 32;
+
+		const uint8_t* data;
+		size_t length;
+		uint16_t method;
+		uint16_t cls;
+		const uint8_t* txid;
+		size_t integrity;	// offset of MESSAGE-INTEGRITY, 0 if there is none
+
+		Attribute attributes[MAX_ATTRIBUTES];
+		size_t count;
+		// comprehension-required ones that aren't understood
+		uint16_t unknown[MAX_ATTRIBUTES];
+		size_t unknownCount;
+
+		bool parse(const uint8_t* _data, size_t _length)
+		{
+			data = _data;
+			length = _length;
+			count = 0;
+			unknownCount = 0;
+			integrity = 0;
+
+			if (length < STUN_HEADER_SIZE || (data[0] & 0xC0) != 0 || get32(data + 4) != MAGIC_COOKIE
+				|| get16(data + 2) + STUN_HEADER_SIZE != length || (length & 3) != 0) {
+				return false;
+			}
+
+			uint16_t type = get16(data);
+			cls = type & 0x0110;
+			method = (type & 0x000F) | ((type & 0x00E0) >> 1) | ((type & 0x3E00) >> 2);
+			txid = data + 8;
+
+			size_t offset = STUN_HEADER_SIZE;
+			while (offset + 4 <= length) {
+				Attribute attr;
+				attr.type = get16(data + offset);
+				attr.length = get16(data + offset + 2);
+				attr.value = data + offset + 4;
+				if (offset + 4 + attr.length > length) {
+					return false;
+				}
+
+				// after MESSAGE-INTEGRITY only FINGERPRINT counts
+				if (!integrity || attr.type == ATTR_FINGERPRINT) {
+					if (attr.type == ATTR_MESSAGE_INTEGRITY) {
+						if (attr.length != HMAC_DIGEST_SIZE) {
+							return false;
+						}
+						integrity = offset;
+					}
+					if (!knownAttribute(attr.type) && unknownCount < MAX_ATTRIBUTES) {
+						unknown[unknownCount++] = attr.type;
+					}
+					if (count < MAX_ATTRIBUTES) {
+						attributes[count++] = attr;
+					}
+				}
+
+				offset += 4 + ((attr.length + 3) & ~3);
+			}
+			return true;
+		}
+
+		const Attribute* find(uint16_t type) const
+		{
+			for (size_t i = 0; i < count; ++i) {
+				if (attributes[i].type == type) {
+					return &attributes[i];
+				}
+			}
+			return NULL;
+		}
+
+		std::string string(uint16_t type) const
+		{
+			const Attribute* attr = find(type);
+			return attr ? std::string(reinterpret_cast<const char*>(attr->value), attr->length) : std::string();
+		}
+
+		// 0 if it's an IPv4 address, otherwise the error code it gets
+		static int address(const Attribute* attr, TurnAddress& address)
+		{
+			if (!attr || attr->length < 4) {
+				return 400;
+			}
+			if (attr->value[1] != 0x01) {
+				return 443;
+			}
+			if (attr->length != 8) {
+				return 400;
+			}
+			address.port = get16(attr->value + 2) ^ uint16_t(MAGIC_COOKIE >> 16);
+			address.ip = get32(attr->value + 4) ^ MAGIC_COOKIE;
+			return 0;
+		}
+
+		bool checkIntegrity(const uint8_t key[16]) const
+		{
+			if (!integrity) {
+				return false;
+			}
+
+			// signed with the length counting up to the end of MESSAGE-INTEGRITY
+			uint8_t header[STUN_HEADER_SIZE];
+			memcpy(header, data, STUN_HEADER_SIZE);
+			put16(header + 2, uint16_t(integrity + 4 + HMAC_DIGEST_SIZE - STUN_HEADER_SIZE));
+
+			HMACContext hmac;
+			HMACInit(&hmac, key, 16);
+			HMACInput(&hmac, header, STUN_HEADER_SIZE);
+			HMACInput(&hmac, data + STUN_HEADER_SIZE, unsigned(integrity - STUN_HEADER_SIZE));
+			uint8_t digest[HMAC_DIGEST_SIZE];
+			HMACResult(&hmac, digest);
+			return memcmp(digest, data + integrity + 4, HMAC_DIGEST_SIZE) == 0;
+		}
+	};
+
+	TurnServer::TurnServer()
+	: realm("humblenet")
+	, credentialLifetime(600)
+	, allowLoopback(false)
+	, allocationCount(0)
+	, m_fd(-1)
+	, m_epoll(-1)
+	, m_outCount(0)
+	, m_indications(0)
+	{
+		// credentials only have to work with this process
+		std::random_device random;
+		for (auto& b : m_secret) {
+			b = static_cast<uint8_t>(random());
+		}
+	}
+
+	std::string TurnServer::password(const std::string& username) const
+	{
+		HMACContext hmac;
+		HMACInit(&hmac, m_secret, sizeof(m_secret));
+		HMACInput(&hmac, reinterpret_cast<const uint8_t*>(username.data()), unsigned(username.size()));
+		uint8_t digest[HMAC_DIGEST_SIZE];
+		HMACResult(&hmac, digest);
+
+		char encoded[64];
+		int n = lws_b64_encode_string(reinterpret_cast<const char*>(digest), sizeof(digest), encoded, sizeof(encoded));
+		return std::string(encoded, std::max(n, 0));
+	}
+
+	// <expiry in unix time>:<peer id>
+	ICEServer TurnServer::credentials(PeerId peer) const
+	{
+		std::string username = std::to_string(unixTime() + credentialLifetime.count()) + ":" + std::to_string(peer);
+		return ICEServer(serverAddress, username, password(username));
+	}
+
+	// <expiry in unix time, 16 hex digits><first 8 bytes of its HMAC, 16 hex digits>
+	std::string TurnServer::createNonce() const
+	{
+		char expiry[17];
+		snprintf(expiry, sizeof(expiry), "%016llx", static_cast<unsigned long long>(unixTime() + NONCE_LIFETIME));
+
+		HMACContext hmac;
+		HMACInit(&hmac, m_secret, sizeof(m_secret));
+		HMACInput(&hmac, reinterpret_cast<const uint8_t*>(expiry), 16);
+		uint8_t digest[HMAC_DIGEST_SIZE];
+		HMACResult(&hmac, digest);
+		std::string signature;
+		HMACResultToHex(digest, signature);
+
+		return std::string(expiry) + signature.substr(0, 16);
+	}
+
+	int TurnServer::checkNonce(const std::string& nonce) const
+	{
+		if (nonce.size() != 32) {
+			return 401;
+		}
+
+		HMACContext hmac;
+		HMACInit(&hmac, m_secret, sizeof(m_secret));
+		HMACInput(&hmac, reinterpret_cast<const uint8_t*>(nonce.data()), 16);
+		uint8_t digest[HMAC_DIGEST_SIZE];
+		HMACResult(&hmac, digest);
+		std::string signature;
+		HMACResultToHex(digest, signature);
+		if (nonce.compare(16, 16, signature, 0, 16) != 0) {
+			return 401;
+		}
+
+		uint64_t expiry = strtoull(nonce.substr(0, 16).c_str(), NULL, 16);
+		return (expiry < unixTime()) ? 438 : 0;
+	}
+
+#if defined(__linux__)
+
+	TurnServer::Allocation::~Allocation()
+	{
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	TurnServer::~TurnServer()
+	{
+		m_allocations.clear();
+		m_removed.clear();
+		if (m_epoll >= 0) {
+			close(m_epoll);
+		}
+		if (m_fd >= 0) {
+			close(m_fd);
+		}
+	}
+
+	bool TurnServer::start(const std::string& relayAddress, int port)
+	{
+		struct in_addr ip;
+		if (inet_pton(AF_INET, relayAddress.c_str(), &ip) != 1) {
+			LOG_ERROR("TURN relay address \"%s\" isn't an IPv4 address\n", relayAddress.c_str());
+			return false;
+		}
+		m_relayAddress = TurnAddress(ntohl(ip.s_addr), uint16_t(port));
+
+		m_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(uint16_t(port));
+		addr.sin_addr = ip;
+		if (m_fd < 0 || bind(m_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+			LOG_ERROR("Can't bind the TURN relay to %s:%d: %s\n", relayAddress.c_str(), port, strerror(errno));
+			return false;
+		}
+
+		// every relayed packet goes through this one socket, both ways
+		int bufferSize = 4 * 1024 * 1024;
+		setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+		setsockopt(m_fd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+
+		m_epoll = epoll_create1(EPOLL_CLOEXEC);
+		struct epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_fd, &event);
+
+		m_in.resize(RECEIVE_BATCH * MAX_DATAGRAM);
+		m_out.resize(SEND_BATCH);
+
+		if (serverAddress.empty()) {
+			serverAddress = relayAddress + ":" + std::to_string(port);
+		}
+		LOG_INFO("TURN relay on %s:%d, peers are told %s\n", relayAddress.c_str(), port, serverAddress.c_str());
+		return true;
+	}
+
+	void TurnServer::run(const std::atomic<bool>& keepGoing)
+	{
+		struct epoll_event events[RECEIVE_BATCH];
+		while (keepGoing) {
+			int n = epoll_wait(m_epoll, events, RECEIVE_BATCH, 200);
+			m_now = Clock::now();
+
+			for (int i = 0; i < n; ++i) {
+				Allocation* allocation = static_cast<Allocation*>(events[i].data.ptr);
+				if (!allocation) {
+					receive(m_fd, NULL);
+				} else if (!allocation->removed) {
+					receive(allocation->fd, allocation);
+				}
+			}
+			flush();
+
+			m_removed.clear();
+			if (m_now - m_lastExpire >= std::chrono::seconds(1)) {
+				m_lastExpire = m_now;
+				expire();
+			}
+		}
+	}
+
+	void TurnServer::receive(int fd, Allocation* allocation)
+	{
+		struct mmsghdr msgs[RECEIVE_BATCH];
+		struct iovec iovs[RECEIVE_BATCH];
+		struct sockaddr_in addrs[RECEIVE_BATCH];
+
+		// a few batches, one busy socket doesn't hold up the others. What's left is
+		// still readable next time
+		for (int round = 0; round < 4; ++round) {
+			for (size_t i = 0; i < RECEIVE_BATCH; ++i) {
+				iovs[i].iov_base = &m_in[i * MAX_DATAGRAM];
+				iovs[i].iov_len = MAX_DATAGRAM;
+				memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+				msgs[i].msg_hdr.msg_iov = &iovs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+				msgs[i].msg_hdr.msg_name = &addrs[i];
+				msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			}
+
+			int n = recvmmsg(fd, msgs, RECEIVE_BATCH, MSG_DONTWAIT, NULL);
+			if (n <= 0) {
+				return;
+			}
+
+			for (int i = 0; i < n; ++i) {
+				if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) || addrs[i].sin_family != AF_INET) {
+					continue;
+				}
+				TurnAddress from(ntohl(addrs[i].sin_addr.s_addr), ntohs(addrs[i].sin_port));
+				const uint8_t* data = &m_in[i * MAX_DATAGRAM];
+				if (allocation) {
+					deliver(allocation, from, data, msgs[i].msg_len);
+				} else {
+					clientPacket(from, data, msgs[i].msg_len);
+				}
+				if (allocation && allocation->removed) {
+					return;
+				}
+			}
+
+			if (size_t(n) < RECEIVE_BATCH) {
+				return;
+			}
+		}
+	}
+
+	TurnServer::OutPacket& TurnServer::queue(int fd, const TurnAddress& to)
+	{
+		if (m_outCount == m_out.size()) {
+			flush();
+		}
+		OutPacket& packet = m_out[m_outCount++];
+		packet.fd = fd;
+		packet.to = to;
+		packet.length = 0;
+		return packet;
+	}
+
+	void TurnServer::flush()
+	{
+		struct mmsghdr msgs[SEND_BATCH];
+		struct iovec iovs[SEND_BATCH];
+		struct sockaddr_in addrs[SEND_BATCH];
+
+		for (size_t i = 0; i < m_outCount; ++i) {
+			OutPacket& packet = m_out[i];
+			addrs[i] = sockaddr_in();
+			addrs[i].sin_family = AF_INET;
+			addrs[i].sin_port = htons(packet.to.port);
+			addrs[i].sin_addr.s_addr = htonl(packet.to.ip);
+			iovs[i].iov_base = packet.data;
+			iovs[i].iov_len = packet.length;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+		}
+
+		// one sendmmsg for each run of packets from the same socket
+		size_t start = 0;
+		while (start < m_outCount) {
+			int fd = m_out[start].fd;
+			size_t end = start + 1;
+			while (end < m_outCount && m_out[end].fd == fd) {
+				++end;
+			}
+
+			size_t sent = start;
+			while (sent < end) {
+				int n = sendmmsg(fd, msgs + sent, unsigned(end - sent), MSG_DONTWAIT);
+				if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					// the socket buffer is full, it's UDP, they're dropped
+					break;
+				}
+				// one that can't be sent is skipped
+				sent += (n > 0) ? n : 1;
+			}
+			start = end;
+		}
+		m_outCount = 0;
+	}
+
+	void TurnServer::clientPacket(const TurnAddress& from, const uint8_t* data, size_t length)
+	{
+		// ChannelData starts with a channel number, 0x4000 to 0x7FFF
+		if (length >= 4 && (data[0] & 0xC0) == 0x40) {
+			auto it = m_allocations.find(from.key());
+			if (it != m_allocations.end()) {
+				channelData(it->second.get(), data, length);
+			}
+			return;
+		}
+
+		StunMessage msg;
+		if (!msg.parse(data, length)) {
+			return;
+		}
+
+		if (msg.cls == STUN_REQUEST) {
+			if (msg.method == STUN_BINDING) {
+				OutPacket& packet = queue(m_fd, from);
+				StunWriter response(packet.data, STUN_BINDING | STUN_SUCCESS, msg.txid);
+				response.address(ATTR_XOR_MAPPED_ADDRESS, from);
+				response.fingerprint();
+				packet.length = response.length;
+			} else if (msg.method == TURN_ALLOCATE) {
+				allocate(from, msg);
+			} else {
+				stunRequest(from, msg);
+			}
+		} else if (msg.cls == STUN_INDICATION && msg.method == TURN_SEND) {
+			auto it = m_allocations.find(from.key());
+			if (it != m_allocations.end()) {
+				sendIndication(it->second.get(), msg);
+			}
+		}
+	}
+
+	void TurnServer::error(const TurnAddress& to, const StunMessage& msg, int code, const char* reason, const uint8_t* key)
+	{
+		OutPacket& packet = queue(m_fd, to);
+		StunWriter response(packet.data, msg.method | STUN_ERROR, msg.txid);
+		response.errorCode(code, reason);
+		if (code == 401 || code == 438) {
+			// how to authenticate, try again with these
+			std::string nonce = createNonce();
+			response.attribute(ATTR_REALM, realm.data(), realm.size());
+			response.attribute(ATTR_NONCE, nonce.data(), nonce.size());
+		}
+		if (code == 420) {
+			uint8_t* p = response.attribute(ATTR_UNKNOWN_ATTRIBUTES, msg.unknownCount * 2);
+			for (size_t i = 0; i < msg.unknownCount; ++i) {
+				put16(p + i * 2, msg.unknown[i]);
+			}
+		}
+		if (key) {
+			response.integrity(key);
+		}
+		response.fingerprint();
+		packet.length = response.length;
+	}
+
+	bool TurnServer::authenticate(const TurnAddress& from, const StunMessage& msg, const Allocation* allocation, uint8_t key[16])
+	{
+		if (!msg.integrity) {
+			// the first try, which is told the realm and nonce
+			error(from, msg, 401, "Unauthorized");
+			return false;
+		}
+
+		std::string username = msg.string(ATTR_USERNAME);
+		std::string nonce = msg.string(ATTR_NONCE);
+		if (username.empty() || nonce.empty() || msg.string(ATTR_REALM) != realm) {
+			error(from, msg, 400, "Bad Request");
+			return false;
+		}
+
+		int nonceError = checkNonce(nonce);
+		if (nonceError) {
+			error(from, msg, nonceError, nonceError == 438 ? "Stale Nonce" : "Unauthorized");
+			return false;
+		}
+
+		if (allocation) {
+			if (username != allocation->username) {
+				error(from, msg, 441, "Wrong Credentials");
+				return false;
+			}
+			memcpy(key, allocation->key, 16);
+		} else {
+			if (strtoull(username.c_str(), NULL, 10) < unixTime()) {
+				// expired credentials, the peer has to get new ones by saying hello again
+				authFailures.add();
+				error(from, msg, 401, "Unauthorized");
+				return false;
+			}
+			std::string secret = username + ":" + realm + ":" + password(username);
+			md5(secret.data(), secret.size(), key);
+		}
+
+		if (!msg.checkIntegrity(key)) {
+			authFailures.add();
+			LOG_WARNING_LIMITED("TURN request from %u.%u.%u.%u:%u with the wrong credentials\n",
+				from.ip >> 24, (from.ip >> 16) & 0xFF, (from.ip >> 8) & 0xFF, from.ip & 0xFF, from.port);
+			error(from, msg, 401, "Unauthorized");
+			return false;
+		}
+
+		if (msg.unknownCount) {
+			error(from, msg, 420, "Unknown Attribute", key);
+			return false;
+		}
+		return true;
+	}
+
+	void TurnServer::allocate(const TurnAddress& from, const StunMessage& msg)
+	{
+		uint8_t key[16];
+		auto existing = m_allocations.find(from.key());
+		if (!authenticate(from, msg, existing != m_allocations.end() ? existing->second.get() : NULL, key)) {
+			return;
+		}
+		if (existing != m_allocations.end()) {
+			error(from, msg, 437, "Allocation Mismatch", key);
+			return;
+		}
+
+		const StunMessage::Attribute* transport = msg.find(ATTR_REQUESTED_TRANSPORT);
+		if (!transport || transport->length != 4) {
+			error(from, msg, 400, "Bad Request", key);
+			return;
+		}
+		if (transport->value[0] != TRANSPORT_UDP) {
+			error(from, msg, 442, "Unsupported Transport Protocol", key);
+			return;
+		}
+
+		std::string username = msg.string(ATTR_USERNAME);
+		size_t colon = username.find(':');
+		PeerId peerId = (colon == std::string::npos) ? 0 : static_cast<PeerId>(strtoul(username.c_str() + colon + 1, NULL, 10));
+		size_t& peerAllocations = m_peerAllocations[peerId];
+		if (peerAllocations >= MAX_ALLOCATIONS_PER_PEER) {
+			error(from, msg, 486, "Allocation Quota Reached", key);
+			return;
+		}
+
+		std::unique_ptr<Allocation> allocation(new Allocation());
+		allocation->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(m_relayAddress.ip);
+		socklen_t addrLength = sizeof(addr);
+		if (allocation->fd < 0 || bind(allocation->fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+			|| getsockname(allocation->fd, reinterpret_cast<struct sockaddr*>(&addr), &addrLength) != 0) {
+			LOG_WARNING_LIMITED("Can't open a port for a TURN allocation: %s\n", strerror(errno));
+			error(from, msg, 508, "Insufficient Capacity", key);
+			return;
+		}
+
+		std::chrono::seconds lifetime = ALLOCATION_LIFETIME;
+		const StunMessage::Attribute* requested = msg.find(ATTR_LIFETIME);
+		if (requested && requested->length == 4) {
+			lifetime = std::min(std::max(std::chrono::seconds(get32(requested->value)), ALLOCATION_LIFETIME), MAX_ALLOCATION_LIFETIME);
+		}
+
+		allocation->client = from;
+		allocation->relayed = TurnAddress(m_relayAddress.ip, ntohs(addr.sin_port));
+		allocation->username = username;
+		allocation->peerId = peerId;
+		memcpy(allocation->key, key, sizeof(key));
+		allocation->expires = m_now + lifetime;
+
+		struct epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.ptr = allocation.get();
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, allocation->fd, &event);
+
+		OutPacket& packet = queue(m_fd, from);
+		StunWriter response(packet.data, TURN_ALLOCATE | STUN_SUCCESS, msg.txid);
+		response.address(ATTR_XOR_RELAYED_ADDRESS, allocation->relayed);
+		response.u32(ATTR_LIFETIME, uint32_t(lifetime.count()));
+		response.address(ATTR_XOR_MAPPED_ADDRESS, from);
+		response.integrity(key);
+		response.fingerprint();
+		packet.length = response.length;
+
+		LOG_DEBUG("TURN allocation for peer %u on port %u\n", peerId, allocation->relayed.port);
+		m_relayedPorts[allocation->relayed.port] = allocation.get();
+		m_allocations[from.key()] = std::move(allocation);
+		++peerAllocations;
+		allocationCount.store(m_allocations.size(), std::memory_order_relaxed);
+	}
+
+	void TurnServer::stunRequest(const TurnAddress& from, const StunMessage& msg)
+	{
+		auto it = m_allocations.find(from.key());
+		if (it == m_allocations.end()) {
+			error(from, msg, 437, "Allocation Mismatch");
+			return;
+		}
+		Allocation* allocation = it->second.get();
+
+		uint8_t key[16];
+		if (!authenticate(from, msg, allocation, key)) {
+			return;
+		}
+
+		OutPacket* packet = NULL;
+		switch (msg.method) {
+			case TURN_REFRESH:
+			{
+				std::chrono::seconds lifetime = ALLOCATION_LIFETIME;
+				const StunMessage::Attribute* requested = msg.find(ATTR_LIFETIME);
+				if (requested && requested->length == 4) {
+					lifetime = std::min(std::chrono::seconds(get32(requested->value)), MAX_ALLOCATION_LIFETIME);
+				}
+
+				packet = &queue(m_fd, from);
+				StunWriter response(packet->data, TURN_REFRESH | STUN_SUCCESS, msg.txid);
+				response.u32(ATTR_LIFETIME, uint32_t(lifetime.count()));
+				response.integrity(key);
+				response.fingerprint();
+				packet->length = response.length;
+
+				if (lifetime.count() == 0) {
+					removeAllocation(allocation);
+				} else {
+					allocation->expires = m_now + lifetime;
+				}
+				return;
+			}
+
+			case TURN_CREATE_PERMISSION:
+			{
+				// all of them or none
+				TurnAddress peers[StunMessage::MAX_ATTRIBUTES];
+				size_t count = 0;
+				for (size_t i = 0; i < msg.count; ++i) {
+					if (msg.attributes[i].type == ATTR_XOR_PEER_ADDRESS) {
+						int code = StunMessage::address(&msg.attributes[i], peers[count++]);
+						if (code) {
+							error(from, msg, code, code == 443 ? "Peer Address Family Mismatch" : "Bad Request", key);
+							return;
+						}
+					}
+				}
+				if (!count) {
+					error(from, msg, 400, "Bad Request", key);
+					return;
+				}
+				for (size_t i = 0; i < count; ++i) {
+					if (deniedIP(peers[i].ip)) {
+						error(from, msg, 403, "Forbidden", key);
+						return;
+					}
+				}
+				for (size_t i = 0; i < count; ++i) {
+					allocation->permissions[peers[i].ip] = m_now + PERMISSION_LIFETIME;
+				}
+				break;
+			}
+
+			case TURN_CHANNEL_BIND:
+			{
+				const StunMessage::Attribute* number = msg.find(ATTR_CHANNEL_NUMBER);
+				TurnAddress peer;
+				int code = StunMessage::address(msg.find(ATTR_XOR_PEER_ADDRESS), peer);
+				if (!code && (!number || number->length != 4)) {
+					code = 400;
+				}
+				uint16_t channel = number ? get16(number->value) : 0;
+				if (!code && (channel < CHANNEL_MIN || channel > CHANNEL_MAX)) {
+					code = 400;
+				}
+				if (!code && denied(peer)) {
+					code = 403;
+				}
+				if (!code) {
+					// a channel is bound to one peer for as long as it lasts, and the other way around
+					auto bound = allocation->channels.find(channel);
+					auto byPeer = allocation->channelsByPeer.find(peer.key());
+					if ((bound != allocation->channels.end() && !(bound->second.peer == peer))
+						|| (byPeer != allocation->channelsByPeer.end() && byPeer->second != channel)) {
+						code = 400;
+					}
+				}
+				if (code) {
+					error(from, msg, code, code == 443 ? "Peer Address Family Mismatch" : code == 403 ? "Forbidden" : "Bad Request", key);
+					return;
+				}
+
+				Channel& bound = allocation->channels[channel];
+				bound.peer = peer;
+				bound.expires = m_now + CHANNEL_LIFETIME;
+				allocation->channelsByPeer[peer.key()] = channel;
+				allocation->permissions[peer.ip] = m_now + PERMISSION_LIFETIME;
+				break;
+			}
+
+			default:
+				error(from, msg, 400, "Bad Request", key);
+				return;
+		}
+
+		packet = &queue(m_fd, from);
+		StunWriter response(packet->data, msg.method | STUN_SUCCESS, msg.txid);
+		response.integrity(key);
+		response.fingerprint();
+		packet->length = response.length;
+	}
+
+	void TurnServer::sendIndication(Allocation* allocation, const StunMessage& msg)
+	{
+		// indications aren't authenticated or answered, anything wrong is just dropped
+		TurnAddress peer;
+		const StunMessage::Attribute* data = msg.find(ATTR_DATA);
+		if (!data || StunMessage::address(msg.find(ATTR_XOR_PEER_ADDRESS), peer) != 0 || !permitted(allocation, peer.ip)) {
+			return;
+		}
+		relay(allocation, peer, data->value, data->length);
+	}
+
+	void TurnServer::channelData(Allocation* allocation, const uint8_t* data, size_t length)
+	{
+		uint16_t channel = get16(data);
+		size_t size = get16(data + 2);
+		if (size + 4 > length) {
+			return;
+		}
+
+		auto it = allocation->channels.find(channel);
+		if (it == allocation->channels.end() || !permitted(allocation, it->second.peer.ip)) {
+			return;
+		}
+		relay(allocation, it->second.peer, data + 4, size);
+	}
+
+	bool TurnServer::permitted(const Allocation* allocation, uint32_t ip) const
+	{
+		auto it = allocation->permissions.find(ip);
+		return it != allocation->permissions.end() && it->second > m_now;
+	}
+
+	bool TurnServer::deniedIP(uint32_t ip) const
+	{
+		if (ip == m_relayAddress.ip) {
+			// the relayed ports are there, denied turns away the rest
+			return false;
+		}
+		if ((ip >> 24) == 127) {
+			return !allowLoopback;
+		}
+		return (ip >> 24) == 0	// 0.0.0.0/8
+			|| (ip >> 24) == 10	// 10.0.0.0/8
+			|| (ip >> 20) == 0xac1	// 172.16.0.0/12
+			|| (ip >> 16) == 0xc0a8	// 192.168.0.0/16
+			|| (ip >> 16) == 0xa9fe;	// 169.254.0.0/16
+	}
+
+	bool TurnServer::denied(const TurnAddress& peer) const
+	{
+		if (peer.ip == m_relayAddress.ip) {
+			// a packet to the relay's own port would be taken for a client's
+			if (peer.port == m_relayAddress.port) {
+				return true;
+			}
+			return !allowLoopback && m_relayedPorts.find(peer.port) == m_relayedPorts.end();
+		}
+		return deniedIP(peer.ip);
+	}
+
+	void TurnServer::relay(Allocation* allocation, const TurnAddress& peer, const uint8_t* data, size_t length)
+	{
+		// to another allocation here, straight to its client
+		if (peer.ip == m_relayAddress.ip) {
+			auto it = m_relayedPorts.find(peer.port);
+			if (it != m_relayedPorts.end()) {
+				deliver(it->second, allocation->relayed, data, length);
+				return;
+			}
+		}
+
+		if (length > MAX_DATAGRAM || denied(peer)) {
+			return;
+		}
+		relayedPackets.add();
+		relayedBytes.add(length);
+		OutPacket& packet = queue(allocation->fd, peer);
+		memcpy(packet.data, data, length);
+		packet.length = length;
+	}
+
+	void TurnServer::deliver(Allocation* allocation, const TurnAddress& peer, const uint8_t* data, size_t length)
+	{
+		if (length > MAX_DATAGRAM || !permitted(allocation, peer.ip)) {
+			return;
+		}
+		relayedPackets.add();
+		relayedBytes.add(length);
+
+		OutPacket& packet = queue(m_fd, allocation->client);
+		auto channel = allocation->channelsByPeer.find(peer.key());
+		if (channel != allocation->channelsByPeer.end()) {
+			// 4 bytes of overhead instead of 36
+			put16(packet.data, channel->second);
+			put16(packet.data + 2, uint16_t(length));
+			memcpy(packet.data + 4, data, length);
+			packet.length = 4 + length;
+			return;
+		}
+
+		uint8_t txid[12] = {};
+		put32(txid + 8, ++m_indications);
+		StunWriter indication(packet.data, TURN_DATA | STUN_INDICATION, txid);
+		indication.address(ATTR_XOR_PEER_ADDRESS, peer);
+		indication.attribute(ATTR_DATA, data, length);
+		packet.length = indication.length;
+	}
+
+	void TurnServer::removeAllocation(Allocation* allocation)
+	{
+		LOG_DEBUG("TURN allocation for peer %u on port %u is gone\n", allocation->peerId, allocation->relayed.port);
+
+		epoll_ctl(m_epoll, EPOLL_CTL_DEL, allocation->fd, NULL);
+		allocation->removed = true;
+		m_relayedPorts.erase(allocation->relayed.port);
+		auto peer = m_peerAllocations.find(allocation->peerId);
+		if (peer != m_peerAllocations.end() && --peer->second == 0) {
+			m_peerAllocations.erase(peer);
+		}
+
+		// epoll may have returned events for it that haven't been handled yet
+		auto it = m_allocations.find(allocation->client.key());
+		m_removed.push_back(std::move(it->second));
+		m_allocations.erase(it);
+		allocationCount.store(m_allocations.size(), std::memory_order_relaxed);
+	}
+
+	void TurnServer::expire()
+	{
+		std::vector<Allocation*> expired;
+		for (auto& it : m_allocations) {
+			Allocation* allocation = it.second.get();
+			if (allocation->expires <= m_now) {
+				expired.push_back(allocation);
+				continue;
+			}
+
+			for (auto permission = allocation->permissions.begin(); permission != allocation->permissions.end(); ) {
+				permission = (permission->second <= m_now) ? allocation->permissions.erase(permission) : std::next(permission);
+			}
+			for (auto channel = allocation->channels.begin(); channel != allocation->channels.end(); ) {
+				if (channel->second.expires <= m_now) {
+					allocation->channelsByPeer.erase(channel->second.peer.key());
+					channel = allocation->channels.erase(channel);
+				} else {
+					++channel;
+				}
+			}
+		}
+
+		for (auto allocation : expired) {
+			removeAllocation(allocation);
+		}
+		m_removed.clear();
+	}
+
+#else
+
+	TurnServer::Allocation::~Allocation()
+	{
+	}
+
+	TurnServer::~TurnServer()
+	{
+	}
+
+	bool TurnServer::start(const std::string& relayAddress, int port)
+	{
+		LOG_ERROR("The TURN relay needs recvmmsg and epoll, it only runs on Linux\n");
+		return false;
+	}
+
+	void TurnServer::run(const std::atomic<bool>& keepGoing)
+	{
+	}
+
+#endif
+
+}
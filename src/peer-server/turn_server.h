@@ -0,0 +1,161 @@
+#pragma once
+
+#include "humblenet.h"
+#include "humblepeer.h"
+#include "metrics.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace humblenet {
+
+	// An IPv4 address and port, in host byte order
+	struct TurnAddress {
+		uint32_t ip;
+		uint16_t port;
+
+		TurnAddress() : ip(0), port(0) {}
+		TurnAddress(uint32_t _ip, uint16_t _port) : ip(_ip), port(_port) {}
+
+		uint64_t key() const { return (uint64_t(ip) << 16) | port; }
+		bool operator==(const TurnAddress& other) const { return ip == other.ip && port == other.port; }
+	};
+
+	// A TURN relay (RFC 5766) on a UDP port of the peer server, for peers behind NATs
+	// that won't let them reach each other directly. It does what browsers use: UDP
+	// allocations over IPv4, permissions, channels, Send and Data indications, and STUN
+	// Binding requests so it works as a STUN server too. Runs on a thread of its own.
+	//
+	// There are no user accounts. A peer gets credentials with its HelloClient, the
+	// username is when they expire and its peer id, the password the HMAC of the username
+	// with a secret of this process (the TURN REST API scheme), so they are checked here
+	// without asking anyone.
+	//
+	// Packets between two allocations of this relay, as when both peers are relayed,
+	// are handed from one to the other without going through the kernel.
+	class TurnServer {
+	public:
+		TurnServer();
+		~TurnServer();
+
+		// binds port on relayAddress, an IPv4 address which the relayed ports are on too.
+		// false if it can't
+		bool start(const std::string& relayAddress, int port);
+		// serves until keepGoing is false
+		void run(const std::atomic<bool>& keepGoing);
+
+		// the TURN server for peer's HelloClient, any thread can ask
+		ICEServer credentials(PeerId peer) const;
+
+		// what peers are told to connect to, host:port
+		std::string serverAddress;
+		std::string realm;
+		// how long credentials work for
+		std::chrono::seconds credentialLifetime;
+		// lets peers be on 127.0.0.0/8 and on other ports of the relay address, for
+		// testing on one machine
+		bool allowLoopback;
+
+		// only changed by the relay's thread
+		Counter relayedBytes;
+		Counter relayedPackets;
+		Counter authFailures;
+		std::atomic<size_t> allocationCount;
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Channel {
+			TurnAddress peer;
+			Clock::time_point expires;
+		};
+
+		struct Allocation {
+			TurnAddress client;
+			TurnAddress relayed;
+			int fd;	// the relayed port's socket
+			bool removed;	// freed after the events it may still have are handled
+
+			std::string username;
+			PeerId peerId;
+			uint8_t key[16];	// MD5 of username:realm:password
+			Clock::time_point expires;
+
+			// by peer IP, the port doesn't matter
+			std::unordered_map<uint32_t, Clock::time_point> permissions;
+			std::unordered_map<uint16_t, Channel> channels;
+			// channel number by peer address key
+			std::unordered_map<uint64_t, uint16_t> channelsByPeer;
+
+			Allocation() : fd(-1), removed(false), peerId(0) {}
+			~Allocation();
+		};
+
+		// a datagram waiting for sendmmsg
+		struct OutPacket {
+			int fd;
+			TurnAddress to;
+			size_t length;
+			uint8_t data[4096 + 64];
+		};
+
+		struct StunMessage;
+
+		void receive(int fd, Allocation* allocation);
+		void clientPacket(const TurnAddress& from, const uint8_t* data, size_t length);
+		void stunRequest(const TurnAddress& from, const StunMessage& msg);
+		void allocate(const TurnAddress& from, const StunMessage& msg);
+		void sendIndication(Allocation* allocation, const StunMessage& msg);
+		void channelData(Allocation* allocation, const uint8_t* data, size_t length);
+
+		// an error response, signed with key if there is one
+		void error(const TurnAddress& to, const StunMessage& msg, int code, const char* reason, const uint8_t* key = NULL);
+		// checks the long-term credentials of msg, answering with an error if they don't do.
+		// key is set to the one the response is signed with
+		bool authenticate(const TurnAddress& from, const StunMessage& msg, const Allocation* allocation, uint8_t key[16]);
+		std::string createNonce() const;
+		// 0 if it's good, otherwise the error code it gets
+		int checkNonce(const std::string& nonce) const;
+		std::string password(const std::string& username) const;
+
+		// from allocation's relayed address to peer
+		void relay(Allocation* allocation, const TurnAddress& peer, const uint8_t* data, size_t length);
+		// from peer to allocation's client
+		void deliver(Allocation* allocation, const TurnAddress& peer, const uint8_t* data, size_t length);
+		bool permitted(const Allocation* allocation, uint32_t ip) const;
+		// peers on this host or the networks around it, which a relay every peer can use
+		// mustn't reach. By IP, as permissions are, and by address
+		bool deniedIP(uint32_t ip) const;
+		bool denied(const TurnAddress& peer) const;
+		void removeAllocation(Allocation* allocation);
+		void expire();
+
+		OutPacket& queue(int fd, const TurnAddress& to);
+		void flush();
+
+		int m_fd;
+		int m_epoll;
+		TurnAddress m_relayAddress;
+		uint8_t m_secret[32];
+
+		std::unordered_map<uint64_t, std::unique_ptr<Allocation>> m_allocations;	// by client address key
+		std::unordered_map<uint16_t, Allocation*> m_relayedPorts;
+		std::unordered_map<PeerId, size_t> m_peerAllocations;
+		std::vector<std::unique_ptr<Allocation>> m_removed;
+		Clock::time_point m_lastExpire;
+
+		// what recvmmsg fills
+		std::vector<uint8_t> m_in;
+		std::vector<OutPacket> m_out;
+		size_t m_outCount;
+		// as of the last wakeup, good enough for lifetimes
+		Clock::time_point m_now;
+		uint32_t m_indications;
+	};
+
+}
@@ -1,8 +1,10 @@
 #include "humblenet.h"
 #include "humblepeer.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -13,6 +15,11 @@
 
 // helper program for AFLing parseMessage
 // if you don't know what this is you don't need it
+//
+// the input is parsed twice: once as a single buffer through recvBuf, and once
+// split into payloads through the parse-from-payload path. chunk sizes are taken
+// from the input itself so AFL explores the partial message handling as well.
+// both paths must see the same messages, anything else aborts.
 
 
 using namespace humblenet;
@@ -22,154 +29,97 @@ using namespace humblenet;
 struct humblenet::P2PSignalConnection {
 };
 
-
-extern "C" {
+ha_bool humblenet::sendP2PMessage(P2PSignalConnection *conn, const uint8_t *buff, size_t length) {
+	return true;
+}
 
 
-static ha_bool parseCallback(HumblePeerMessageType msgType, const HumblePeerMessage *msg, const char *payload, void *user) {
+static ha_bool parseCallback(const HumblePeer::Message *msg, void *user) {
 	assert(user != NULL);
 
 	// we use temp to make sure we have side-effects the compiler can't remove
 	uintptr_t &temp = *reinterpret_cast<uintptr_t *>(user);
 
-	unsigned int payloadLen = 0;
-
-	switch(msgType) {
-	case P2PConnect:
-		{
-			const P2PConnectMsg &p2pmsg = msg->p2pConnect;
-			temp = temp ^ p2pmsg.peer;
-			temp = temp ^ p2pmsg.flags;
-			payloadLen = p2pmsg.payloadLen;
-		}
-		break;
-
-	case P2PResponse:
-		{
-			const P2PResponseMsg &p2pmsg = msg->p2pResponse;
-			temp = temp ^ p2pmsg.peer;
-			payloadLen = p2pmsg.payloadLen;
-		}
-		break;
-
-	case ICECandidate:
-		{
-			const ICECandidateMsg &p2pmsg = msg->iceCandidate;
-			temp = temp ^ p2pmsg.peer;
-			payloadLen = p2pmsg.payloadLen;
-		}
-		break;
-
-	case ErrNoSuchPeer:
-	case ErrPeerRefused:
-		{
-			const P2PErrMsg &err = msg->err;
-			temp = temp ^ err.peer;
-		}
-		break;
-
-	case HelloServer:
-		{
-			const HelloServerMsg &server = msg->serverHello;
-			payloadLen = server.authTokenLen + server.browserInfoLen;
-		}
-		break;
-
-	case HelloClient:
-		{
-			const HelloClientMsg &client = msg->clientHello;
-			temp = temp ^ client.peerId;
-			payloadLen = client.credentialLen;
-		}
-		break;
+	temp = (temp * 65537) ^ static_cast<uintptr_t>(msg->message_type());
 
-	case ConnectionEstablished:
-		break;
+	const flatbuffers::String *str = NULL;
 
-	case CreateLobby:
+	switch (msg->message_type()) {
+	case HumblePeer::MessageType::HelloServer:
 		{
-			const CreateLobbyMsg &lobbymsg = msg->createLobby;
-			temp = temp ^ lobbymsg.maxUsers;
-			payloadLen = lobbymsg.lobbyNameLen + lobbymsg.passwordLen;
+			auto hello = reinterpret_cast<const HumblePeer::HelloServer*>(msg->message());
+			temp = temp ^ hello->version();
+			str = hello->gameToken();
 		}
 		break;
 
-	case JoinLobby:
+	case HumblePeer::MessageType::HelloClient:
 		{
-			const JoinLobbyMsg &lobbymsg = msg->joinLobby;
-			payloadLen = lobbymsg.lobbyNameLen + lobbymsg.passwordLen;
+			auto hello = reinterpret_cast<const HumblePeer::HelloClient*>(msg->message());
+			temp = temp ^ hello->peerId();
+			str = hello->reconnectToken();
 		}
 		break;
 
-	case CloseLobby:
+	case HumblePeer::MessageType::P2POffer:
 		{
-			const CloseLobbyMsg &lobbymsg = msg->closeLobby;
-			payloadLen = lobbymsg.lobbyNameLen;
+			auto p2p = reinterpret_cast<const HumblePeer::P2POffer*>(msg->message());
+			temp = temp ^ p2p->peerId() ^ p2p->flags();
+			str = p2p->offer();
 		}
 		break;
 
-	case LobbyPeerId:
+	case HumblePeer::MessageType::P2PAnswer:
 		{
-			const LobbyPeerIdMsg &lobbymsg = msg->lobbyPeerId;
-			temp = temp ^ lobbymsg.peerId;
-			payloadLen = lobbymsg.lobbyNameLen;
+			auto p2p = reinterpret_cast<const HumblePeer::P2PAnswer*>(msg->message());
+			temp = temp ^ p2p->peerId();
+			str = p2p->offer();
 		}
 		break;
 
-	case ErrLobbyError:
+	case HumblePeer::MessageType::ICECandidate:
 		{
-			const LobbyErrorMsg &lobbymsg = msg->lobbyError;
-			payloadLen = lobbymsg.lobbyNameLen;
+			auto ice = reinterpret_cast<const HumblePeer::ICECandidate*>(msg->message());
+			temp = temp ^ ice->peerId();
+			str = ice->offer();
 		}
 		break;
 
-	case LobbyEstablished:
+	case HumblePeer::MessageType::P2PRelayData:
 		{
-			const LobbyEstablishedMsg &lobbymsg = msg->lobbyEstablished;
-			payloadLen = lobbymsg.lobbyNameLen;
+			auto relay = reinterpret_cast<const HumblePeer::P2PRelayData*>(msg->message());
+			temp = temp ^ relay->peerId();
+			if (relay->data()) {
+				for (auto b : *relay->data()) {
+					temp = (temp * 65537) ^ b;
+				}
+			}
 		}
 		break;
 
-	case P2PData:
-		{
-			const P2PDataMsg &p2pdata = msg->p2pData;
-			temp = temp ^ p2pdata.peer;
-			payloadLen = p2pdata.payloadLen;
-		}
+	case HumblePeer::MessageType::AliasRegister:
+		str = reinterpret_cast<const HumblePeer::AliasRegister*>(msg->message())->alias();
 		break;
 
-	case P2PClosed:
-		{
-			const P2PClosedMsg &p2pClosed = msg->p2pClosed;
-			temp = temp ^ p2pClosed.peer;
-		}
-		break;
-
-	case LobbyJoined:
-		{
-			const LobbyJoinedMsg &lobbymsg = msg->lobbyJoined;
-			temp = temp ^ lobbymsg.peerId;
-			temp = temp ^ lobbymsg.lobbyId;
-			payloadLen = lobbymsg.lobbyNameLen;
-		}
+	case HumblePeer::MessageType::AliasLookup:
+		str = reinterpret_cast<const HumblePeer::AliasLookup*>(msg->message())->alias();
 		break;
 
 	default:
-		assert(false);
+		break;
 	}
 
-	// read every byte of payload
-	for (unsigned int i = 0; i < payloadLen; i++) {
-		temp = (temp * 65537) ^ payload[i];
+	// read every byte of the string
+	if (str) {
+		for (auto c : *str) {
+			temp = (temp * 65537) ^ c;
+		}
 	}
 
 	return true;
 }
 
 
-}  // extern "C"
-
-
 int main(int argc, char *argv[]) {
 	if (argc < 2) {
 		return 1;
@@ -186,12 +136,34 @@ int main(int argc, char *argv[]) {
 	int retval = fstat(fileno(f), &statbuf);
 	if (retval == 0) {
 		size_t filesize = statbuf.st_size;
-		std::vector<char> msgBuf(filesize, 0);
-		fread(&msgBuf[0], 1, filesize, f);
+		std::vector<uint8_t> msgBuf(filesize, 0);
+		if (filesize > 0) {
+			fread(&msgBuf[0], 1, filesize, f);
+		}
 
 		uintptr_t temp = 0;
-		parseMessage(msgBuf, parseCallback, &temp);
-		printf("temp: %lu\n", temp);
+		std::vector<uint8_t> recvBuf(msgBuf);
+		ha_bool bufferOk = parseMessage(recvBuf, parseCallback, &temp);
+
+		uintptr_t payloadTemp = 0;
+		std::vector<uint8_t> partial;
+		ha_bool payloadOk = true;
+		size_t offset = 0;
+		while (payloadOk && offset < filesize) {
+			size_t chunk = std::min<size_t>(1 + msgBuf[offset] % 64, filesize - offset);
+			payloadOk = parseMessage(partial, msgBuf.data() + offset, chunk, parseCallback, &payloadTemp);
+			offset += chunk;
+		}
+
+		// an error stops both paths at the same message
+		if (bufferOk != payloadOk || temp != payloadTemp) {
+			abort();
+		}
+		if (bufferOk && recvBuf != partial) {
+			abort();
+		}
+
+		printf("temp: %lu\n", (unsigned long)temp);
 	}
 
 	fclose(f);
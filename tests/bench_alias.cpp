@@ -0,0 +1,211 @@
+// Measures alias lookups with and without the client side alias cache.
+//
+//   humblenet_bench_alias [cached|uncached] [aliases]
+//
+// Forks a peer which registers the aliases bench-alias-N (512 by default), then this
+// process looks all of them up with humblenet_p2p_lookup_alias, like a server browser
+// would. It times resolving them all the first time, then keeps looking them up for a
+// second to get lookups/s and how many were answered without asking the peer server.
+// Last the other peer unregisters one of them and we time how long until a lookup says
+// it's gone, that's the push invalidation when cached.
+
+#include "humblenet_p2p.h"
+#include "child_process.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const int DEFAULT_ALIASES = 512;
+const int TIMEOUT_S = 30;
+
+const char client_token[] = "hello_world";
+const char client_secret[] = "secret";
+
+typedef std::chrono::steady_clock Clock;
+
+static std::string alias_for(int index)
+{
+	return "bench-alias-" + std::to_string(index);
+}
+
+static double ms_since(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void connect_peer(bool cached)
+{
+	if (!cached) {
+		humblenet_set_hint("alias_cache", "0");
+	}
+
+	humblenet_init();
+	humblenet_p2p_init(HUMBLENET_SERVER_URL, client_token, client_secret, NULL);
+
+	while (humblenet_p2p_get_my_peer_id() == 0) {
+		humblenet_p2p_wait(10);
+	}
+}
+
+// registers the aliases, reports its peer id once they're all there and unregisters
+// the first one when asked to.
+static void run_owner(int aliases, bool cached, int readyFd, int commandFd)
+{
+	connect_peer(cached);
+
+	for (int i = 0; i < aliases; ++i) {
+		humblenet_p2p_register_alias(alias_for(i).c_str());
+	}
+
+	// registration isn't acknowledged, but the server handles our messages in order
+	PeerId me = humblenet_p2p_get_my_peer_id();
+	PeerId last = 0;
+	while (!humblenet_p2p_lookup_alias(alias_for(aliases - 1).c_str(), &last) || last != me) {
+		humblenet_p2p_wait(5);
+	}
+	if (write(readyFd, &me, sizeof(me)) != sizeof(me)) {
+		_exit(1);
+	}
+
+	// until the tool kills us, or is gone
+	while (parentAlive()) {
+		struct pollfd pfd = { commandFd, POLLIN, 0 };
+		char command;
+		if (poll(&pfd, 1, 0) > 0 && read(commandFd, &command, 1) == 1) {
+			humblenet_p2p_unregister_alias(alias_for(0).c_str());
+		}
+
+		humblenet_p2p_wait(5);
+	}
+
+	humblenet_shutdown();
+}
+
+int main(int argc, char *argv[])
+{
+	bool cached = !(argc > 1 && strcmp(argv[1], "uncached") == 0);
+	int aliases = argc > 2 ? std::stoi(argv[2]) : DEFAULT_ALIASES;
+	if (aliases < 1) {
+		std::cout << "need at least one alias" << std::endl;
+		return 1;
+	}
+
+	int ready[2], command[2];
+	if (pipe(ready) != 0 || pipe(command) != 0) {
+		return 1;
+	}
+
+	pid_t owner = forkChild();
+	if (owner == 0) {
+		close(ready[0]);
+		close(command[1]);
+		run_owner(aliases, cached, ready[1], command[0]);
+		_exit(0);
+	}
+	close(ready[1]);
+	close(command[0]);
+
+	bool passed = true;
+	auto giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+
+	PeerId ownerPeer = 0;
+	struct pollfd pfd = { ready[0], POLLIN, 0 };
+	if (poll(&pfd, 1, TIMEOUT_S * 1000) <= 0 || read(ready[0], &ownerPeer, sizeof(ownerPeer)) != sizeof(ownerPeer)) {
+		std::cout << "the aliases weren't registered within " << TIMEOUT_S << " s" << std::endl;
+		kill(owner, SIGTERM);
+		waitpid(owner, NULL, 0);
+		return 1;
+	}
+
+	connect_peer(cached);
+
+	std::vector<std::string> names;
+	for (int i = 0; i < aliases; ++i) {
+		names.push_back(alias_for(i));
+	}
+
+	// first lookup of everything, all of it has to go to the server
+	auto start = Clock::now();
+	std::vector<PeerId> peers(aliases, 0);
+	std::vector<bool> resolved(aliases, false);
+	int remaining = aliases;
+	while (remaining > 0 && Clock::now() < giveUp) {
+		for (int i = 0; i < aliases; ++i) {
+			if (!resolved[i] && humblenet_p2p_lookup_alias(names[i].c_str(), &peers[i])) {
+				resolved[i] = true;
+				--remaining;
+			}
+		}
+		if (remaining > 0) {
+			humblenet_p2p_wait(1);
+		}
+	}
+	double coldMs = ms_since(start);
+
+	for (int i = 0; i < aliases; ++i) {
+		if (resolved[i] && peers[i] != ownerPeer) {
+			std::cout << names[i] << " resolved to " << peers[i] << " instead of " << ownerPeer << std::endl;
+			passed = false;
+		}
+	}
+	if (remaining > 0) {
+		std::cout << remaining << " aliases were not resolved" << std::endl;
+		passed = false;
+	}
+
+	// and again for a second, a miss means the server is asked again
+	uint64_t lookups = 0, local = 0;
+	start = Clock::now();
+	while (ms_since(start) < 1000) {
+		for (int i = 0; i < aliases; ++i) {
+			PeerId peer;
+			if (humblenet_p2p_lookup_alias(names[i].c_str(), &peer)) {
+				++local;
+			}
+			++lookups;
+		}
+		humblenet_p2p_wait(0);
+	}
+	double warmS = ms_since(start) / 1000;
+
+	// unregistered while we have it cached
+	char unregister = 'U';
+	if (write(command[1], &unregister, 1) != 1) {
+		passed = false;
+	}
+	start = Clock::now();
+	PeerId first = ownerPeer;
+	while (Clock::now() < giveUp) {
+		if (humblenet_p2p_lookup_alias(names[0].c_str(), &first) && first == 0) {
+			break;
+		}
+		humblenet_p2p_wait(1);
+	}
+	double invalidateMs = ms_since(start);
+	if (first != 0) {
+		std::cout << names[0] << " still resolves after it was unregistered" << std::endl;
+		passed = false;
+	}
+
+	humblenet_shutdown();
+
+	kill(owner, SIGTERM);
+	waitpid(owner, NULL, 0);
+
+	std::cout << (cached ? "cached" : "uncached") << " alias lookups, " << aliases << " aliases" << std::endl;
+	std::cout << "first lookup of all: " << coldMs << " ms" << std::endl;
+	std::cout << "repeated lookups: " << (uint64_t)(lookups / warmS) << " lookups/s, "
+		<< local << " of " << lookups << " answered without a round trip to the server" << std::endl;
+	std::cout << "unregistered alias noticed after " << invalidateMs << " ms" << std::endl;
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+// Measures how long it takes to set up a WebRTC connection between two native peers.
+//
+//   humblenet_bench_connect [trickle|gather] [peers]
+//
+// Forks the peers (8 by default), which connect to the peer server and wait. This process
+// then connects to each of them in turn with humblenet_p2p_preconnect, timing from asking
+// for the connection to it being established. With "gather" every process sets the hint
+// p2p_trickle_ice to 0, so the offer and answer wait for the STUN candidates instead of
+// those following along as they're found.
+
+#include "humblenet_p2p.h"
+#include "child_process.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const int DEFAULT_PEERS = 8;
+const int TIMEOUT_S = 30;
+
+const char client_token[] = "hello_world";
+const char client_secret[] = "secret";
+
+typedef std::chrono::steady_clock Clock;
+
+static double ms_since(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void connect_peer(bool trickle)
+{
+	if (!trickle) {
+		humblenet_set_hint("p2p_trickle_ice", "0");
+	}
+
+	humblenet_init();
+	humblenet_p2p_init(HUMBLENET_SERVER_URL, client_token, client_secret, NULL);
+
+	while (humblenet_p2p_get_my_peer_id() == 0) {
+		humblenet_p2p_wait(10);
+	}
+}
+
+static void run_peer(bool trickle, int readyFd)
+{
+	connect_peer(trickle);
+
+	PeerId me = humblenet_p2p_get_my_peer_id();
+	if (write(readyFd, &me, sizeof(me)) != sizeof(me)) {
+		_exit(1);
+	}
+
+	// until the tool kills us, or is gone
+	while (parentAlive()) {
+		humblenet_p2p_wait(5);
+	}
+
+	humblenet_shutdown();
+}
+
+int main(int argc, char *argv[])
+{
+	bool trickle = !(argc > 1 && strcmp(argv[1], "gather") == 0);
+	int peers = argc > 2 ? std::stoi(argv[2]) : DEFAULT_PEERS;
+	if (peers < 1) {
+		std::cout << "need at least one peer" << std::endl;
+		return 1;
+	}
+
+	int ready[2];
+	if (pipe(ready) != 0) {
+		return 1;
+	}
+
+	std::vector<pid_t> children;
+	for (int i = 0; i < peers; ++i) {
+		pid_t pid = forkChild();
+		if (pid == 0) {
+			close(ready[0]);
+			run_peer(trickle, ready[1]);
+			_exit(0);
+		}
+		children.push_back(pid);
+	}
+	close(ready[1]);
+
+	bool passed = true;
+	auto giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+
+	std::vector<PeerId> others;
+	while ((int)others.size() < peers && Clock::now() < giveUp) {
+		struct pollfd pfd = { ready[0], POLLIN, 0 };
+		PeerId peer;
+		if (poll(&pfd, 1, 100) > 0 && read(ready[0], &peer, sizeof(peer)) == sizeof(peer)) {
+			others.push_back(peer);
+		}
+	}
+
+	std::vector<double> setup;
+
+	if ((int)others.size() < peers) {
+		std::cout << "only " << others.size() << " of " << peers << " peers connected within " << TIMEOUT_S << " s" << std::endl;
+		passed = false;
+	} else {
+		connect_peer(trickle);
+
+		for (auto peer : others) {
+			auto start = Clock::now();
+			bool connected;
+			while (!(connected = humblenet_p2p_preconnect(peer)) && Clock::now() < giveUp) {
+				humblenet_p2p_wait(1);
+			}
+
+			if (!connected) {
+				std::cout << "couldn't connect to peer " << peer << ": " << humblenet_get_error() << std::endl;
+				passed = false;
+				break;
+			}
+			setup.push_back(ms_since(start));
+		}
+
+		humblenet_shutdown();
+	}
+
+	for (auto pid : children) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+
+	std::cout << (trickle ? "trickle" : "gather") << " ICE, " << setup.size() << " connections" << std::endl;
+	if (!setup.empty()) {
+		std::sort(setup.begin(), setup.end());
+		std::cout << "connection setup (ms): min " << setup.front() << " p50 " << setup[setup.size() / 2]
+			<< " max " << setup.back() << std::endl;
+	}
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+// Checks the crc implementations against the original table version, then measures
+// their throughput.
+//
+//   humblenet_bench_crc [megabytes]
+//
+// Every implementation has to agree with crc_update_table on random lengths,
+// alignments and starting crcs, otherwise this exits with 1.
+
+#include "crc.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef crc_t (*CrcFunc)(crc_t crc, const void *data, size_t data_len);
+
+struct Implementation {
+	const char* name;
+	CrcFunc update;
+};
+
+static bool crossCheck(const Implementation& impl, const std::vector<uint8_t>& data)
+{
+	std::mt19937 rng(1234);
+
+	for (int i = 0; i < 100000; ++i) {
+		size_t offset = rng() % 64;
+		// mostly short messages, with some long enough for every code path
+		size_t length = (i % 10 == 0) ? rng() % (data.size() - 64) : rng() % 512;
+		crc_t crc = (i % 2) ? crc_init() : crc_t(rng());
+
+		crc_t expected = crc_update_table(crc, data.data() + offset, length);
+		crc_t actual = impl.update(crc, data.data() + offset, length);
+		if (expected != actual) {
+			std::cout << impl.name << ": crc mismatch at offset " << offset << ", length " << length << std::endl;
+			return false;
+		}
+	}
+
+	// the standard check value for this crc
+	const char* check = "123456789";
+	if (crc_finalize(impl.update(crc_init(), check, 9)) != 0xfc891918) {
+		std::cout << impl.name << ": wrong check value" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+static void measure(const Implementation& impl, const std::vector<uint8_t>& data, size_t blockSize, size_t total)
+{
+	crc_t crc = crc_init();
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t done = 0; done < total; done += blockSize) {
+		crc = impl.update(crc, data.data(), blockSize);
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "  " << impl.name << ": " << (uint64_t)(total / elapsed / (1024 * 1024)) << " MB/s"
+		<< " (crc " << std::hex << crc_finalize(crc) << std::dec << ")" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t megabytes = argc > 1 ? std::stoul(argv[1]) : 256;
+
+	std::vector<uint8_t> data(64 * 1024);
+	std::mt19937 rng(42);
+	for (auto& b : data) {
+		b = uint8_t(rng());
+	}
+
+	std::string accelerated = std::string("crc_update (") + crc_implementation() + ")";
+	Implementation impls[] = {
+		{ "table     ", &crc_update_table },
+		{ "slice8    ", &crc_update_slice8 },
+		{ accelerated.c_str(), &crc_update },
+	};
+
+	for (const auto& impl : impls) {
+		if (!crossCheck(impl, data)) {
+			return 1;
+		}
+	}
+	std::cout << "all implementations match the table version" << std::endl;
+
+	size_t blockSizes[] = { 64, 1024, 16 * 1024, 64 * 1024 };
+	for (size_t blockSize : blockSizes) {
+		std::cout << blockSize << " byte buffers" << std::endl;
+		for (const auto& impl : impls) {
+			// the byte at a time version gets less data, it is slow enough to measure
+			size_t total = megabytes * 1024 * 1024 / (impl.update == &crc_update_table ? 8 : 1);
+			measure(impl, data, blockSize, total);
+		}
+	}
+
+	return 0;
+}
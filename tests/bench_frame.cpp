@@ -0,0 +1,189 @@
+// Compares the per frame cost of humblenet in the threaded and inline poll modes.
+//
+//   humblenet_bench_frame [threaded|inline] [frames]
+//
+// Forks 16 echo peers (always threaded) which register the aliases bench-echo-N,
+// then runs a 60Hz frame loop in the requested mode. Each frame pumps humblenet,
+// sends one message to every peer and drains the replies. Only the time spent
+// inside humblenet on the game thread is measured, the sleep until the next frame
+// is not. The total process CPU time is reported as well, as in threaded mode most
+// of the work happens on the humblenet thread.
+
+#include "humblenet_p2p.h"
+#include "child_process.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const int PEERS = 16;
+const uint8_t CHANNEL = 44;
+const int FRAME_MS = 16;
+const int MESSAGE_SIZE = 64;
+
+const char client_token[] = "hello_world";
+const char client_secret[] = "secret";
+
+static std::string alias_for(int index)
+{
+	return "bench-echo-" + std::to_string(index);
+}
+
+static void connect_server(bool inlineMode)
+{
+	humblenet_init();
+	humblenet_p2p_init(HUMBLENET_SERVER_URL, client_token, client_secret, NULL);
+
+	while (humblenet_p2p_get_my_peer_id() == 0) {
+		if (inlineMode) {
+			humblenet_process(10);
+		} else {
+			humblenet_p2p_wait(10);
+		}
+	}
+}
+
+static void run_echo(int index)
+{
+	connect_server(false);
+
+	humblenet_p2p_register_alias(alias_for(index).c_str());
+
+	uint8_t buff[MESSAGE_SIZE];
+
+	// until the tool kills us, or is gone
+	while (parentAlive()) {
+		if (!humblenet_p2p_wait(500)) continue;
+
+		PeerId fromPeer = 0;
+		int ret;
+		while ((ret = humblenet_p2p_recvfrom(buff, sizeof(buff), &fromPeer, CHANNEL)) > 0) {
+			humblenet_p2p_sendto(buff, ret, fromPeer, SEND_RELIABLE, CHANNEL);
+		}
+	}
+
+	humblenet_shutdown();
+}
+
+int main(int argc, char *argv[])
+{
+	bool inlineMode = argc > 1 && strcmp(argv[1], "inline") == 0;
+	int frames = argc > 2 ? std::stoi(argv[2]) : 1000;
+
+	std::vector<pid_t> children;
+	for (int i = 0; i < PEERS; ++i) {
+		pid_t pid = forkChild();
+		if (pid == 0) {
+			run_echo(i);
+			_exit(0);
+		}
+		children.push_back(pid);
+	}
+
+	if (inlineMode) {
+		humblenet_set_poll_mode(POLL_INLINE);
+	}
+
+	connect_server(inlineMode);
+
+	PeerId peers[PEERS];
+	for (int i = 0; i < PEERS; ++i) {
+		peers[i] = humblenet_p2p_virtual_peer_for_alias(alias_for(i).c_str());
+	}
+
+	uint8_t buff[MESSAGE_SIZE];
+	memset(buff, 0, sizeof(buff));
+
+	auto pump = [&]() {
+		if (inlineMode) {
+			humblenet_process(0);
+		}
+
+		int received = 0;
+		PeerId fromPeer = 0;
+		while (humblenet_p2p_recvfrom(buff, sizeof(buff), &fromPeer, CHANNEL) > 0) {
+			++received;
+		}
+		return received;
+	};
+
+	// wait until every echo peer answered once so connection setup is not measured.
+	std::cout << "Connecting to " << PEERS << " echo peers..." << std::endl;
+	{
+		std::set<PeerId> answered;
+		auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+		while (answered.size() < PEERS && std::chrono::steady_clock::now() < giveUp) {
+			for (int i = 0; i < PEERS; ++i) {
+				if (answered.count(peers[i]) == 0) {
+					humblenet_p2p_sendto(buff, sizeof(buff), peers[i], SEND_RELIABLE, CHANNEL);
+				}
+			}
+
+			for (int t = 0; t < 10; ++t) {
+				humblenet_p2p_wait(10);
+				PeerId fromPeer = 0;
+				while (humblenet_p2p_recvfrom(buff, sizeof(buff), &fromPeer, CHANNEL) > 0) {
+					answered.insert(fromPeer);
+				}
+			}
+		}
+
+		if (answered.size() < PEERS) {
+			std::cout << "Only " << answered.size() << " peers answered, giving up" << std::endl;
+		}
+	}
+
+	std::vector<int64_t> samples;
+	samples.reserve(frames);
+	int64_t received = 0;
+
+	clock_t cpuStart = clock();
+	auto nextFrame = std::chrono::steady_clock::now();
+	for (int f = 0; f < frames; ++f) {
+		auto start = std::chrono::steady_clock::now();
+
+		received += pump();
+		for (int i = 0; i < PEERS; ++i) {
+			humblenet_p2p_sendto(buff, sizeof(buff), peers[i], SEND_RELIABLE, CHANNEL);
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		samples.push_back(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+
+		nextFrame += std::chrono::milliseconds(FRAME_MS);
+		std::this_thread::sleep_until(nextFrame);
+	}
+
+	clock_t cpuUsed = clock() - cpuStart;
+
+	std::sort(samples.begin(), samples.end());
+	int64_t total = 0;
+	for (auto s : samples) total += s;
+
+	std::cout << (inlineMode ? "inline" : "threaded") << " mode, " << PEERS << " peers, "
+		<< frames << " frames, " << received << " echoes received" << std::endl;
+	std::cout << "per frame (us): avg " << total / (int64_t)samples.size()
+		<< " p50 " << samples[samples.size() / 2]
+		<< " p99 " << samples[samples.size() * 99 / 100]
+		<< " max " << samples.back() << std::endl;
+	std::cout << "process cpu per frame (us): " << (int64_t)cpuUsed * 1000000 / CLOCKS_PER_SEC / frames << std::endl;
+
+	humblenet_shutdown();
+
+	for (auto pid : children) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,383 @@
+// Measures how fast the peer server takes hellos, as when every client reconnects at
+// once after a restart.
+//
+//   humblenet_bench_hello <peer-server> [connections] [concurrent]
+//
+// First, in this process, what checking the signature of a hello costs when HMAC is
+// keyed with the game's secret for every hello, as the server used to, and when a keyed
+// one is copied, as it does now.
+//
+// Then it starts the given peer-server binary on port 28095 with a flat file of games
+// and opens 5000 connections (or the given number), 100 at a time (or the given number).
+// Each upgrades to a websocket, says hello and is closed once the HelloClient comes;
+// once for a game whose hellos are verified and once for one whose aren't. Reported are
+// hellos per second, the time from connecting to the HelloClient and the server's CPU
+// time per hello, from /proc.
+//
+// Last it adds a game to the file, replacing it like a deployment would, and reports how
+// long it takes until a hello for the new game is taken.
+
+#include "humblenet.h"
+#include "humblepeer.h"
+#include "hmac.h"
+#include "peer_server_fixture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace humblenet;
+
+typedef std::chrono::steady_clock Clock;
+
+const int PORT = 28095;
+const int TIMEOUT_S = 10;
+const int DEFAULT_CONNECTIONS = 5000;
+const int DEFAULT_CONCURRENT = 100;
+const int VERIFY_ITERATIONS = 1000000;
+
+const char* SECRET = "b4c8d2e6f0a1b3c5d7e9f1a3b5c7d9e1";
+
+enum State { Connecting, Upgrading, Hello, Done, Failed };
+
+struct humblenet::P2PSignalConnection {
+	int fd = -1;
+	State state = Connecting;
+	Clock::time_point start;
+	std::vector<uint8_t> in;
+	std::vector<uint8_t> recvBuf;
+	std::vector<uint8_t> out;	// only the one the hello is built with
+};
+
+static pid_t serverPid = 0;
+static std::string gamesFile;
+
+ha_bool humblenet::sendP2PMessage(P2PSignalConnection *conn, const uint8_t *buff, size_t length) {
+	appendFrame(conn->out, buff, length);
+	return true;
+}
+
+static ha_bool onMessage(const HumblePeer::Message* msg, void* data)
+{
+	P2PSignalConnection* conn = reinterpret_cast<P2PSignalConnection*>(data);
+	if (msg->message_type() == HumblePeer::MessageType::HelloClient) {
+		conn->state = Done;
+	}
+	return true;
+}
+
+// the server's frames in conn->in, unmasked
+static void parseFrames(P2PSignalConnection* conn)
+{
+	std::vector<uint8_t>& in = conn->in;
+	size_t offset = 0;
+
+	WebsocketFrame frame;
+	while (conn->state == Hello && nextFrame(in, offset, &frame)) {
+		if (frame.opcode == 0x8 || ((frame.opcode == 0x0 || frame.opcode == 0x2) && !parseMessage(conn->recvBuf, frame.payload, frame.length, onMessage, conn))) {
+			conn->state = Failed;
+			return;
+		}
+		offset += frame.size;
+	}
+
+	in.erase(in.begin(), in.begin() + offset);
+}
+
+static void startConnection(P2PSignalConnection* conn)
+{
+	conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+	fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+	// closed with a reset, so thousands of them don't use up the ports in TIME_WAIT
+	struct linger linger = { 1, 0 };
+	setsockopt(conn->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+
+	conn->state = Connecting;
+	conn->start = Clock::now();
+	conn->in.clear();
+	conn->recvBuf.clear();
+
+	struct sockaddr_in addr = loopbackAddress(PORT);
+	if (connect(conn->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS) {
+		conn->state = Failed;
+	}
+}
+
+// moves conn along as far as its socket lets it
+static void advance(P2PSignalConnection* conn, const std::vector<uint8_t>& hello, short revents)
+{
+	if (conn->state == Connecting && (revents & (POLLOUT | POLLERR | POLLHUP))) {
+		int error = 0;
+		socklen_t length = sizeof(error);
+		getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+
+		if (error != 0 || send(conn->fd, WEBSOCKET_REQUEST, strlen(WEBSOCKET_REQUEST), MSG_NOSIGNAL) != ssize_t(strlen(WEBSOCKET_REQUEST))) {
+			conn->state = Failed;
+			return;
+		}
+		conn->state = Upgrading;
+		return;
+	}
+
+	if (!(revents & (POLLIN | POLLERR | POLLHUP))) {
+		return;
+	}
+	uint8_t buff[16 * 1024];
+	ssize_t n = recv(conn->fd, buff, sizeof(buff), 0);
+	if (n <= 0) {
+		if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			conn->state = Failed;
+		}
+		return;
+	}
+	conn->in.insert(conn->in.end(), buff, buff + n);
+
+	if (conn->state == Upgrading) {
+		static const char end[] = "\r\n\r\n";
+		auto it = std::search(conn->in.begin(), conn->in.end(), end, end + 4);
+		if (it == conn->in.end()) {
+			return;
+		}
+		if (conn->in.size() < 12 || memcmp(conn->in.data(), "HTTP/1.1 101", 12) != 0
+			|| send(conn->fd, hello.data(), hello.size(), MSG_NOSIGNAL) != ssize_t(hello.size())) {
+			conn->state = Failed;
+			return;
+		}
+		conn->in.erase(conn->in.begin(), it + 4);
+		conn->state = Hello;
+	}
+	if (conn->state == Hello) {
+		parseFrames(conn);
+	}
+}
+
+// the masked frame of a hello for token
+static std::vector<uint8_t> buildHello(const std::string& token)
+{
+	P2PSignalConnection builder;
+	std::map<std::string, std::string> attributes;
+	sendHelloServer(&builder, 0x1, token, SECRET, "", "", attributes);
+	return builder.out;
+}
+
+struct StormResult {
+	uint64_t hellos = 0;
+	uint64_t failures = 0;
+	double seconds = 0;
+	std::vector<double> latencies;	// microseconds
+};
+
+// connections hellos for token, concurrent at a time
+static StormResult storm(const std::string& token, int connections, int concurrent)
+{
+	std::vector<uint8_t> hello = buildHello(token);
+	std::vector<P2PSignalConnection> conns(concurrent);
+	std::vector<struct pollfd> pfds(concurrent);
+
+	StormResult result;
+	int started = 0;
+	auto start = Clock::now();
+
+	for (auto& conn : conns) {
+		if (started < connections) {
+			startConnection(&conn);
+			++started;
+		} else {
+			conn.state = Done;
+		}
+	}
+
+	for (;;) {
+		size_t active = 0;
+		for (size_t i = 0; i < conns.size(); ++i) {
+			P2PSignalConnection& conn = conns[i];
+			if (conn.state == Done || conn.state == Failed) {
+				pfds[i].fd = -1;
+				continue;
+			}
+			++active;
+			pfds[i].fd = conn.fd;
+			pfds[i].events = (conn.state == Connecting) ? POLLOUT : POLLIN;
+			pfds[i].revents = 0;
+		}
+		if (!active) {
+			break;
+		}
+		poll(pfds.data(), pfds.size(), 100);
+
+		auto now = Clock::now();
+		for (size_t i = 0; i < conns.size(); ++i) {
+			P2PSignalConnection& conn = conns[i];
+			if (pfds[i].fd < 0) {
+				continue;
+			}
+			advance(&conn, hello, pfds[i].revents);
+			if (conn.state != Done && conn.state != Failed && now - conn.start > std::chrono::seconds(TIMEOUT_S)) {
+				conn.state = Failed;
+			}
+			if (conn.state != Done && conn.state != Failed) {
+				continue;
+			}
+
+			close(conn.fd);
+			if (conn.state == Done) {
+				result.hellos++;
+				result.latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - conn.start).count());
+			} else {
+				result.failures++;
+			}
+			if (started < connections) {
+				startConnection(&conn);
+				++started;
+			}
+		}
+	}
+
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	std::sort(result.latencies.begin(), result.latencies.end());
+	return result;
+}
+
+// replaces the games file in one go, so the server never reads half of it
+static bool writeGames(bool withNewGame)
+{
+	std::string temporary = gamesFile + ".new";
+	FILE* f = fopen(temporary.c_str(), "w");
+	if (!f) {
+		return false;
+	}
+	fprintf(f, "# game id, token, secret, verify, active\n");
+	fprintf(f, "1,bench-verified,%s,1,1\n", SECRET);
+	fprintf(f, "2,bench-unverified,%s,0,1\n", SECRET);
+	if (withNewGame) {
+		fprintf(f, "3,bench-added,%s,1,1\n", SECRET);
+	}
+	fclose(f);
+	return rename(temporary.c_str(), gamesFile.c_str()) == 0;
+}
+
+// the server's check of a hello's signature, keyed for every hello or copied keyed
+static double verifyCost(bool keyEveryTime)
+{
+	const std::string timestamp = std::to_string(time(NULL));
+	const uint8_t key[] = "timestamp";
+
+	HMACContext keyed;
+	HMACInit(&keyed, reinterpret_cast<const uint8_t*>(SECRET), unsigned(strlen(SECRET)));
+
+	std::string signature;
+	// so the loop isn't optimized away
+	volatile char sink = 0;
+	auto start = Clock::now();
+	for (int i = 0; i < VERIFY_ITERATIONS; ++i) {
+		HMACContext hmac;
+		if (keyEveryTime) {
+			HMACInit(&hmac, reinterpret_cast<const uint8_t*>(SECRET), unsigned(strlen(SECRET)));
+		} else {
+			hmac = keyed;
+		}
+		HMACInput(&hmac, key, sizeof(key) - 1);
+		HMACInput(&hmac, reinterpret_cast<const uint8_t*>(timestamp.data()), unsigned(timestamp.size()));
+		uint8_t digest[HMAC_DIGEST_SIZE];
+		HMACResult(&hmac, digest);
+		HMACResultToHex(digest, signature);
+		sink = signature[0];
+	}
+	(void)sink;
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / VERIFY_ITERATIONS;
+}
+
+static bool report(const char* name, const StormResult& result, double cpu)
+{
+	if (result.latencies.empty()) {
+		std::cout << name << ": no hellos taken, " << result.failures << " failed" << std::endl;
+		return false;
+	}
+	auto percentile = [&result](double p) {
+		return result.latencies[std::min(result.latencies.size() - 1, size_t(p * result.latencies.size()))];
+	};
+	char line[200];
+	snprintf(line, sizeof(line), "%-10s  %8.0f hellos/s  p50 %6.0f us  p99 %6.0f us  %6.1f server CPU us/hello  %llu failed",
+		name, result.hellos / result.seconds, percentile(0.5), percentile(0.99),
+		cpu * 1e6 / result.hellos, static_cast<unsigned long long>(result.failures));
+	std::cout << line << std::endl;
+	return result.failures == 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std::cout << "usage: " << argv[0] << " <peer-server> [connections] [concurrent]" << std::endl;
+		return 1;
+	}
+	int connections = argc > 2 ? std::stoi(argv[2]) : DEFAULT_CONNECTIONS;
+	int concurrent = argc > 3 ? std::stoi(argv[3]) : DEFAULT_CONCURRENT;
+	if (connections < 1 || concurrent < 1) {
+		std::cout << "connections and concurrent have to be at least 1" << std::endl;
+		return 1;
+	}
+
+	double keyed = verifyCost(true);
+	double copied = verifyCost(false);
+	char line[160];
+	snprintf(line, sizeof(line), "verifying a hello: %.0f ns keying HMAC every time, %.0f ns copying a keyed one", keyed, copied);
+	std::cout << line << std::endl;
+
+	gamesFile = "/tmp/bench_hello_" + std::to_string(getpid()) + ".csv";
+	if (writeGames(false)) {
+		serverPid = startServer(argv[1], "bench_hello", "port=" + std::to_string(PORT) + "\nlogfile=/dev/null\ngameDB=flat:" + gamesFile + "\n",
+			loopbackAddress(PORT), TIMEOUT_S);
+	}
+	if (serverPid <= 0) {
+		std::cout << "couldn't start " << argv[1] << std::endl;
+		unlink(gamesFile.c_str());
+		return 1;
+	}
+
+	std::cout << connections << " hellos, " << concurrent << " at a time" << std::endl;
+	double cpu = processCPU(serverPid);
+	StormResult result = storm("bench-verified", connections, concurrent);
+	bool ok = report("verified", result, processCPU(serverPid) - cpu);
+
+	cpu = processCPU(serverPid);
+	result = storm("bench-unverified", connections, concurrent);
+	ok = report("unverified", result, processCPU(serverPid) - cpu) && ok;
+
+	// the server doesn't know the game yet
+	if (storm("bench-added", 1, 1).hellos != 0) {
+		std::cout << "a hello for a game which isn't in the file was taken" << std::endl;
+		ok = false;
+	}
+
+	auto start = Clock::now();
+	bool reloaded = writeGames(true);
+	while (reloaded && storm("bench-added", 1, 1).hellos == 0) {
+		if (Clock::now() - start > std::chrono::seconds(TIMEOUT_S)) {
+			reloaded = false;
+		}
+		usleep(1000);
+	}
+	if (reloaded) {
+		snprintf(line, sizeof(line), "a game added to the file is taken after %.1f ms",
+			std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+		std::cout << line << std::endl;
+	} else {
+		std::cout << "a game added to the file wasn't taken" << std::endl;
+		ok = false;
+	}
+
+	stopServer(serverPid);
+	unlink(gamesFile.c_str());
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+// Measures the cost of a log call in the peer server, against the logger it replaced.
+//
+//   humblenet_bench_logging [threads] [calls] [logfile]
+//
+// Every thread (4 by default) makes the given number of calls (200000 by default), each
+// a line like the ones logged for signaling messages, into the log file (a file in /tmp
+// by default, removed afterwards).
+//
+//   previous    a mutex around formatting the time and fprintf to a line buffered file
+//   info        LOG_INFO, formatted into the thread's ring and written in the background
+//   filtered    LOG_DEBUG while logging at info, skipped before formatting
+//
+// Reports the calls per second each thread sees, and for the current logger also how
+// long until everything was written and how many lines made it to the file (the rest
+// were dropped because the writer couldn't keep up).
+
+#include "logging.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/time.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+const char* URL = "127.0.0.1:51234";
+
+static FILE* previousFP = NULL;
+static std::mutex previousMutex;
+
+// the previous logger, as it was
+static std::string previousLogTime()
+{
+	struct tm tparts;
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	gmtime_r(&t.tv_sec, &tparts);
+	char buff[100], buff2[40];
+	strftime(buff2, sizeof(buff2), "%y-%m-%d %H:%M:%S", &tparts);
+	snprintf(buff, sizeof(buff), "%s.%03d", buff2, int(t.tv_usec / 1000));
+	return std::string(buff);
+}
+
+static void previousLog(const char* fmt, unsigned a, const char* b, unsigned c)
+{
+	std::lock_guard<std::mutex> lock(previousMutex);
+	fprintf(previousFP, "[%s]: %s: ", previousLogTime().c_str(), "NOTICE");
+	fprintf(previousFP, fmt, a, b, c);
+}
+
+enum class Mode {
+	PREVIOUS,
+	INFO,
+	FILTERED,
+};
+
+// returns the calls per second per thread
+static double run(Mode mode, int threads, int calls)
+{
+	std::vector<std::thread> workers;
+	std::vector<double> seconds(threads);
+
+	for (int t = 0; t < threads; ++t) {
+		workers.emplace_back([mode, calls, t, &seconds] {
+			auto start = Clock::now();
+			for (int i = 0; i < calls; ++i) {
+				switch (mode) {
+					case Mode::PREVIOUS:
+						previousLog("ICECandidate from peer %u (%s) to peer %u\n", i, URL, t);
+						break;
+					case Mode::INFO:
+						LOG_INFO("ICECandidate from peer %u (%s) to peer %u\n", i, URL, t);
+						break;
+					case Mode::FILTERED:
+						LOG_DEBUG("ICECandidate from peer %u (%s) to peer %u\n", i, URL, t);
+						break;
+				}
+			}
+			seconds[t] = std::chrono::duration<double>(Clock::now() - start).count();
+		});
+	}
+
+	double total = 0;
+	for (int t = 0; t < threads; ++t) {
+		workers[t].join();
+		total += seconds[t];
+	}
+	return calls / (total / threads);
+}
+
+// the benchmark's lines, not the notes about dropped ones
+static size_t countLines(const std::string& file)
+{
+	std::ifstream in(file.c_str());
+	size_t lines = 0;
+	std::string line;
+	while (std::getline(in, line)) {
+		lines += (line.find("ICECandidate") != std::string::npos);
+	}
+	return lines;
+}
+
+int main(int argc, char *argv[])
+{
+	int threads = argc > 1 ? std::stoi(argv[1]) : 4;
+	int calls = argc > 2 ? std::stoi(argv[2]) : 200000;
+	bool temporary = argc <= 3;
+	std::string logFile = temporary ? "/tmp/bench_logging_" + std::to_string(getpid()) + ".log" : argv[3];
+	if (threads < 1 || calls < 1) {
+		std::cout << "usage: " << argv[0] << " [threads] [calls] [logfile]" << std::endl;
+		return 1;
+	}
+
+	std::cout << threads << " threads making " << calls << " log calls each" << std::endl;
+
+	previousFP = fopen(logFile.c_str(), "w");
+	if (!previousFP) {
+		std::cout << "can't open " << logFile << std::endl;
+		return 1;
+	}
+	setvbuf(previousFP, NULL, _IOLBF, BUFSIZ);
+	double rate = run(Mode::PREVIOUS, threads, calls);
+	fclose(previousFP);
+	std::cout << "  previous: " << (uint64_t)rate << " calls/s" << std::endl;
+
+	// the current logger appends after the previous one's lines
+	size_t before = countLines(logFile);
+	logSetLevel("info");
+	logFileOpen(logFile);
+
+	auto start = Clock::now();
+	rate = run(Mode::INFO, threads, calls);
+	logFileClose();
+	double written = std::chrono::duration<double>(Clock::now() - start).count();
+	size_t lines = countLines(logFile) - before;
+	std::cout << "  info    : " << (uint64_t)rate << " calls/s, all written after " << written * 1000 << " ms, "
+		<< lines << " of " << size_t(threads) * calls << " lines" << std::endl;
+
+	rate = run(Mode::FILTERED, threads, calls);
+	std::cout << "  filtered: " << (uint64_t)rate << " calls/s" << std::endl;
+
+	if (temporary) {
+		unlink(logFile.c_str());
+	}
+
+	return 0;
+}
@@ -0,0 +1,265 @@
+// Measures the peer server's outbound queue on relayed traffic, against the byte buffer it replaced.
+//
+//   humblenet_bench_outbound [messages] [size] [fanout]
+//
+// Encodes P2PRelayData messages (100k of 1000 bytes by default) and queues each on
+// sockets the way the peer server does: every message on one socket, and then every
+// message on fanout sockets (8 by default) as with a message sent to several peers.
+// The sockets take a pseudo random 2-64 KB per writable callback, so frames are often
+// only partly written, and copy it like the kernel would. Before the timed runs both
+// queues run on the first VERIFY_MESSAGES messages keeping everything the sockets took,
+// which is parsed to check every message arrived whole.
+//
+//   byte buffer   the previous queue: append to a per socket std::vector<char>, copy up to
+//                 MAX_SIGNAL_FRAME_SIZE into the padded write buffer, erase what was written
+//   OutQueue      one padded, reference counted copy per message, large messages are
+//                 written from it in place and small ones coalesced
+//
+// Allocations are counted with a replacement operator new and reported per queued message.
+
+#include "humblenet.h"
+#include "humblepeer.h"
+
+#include "out_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace humblenet;
+
+const size_t VERIFY_MESSAGES = 2000;
+const size_t SOCKET_BUFFER_SIZE = 64 * 1024;
+
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete[](void* p) noexcept
+{
+	operator delete(p);
+}
+
+// the last encoded message is left here instead of being sent
+struct humblenet::P2PSignalConnection {
+	const uint8_t* data;
+	size_t length;
+};
+
+ha_bool humblenet::sendP2PMessage(P2PSignalConnection *conn, const uint8_t *buff, size_t length) {
+	conn->data = buff;
+	conn->length = length;
+	return true;
+}
+
+static ha_bool countMessage(const HumblePeer::Message *msg, void *user) {
+	size_t &count = *reinterpret_cast<size_t *>(user);
+	if (msg->message_type() == HumblePeer::MessageType::P2PRelayData) {
+		++count;
+	}
+	return true;
+}
+
+// A websocket which takes a limited number of bytes each time it's writable.
+struct FakeSocket {
+	// everything written when verifying, otherwise the last SOCKET_BUFFER_SIZE bytes
+	std::vector<uint8_t> sink;
+	bool keep;
+	size_t budget;
+	uint32_t seed;
+
+	// the previous queue
+	std::vector<char> sendBuf;
+
+	OutQueue sendQueue;
+
+	FakeSocket(uint32_t s, bool k) : sink(k ? 0 : SOCKET_BUFFER_SIZE), keep(k), budget(0), seed(s) {}
+
+	void writable()
+	{
+		seed = seed * 1103515245 + 12345;
+		budget = 2048 + (seed >> 8) % (62 * 1024);
+	}
+
+	int write(const uint8_t* buf, size_t length)
+	{
+		size_t n = std::min(length, budget);
+		if (keep) {
+			sink.insert(sink.end(), buf, buf + n);
+		} else {
+			memcpy(sink.data(), buf, n);
+		}
+		budget -= n;
+		return int(n);
+	}
+};
+
+enum class Mode {
+	BYTE_BUFFER,
+	OUT_QUEUE,
+};
+
+// the previous LWS_CALLBACK_SERVER_WRITEABLE, one frame per callback
+static void writeByteBuffer(FakeSocket& sock, std::vector<uint8_t>& writeBuf)
+{
+	size_t bufsize = std::min(sock.sendBuf.size(), MAX_SIGNAL_FRAME_SIZE);
+	writeBuf.resize(LWS_SEND_BUFFER_PRE_PADDING + bufsize + LWS_SEND_BUFFER_POST_PADDING);
+	memcpy(&writeBuf[LWS_SEND_BUFFER_PRE_PADDING], &sock.sendBuf[0], bufsize);
+	int retval = sock.write(&writeBuf[LWS_SEND_BUFFER_PRE_PADDING], bufsize);
+	sock.sendBuf.erase(sock.sendBuf.begin(), sock.sendBuf.begin() + retval);
+}
+
+static void writeOutQueue(FakeSocket& sock, std::vector<uint8_t>& writeBuf)
+{
+	auto write = [&sock](uint8_t* buf, size_t length) {
+		return sock.write(buf, length);
+	};
+
+	while (!sock.sendQueue.empty()) {
+		sock.sendQueue.writeFrame(write, writeBuf);
+		if (sock.sendQueue.inFrame() || sock.budget == 0) {
+			break;
+		}
+	}
+}
+
+static bool pending(const FakeSocket& sock, Mode mode)
+{
+	return mode == Mode::BYTE_BUFFER ? !sock.sendBuf.empty() : !sock.sendQueue.empty();
+}
+
+// returns false if verifying and a socket didn't get every message whole
+static bool run(const char* name, Mode mode, size_t messages, size_t size, size_t fanout, bool verify)
+{
+	// the server gets to write after every burst of this many messages
+	const size_t BURST = 16;
+
+	std::vector<FakeSocket> sockets;
+	for (size_t i = 0; i < fanout; ++i) {
+		sockets.emplace_back(uint32_t(i + 1), verify);
+	}
+
+	std::vector<uint8_t> payload(size, 0x42);
+	std::vector<uint8_t> writeBuf;
+	P2PSignalConnection conn;
+
+	uint64_t allocationsBefore = allocations.load(std::memory_order_relaxed);
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < messages; ++i) {
+		if (!sendP2PRelayData(&conn, PeerId(1 + i % 1000), payload.data(), uint16_t(size))) {
+			return false;
+		}
+
+		if (mode == Mode::BYTE_BUFFER) {
+			for (auto& sock : sockets) {
+				sock.sendBuf.insert(sock.sendBuf.end(), conn.data, conn.data + conn.length);
+			}
+		} else {
+			OutMessageRef msg = OutMessage::create(conn.data, conn.length);
+			for (auto& sock : sockets) {
+				sock.sendQueue.push(msg);
+			}
+		}
+
+		if ((i + 1) % BURST == 0 || i + 1 == messages) {
+			bool more = true;
+			while (more) {
+				more = false;
+				for (auto& sock : sockets) {
+					if (!pending(sock, mode)) {
+						continue;
+					}
+					sock.writable();
+					if (mode == Mode::BYTE_BUFFER) {
+						writeByteBuffer(sock, writeBuf);
+					} else {
+						writeOutQueue(sock, writeBuf);
+					}
+					more = more || pending(sock, mode);
+				}
+			}
+		}
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	uint64_t allocated = allocations.load(std::memory_order_relaxed) - allocationsBefore;
+
+	if (verify) {
+		for (auto& sock : sockets) {
+			std::vector<uint8_t> recvBuf;
+			size_t count = 0;
+			if (!parseMessage(recvBuf, sock.sink.data(), sock.sink.size(), countMessage, &count) || count != messages || !recvBuf.empty()) {
+				std::cout << "  " << name << ": FAILED, a socket got " << count << " of " << messages << " messages whole" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	size_t queued = messages * fanout;
+	double bytes = double(conn.length) * queued;
+
+	std::cout << "  " << name << ": " << elapsed * 1000 << " ms, "
+		<< (uint64_t)(queued / elapsed) << " messages/s, "
+		<< (uint64_t)(bytes / elapsed / (1024 * 1024)) << " MB/s, "
+		<< double(allocated) / queued << " allocations per message" << std::endl;
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	size_t messages = argc > 1 ? std::stoul(argv[1]) : 100000;
+	size_t size = argc > 2 ? std::stoul(argv[2]) : 1000;
+	size_t fanout = argc > 3 ? std::stoul(argv[3]) : 8;
+	if (messages == 0 || size == 0 || size > 65535 || fanout == 0) {
+		std::cout << "usage: " << argv[0] << " [messages] [size, up to 65535] [fanout]" << std::endl;
+		return 1;
+	}
+
+	// warm up the builder pool
+	P2PSignalConnection conn;
+	uint8_t warm = 0;
+	(void)sendP2PRelayData(&conn, 1, &warm, 1);
+
+	size_t verifyMessages = std::min(messages, VERIFY_MESSAGES);
+	if (!run("byte buffer", Mode::BYTE_BUFFER, verifyMessages, size, fanout, true) ||
+		!run("OutQueue", Mode::OUT_QUEUE, verifyMessages, size, fanout, true)) {
+		return 1;
+	}
+
+	std::cout << messages << " relayed messages of " << size << " bytes" << std::endl;
+
+	std::cout << "one socket" << std::endl;
+	run("byte buffer", Mode::BYTE_BUFFER, messages, size, 1, false);
+	run("OutQueue   ", Mode::OUT_QUEUE, messages, size, 1, false);
+
+	std::cout << "fanned out to " << fanout << " sockets" << std::endl;
+	run("byte buffer", Mode::BYTE_BUFFER, messages, size, fanout, false);
+	run("OutQueue   ", Mode::OUT_QUEUE, messages, size, fanout, false);
+
+	return 0;
+}
@@ -0,0 +1,183 @@
+// Measures encoding and parseMessage on a stream of 100k mixed signaling messages.
+//
+//   humblenet_bench_parse [messages] [frame size]
+//
+// The stream is cut into websocket sized frames (so messages straddle frames) and
+// parsed three ways:
+//   per-message erase   the previous parser: append to recvBuf, erase after every message
+//   recvBuf             append to recvBuf, parseMessage compacts it once per frame
+//   payload             parseMessage straight from the frame, only partial messages are copied
+// Encoding reports how often the builder pool allocated, past the first message that
+// should be never. Then the whole stream is parsed as a single frame, the burst case that made the
+// previous parser quadratic. That one only runs on the first 10k messages.
+
+#include "humblenet.h"
+#include "humblepeer.h"
+
+#include "crc.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace humblenet;
+
+const size_t PEER_OFFSET_SIZE = 8;
+const size_t LEGACY_BURST_MESSAGES = 10000;
+
+// the generated messages are captured here instead of being sent.
+struct humblenet::P2PSignalConnection {
+	std::vector<uint8_t> stream;
+	std::vector<size_t> ends;
+};
+
+ha_bool humblenet::sendP2PMessage(P2PSignalConnection *conn, const uint8_t *buff, size_t length) {
+	conn->stream.insert(conn->stream.end(), buff, buff + length);
+	conn->ends.push_back(conn->stream.size());
+	return true;
+}
+
+static ha_bool countMessage(const HumblePeer::Message *msg, void *user) {
+	size_t &count = *reinterpret_cast<size_t *>(user);
+	if (msg->message_type() != HumblePeer::MessageType::NONE) {
+		++count;
+	}
+	return true;
+}
+
+// the parser this replaces, minus the recursion, as the baseline.
+static ha_bool legacyParseMessage(std::vector<uint8_t> &recvBuf, ProcessMsgFunc processFunc, void *user_data) {
+	while (recvBuf.size() >= PEER_OFFSET_SIZE) {
+		flatbuffers::uoffset_t fbSize = flatbuffers::ReadScalar<flatbuffers::uoffset_t>(recvBuf.data());
+		if (recvBuf.size() < (fbSize + PEER_OFFSET_SIZE)) {
+			return 1;
+		}
+
+		const uint8_t* buff = recvBuf.data() + PEER_OFFSET_SIZE;
+
+		auto crc = crc_init();
+		crc = crc_update(crc, buff, fbSize);
+		crc = crc_finalize(crc);
+
+		if (flatbuffers::ReadScalar<flatbuffers::uoffset_t>(recvBuf.data() + sizeof(flatbuffers::uoffset_t)) != crc) {
+			return 0;
+		}
+
+		flatbuffers::Verifier v(buff, fbSize);
+		if (!HumblePeer::VerifyMessageBuffer(v)) {
+			return 0;
+		}
+
+		if (!processFunc(HumblePeer::GetMessage(buff), user_data)) {
+			return 0;
+		}
+
+		recvBuf.erase(recvBuf.begin(), recvBuf.begin() + fbSize + PEER_OFFSET_SIZE);
+	}
+	return 1;
+}
+
+enum class Mode {
+	LEGACY,
+	BUFFERED,
+	PAYLOAD,
+};
+
+static void run(const char* name, Mode mode, const uint8_t *stream, size_t size, size_t frameSize, size_t expected) {
+	std::vector<uint8_t> recvBuf;
+	size_t count = 0;
+	ha_bool ok = true;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t offset = 0; ok && offset < size; offset += frameSize) {
+		size_t len = std::min(frameSize, size - offset);
+		const uint8_t* frame = stream + offset;
+
+		if (mode == Mode::PAYLOAD) {
+			ok = parseMessage(recvBuf, frame, len, countMessage, &count);
+		} else {
+			recvBuf.insert(recvBuf.end(), frame, frame + len);
+			if (mode == Mode::LEGACY) {
+				ok = legacyParseMessage(recvBuf, countMessage, &count);
+			} else {
+				ok = parseMessage(recvBuf, countMessage, &count);
+			}
+		}
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "  " << name << ": " << elapsed * 1000 << " ms, "
+		<< (uint64_t)(count / elapsed) << " messages/s";
+	if (!ok || count != expected) {
+		std::cout << " (FAILED, parsed " << count << " of " << expected << ")";
+	}
+	std::cout << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+	size_t messages = argc > 1 ? std::stoul(argv[1]) : 100000;
+	size_t frameSize = argc > 2 ? std::stoul(argv[2]) : 4096;
+	if (messages == 0 || frameSize == 0) {
+		return 1;
+	}
+
+	P2PSignalConnection conn;
+
+	std::string offer(300, 'o');
+	std::string candidate = "candidate:1 1 UDP 2122252543 192.168.1.10 50000 typ host";
+	uint8_t relay[64];
+	memset(relay, 0x42, sizeof(relay));
+
+	conn.stream.reserve(messages * 256);
+	conn.ends.reserve(messages);
+
+	FBBAllocStats before = getFBBAllocStats();
+	FBBAllocStats warm = before;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < messages; ++i) {
+		if (i == 1) {
+			warm = getFBBAllocStats();
+		}
+		PeerId peer = 1 + (i % 1000);
+		ha_bool ok = true;
+		switch (i % 6) {
+		case 0: ok = sendP2PConnect(&conn, peer, 1, offer.c_str()); break;
+		case 1: ok = sendP2PResponse(&conn, peer, offer.c_str()); break;
+		case 2: ok = sendICECandidate(&conn, peer, candidate.c_str()); break;
+		case 3: ok = sendP2PRelayData(&conn, peer, relay, sizeof(relay)); break;
+		case 4: ok = sendAliasLookup(&conn, "bench-alias-" + std::to_string(peer)); break;
+		case 5: ok = sendP2PDisconnect(&conn, peer); break;
+		}
+		(void)ok;
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	FBBAllocStats after = getFBBAllocStats();
+
+	std::cout << messages << " messages, " << conn.stream.size() << " bytes" << std::endl;
+	std::cout << "encoding: " << elapsed * 1000 << " ms, " << (uint64_t)(messages / elapsed) << " messages/s, "
+		<< (after.builders - before.builders) << " builders, "
+		<< (after.allocations - before.allocations) << " buffer allocations ("
+		<< (after.allocations - warm.allocations) << " after the first message)" << std::endl;
+
+	std::cout << frameSize << " byte frames" << std::endl;
+	run("per-message erase", Mode::LEGACY, conn.stream.data(), conn.stream.size(), frameSize, messages);
+	run("recvBuf          ", Mode::BUFFERED, conn.stream.data(), conn.stream.size(), frameSize, messages);
+	run("payload          ", Mode::PAYLOAD, conn.stream.data(), conn.stream.size(), frameSize, messages);
+
+	std::cout << "single frame" << std::endl;
+	size_t legacyMessages = std::min(messages, LEGACY_BURST_MESSAGES);
+	size_t legacySize = conn.ends[legacyMessages - 1];
+	run("per-message erase", Mode::LEGACY, conn.stream.data(), legacySize, legacySize, legacyMessages);
+	run("recvBuf          ", Mode::BUFFERED, conn.stream.data(), conn.stream.size(), conn.stream.size(), messages);
+	run("payload          ", Mode::PAYLOAD, conn.stream.data(), conn.stream.size(), conn.stream.size(), messages);
+
+	return 0;
+}
@@ -0,0 +1,306 @@
+// Measures how fast the peer server relays data from one peer to another.
+//
+//   humblenet_bench_relay <peer-server> [packet bytes] [megabytes]
+//
+// Starts the given peer-server binary on port 28092, connects a sender and a receiver
+// and relays 256 MB (or the given number) of 512 byte packets (or the given size) from
+// one to the other, once for each way relay data can travel:
+//
+//   relaydata   every packet is a P2PRelayData message, verified and rebuilt by the server
+//   frames      every packet is a relay frame of its own, forwarded as it is
+//   coalesced   packets are put into relay frames of up to 16 KB, like the library does
+//               while its writes are waiting for the socket
+//
+// The sender keeps at most 512 KB ahead of the receiver so nothing is dropped. Reported
+// are packets and megabytes per second and the server's CPU time per gigabyte, from
+// /proc.
+
+#include "humblenet.h"
+#include "humblepeer.h"
+#include "peer_server_fixture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace humblenet;
+
+typedef std::chrono::steady_clock Clock;
+
+const int PORT = 28092;
+const int TIMEOUT_S = 10;
+const int DEFAULT_PACKET = 512;
+const int DEFAULT_MEGABYTES = 256;
+// under the server's high water mark, past it relay data is dropped
+const uint64_t WINDOW = 512 * 1024;
+const size_t COALESCE_SIZE = MAX_SIGNAL_FRAME_SIZE;
+const size_t MAX_OUT = 256 * 1024;
+
+enum class Mode { RelayData, Frames, Coalesced };
+
+struct humblenet::P2PSignalConnection {
+	int fd = -1;
+	bool closed = false;
+	std::vector<uint8_t> out;
+	size_t outOffset = 0;
+	std::vector<uint8_t> in;
+	std::vector<uint8_t> recvBuf;
+
+	PeerId peerId = 0;
+	uint64_t packets = 0;	// relayed to this peer
+	uint64_t bytes = 0;
+};
+
+static pid_t serverPid = 0;
+
+static void flush(P2PSignalConnection* conn)
+{
+	while (!conn->closed && conn->outOffset < conn->out.size()) {
+		ssize_t n = send(conn->fd, conn->out.data() + conn->outOffset, conn->out.size() - conn->outOffset, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				conn->closed = true;
+			}
+			break;
+		}
+		conn->outOffset += n;
+	}
+	if (conn->outOffset == conn->out.size()) {
+		conn->out.clear();
+		conn->outOffset = 0;
+	}
+}
+
+// a masked binary frame, the key is 0. Sent by pump
+ha_bool humblenet::sendP2PMessage(P2PSignalConnection *conn, const uint8_t *buff, size_t length) {
+	appendFrame(conn->out, buff, length);
+	return !conn->closed;
+}
+
+static ha_bool onMessage(const HumblePeer::Message* msg, void* data)
+{
+	P2PSignalConnection* conn = reinterpret_cast<P2PSignalConnection*>(data);
+
+	switch (msg->message_type()) {
+		case HumblePeer::MessageType::HelloClient:
+			conn->peerId = reinterpret_cast<const HumblePeer::HelloClient*>(msg->message())->peerId();
+			break;
+
+		case HumblePeer::MessageType::P2PRelayData:
+			conn->packets++;
+			conn->bytes += reinterpret_cast<const HumblePeer::P2PRelayData*>(msg->message())->data()->size();
+			break;
+
+		default:
+			break;
+	}
+	return true;
+}
+
+static ha_bool onRelayFrame(const uint8_t* frame, size_t length, void* data)
+{
+	P2PSignalConnection* conn = reinterpret_cast<P2PSignalConnection*>(data);
+	return forEachRelayPacket(frame, length, [conn](const uint8_t*, size_t size) {
+		conn->packets++;
+		conn->bytes += size;
+	});
+}
+
+// the server's frames in conn->in, unmasked
+static void parseFrames(P2PSignalConnection* conn)
+{
+	std::vector<uint8_t>& in = conn->in;
+	size_t offset = 0;
+
+	WebsocketFrame frame;
+	while (nextFrame(in, offset, &frame)) {
+		if (frame.opcode == 0x8) {
+			conn->closed = true;
+			return;
+		}
+		if ((frame.opcode == 0x0 || frame.opcode == 0x2) && !parseMessage(conn->recvBuf, frame.payload, frame.length, onMessage, conn, onRelayFrame)) {
+			conn->closed = true;
+			return;
+		}
+		offset += frame.size;
+	}
+
+	in.erase(in.begin(), in.begin() + offset);
+}
+
+static void receive(P2PSignalConnection* conn)
+{
+	uint8_t buff[256 * 1024];
+	ssize_t n = recv(conn->fd, buff, sizeof(buff), 0);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+		conn->closed = true;
+		return;
+	}
+	if (n > 0) {
+		conn->in.insert(conn->in.end(), buff, buff + n);
+		parseFrames(conn);
+	}
+}
+
+// waits up to timeoutMs for either socket, writes what's queued and reads what came
+static void pump(P2PSignalConnection** conns, size_t count, int timeoutMs)
+{
+	struct pollfd pfds[2] = {};
+	for (size_t i = 0; i < count; ++i) {
+		pfds[i].fd = conns[i]->closed ? -1 : conns[i]->fd;
+		pfds[i].events = POLLIN | (conns[i]->out.empty() ? 0 : POLLOUT);
+	}
+	if (poll(pfds, count, timeoutMs) <= 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (pfds[i].revents & POLLOUT) {
+			flush(conns[i]);
+		}
+		if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+			receive(conns[i]);
+		}
+	}
+}
+
+static bool openPeer(P2PSignalConnection* conn, uint8_t flags)
+{
+	conn->fd = openWebsocket(loopbackAddress(PORT));
+	if (conn->fd < 0) {
+		return false;
+	}
+
+	std::map<std::string, std::string> attributes;
+	if (!sendHelloServer(conn, flags, "bench-relay", "secret", "", "", attributes)) {
+		return false;
+	}
+
+	auto giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+	while (!conn->peerId && !conn->closed && Clock::now() < giveUp) {
+		pump(&conn, 1, 10);
+	}
+	return conn->peerId != 0;
+}
+
+// queues the next packets for receiver, as many as the mode puts in a message
+static size_t queuePackets(P2PSignalConnection* sender, PeerId receiver, Mode mode, const std::vector<uint8_t>& packet, uint64_t left)
+{
+	switch (mode) {
+		case Mode::RelayData:
+			sendP2PRelayData(sender, receiver, packet.data(), uint16_t(packet.size()));
+			return 1;
+
+		case Mode::Frames:
+			sendRelayFrame(sender, receiver, packet.data(), packet.size());
+			return 1;
+
+		case Mode::Coalesced:
+		{
+			std::vector<uint8_t> frame(RELAY_FRAME_HEADER_SIZE);
+			setRelayFramePeer(frame.data(), receiver);
+			size_t count = 0;
+			do {
+				appendRelayPacket(frame, 0, packet.data(), packet.size());
+				++count;
+			} while (count < left && frame.size() + RELAY_PACKET_HEADER_SIZE + packet.size() <= COALESCE_SIZE);
+			return sendP2PMessage(sender, frame.data(), frame.size()) ? count : 0;
+		}
+	}
+	return 0;
+}
+
+static bool run(const char* name, Mode mode, size_t packetSize, uint64_t total)
+{
+	uint8_t flags = 0x1;
+	if (mode != Mode::RelayData) {
+		flags |= HELLO_FLAG_RELAY_FRAMES;
+	}
+
+	P2PSignalConnection sender, receiver;
+	if (!openPeer(&sender, flags) || !openPeer(&receiver, flags)) {
+		std::cout << name << ": couldn't connect" << std::endl;
+		return false;
+	}
+
+	std::vector<uint8_t> packet(packetSize, 0x5a);
+	uint64_t packets = total / packetSize;
+	uint64_t sent = 0;
+
+	P2PSignalConnection* conns[] = { &sender, &receiver };
+	double cpuStart = processCPU(serverPid);
+	auto start = Clock::now();
+	auto lastProgress = start;
+	uint64_t lastReceived = 0;
+
+	while (receiver.packets < packets && !sender.closed && !receiver.closed) {
+		while (!sender.closed && sent < packets && (sent - receiver.packets) * packetSize < WINDOW && sender.out.size() < MAX_OUT) {
+			sent += queuePackets(&sender, receiver.peerId, mode, packet, packets - sent);
+		}
+		pump(conns, 2, 100);
+
+		auto now = Clock::now();
+		if (receiver.packets != lastReceived) {
+			lastReceived = receiver.packets;
+			lastProgress = now;
+		} else if (now - lastProgress > std::chrono::seconds(TIMEOUT_S)) {
+			break;
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	double cpu = processCPU(serverPid) - cpuStart;
+	close(sender.fd);
+	close(receiver.fd);
+
+	if (receiver.packets != packets || receiver.bytes != packets * packetSize) {
+		std::cout << name << ": received " << receiver.packets << " of " << packets << " packets" << std::endl;
+		return false;
+	}
+
+	double gigabytes = double(receiver.bytes) / (1024.0 * 1024.0 * 1024.0);
+	char line[160];
+	snprintf(line, sizeof(line), "%-10s  %10.0f packets/s  %8.1f MB/s  %6.2f server CPU s/GB",
+		name, packets / seconds, receiver.bytes / (1024.0 * 1024.0) / seconds, cpu / gigabytes);
+	std::cout << line << std::endl;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std::cout << "usage: " << argv[0] << " <peer-server> [packet bytes] [megabytes]" << std::endl;
+		return 1;
+	}
+	size_t packetSize = size_t(argc > 2 ? std::stoi(argv[2]) : DEFAULT_PACKET);
+	uint64_t total = uint64_t(argc > 3 ? std::stoi(argv[3]) : DEFAULT_MEGABYTES) * 1024 * 1024;
+	if (packetSize == 0 || packetSize > UINT16_MAX) {
+		std::cout << "the packet size has to fit P2PRelayData, 1 to 65535 bytes" << std::endl;
+		return 1;
+	}
+
+	serverPid = startServer(argv[1], "bench_relay", "port=" + std::to_string(PORT) + "\nlogfile=/dev/null\n",
+		loopbackAddress(PORT), TIMEOUT_S);
+	if (serverPid < 0) {
+		std::cout << "couldn't start " << argv[1] << std::endl;
+		return 1;
+	}
+
+	std::cout << "relaying " << total / (1024 * 1024) << " MB in " << packetSize << " byte packets" << std::endl;
+	bool ok = run("relaydata", Mode::RelayData, packetSize, total);
+	ok = run("frames", Mode::Frames, packetSize, total) && ok;
+	ok = run("coalesced", Mode::Coalesced, packetSize, total) && ok;
+
+	stopServer(serverPid);
+	return ok ? 0 : 1;
+}
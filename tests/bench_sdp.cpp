@@ -0,0 +1,175 @@
+// Compares the size and cost of sending offers and ICE candidates as SDP text
+// and in the compact encoding.
+//
+//   humblenet_bench_sdp [iterations]
+//
+// The samples are shaped like what the two WebRTC stacks we talk to generate:
+// the Microstack SDP template (ILibWrapper_BlockToSDPEx) for native peers and a
+// browser data channel offer/answer with trickled candidates. Every sample is
+// encoded both ways, parsed back with parseMessage and checked against the
+// original text. Messages that wouldn't come out smaller are sent as text
+// even when compact is asked for, so those show no change.
+
+#include "humblenet.h"
+#include "humblepeer.h"
+#include "humblepeer_sdp.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace humblenet;
+
+// the generated messages are captured here instead of being sent.
+struct humblenet::P2PSignalConnection {
+	std::vector<uint8_t> stream;
+};
+
+ha_bool humblenet::sendP2PMessage(P2PSignalConnection *conn, const uint8_t *buff, size_t length) {
+	conn->stream.insert(conn->stream.end(), buff, buff + length);
+	return true;
+}
+
+static const char* microstackOffer =
+	"v=0\r\n"
+	"o=MeshAgent 1804289383 0 IN IP4 0.0.0.0\r\n"
+	"s=SIP Call\r\n"
+	"t=0 0\r\n"
+	"a=ice-ufrag:0A7D3F2B91C4E5D6\r\n"
+	"a=ice-pwd:6B1E9C0D4A8F27E35D9B0C1A7E4F6D2B\r\n"
+	"a=fingerprint:sha-256 4F:1A:9C:E2:77:0B:D3:5E:A8:61:2C:F4:93:B7:0E:58:CA:16:7D:E9:42:B0:85:3F:6A:D1:29:C7:0F:E4:8B:53\r\n"
+	"m=application 1 DTLS/SCTP 5000\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=sctpmap:5000 webrtc-datachannel 16\r\n"
+	"a=setup:actpass\r\n"
+	"a=candidate:0 1 UDP 2128609535 192.168.1.23 49812 typ host\r\n"
+	"a=candidate:1 1 UDP 2128609534 10.0.0.7 49812 typ host\r\n"
+	"a=candidate:2 1 UDP 2128609533 172.17.0.1 49812 typ host\r\n"
+	"a=candidate:3 1 UDP 1693498111 203.0.113.45 61874 typ srflx raddr 192.168.1.23 rport 49812\r\n";
+
+static const char* browserOffer =
+	"v=0\r\n"
+	"o=- 4611731400430051336 2 IN IP4 127.0.0.1\r\n"
+	"s=-\r\n"
+	"t=0 0\r\n"
+	"a=group:BUNDLE data\r\n"
+	"a=msid-semantic: WMS\r\n"
+	"m=application 9 UDP/DTLS/SCTP webrtc-datachannel\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:Wq3J\r\n"
+	"a=ice-pwd:nVbrnsqZ6V0TGm2JA8IG/p8X\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 D2:FA:0E:C3:22:59:5E:14:95:69:92:3D:13:B4:84:24:2C:C2:A2:C0:3E:FD:34:8E:5E:EA:6F:AF:52:CE:E6:0F\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:data\r\n"
+	"a=sctp-port:5000\r\n"
+	"a=max-message-size:262144\r\n";
+
+static const char* browserCandidates[] = {
+	"candidate:842163049 1 udp 1677729535 203.0.113.45 61874 typ srflx raddr 192.168.1.23 rport 49812 generation 0 ufrag Wq3J network-cost 999",
+	"candidate:1467250027 1 udp 2122260223 192.168.1.23 49812 typ host generation 0 ufrag Wq3J network-id 1",
+	"candidate:2999745851 1 udp 2122194687 2001:db8:85a3::8a2e:370:7334 50243 typ host generation 0 ufrag Wq3J network-id 2",
+	"candidate:3528925834 1 udp 41885439 198.51.100.7 3478 typ relay raddr 203.0.113.45 rport 61874 generation 0 ufrag Wq3J network-cost 999",
+};
+
+static ha_bool checkMessage(const HumblePeer::Message *msg, void *user) {
+	std::string &text = *reinterpret_cast<std::string *>(user);
+
+	switch (msg->message_type()) {
+		case HumblePeer::MessageType::P2POffer:
+		{
+			auto p2p = reinterpret_cast<const HumblePeer::P2POffer*>(msg->message());
+			return offerText(p2p->offer(), p2p->description(), text);
+		}
+
+		case HumblePeer::MessageType::ICECandidate:
+		{
+			auto ice = reinterpret_cast<const HumblePeer::ICECandidate*>(msg->message());
+			return candidateText(ice->offer(), ice->candidate(), text);
+		}
+
+		default:
+			return false;
+	}
+}
+
+static size_t encode(const char* text, bool candidate, bool compact) {
+	P2PSignalConnection conn;
+	ha_bool ok = candidate ? sendICECandidate(&conn, 1, text, compact) : sendP2PConnect(&conn, 1, 0, text, compact);
+	(void)ok;
+	return conn.stream.size();
+}
+
+static bool roundTrip(const char* text, bool candidate, bool compact) {
+	P2PSignalConnection conn;
+	ha_bool ok = candidate ? sendICECandidate(&conn, 1, text, compact) : sendP2PConnect(&conn, 1, 0, text, compact);
+	if (!ok) {
+		return false;
+	}
+
+	std::vector<uint8_t> recvBuf;
+	std::string decoded;
+	return parseMessage(recvBuf, conn.stream.data(), conn.stream.size(), checkMessage, &decoded) && decoded == text;
+}
+
+static void run(const char* name, const char* text, bool candidate, size_t iterations) {
+	size_t sizes[2];
+	double encodeTime[2], decodeTime[2];
+
+	for (int compact = 0; compact < 2; ++compact) {
+		if (!roundTrip(text, candidate, compact)) {
+			std::cout << name << ": round trip FAILED" << std::endl;
+			return;
+		}
+
+		sizes[compact] = encode(text, candidate, compact);
+
+		P2PSignalConnection conn;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; ++i) {
+			conn.stream.clear();
+			ha_bool ok = candidate ? sendICECandidate(&conn, 1, text, compact) : sendP2PConnect(&conn, 1, 0, text, compact);
+			(void)ok;
+		}
+		encodeTime[compact] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::vector<uint8_t> recvBuf;
+		std::string decoded;
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; ++i) {
+			ha_bool ok = parseMessage(recvBuf, conn.stream.data(), conn.stream.size(), checkMessage, &decoded);
+			(void)ok;
+		}
+		decodeTime[compact] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	std::cout << name << ": " << sizes[0] << " -> " << sizes[1] << " bytes ("
+		<< (100 * sizes[1] / sizes[0]) << "%), encode "
+		<< encodeTime[0] * 1e9 / iterations << " -> " << encodeTime[1] * 1e9 / iterations << " ns, decode "
+		<< decodeTime[0] * 1e9 / iterations << " -> " << decodeTime[1] * 1e9 / iterations << " ns" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+	size_t iterations = argc > 1 ? std::stoul(argv[1]) : 100000;
+	if (iterations == 0) {
+		return 1;
+	}
+
+	std::cout << "text -> compact, message size including the 8 byte header" << std::endl;
+	run("microstack offer", microstackOffer, false, iterations);
+	run("browser offer   ", browserOffer, false, iterations);
+
+	size_t textTotal = 0, compactTotal = 0;
+	for (auto candidate : browserCandidates) {
+		run("browser candidate", candidate, true, iterations);
+		textTotal += encode(candidate, true, false);
+		compactTotal += encode(candidate, true, true);
+	}
+
+	std::cout << "browser negotiation (offer + candidates): "
+		<< encode(browserOffer, false, false) + textTotal << " -> "
+		<< encode(browserOffer, false, true) + compactTotal << " bytes" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,269 @@
+// Measures how the peer server's throughput scales with its number of threads.
+//
+//   humblenet_bench_server_threads <peer-server> [clients] [seconds] [games] [logfile]
+//
+// Starts the given peer-server binary with 1, 2, 4 and 8 threads in turn, each time on
+// port 28080 with a config file written to /tmp. Then forks the clients (32 by default),
+// spread over a number of games (8 by default) so the server has games to shard. Every
+// client keeps 16 alias registrations in flight for the given number of seconds (5 by
+// default): as soon as one is acknowledged it is unregistered and the next one registered.
+// Reports the acknowledged registrations per second, each of which is three messages:
+// the registration, its acknowledgement and the unregistration.
+//
+// The server logs to /dev/null unless given a log file, every registration is logged at
+// info so that is also what logging costs the signaling.
+//
+// The clients need cores too, so the scaling shows best with more cores than threads.
+
+#include "humblenet_p2p.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const int DEFAULT_CLIENTS = 32;
+const int DEFAULT_SECONDS = 5;
+const int DEFAULT_GAMES = 8;
+const int IN_FLIGHT = 16;
+const int PORT = 28080;
+const int TIMEOUT_S = 30;
+
+const char client_secret[] = "secret";
+
+typedef std::chrono::steady_clock Clock;
+
+static bool server_listening()
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	bool ok = connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+	close(fd);
+	return ok;
+}
+
+static pid_t start_server(const char* binary, int threads, const std::string& logFile)
+{
+	std::string config = "/tmp/bench_server_threads_" + std::to_string(getpid()) + ".cfg";
+	FILE* f = fopen(config.c_str(), "w");
+	if (!f) {
+		return -1;
+	}
+	fprintf(f, "port=%d\nthreads=%d\nlogfile=%s\n", PORT, threads, logFile.c_str());
+	fclose(f);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		execl(binary, binary, "-c", config.c_str(), (char*)NULL);
+		_exit(1);
+	}
+
+	auto giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+	while (!server_listening()) {
+		if (Clock::now() > giveUp || waitpid(pid, NULL, WNOHANG) == pid) {
+			kill(pid, SIGTERM);
+			waitpid(pid, NULL, 0);
+			return -1;
+		}
+		usleep(10000);
+	}
+
+	// with several threads every one of them has to be listening
+	usleep(100000);
+	return pid;
+}
+
+static void run_client(int index, int games, int seconds, int readyFd, int goFd, int resultFd)
+{
+	std::string url = "ws://127.0.0.1:" + std::to_string(PORT) + "/ws";
+	std::string token = "bench-threads-" + std::to_string(index % games);
+
+	humblenet_init();
+	humblenet_p2p_init(url.c_str(), token.c_str(), client_secret, NULL);
+
+	while (humblenet_p2p_get_my_peer_id() == 0) {
+		humblenet_p2p_wait(10);
+	}
+
+	char c = 'R';
+	if (write(readyFd, &c, 1) != 1 || read(goFd, &c, 1) != 1) {
+		_exit(1);
+	}
+
+	std::string prefix = "bench-threads-" + std::to_string(getpid()) + "-";
+	uint64_t next = 0;
+	std::vector<std::string> inFlight;
+	for (int i = 0; i < IN_FLIGHT; ++i) {
+		inFlight.push_back(prefix + std::to_string(next++));
+		humblenet_p2p_register_alias(inFlight.back().c_str());
+	}
+
+	uint64_t claims = 0;
+	auto end = Clock::now() + std::chrono::seconds(seconds);
+	while (Clock::now() < end) {
+		humblenet_p2p_wait(1);
+
+		for (auto& alias : inFlight) {
+			AliasStatus status = humblenet_p2p_alias_status(alias.c_str(), NULL);
+			if (status == ALIAS_PENDING) {
+				continue;
+			}
+			if (status == ALIAS_REGISTERED) {
+				++claims;
+			}
+			humblenet_p2p_unregister_alias(alias.c_str());
+
+			alias = prefix + std::to_string(next++);
+			humblenet_p2p_register_alias(alias.c_str());
+		}
+	}
+
+	if (write(resultFd, &claims, sizeof(claims)) != sizeof(claims)) {
+		_exit(1);
+	}
+
+	humblenet_shutdown();
+}
+
+// returns the acknowledged registrations per second, or -1
+static double run_round(int clients, int games, int seconds)
+{
+	int ready[2], go[2], results[2];
+	if (pipe(ready) != 0 || pipe(go) != 0 || pipe(results) != 0) {
+		return -1;
+	}
+
+	std::vector<pid_t> children;
+	for (int i = 0; i < clients; ++i) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(ready[0]);
+			close(go[1]);
+			close(results[0]);
+			run_client(i, games, seconds, ready[1], go[0], results[1]);
+			_exit(0);
+		}
+		children.push_back(pid);
+	}
+	close(ready[1]);
+	close(go[0]);
+	close(results[1]);
+
+	auto giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+	int connected = 0;
+	while (connected < clients && Clock::now() < giveUp) {
+		struct pollfd pfd = { ready[0], POLLIN, 0 };
+		char c;
+		if (poll(&pfd, 1, 100) > 0 && read(ready[0], &c, 1) == 1) {
+			++connected;
+		}
+	}
+
+	double rate = -1;
+	if (connected < clients) {
+		std::cout << "only " << connected << " of " << clients << " clients connected within " << TIMEOUT_S << " s" << std::endl;
+	} else {
+		// everyone starts at once
+		std::string start(clients, 'G');
+		if (write(go[1], start.data(), start.size()) == (ssize_t)start.size()) {
+			uint64_t total = 0;
+			int reported = 0;
+			giveUp = Clock::now() + std::chrono::seconds(seconds + TIMEOUT_S);
+			while (reported < clients && Clock::now() < giveUp) {
+				struct pollfd pfd = { results[0], POLLIN, 0 };
+				uint64_t claims;
+				if (poll(&pfd, 1, 100) > 0 && read(results[0], &claims, sizeof(claims)) == sizeof(claims)) {
+					total += claims;
+					++reported;
+				}
+			}
+			if (reported == clients) {
+				rate = double(total) / seconds;
+			}
+		}
+	}
+
+	for (auto pid : children) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+	close(ready[0]);
+	close(go[1]);
+	close(results[0]);
+
+	return rate;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std::cout << "usage: " << argv[0] << " <peer-server> [clients] [seconds] [games] [logfile]" << std::endl;
+		return 1;
+	}
+
+	const char* binary = argv[1];
+	int clients = argc > 2 ? std::stoi(argv[2]) : DEFAULT_CLIENTS;
+	int seconds = argc > 3 ? std::stoi(argv[3]) : DEFAULT_SECONDS;
+	int games = argc > 4 ? std::stoi(argv[4]) : DEFAULT_GAMES;
+	std::string logFile = argc > 5 ? argv[5] : "/dev/null";
+	if (clients < 1 || seconds < 1 || games < 1) {
+		std::cout << "need at least 1 client, second and game" << std::endl;
+		return 1;
+	}
+
+	bool passed = true;
+	double baseline = 0;
+
+	for (int threads = 1; threads <= 8; threads *= 2) {
+		pid_t server = start_server(binary, threads, logFile);
+		if (server < 0) {
+			std::cout << "couldn't start " << binary << " with " << threads << " threads" << std::endl;
+			passed = false;
+			break;
+		}
+
+		double rate = run_round(clients, games, seconds);
+
+		kill(server, SIGTERM);
+		waitpid(server, NULL, 0);
+
+		if (rate < 0) {
+			passed = false;
+			break;
+		}
+		if (threads == 1) {
+			baseline = rate;
+		}
+
+		std::cout << threads << " threads: " << (uint64_t)rate << " registrations/s, "
+			<< (uint64_t)(rate * 3) << " messages/s";
+		if (baseline > 0) {
+			std::cout << " (" << rate / baseline << "x)";
+		}
+		std::cout << std::endl;
+	}
+
+	unlink(("/tmp/bench_server_threads_" + std::to_string(getpid()) + ".cfg").c_str());
+
+	std::cout << clients << " clients in " << games << " games, " << IN_FLIGHT << " registrations in flight each" << std::endl;
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,373 @@
+// Measures signaling for a full mesh join, with and without batching of signaling messages.
+//
+//   humblenet_bench_signaling [batched|unbatched] [peers]
+//
+// Forks the peers (16 by default), every one registers the alias bench-mesh-N and then
+// connects to all the others at once. A peer has joined once every other peer answered
+// its hello. The peers reach the peer server through a proxy in this process which
+// counts the websocket frames going each way, so the frame counts are what actually
+// went over the wire.
+
+#include "humblenet_p2p.h"
+#include "child_process.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const int DEFAULT_PEERS = 16;
+const uint8_t CHANNEL = 45;
+const int JOIN_TIMEOUT_S = 60;
+
+const char client_token[] = "hello_world";
+const char client_secret[] = "secret";
+
+static std::string alias_for(int index)
+{
+	return "bench-mesh-" + std::to_string(index);
+}
+
+// Counts websocket frames in one direction of a proxied connection.
+struct FrameCounter {
+	bool handshake = true;
+	size_t matched = 0;      // bytes of "\r\n\r\n" matched while in the handshake
+	uint8_t header[14];
+	size_t headerLen = 0;
+	uint64_t payloadLeft = 0;
+
+	uint64_t frames = 0;
+	uint64_t bytes = 0;
+
+	void feed(const uint8_t* data, size_t len)
+	{
+		bytes += len;
+		for (size_t i = 0; i < len; ) {
+			if (handshake) {
+				static const char end[] = "\r\n\r\n";
+				matched = (data[i] == end[matched]) ? matched + 1 : (data[i] == '\r' ? 1 : 0);
+				handshake = matched < 4;
+				++i;
+			} else if (payloadLeft > 0) {
+				uint64_t skip = std::min<uint64_t>(payloadLeft, len - i);
+				payloadLeft -= skip;
+				i += skip;
+			} else {
+				header[headerLen++] = data[i++];
+				if (headerLen < 2) continue;
+
+				size_t need = 2 + ((header[1] & 0x80) ? 4 : 0);
+				uint64_t length = header[1] & 0x7f;
+				if (length == 126) need += 2;
+				if (length == 127) need += 8;
+				if (headerLen < need) continue;
+
+				if (length == 126) {
+					length = (uint64_t(header[2]) << 8) | header[3];
+				} else if (length == 127) {
+					length = 0;
+					for (int b = 0; b < 8; ++b) length = (length << 8) | header[2 + b];
+				}
+
+				++frames;
+				payloadLeft = length;
+				headerLen = 0;
+			}
+		}
+	}
+};
+
+struct Proxy {
+	int listenSocket = -1;
+	struct sockaddr_storage server;
+	socklen_t serverLen = 0;
+
+	std::atomic<bool> running;
+	FrameCounter toServer;
+	FrameCounter toClient;
+
+	struct Pair {
+		int client;
+		int server;
+	};
+	std::vector<Pair> pairs;
+
+	Proxy() : running(true) {}
+
+	void run()
+	{
+		std::vector<struct pollfd> fds;
+		uint8_t buff[65536];
+
+		while (running) {
+			fds.clear();
+			fds.push_back({ listenSocket, POLLIN, 0 });
+			for (auto& p : pairs) {
+				fds.push_back({ p.client, POLLIN, 0 });
+				fds.push_back({ p.server, POLLIN, 0 });
+			}
+
+			if (poll(fds.data(), fds.size(), 100) <= 0) continue;
+
+			// pairs accepted below weren't polled yet
+			size_t polled = pairs.size();
+
+			if (fds[0].revents & POLLIN) {
+				int client = accept(listenSocket, NULL, NULL);
+				int upstream = socket(server.ss_family, SOCK_STREAM, 0);
+				if (client >= 0 && upstream >= 0 && connect(upstream, (struct sockaddr*)&server, serverLen) == 0) {
+					pairs.push_back({ client, upstream });
+				} else {
+					if (client >= 0) close(client);
+					if (upstream >= 0) close(upstream);
+				}
+			}
+
+			std::vector<bool> closed(pairs.size(), false);
+			for (size_t i = 0; i < polled; ++i) {
+				const struct pollfd& c = fds[1 + 2 * i];
+				const struct pollfd& s = fds[2 + 2 * i];
+
+				bool ok = true;
+				if (c.revents & (POLLIN | POLLHUP | POLLERR)) {
+					ok = forward(pairs[i].client, pairs[i].server, toServer, buff, sizeof(buff));
+				}
+				if (ok && (s.revents & (POLLIN | POLLHUP | POLLERR))) {
+					ok = forward(pairs[i].server, pairs[i].client, toClient, buff, sizeof(buff));
+				}
+				closed[i] = !ok;
+			}
+
+			for (size_t i = pairs.size(); i-- > 0; ) {
+				if (closed[i]) {
+					close(pairs[i].client);
+					close(pairs[i].server);
+					pairs.erase(pairs.begin() + i);
+				}
+			}
+		}
+
+		for (auto& p : pairs) {
+			close(p.client);
+			close(p.server);
+		}
+	}
+
+	static bool forward(int from, int to, FrameCounter& counter, uint8_t* buff, size_t size)
+	{
+		ssize_t got = recv(from, buff, size, 0);
+		if (got <= 0) return false;
+
+		counter.feed(buff, got);
+
+		for (ssize_t sent = 0; sent < got; ) {
+			ssize_t ret = send(to, buff + sent, got - sent, MSG_NOSIGNAL);
+			if (ret <= 0) return false;
+			sent += ret;
+		}
+		return true;
+	}
+};
+
+// splits ws://host:port/path, returns false if it isn't one
+static bool parse_url(const std::string& url, std::string& host, std::string& port, std::string& path)
+{
+	const std::string scheme = "ws://";
+	if (url.compare(0, scheme.size(), scheme) != 0) return false;
+
+	size_t hostStart = scheme.size();
+	size_t pathStart = url.find('/', hostStart);
+	std::string hostPort = url.substr(hostStart, pathStart == std::string::npos ? std::string::npos : pathStart - hostStart);
+	path = pathStart == std::string::npos ? "/" : url.substr(pathStart);
+
+	size_t colon = hostPort.rfind(':');
+	host = hostPort.substr(0, colon);
+	port = colon == std::string::npos ? "80" : hostPort.substr(colon + 1);
+	return true;
+}
+
+static void run_peer(int index, int peers, bool batched, const std::string& url, std::chrono::steady_clock::time_point start, int resultFd)
+{
+	if (!batched) {
+		humblenet_set_hint("signaling_batch", "0");
+	}
+
+	humblenet_init();
+	humblenet_p2p_init(url.c_str(), client_token, client_secret, NULL);
+
+	while (humblenet_p2p_get_my_peer_id() == 0) {
+		humblenet_p2p_wait(10);
+	}
+
+	humblenet_p2p_register_alias(alias_for(index).c_str());
+
+	std::vector<PeerId> others(peers, 0);
+	std::vector<bool> answered(peers, false);
+	answered[index] = true;
+	int remaining = peers - 1;
+	bool reported = false;
+
+	uint8_t hello[2] = { 'H', uint8_t(index) };
+	uint8_t reply[2] = { 'R', uint8_t(index) };
+	uint8_t buff[16];
+
+	auto lastHello = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+
+	// until the tool kills us, or is gone
+	while (parentAlive()) {
+		auto now = std::chrono::steady_clock::now();
+		if (remaining > 0 && now - lastHello > std::chrono::milliseconds(250)) {
+			// aliases register at different times, keep trying the ones that didn't answer yet
+			for (int i = 0; i < peers; ++i) {
+				if (answered[i]) continue;
+				if (others[i] == 0) {
+					others[i] = humblenet_p2p_virtual_peer_for_alias(alias_for(i).c_str());
+				}
+				humblenet_p2p_sendto(hello, sizeof(hello), others[i], SEND_RELIABLE, CHANNEL);
+			}
+			lastHello = now;
+		}
+
+		humblenet_p2p_wait(5);
+
+		PeerId fromPeer = 0;
+		int ret;
+		while ((ret = humblenet_p2p_recvfrom(buff, sizeof(buff), &fromPeer, CHANNEL)) > 0) {
+			if (ret < 2 || buff[1] >= peers) continue;
+
+			if (buff[0] == 'H') {
+				humblenet_p2p_sendto(reply, sizeof(reply), fromPeer, SEND_RELIABLE, CHANNEL);
+			} else if (buff[0] == 'R' && !answered[buff[1]]) {
+				answered[buff[1]] = true;
+				--remaining;
+			}
+		}
+
+		if (remaining == 0 && !reported) {
+			int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+			reported = write(resultFd, &ms, sizeof(ms)) == sizeof(ms);
+		}
+	}
+
+	humblenet_shutdown();
+}
+
+int main(int argc, char *argv[])
+{
+	bool batched = !(argc > 1 && strcmp(argv[1], "unbatched") == 0);
+	int peers = argc > 2 ? std::stoi(argv[2]) : DEFAULT_PEERS;
+	if (peers < 2 || peers > 255) {
+		std::cout << "peers must be between 2 and 255" << std::endl;
+		return 1;
+	}
+
+	std::string host, port, path;
+	if (!parse_url(HUMBLENET_SERVER_URL, host, port, path)) {
+		std::cout << "Can only proxy ws:// peer servers, not " << HUMBLENET_SERVER_URL << std::endl;
+		return 1;
+	}
+
+	Proxy proxy;
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* res = NULL;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || res == NULL) {
+		std::cout << "Could not resolve " << host << std::endl;
+		return 1;
+	}
+	memcpy(&proxy.server, res->ai_addr, res->ai_addrlen);
+	proxy.serverLen = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t localLen = sizeof(local);
+
+	proxy.listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+	if (proxy.listenSocket < 0
+		|| bind(proxy.listenSocket, (struct sockaddr*)&local, sizeof(local)) != 0
+		|| listen(proxy.listenSocket, 64) != 0
+		|| getsockname(proxy.listenSocket, (struct sockaddr*)&local, &localLen) != 0) {
+		std::cout << "Could not start the proxy" << std::endl;
+		return 1;
+	}
+
+	std::string url = "ws://127.0.0.1:" + std::to_string(ntohs(local.sin_port)) + path;
+
+	int results[2];
+	if (pipe(results) != 0) {
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	// fork before starting the proxy thread, the children only need the listening socket to exist.
+	std::vector<pid_t> children;
+	for (int i = 0; i < peers; ++i) {
+		pid_t pid = forkChild();
+		if (pid == 0) {
+			close(proxy.listenSocket);
+			close(results[0]);
+			run_peer(i, peers, batched, url, start, results[1]);
+			_exit(0);
+		}
+		children.push_back(pid);
+	}
+	close(results[1]);
+
+	std::thread proxyThread(&Proxy::run, &proxy);
+
+	std::vector<int64_t> joined;
+	auto giveUp = start + std::chrono::seconds(JOIN_TIMEOUT_S);
+	while ((int)joined.size() < peers && std::chrono::steady_clock::now() < giveUp) {
+		struct pollfd pfd = { results[0], POLLIN, 0 };
+		if (poll(&pfd, 1, 100) <= 0) continue;
+
+		int64_t ms = 0;
+		if (read(results[0], &ms, sizeof(ms)) != sizeof(ms)) break;
+		joined.push_back(ms);
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	proxy.running = false;
+	proxyThread.join();
+
+	for (auto pid : children) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+
+	std::sort(joined.begin(), joined.end());
+
+	std::cout << (batched ? "batched" : "unbatched") << " signaling, " << peers << " peer mesh" << std::endl;
+	if ((int)joined.size() < peers) {
+		std::cout << "only " << joined.size() << " of " << peers << " peers joined within " << JOIN_TIMEOUT_S << " s" << std::endl;
+	}
+	if (!joined.empty()) {
+		std::cout << "join completed (ms): p50 " << joined[joined.size() / 2] << " max " << joined.back() << std::endl;
+	}
+	std::cout << "client -> server: " << proxy.toServer.frames << " frames, " << proxy.toServer.bytes << " bytes, "
+		<< (uint64_t)(proxy.toServer.frames / elapsed) << " frames/s" << std::endl;
+	std::cout << "server -> client: " << proxy.toClient.frames << " frames, " << proxy.toClient.bytes << " bytes, "
+		<< (uint64_t)(proxy.toClient.frames / elapsed) << " frames/s" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,677 @@
+// Compares the peer server's TURN relay with its websocket relay.
+//
+//   humblenet_bench_turn <peer-server> [packet bytes] [megabytes]
+//
+// Starts the given peer-server binary with its TURN relay on 127.0.0.1, websockets on
+// port 28093 and TURN on 28094, and connects two peers. Both take the TURN credentials
+// from their HelloClient and allocate, which checks the relay turns away a wrong
+// password, and bind channels to each other, so everything after goes through the
+// relay as it would for a browser only given relay candidates. It's also checked that
+// the relay won't take private networks or its own port for peers; loopback is let
+// through, turnAllowLoopback is set for this. Then, once for each way between the peers:
+//
+//   websocket   every packet is a relay frame of its own over the peers' websockets
+//   turn        ChannelData between the two allocations, both peers are relayed
+//   turn-host   ChannelData from one allocation to a plain UDP socket of the other
+//               peer, which answers to the relayed address, as a peer that can be
+//               reached directly would
+//
+// it measures the round trip of 2000 pings and relays 64 MB (or the given number) of
+// 1200 byte packets (or the given size), about what WebRTC data channels send. The
+// sender keeps at most 64 packets ahead of the receiver; datagrams that don't arrive
+// in 100 ms are counted as lost. Reported are the latency percentiles, packets and
+// megabytes per second, the loss and the server's CPU time per gigabyte, from /proc.
+
+#include "humblenet.h"
+#include "humblepeer.h"
+#include "peer_server_fixture.h"
+#include "hmac.h"
+#include "md5.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace humblenet;
+
+typedef std::chrono::steady_clock Clock;
+
+const int PORT = 28093;
+const int TURN_PORT = 28094;
+const int TIMEOUT_S = 10;
+const int DEFAULT_PACKET = 1200;
+const int DEFAULT_MEGABYTES = 64;
+const int PINGS = 2000;
+const uint64_t WINDOW_PACKETS = 64;
+const auto LOSS_TIMEOUT = std::chrono::milliseconds(100);
+
+// ChannelData has a 16 bit length and the relay takes datagrams up to 4 KB
+const size_t MAX_PACKET = 4000;
+
+const uint32_t MAGIC_COOKIE = 0x2112A442;
+const uint16_t TURN_ALLOCATE = 0x003;
+const uint16_t TURN_CREATE_PERMISSION = 0x008;
+const uint16_t TURN_CHANNEL_BIND = 0x009;
+const uint16_t STUN_SUCCESS = 0x100;
+const uint16_t STUN_ERROR = 0x110;
+const uint16_t ATTR_USERNAME = 0x0006;
+const uint16_t ATTR_MESSAGE_INTEGRITY = 0x0008;
+const uint16_t ATTR_ERROR_CODE = 0x0009;
+const uint16_t ATTR_CHANNEL_NUMBER = 0x000C;
+const uint16_t ATTR_XOR_PEER_ADDRESS = 0x0012;
+const uint16_t ATTR_REALM = 0x0014;
+const uint16_t ATTR_NONCE = 0x0015;
+const uint16_t ATTR_XOR_RELAYED_ADDRESS = 0x0016;
+const uint16_t ATTR_REQUESTED_TRANSPORT = 0x0019;
+
+// to the other peer's relayed address and to its plain socket
+const uint16_t CHANNEL_RELAYED = 0x4000;
+const uint16_t CHANNEL_HOST = 0x4001;
+const uint16_t CHANNEL_DENIED = 0x4002;
+
+enum class Mode { Websocket, Turn, TurnHost };
+
+struct humblenet::P2PSignalConnection {
+	int fd = -1;
+	bool closed = false;
+	std::vector<uint8_t> out;
+	size_t outOffset = 0;
+	std::vector<uint8_t> in;
+	std::vector<uint8_t> recvBuf;
+
+	PeerId peerId = 0;
+	std::string turnUsername;
+	std::string turnPassword;
+
+	// the socket to the TURN relay and the address it relays from
+	int turn = -1;
+	sockaddr_in relayed = {};
+	// a socket only the other peer's allocation sends to
+	int host = -1;
+	sockaddr_in hostAddress = {};
+
+	uint64_t packets = 0;	// sent to this peer, any way
+	uint64_t bytes = 0;
+};
+
+static pid_t serverPid = 0;
+static sockaddr_in turnServer = {};
+
+static void flush(P2PSignalConnection* conn)
+{
+	while (!conn->closed && conn->outOffset < conn->out.size()) {
+		ssize_t n = send(conn->fd, conn->out.data() + conn->outOffset, conn->out.size() - conn->outOffset, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				conn->closed = true;
+			}
+			break;
+		}
+		conn->outOffset += n;
+	}
+	if (conn->outOffset == conn->out.size()) {
+		conn->out.clear();
+		conn->outOffset = 0;
+	}
+}
+
+// a masked binary frame, the key is 0. Sent by pump
+ha_bool humblenet::sendP2PMessage(P2PSignalConnection *conn, const uint8_t *buff, size_t length) {
+	appendFrame(conn->out, buff, length);
+	return !conn->closed;
+}
+
+static ha_bool onMessage(const HumblePeer::Message* msg, void* data)
+{
+	P2PSignalConnection* conn = reinterpret_cast<P2PSignalConnection*>(data);
+
+	if (msg->message_type() == HumblePeer::MessageType::HelloClient) {
+		auto hello = reinterpret_cast<const HumblePeer::HelloClient*>(msg->message());
+		if (hello->iceServers()) {
+			for (auto server : *hello->iceServers()) {
+				if (server->type() == HumblePeer::ICEServerType::TURNServer && server->username() && server->password()) {
+					conn->turnUsername = server->username()->str();
+					conn->turnPassword = server->password()->str();
+				}
+			}
+		}
+		conn->peerId = hello->peerId();
+	}
+	return true;
+}
+
+static ha_bool onRelayFrame(const uint8_t* frame, size_t length, void* data)
+{
+	P2PSignalConnection* conn = reinterpret_cast<P2PSignalConnection*>(data);
+	return forEachRelayPacket(frame, length, [conn](const uint8_t*, size_t size) {
+		conn->packets++;
+		conn->bytes += size;
+	});
+}
+
+// the server's frames in conn->in, unmasked
+static void parseFrames(P2PSignalConnection* conn)
+{
+	std::vector<uint8_t>& in = conn->in;
+	size_t offset = 0;
+
+	WebsocketFrame frame;
+	while (nextFrame(in, offset, &frame)) {
+		if (frame.opcode == 0x8) {
+			conn->closed = true;
+			return;
+		}
+		if ((frame.opcode == 0x0 || frame.opcode == 0x2) && !parseMessage(conn->recvBuf, frame.payload, frame.length, onMessage, conn, onRelayFrame)) {
+			conn->closed = true;
+			return;
+		}
+		offset += frame.size;
+	}
+
+	in.erase(in.begin(), in.begin() + offset);
+}
+
+static void receive(P2PSignalConnection* conn)
+{
+	uint8_t buff[256 * 1024];
+	ssize_t n = recv(conn->fd, buff, sizeof(buff), 0);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+		conn->closed = true;
+		return;
+	}
+	if (n > 0) {
+		conn->in.insert(conn->in.end(), buff, buff + n);
+		parseFrames(conn);
+	}
+}
+
+// everything waiting on a UDP socket of conn, ChannelData from the relay or the
+// packets themselves on the plain socket
+static void receiveDatagrams(P2PSignalConnection* conn, int fd)
+{
+	uint8_t buff[65536];
+	for (;;) {
+		ssize_t n = recv(fd, buff, sizeof(buff), 0);
+		if (n < 0) {
+			return;
+		}
+		if (fd == conn->host) {
+			conn->packets++;
+			conn->bytes += size_t(n);
+		} else if (n >= 4 && buff[0] >= 0x40 && buff[0] < 0x80) {
+			size_t length = (size_t(buff[2]) << 8) | buff[3];
+			if (length <= size_t(n) - 4) {
+				conn->packets++;
+				conn->bytes += length;
+			}
+		}
+	}
+}
+
+// waits up to timeoutMs for any socket of the peers, writes what's queued and reads
+// what came
+static void pump(P2PSignalConnection** conns, size_t count, int timeoutMs)
+{
+	struct pollfd pfds[6] = {};
+	for (size_t i = 0; i < count; ++i) {
+		pfds[i * 3].fd = conns[i]->closed ? -1 : conns[i]->fd;
+		pfds[i * 3].events = POLLIN | (conns[i]->out.empty() ? 0 : POLLOUT);
+		pfds[i * 3 + 1].fd = conns[i]->turn;
+		pfds[i * 3 + 1].events = POLLIN;
+		pfds[i * 3 + 2].fd = conns[i]->host;
+		pfds[i * 3 + 2].events = POLLIN;
+	}
+	if (poll(pfds, count * 3, timeoutMs) <= 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (pfds[i * 3].revents & POLLOUT) {
+			flush(conns[i]);
+		}
+		if (pfds[i * 3].revents & (POLLIN | POLLHUP | POLLERR)) {
+			receive(conns[i]);
+		}
+		for (int j = 1; j <= 2; ++j) {
+			if (pfds[i * 3 + j].revents & POLLIN) {
+				receiveDatagrams(conns[i], pfds[i * 3 + j].fd);
+			}
+		}
+	}
+}
+
+static bool openPeer(P2PSignalConnection* conn, uint8_t flags)
+{
+	conn->fd = openWebsocket(loopbackAddress(PORT));
+	if (conn->fd < 0) {
+		return false;
+	}
+
+	std::map<std::string, std::string> attributes;
+	if (!sendHelloServer(conn, flags, "bench-turn", "secret", "", "", attributes)) {
+		return false;
+	}
+
+	auto giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+	while (!conn->peerId && !conn->closed && Clock::now() < giveUp) {
+		pump(&conn, 1, 10);
+	}
+	return conn->peerId != 0;
+}
+
+// a non blocking UDP socket on a port of loopback
+static int openUDP(sockaddr_in* bound)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	int size = 4 * 1024 * 1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(addr);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || getsockname(fd, (struct sockaddr*)&addr, &length) != 0) {
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	if (bound) {
+		*bound = addr;
+	}
+	return fd;
+}
+
+// A STUN request, attributes are added in order
+struct StunRequest {
+	std::vector<uint8_t> data;
+
+	explicit StunRequest(uint16_t method) : data(20)
+	{
+		data[0] = uint8_t(method >> 8);
+		data[1] = uint8_t(method);
+		for (int i = 0; i < 4; ++i) {
+			data[4 + i] = uint8_t(MAGIC_COOKIE >> (24 - 8 * i));
+		}
+		static std::mt19937 random(std::random_device{}());
+		for (int i = 8; i < 20; ++i) {
+			data[i] = uint8_t(random());
+		}
+	}
+
+	void add(uint16_t type, const void* value, size_t length)
+	{
+		uint8_t header[4] = { uint8_t(type >> 8), uint8_t(type), uint8_t(length >> 8), uint8_t(length) };
+		data.insert(data.end(), header, header + 4);
+		data.insert(data.end(), static_cast<const uint8_t*>(value), static_cast<const uint8_t*>(value) + length);
+		data.resize((data.size() + 3) & ~size_t(3));
+		setLength(data.size() - 20);
+	}
+
+	void add(uint16_t type, const std::string& value) { add(type, value.data(), value.size()); }
+
+	void addAddress(uint16_t type, const sockaddr_in& addr)
+	{
+		uint8_t value[8] = { 0, 1 };
+		uint16_t port = ntohs(addr.sin_port) ^ uint16_t(MAGIC_COOKIE >> 16);
+		uint32_t ip = ntohl(addr.sin_addr.s_addr) ^ MAGIC_COOKIE;
+		value[2] = uint8_t(port >> 8);
+		value[3] = uint8_t(port);
+		for (int i = 0; i < 4; ++i) {
+			value[4 + i] = uint8_t(ip >> (24 - 8 * i));
+		}
+		add(type, value, sizeof(value));
+	}
+
+	// MESSAGE-INTEGRITY, last
+	void sign(const uint8_t key[MD5_DIGEST_SIZE])
+	{
+		setLength(data.size() - 20 + 24);
+		HMACContext hmac;
+		HMACInit(&hmac, key, MD5_DIGEST_SIZE);
+		HMACInput(&hmac, data.data(), unsigned(data.size()));
+		uint8_t digest[HMAC_DIGEST_SIZE];
+		HMACResult(&hmac, digest);
+		add(ATTR_MESSAGE_INTEGRITY, digest, sizeof(digest));
+	}
+
+	void setLength(size_t length)
+	{
+		data[2] = uint8_t(length >> 8);
+		data[3] = uint8_t(length);
+	}
+};
+
+// What came back for a request
+struct StunResponse {
+	uint16_t type = 0;
+	int errorCode = 0;
+	std::map<uint16_t, std::string> attributes;
+
+	bool address(uint16_t attribute, sockaddr_in* addr) const
+	{
+		auto it = attributes.find(attribute);
+		if (it == attributes.end() || it->second.size() != 8) {
+			return false;
+		}
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(it->second.data());
+		*addr = sockaddr_in();
+		addr->sin_family = AF_INET;
+		addr->sin_port = htons(uint16_t((p[2] << 8) | p[3]) ^ uint16_t(MAGIC_COOKIE >> 16));
+		uint32_t ip = (uint32_t(p[4]) << 24) | (uint32_t(p[5]) << 16) | (uint32_t(p[6]) << 8) | p[7];
+		addr->sin_addr.s_addr = htonl(ip ^ MAGIC_COOKIE);
+		return true;
+	}
+};
+
+// sends request from fd to the relay, resending it a few times, until its response
+// comes. false if none does
+static bool transact(int fd, const StunRequest& request, StunResponse* response)
+{
+	for (int attempt = 0; attempt < 5; ++attempt) {
+		sendto(fd, request.data.data(), request.data.size(), 0, (struct sockaddr*)&turnServer, sizeof(turnServer));
+
+		auto giveUp = Clock::now() + std::chrono::milliseconds(500);
+		while (Clock::now() < giveUp) {
+			struct pollfd pfd = { fd, POLLIN, 0 };
+			if (poll(&pfd, 1, 50) <= 0) {
+				continue;
+			}
+			uint8_t buff[2048];
+			ssize_t n = recv(fd, buff, sizeof(buff), 0);
+			if (n < 20 || memcmp(buff + 8, request.data.data() + 8, 12) != 0) {
+				continue;
+			}
+
+			response->type = uint16_t((buff[0] << 8) | buff[1]);
+			size_t offset = 20;
+			while (offset + 4 <= size_t(n)) {
+				uint16_t type = uint16_t((buff[offset] << 8) | buff[offset + 1]);
+				size_t length = (size_t(buff[offset + 2]) << 8) | buff[offset + 3];
+				if (offset + 4 + length > size_t(n)) {
+					break;
+				}
+				response->attributes[type].assign(reinterpret_cast<const char*>(buff + offset + 4), length);
+				if (type == ATTR_ERROR_CODE && length >= 4) {
+					response->errorCode = buff[offset + 6] * 100 + buff[offset + 7];
+				}
+				offset += 4 + ((length + 3) & ~size_t(3));
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+// allocates on the relay with password, false if it isn't taken
+static bool allocate(P2PSignalConnection* conn, const std::string& password)
+{
+	const uint8_t udp[4] = { 17, 0, 0, 0 };
+
+	// the first try has no credentials, the relay answers with its realm and a nonce
+	StunRequest first(TURN_ALLOCATE);
+	first.add(ATTR_REQUESTED_TRANSPORT, udp, sizeof(udp));
+	StunResponse challenge;
+	if (!transact(conn->turn, first, &challenge) || challenge.errorCode != 401) {
+		return false;
+	}
+	std::string realm = challenge.attributes[ATTR_REALM];
+	std::string nonce = challenge.attributes[ATTR_NONCE];
+
+	std::string secret = conn->turnUsername + ":" + realm + ":" + password;
+	uint8_t key[MD5_DIGEST_SIZE];
+	md5(secret.data(), secret.size(), key);
+
+	StunRequest request(TURN_ALLOCATE);
+	request.add(ATTR_REQUESTED_TRANSPORT, udp, sizeof(udp));
+	request.add(ATTR_USERNAME, conn->turnUsername);
+	request.add(ATTR_REALM, realm);
+	request.add(ATTR_NONCE, nonce);
+	request.sign(key);
+	StunResponse response;
+	if (!transact(conn->turn, request, &response) || response.type != (TURN_ALLOCATE | STUN_SUCCESS)) {
+		return false;
+	}
+	return response.address(ATTR_XOR_RELAYED_ADDRESS, &conn->relayed);
+}
+
+// a permission for peer's IP and channel bound to it, with the credentials allocate took.
+// errorCode is set to the error either got, if any
+static bool bindChannel(P2PSignalConnection* conn, uint16_t channel, const sockaddr_in& peer, int* errorCode = NULL)
+{
+	StunRequest first(TURN_CHANNEL_BIND);
+	StunResponse challenge;
+	if (!transact(conn->turn, first, &challenge) || challenge.errorCode != 401) {
+		return false;
+	}
+	std::string realm = challenge.attributes[ATTR_REALM];
+	std::string nonce = challenge.attributes[ATTR_NONCE];
+	std::string secret = conn->turnUsername + ":" + realm + ":" + conn->turnPassword;
+	uint8_t key[MD5_DIGEST_SIZE];
+	md5(secret.data(), secret.size(), key);
+
+	StunRequest permission(TURN_CREATE_PERMISSION);
+	permission.addAddress(ATTR_XOR_PEER_ADDRESS, peer);
+	permission.add(ATTR_USERNAME, conn->turnUsername);
+	permission.add(ATTR_REALM, realm);
+	permission.add(ATTR_NONCE, nonce);
+	permission.sign(key);
+	StunResponse response;
+	if (!transact(conn->turn, permission, &response) || response.type != (TURN_CREATE_PERMISSION | STUN_SUCCESS)) {
+		if (errorCode) {
+			*errorCode = response.errorCode;
+		}
+		return false;
+	}
+
+	const uint8_t number[4] = { uint8_t(channel >> 8), uint8_t(channel), 0, 0 };
+	StunRequest bind(TURN_CHANNEL_BIND);
+	bind.add(ATTR_CHANNEL_NUMBER, number, sizeof(number));
+	bind.addAddress(ATTR_XOR_PEER_ADDRESS, peer);
+	bind.add(ATTR_USERNAME, conn->turnUsername);
+	bind.add(ATTR_REALM, realm);
+	bind.add(ATTR_NONCE, nonce);
+	bind.sign(key);
+	response = StunResponse();
+	bool bound = transact(conn->turn, bind, &response) && response.type == (TURN_CHANNEL_BIND | STUN_SUCCESS);
+	if (errorCode) {
+		*errorCode = response.errorCode;
+	}
+	return bound;
+}
+
+// whether the relay turns away peer with 403
+static bool forbidden(P2PSignalConnection* conn, uint32_t ip, uint16_t port)
+{
+	sockaddr_in peer = {};
+	peer.sin_family = AF_INET;
+	peer.sin_port = htons(port);
+	peer.sin_addr.s_addr = htonl(ip);
+	int errorCode = 0;
+	return !bindChannel(conn, CHANNEL_DENIED, peer, &errorCode) && errorCode == 403;
+}
+
+// sends packet from one peer to the other the way mode goes
+static void sendPacket(Mode mode, P2PSignalConnection* from, P2PSignalConnection* to, bool first, std::vector<uint8_t>& packet)
+{
+	switch (mode) {
+		case Mode::Websocket:
+			sendRelayFrame(from, to->peerId, packet.data() + 4, packet.size() - 4);
+			flush(from);
+			return;
+
+		case Mode::Turn:
+		case Mode::TurnHost:
+		{
+			if (mode == Mode::TurnHost && !first) {
+				// the plain socket answers the relayed address directly
+				sendto(from->host, packet.data() + 4, packet.size() - 4, 0, (struct sockaddr*)&to->relayed, sizeof(to->relayed));
+				return;
+			}
+			uint16_t channel = (mode == Mode::Turn) ? CHANNEL_RELAYED : CHANNEL_HOST;
+			size_t length = packet.size() - 4;
+			packet[0] = uint8_t(channel >> 8);
+			packet[1] = uint8_t(channel);
+			packet[2] = uint8_t(length >> 8);
+			packet[3] = uint8_t(length);
+			sendto(from->turn, packet.data(), packet.size(), 0, (struct sockaddr*)&turnServer, sizeof(turnServer));
+			return;
+		}
+	}
+}
+
+// reads and drops what is left over from the last run
+static void drain(P2PSignalConnection** conns)
+{
+	auto until = Clock::now() + std::chrono::milliseconds(200);
+	while (Clock::now() < until) {
+		pump(conns, 2, 10);
+	}
+	for (int i = 0; i < 2; ++i) {
+		conns[i]->packets = 0;
+		conns[i]->bytes = 0;
+	}
+}
+
+static bool run(const char* name, Mode mode, P2PSignalConnection* a, P2PSignalConnection* b, size_t packetSize, uint64_t total)
+{
+	P2PSignalConnection* conns[] = { a, b };
+	// room for the ChannelData header in front
+	std::vector<uint8_t> packet(packetSize + 4, 0x5a);
+	std::vector<uint8_t> ping(64 + 4, 0x5a);
+
+	// pings, from a to b and back
+	drain(conns);
+	std::vector<double> rtts;
+	for (int i = 0; i < PINGS && !a->closed && !b->closed; ++i) {
+		uint64_t atB = b->packets, atA = a->packets;
+		auto start = Clock::now();
+		auto giveUp = start + std::chrono::seconds(1);
+
+		sendPacket(mode, a, b, true, ping);
+		while (b->packets == atB && Clock::now() < giveUp) {
+			pump(conns, 2, 10);
+		}
+		sendPacket(mode, b, a, false, ping);
+		while (a->packets == atA && Clock::now() < giveUp) {
+			pump(conns, 2, 10);
+		}
+		if (a->packets == atA) {
+			continue;	// lost, it doesn't count
+		}
+		rtts.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	}
+	if (rtts.empty()) {
+		std::cout << name << ": no pings came back" << std::endl;
+		return false;
+	}
+	std::sort(rtts.begin(), rtts.end());
+
+	// the stream, from a to b
+	drain(conns);
+	uint64_t packets = total / packetSize;
+	uint64_t sent = 0, lost = 0;
+	double cpuStart = processCPU(serverPid);
+	auto start = Clock::now();
+	auto lastProgress = start;
+	uint64_t lastReceived = 0;
+
+	while (b->packets + lost < packets && !a->closed && !b->closed) {
+		while (sent < packets && sent - b->packets - lost < WINDOW_PACKETS && a->out.size() < 256 * 1024) {
+			sendPacket(mode, a, b, true, packet);
+			++sent;
+		}
+		pump(conns, 2, 10);
+
+		auto now = Clock::now();
+		if (b->packets != lastReceived) {
+			lastReceived = b->packets;
+			lastProgress = now;
+		} else if (now - lastProgress > LOSS_TIMEOUT) {
+			// what's in flight isn't coming
+			lost = sent - b->packets;
+			lastProgress = now;
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	double cpu = processCPU(serverPid) - cpuStart;
+	if (b->packets + lost != packets || b->bytes != b->packets * packetSize) {
+		std::cout << name << ": received " << b->packets << " of " << packets << " packets" << std::endl;
+		return false;
+	}
+
+	auto percentile = [&rtts](double p) { return rtts[std::min(rtts.size() - 1, size_t(p * rtts.size()))]; };
+	double gigabytes = double(b->bytes) / (1024.0 * 1024.0 * 1024.0);
+	char line[240];
+	snprintf(line, sizeof(line), "%-10s  rtt p50 %6.0f us  p99 %6.0f us  max %6.0f us  %8.0f packets/s  %7.1f MB/s  %5.2f%% lost  %6.2f server CPU s/GB",
+		name, percentile(0.5), percentile(0.99), rtts.back(),
+		b->packets / seconds, b->bytes / (1024.0 * 1024.0) / seconds, 100.0 * lost / packets, cpu / gigabytes);
+	std::cout << line << std::endl;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std::cout << "usage: " << argv[0] << " <peer-server> [packet bytes] [megabytes]" << std::endl;
+		return 1;
+	}
+	size_t packetSize = size_t(argc > 2 ? std::stoi(argv[2]) : DEFAULT_PACKET);
+	uint64_t total = uint64_t(argc > 3 ? std::stoi(argv[3]) : DEFAULT_MEGABYTES) * 1024 * 1024;
+	if (packetSize < 64 || packetSize > MAX_PACKET) {
+		std::cout << "the packet size has to be 64 to " << MAX_PACKET << " bytes" << std::endl;
+		return 1;
+	}
+
+	// the relay is on loopback too, the peers may use it
+	std::string config = "port=" + std::to_string(PORT) + "\nlogfile=/dev/null\nturnPort=" + std::to_string(TURN_PORT)
+		+ "\nturnRelayAddress=127.0.0.1\nturnAllowLoopback=1\n";
+	serverPid = startServer(argv[1], "bench_turn", config, loopbackAddress(PORT), TIMEOUT_S);
+	if (serverPid < 0) {
+		std::cout << "couldn't start " << argv[1] << std::endl;
+		return 1;
+	}
+	turnServer = loopbackAddress(TURN_PORT);
+
+	bool ok = false;
+	P2PSignalConnection a, b;
+	if (!openPeer(&a, 0x1 | HELLO_FLAG_RELAY_FRAMES) || !openPeer(&b, 0x1 | HELLO_FLAG_RELAY_FRAMES)) {
+		std::cout << "couldn't connect" << std::endl;
+	} else if (a.turnUsername.empty() || b.turnUsername.empty()) {
+		std::cout << "no TURN server in the HelloClient" << std::endl;
+	} else if ((a.turn = openUDP(NULL)) < 0 || (b.turn = openUDP(NULL)) < 0 || (b.host = openUDP(&b.hostAddress)) < 0) {
+		std::cout << "couldn't open UDP sockets" << std::endl;
+	} else if (allocate(&a, a.turnPassword + "x")) {
+		std::cout << "the relay took a wrong password" << std::endl;
+	} else if (!allocate(&a, a.turnPassword) || !allocate(&b, b.turnPassword)) {
+		std::cout << "couldn't allocate" << std::endl;
+	} else if (!forbidden(&a, 0x0a000001, 5000) || !forbidden(&a, 0xc0a80001, 5000) || !forbidden(&a, INADDR_LOOPBACK, TURN_PORT)) {
+		std::cout << "the relay let a peer reach its network or its own port" << std::endl;
+	} else if (!bindChannel(&a, CHANNEL_RELAYED, b.relayed) || !bindChannel(&b, CHANNEL_RELAYED, a.relayed)
+		|| !bindChannel(&a, CHANNEL_HOST, b.hostAddress)) {
+		std::cout << "couldn't bind channels" << std::endl;
+	} else {
+		std::cout << "relaying " << total / (1024 * 1024) << " MB in " << packetSize << " byte packets" << std::endl;
+		ok = run("websocket", Mode::Websocket, &a, &b, packetSize, total);
+		ok = run("turn", Mode::Turn, &a, &b, packetSize, total) && ok;
+		ok = run("turn-host", Mode::TurnHost, &a, &b, packetSize, total) && ok;
+	}
+
+	stopServer(serverPid);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+// Measures the Microstack UDP path on loopback, in packets per second and system calls per packet.
+//
+//   humblenet_bench_udp [none|mmsg|gso] [seconds] [size]
+//
+// A sender module on the chain pushes a burst of datagrams to a receiver socket on the
+// same chain, the way the WebRTC stack sends from the chain thread. A new burst is only
+// sent once the previous one was received, so nothing is dropped and the rates measure
+// the work done per datagram, not how fast the kernel can discard them.
+
+#include "ILibParsers.h"
+#include "ILibAsyncUDPSocket.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+const int BURST = 32;
+const int SOCKET_BUFFER = 4 * 1024 * 1024;
+
+struct BenchSender {
+	ILibChain_PreSelect PreSelect;
+	ILibChain_PostSelect PostSelect;
+	ILibChain_Destroy Destroy;
+
+	void* chain;
+	ILibAsyncUDPSocket_SocketModule sender;
+	ILibAsyncUDPSocket_SocketModule receiver;
+	struct sockaddr_in6 target;
+	char* buffer;
+	int size;
+	uint64_t queued;
+	int64_t stopAt;
+};
+
+static uint64_t g_received = 0;
+static ILibAsyncSocket_IOStats g_sendStats;
+static ILibAsyncSocket_IOStats g_receiveStats;
+
+static int64_t now_us()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void on_data(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface, void *user, void *user2, int *PAUSE)
+{
+	++g_received;
+}
+
+static void sender_pre_select(void* object, fd_set *readset, fd_set *writeset, fd_set *errorset, int* blocktime)
+{
+	*blocktime = 0;
+}
+
+static void sender_post_select(void* object, int slct, fd_set *readset, fd_set *writeset, fd_set *errorset)
+{
+	BenchSender* bench = (BenchSender*)object;
+
+	if (now_us() >= bench->stopAt) {
+		// the sockets are freed with the chain, so grab the counters now.
+		ILibAsyncUDPSocket_GetIOStats(bench->sender, &g_sendStats);
+		ILibAsyncUDPSocket_GetIOStats(bench->receiver, &g_receiveStats);
+		ILibStopChain(bench->chain);
+		return;
+	}
+
+	// keep a single burst in flight.
+	if (bench->queued > g_received) return;
+
+	for (int i = 0; i < BURST; ++i) {
+		ILibAsyncUDPSocket_SendTo(bench->sender, (struct sockaddr*)&bench->target, bench->buffer, bench->size, ILibAsyncSocket_MemoryOwnership_STATIC);
+	}
+	bench->queued += BURST;
+}
+
+static void sender_destroy(void* object)
+{
+	BenchSender* bench = (BenchSender*)object;
+	free(bench->buffer);
+}
+
+static ILibAsyncUDPSocket_SocketModule create_socket(void* chain, int flags, ILibAsyncUDPSocket_OnData onData)
+{
+	struct sockaddr_in6 local;
+	memset(&local, 0, sizeof(local));
+	local.sin6_family = AF_INET6;
+	local.sin6_addr = in6addr_loopback;
+
+	ILibAsyncUDPSocket_SocketModule socket = ILibAsyncUDPSocket_CreateEx(chain, 2048, (struct sockaddr*)&local, ILibAsyncUDPSocket_Reuse_EXCLUSIVE, onData, NULL, NULL);
+	if (socket == NULL) return NULL;
+
+	int bufferSize = SOCKET_BUFFER;
+	SOCKET sock = ILibAsyncUDPSocket_GetSocket(socket);
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char*)&bufferSize, sizeof(bufferSize));
+	setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char*)&bufferSize, sizeof(bufferSize));
+
+	ILibAsyncUDPSocket_SetBatching(socket, flags);
+	return socket;
+}
+
+static std::string describe(int flags)
+{
+	if (flags & ILibAsyncSocket_DatagramBatching_GSO) return "recvmmsg/sendmmsg + GSO";
+	if (flags & ILibAsyncSocket_DatagramBatching_MMSG) return "recvmmsg/sendmmsg";
+	return "recvfrom/sendto";
+}
+
+int main(int argc, char *argv[])
+{
+	std::string mode = argc > 1 ? argv[1] : "gso";
+	int seconds = argc > 2 ? std::stoi(argv[2]) : 5;
+	int size = argc > 3 ? std::stoi(argv[3]) : 1200;
+
+	int flags = ILibAsyncSocket_DatagramBatching_NONE;
+	if (mode == "mmsg") {
+		flags = ILibAsyncSocket_DatagramBatching_MMSG;
+	} else if (mode == "gso") {
+		flags = ILibAsyncSocket_DatagramBatching_MMSG | ILibAsyncSocket_DatagramBatching_GSO;
+	}
+
+	void* chain = ILibCreateChain();
+
+	BenchSender* bench = (BenchSender*)malloc(sizeof(BenchSender));
+	memset(bench, 0, sizeof(BenchSender));
+	bench->receiver = create_socket(chain, flags, &on_data);
+	bench->sender = create_socket(chain, flags, NULL);
+	if (bench->receiver == NULL || bench->sender == NULL) {
+		std::cout << "Could not bind to the loopback interface" << std::endl;
+		return 1;
+	}
+
+	int enabled = ILibAsyncUDPSocket_SetBatching(bench->sender, flags);
+
+	bench->PreSelect = &sender_pre_select;
+	bench->PostSelect = &sender_post_select;
+	bench->Destroy = &sender_destroy;
+	bench->chain = chain;
+	bench->size = size;
+	bench->buffer = (char*)malloc(size);
+	memset(bench->buffer, 0x5A, size);
+	ILibAsyncUDPSocket_GetLocalInterface(bench->receiver, (struct sockaddr*)&bench->target);
+	bench->stopAt = now_us() + (int64_t)seconds * 1000000;
+	ILibAddToChain(chain, bench);
+
+	auto start = std::chrono::steady_clock::now();
+	ILibStartChain(chain);
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	uint64_t sent = g_sendStats.PacketsSent;
+
+	std::cout << describe(enabled) << ", " << size << " byte datagrams, " << elapsed << " s" << std::endl;
+	std::cout << "sent:     " << sent << " packets, " << (uint64_t)(sent / elapsed) << " packets/s, "
+		<< (sent ? (double)g_sendStats.SendCalls / sent : 0) << " syscalls/packet" << std::endl;
+	std::cout << "received: " << g_received << " packets, " << (uint64_t)(g_received / elapsed) << " packets/s, "
+		<< (g_received ? (double)g_receiveStats.ReceiveCalls / g_received : 0) << " syscalls/packet" << std::endl;
+	std::cout << "lost or in flight: " << (sent > g_received ? sent - g_received : 0) << " packets" << std::endl;
+
+	return 0;
+}
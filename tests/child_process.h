@@ -0,0 +1,34 @@
+// For the tools which run peers in forked children, so a child stops when the tool
+// does, even if the tool dies before it can kill it.
+#pragma once
+
+#include <signal.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+
+// the process which forked this one, 0 in the tool itself
+static pid_t parentPid = 0;
+
+// fork(), but on Linux the child gets SIGTERM once this process is gone. Call it from
+// the main thread, that signal comes when the forking thread exits
+inline pid_t forkChild()
+{
+	pid_t parent = getpid();
+	pid_t pid = fork();
+	if (pid == 0) {
+		parentPid = parent;
+#if defined(__linux__)
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+	}
+	return pid;
+}
+
+// false in a child once the tool is gone. Whoever adopts an orphan needn't be init,
+// so this compares with the parent it was forked by
+inline bool parentAlive()
+{
+	return getppid() == parentPid;
+}
@@ -0,0 +1,207 @@
+// What the tools that start a peer-server binary of their own and talk to it over raw
+// websockets share: starting and stopping it, its CPU time, the websocket upgrade and
+// the frames going either way.
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// the upgrade every client asks for, the server doesn't check the key
+static const char WEBSOCKET_REQUEST[] =
+	"GET /ws HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"Upgrade: websocket\r\n"
+	"Connection: Upgrade\r\n"
+	"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+	"Sec-WebSocket-Version: 13\r\n"
+	"Sec-WebSocket-Protocol: humblepeer\r\n"
+	"Origin: http://localhost\r\n"
+	"\r\n";
+
+inline struct sockaddr_in loopbackAddress(int port)
+{
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	return addr;
+}
+
+inline bool serverListening(const struct sockaddr_in& addr)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+	bool ok = connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == 0;
+	close(fd);
+	return ok;
+}
+
+// runs binary with a configuration file of the given lines, named after the tool, and
+// waits up to timeoutS for it to listen on addr. Its pid, or -1 if it didn't start
+inline pid_t startServer(const char* binary, const char* tool, const std::string& config,
+	const struct sockaddr_in& addr, int timeoutS)
+{
+	std::string path = std::string("/tmp/") + tool + "_" + std::to_string(getpid()) + ".cfg";
+	FILE* f = fopen(path.c_str(), "w");
+	if (!f) {
+		return -1;
+	}
+	fputs(config.c_str(), f);
+	fclose(f);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		execl(binary, binary, "-c", path.c_str(), (char*)NULL);
+		_exit(1);
+	}
+
+	auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(timeoutS);
+	while (!serverListening(addr)) {
+		if (pid < 0 || std::chrono::steady_clock::now() > giveUp || waitpid(pid, NULL, WNOHANG) == pid) {
+			if (pid > 0) {
+				kill(pid, SIGTERM);
+				waitpid(pid, NULL, 0);
+			}
+			unlink(path.c_str());
+			return -1;
+		}
+		usleep(10000);
+	}
+	unlink(path.c_str());
+	return pid;
+}
+
+inline void stopServer(pid_t pid)
+{
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+// user and system time of the process in seconds, or -1
+inline double processCPU(pid_t pid)
+{
+	std::ifstream in("/proc/" + std::to_string(pid) + "/stat");
+	std::string stat((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	// the fields after the command name, which may have spaces in it
+	size_t end = stat.rfind(')');
+	if (end == std::string::npos) {
+		return -1;
+	}
+	unsigned long utime = 0, stime = 0;
+	if (sscanf(stat.c_str() + end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+		return -1;
+	}
+	return double(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// connects to addr and upgrades to a websocket, blocking until it's done. A small
+// receive buffer makes a peer that stops reading stall quickly. The socket is left non
+// blocking, -1 if the server wouldn't take it
+inline int openWebsocket(const struct sockaddr_in& addr, int receiveBuffer = 0)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (receiveBuffer) {
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+	}
+
+	bool ok = connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == 0
+		&& send(fd, WEBSOCKET_REQUEST, strlen(WEBSOCKET_REQUEST), MSG_NOSIGNAL) == ssize_t(strlen(WEBSOCKET_REQUEST));
+
+	// byte by byte, nothing after the response is read
+	std::string response;
+	char c;
+	while (ok && response.find("\r\n\r\n") == std::string::npos) {
+		ok = recv(fd, &c, 1, 0) == 1;
+		response += c;
+	}
+	if (!ok || response.compare(0, 12, "HTTP/1.1 101") != 0) {
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+// appends a masked binary frame of data to out, the key is 0
+inline void appendFrame(std::vector<uint8_t>& out, const uint8_t* data, size_t length)
+{
+	out.push_back(0x82);
+	if (length < 126) {
+		out.push_back(uint8_t(0x80 | length));
+	} else if (length < 65536) {
+		out.push_back(0x80 | 126);
+		out.push_back(uint8_t(length >> 8));
+		out.push_back(uint8_t(length));
+	} else {
+		out.push_back(0x80 | 127);
+		for (int i = 7; i >= 0; --i) {
+			out.push_back(uint8_t(uint64_t(length) >> (8 * i)));
+		}
+	}
+	out.insert(out.end(), 4, 0);
+	out.insert(out.end(), data, data + length);
+}
+
+// a frame from the server, which doesn't mask them
+struct WebsocketFrame {
+	uint8_t opcode;
+	const uint8_t* payload;
+	size_t length;
+	size_t size;	// header included
+};
+
+// the frame at offset in in, false if it isn't all there yet
+inline bool nextFrame(const std::vector<uint8_t>& in, size_t offset, WebsocketFrame* frame)
+{
+	if (in.size() - offset < 2) {
+		return false;
+	}
+	const uint8_t* p = in.data() + offset;
+	uint64_t length = p[1] & 0x7f;
+	size_t header = 2;
+	if (length == 126) {
+		if (in.size() - offset < 4) {
+			return false;
+		}
+		length = (uint64_t(p[2]) << 8) | p[3];
+		header = 4;
+	} else if (length == 127) {
+		if (in.size() - offset < 10) {
+			return false;
+		}
+		length = 0;
+		for (int i = 0; i < 8; ++i) {
+			length = (length << 8) | p[2 + i];
+		}
+		header = 10;
+	}
+	if (in.size() - offset < header + length) {
+		return false;
+	}
+
+	frame->opcode = p[0] & 0x0f;
+	frame->payload = p + header;
+	frame->length = size_t(length);
+	frame->size = header + size_t(length);
+	return true;
+}
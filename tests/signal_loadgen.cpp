@@ -0,0 +1,807 @@
+// Puts synthetic signaling load on a peer server and measures how it copes.
+//
+//   humblenet_signal_loadgen [-s peer-server] [-a host:port] [-p pid] [-c connections]
+//                            [-t seconds] [-g games] [-j threads] [-T server threads]
+//                            [-b relay bytes]
+//
+// Opens the connections (1000 by default) over raw websockets to the server at -a
+// (127.0.0.1:8080 by default), or to the peer-server binary given with -s, which is
+// started here on port 28090 with -T threads (1 by default). Every connection says
+// HelloServer for one of the games (16 by default), asking for compact SDP and alias
+// acknowledgements, and registers an alias.
+//
+// Then the connections go in pairs within their game, and for the given number of seconds
+// (10 by default) every pair goes through one session after another the way two native
+// peers would: look up the other's alias, offer, answer, 4 ICE candidates each way and 8
+// relayed packets (256 bytes by default) bouncing back and forth. The messages are made
+// with the humblepeer encoders, from SDP shaped like a browser's.
+//
+// Reports how fast the connections were made, the messages per second during the
+// sessions, the latency of every kind of message from being sent to arriving at the
+// other end (or to its answer arriving, for alias registrations and lookups), and the
+// server's CPU time during the sessions when it was started here or its pid given with -p.
+//
+// The connections are spread over the threads (1 by default), each with its own epoll.
+
+#include "humblenet.h"
+#include "humblepeer.h"
+#include "peer_server_fixture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace humblenet;
+
+typedef std::chrono::steady_clock Clock;
+typedef uint32_t GameId;
+
+const int DEFAULT_CONNECTIONS = 1000;
+const int DEFAULT_SECONDS = 10;
+const int DEFAULT_GAMES = 16;
+const int DEFAULT_RELAY_BYTES = 256;
+const int SERVER_PORT = 28090;
+const int TIMEOUT_S = 30;
+
+// handshakes in progress per thread, more and the listen backlog overflows
+const size_t MAX_CONNECTING = 128;
+
+const int ICE_CANDIDATES = 4;
+const int RELAY_PACKETS = 8;
+
+const uint8_t HELLO_FLAGS = 0x1 | HELLO_FLAG_COMPACT_SDP | HELLO_FLAG_ALIAS_ACK;
+
+static const char* offerSDP =
+	"v=0\r\n"
+	"o=- 4611731400430051336 2 IN IP4 127.0.0.1\r\n"
+	"s=-\r\n"
+	"t=0 0\r\n"
+	"a=group:BUNDLE data\r\n"
+	"a=msid-semantic: WMS\r\n"
+	"m=application 9 UDP/DTLS/SCTP webrtc-datachannel\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:Wq3J\r\n"
+	"a=ice-pwd:nVbrnsqZ6V0TGm2JA8IG/p8X\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 D2:FA:0E:C3:22:59:5E:14:95:69:92:3D:13:B4:84:24:2C:C2:A2:C0:3E:FD:34:8E:5E:EA:6F:AF:52:CE:E6:0F\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:data\r\n"
+	"a=sctp-port:5000\r\n"
+	"a=max-message-size:262144\r\n";
+
+static const char* answerSDP =
+	"v=0\r\n"
+	"o=- 2890844526 2 IN IP4 127.0.0.1\r\n"
+	"s=-\r\n"
+	"t=0 0\r\n"
+	"a=group:BUNDLE data\r\n"
+	"a=msid-semantic: WMS\r\n"
+	"m=application 9 UDP/DTLS/SCTP webrtc-datachannel\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:Hx7p\r\n"
+	"a=ice-pwd:3kqL9vD2mXs8RtYw0PzN4cJe\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 6B:1E:9C:0D:4A:8F:27:E3:5D:9B:0C:1A:7E:4F:6D:2B:4F:1A:9C:E2:77:0B:D3:5E:A8:61:2C:F4:93:B7:0E:58\r\n"
+	"a=setup:active\r\n"
+	"a=mid:data\r\n"
+	"a=sctp-port:5000\r\n"
+	"a=max-message-size:262144\r\n";
+
+static const char* candidates[ICE_CANDIDATES] = {
+	"candidate:1467250027 1 udp 2122260223 192.168.1.23 49812 typ host generation 0 ufrag Wq3J network-id 1",
+	"candidate:2999745851 1 udp 2122194687 2001:db8:85a3::8a2e:370:7334 50243 typ host generation 0 ufrag Wq3J network-id 2",
+	"candidate:842163049 1 udp 1677729535 203.0.113.45 61874 typ srflx raddr 192.168.1.23 rport 49812 generation 0 ufrag Wq3J network-cost 999",
+	"candidate:3528925834 1 udp 41885439 198.51.100.7 3478 typ relay raddr 203.0.113.45 rport 61874 generation 0 ufrag Wq3J network-cost 999",
+};
+
+enum Kind {
+	REGISTER,
+	LOOKUP,
+	OFFER,
+	ANSWER,
+	ICE,
+	RELAY,
+	KINDS
+};
+
+static const char* kindNames[KINDS] = { "register", "lookup", "offer", "answer", "ice", "relay" };
+
+// what a thread measured, merged at the end
+struct Stats {
+	std::vector<uint32_t> connectLatencies;	// microseconds, connect() to HelloClient
+	std::vector<uint32_t> latencies[KINDS];	// microseconds
+	Clock::time_point lastConnected;
+	uint64_t connected = 0;
+	uint64_t failed = 0;
+	uint64_t errors = 0;	// unexpected messages
+	uint64_t sessions = 0;
+	uint64_t messages = 0;	// received while the sessions ran
+};
+
+struct Worker;
+
+enum class State {
+	Connecting,
+	Handshake,
+	Hello,
+	Registering,
+	Ready,
+	Failed,
+};
+
+struct humblenet::P2PSignalConnection {
+	Worker* worker = nullptr;
+	int fd = -1;
+	State state = State::Connecting;
+	Clock::time_point started;
+
+	std::string handshake;	// the http response so far
+	std::vector<uint8_t> out;	// waiting for the socket to take it
+	size_t outOffset = 0;
+	bool wantWrite = false;
+	std::vector<uint8_t> in;	// websocket frames not parsed yet
+	std::vector<uint8_t> recvBuf;	// a partial humblepeer message
+
+	GameId game = 0;
+	PeerId peerId = 0;
+	std::string alias;
+
+	// the pair this is in, the initiator starts every session
+	P2PSignalConnection* partner = nullptr;
+	bool initiator = false;
+	int candidatesReceived = 0;
+	int relaysReceived = 0;
+
+	// when the answers to the requests on the way were asked for
+	std::deque<Clock::time_point> requests;
+	// when the partner sent what's on its way here through the server
+	std::deque<Clock::time_point> forwarded;
+};
+
+struct Worker {
+	int epfd;
+	std::vector<std::unique_ptr<P2PSignalConnection>> conns;
+	size_t nextToConnect = 0;
+	size_t connecting = 0;
+	size_t settled = 0;	// registered or failed
+
+	Stats stats;
+	bool running = false;	// the sessions
+	Clock::time_point deadline;
+};
+
+static struct sockaddr_in serverAddress;
+static int relayBytes = DEFAULT_RELAY_BYTES;
+
+static std::atomic<int> readyWorkers(0);
+static std::atomic<bool> go(false);
+static std::atomic<int64_t> goDeadline(0);	// Clock ticks
+static std::atomic<bool> stop(false);
+
+static uint32_t microseconds(Clock::duration d)
+{
+	return uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+}
+
+static void watch(P2PSignalConnection* conn)
+{
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN | (conn->wantWrite ? EPOLLOUT : 0);
+	ev.data.ptr = conn;
+	epoll_ctl(conn->worker->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+static void fail(P2PSignalConnection* conn)
+{
+	if (conn->state == State::Failed) {
+		return;
+	}
+	if (conn->state == State::Connecting || conn->state == State::Handshake || conn->state == State::Hello) {
+		conn->worker->connecting--;
+	}
+	if (conn->state != State::Ready) {
+		conn->worker->settled++;
+	}
+	conn->worker->stats.failed++;
+	conn->state = State::Failed;
+	epoll_ctl(conn->worker->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+}
+
+static void flush(P2PSignalConnection* conn)
+{
+	while (conn->outOffset < conn->out.size()) {
+		ssize_t n = send(conn->fd, conn->out.data() + conn->outOffset, conn->out.size() - conn->outOffset, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			fail(conn);
+			return;
+		}
+		conn->outOffset += n;
+	}
+
+	if (conn->outOffset == conn->out.size()) {
+		conn->out.clear();
+		conn->outOffset = 0;
+	}
+
+	bool wantWrite = !conn->out.empty();
+	if (wantWrite != conn->wantWrite) {
+		conn->wantWrite = wantWrite;
+		watch(conn);
+	}
+}
+
+// every message goes out as a frame of its own
+ha_bool humblenet::sendP2PMessage(P2PSignalConnection *conn, const uint8_t *buff, size_t length) {
+	if (conn->state == State::Failed) {
+		return false;
+	}
+
+	appendFrame(conn->out, buff, length);
+	flush(conn);
+	return true;
+}
+
+static void startSession(P2PSignalConnection* initiator)
+{
+	P2PSignalConnection* partner = initiator->partner;
+	initiator->candidatesReceived = 0;
+	initiator->relaysReceived = 0;
+	partner->candidatesReceived = 0;
+	partner->relaysReceived = 0;
+
+	initiator->requests.push_back(Clock::now());
+	if (!sendAliasLookup(initiator, partner->alias)) {
+		fail(initiator);
+	}
+}
+
+static void sendCandidates(P2PSignalConnection* conn)
+{
+	for (int i = 0; i < ICE_CANDIDATES; ++i) {
+		conn->partner->forwarded.push_back(Clock::now());
+		if (!sendICECandidate(conn, conn->partner->peerId, candidates[i], true)) {
+			fail(conn);
+			return;
+		}
+	}
+}
+
+static void sendRelay(P2PSignalConnection* conn)
+{
+	std::vector<uint8_t> packet(relayBytes, 0x5a);
+	conn->partner->forwarded.push_back(Clock::now());
+	if (!sendP2PRelayData(conn, conn->partner->peerId, packet.data(), uint16_t(packet.size()))) {
+		fail(conn);
+	}
+}
+
+static void sessionDone(P2PSignalConnection* conn)
+{
+	Worker* worker = conn->worker;
+	P2PSignalConnection* initiator = conn->initiator ? conn : conn->partner;
+
+	if (worker->running && Clock::now() < worker->deadline) {
+		worker->stats.sessions++;
+		startSession(initiator);
+	}
+}
+
+// the latency of a request, or of a message the partner sent
+static void measure(P2PSignalConnection* conn, Kind kind, std::deque<Clock::time_point>& sent)
+{
+	if (sent.empty()) {
+		conn->worker->stats.errors++;
+		return;
+	}
+	conn->worker->stats.latencies[kind].push_back(microseconds(Clock::now() - sent.front()));
+	sent.pop_front();
+}
+
+static ha_bool onMessage(const HumblePeer::Message* msg, void* data)
+{
+	P2PSignalConnection* conn = reinterpret_cast<P2PSignalConnection*>(data);
+	Worker* worker = conn->worker;
+	Stats& stats = worker->stats;
+
+	if (worker->running && Clock::now() < worker->deadline) {
+		stats.messages++;
+	}
+
+	switch (msg->message_type()) {
+		case HumblePeer::MessageType::HelloClient:
+		{
+			auto hello = reinterpret_cast<const HumblePeer::HelloClient*>(msg->message());
+			conn->peerId = hello->peerId();
+			stats.connectLatencies.push_back(microseconds(Clock::now() - conn->started));
+			stats.lastConnected = Clock::now();
+			stats.connected++;
+			worker->connecting--;
+
+			conn->state = State::Registering;
+			conn->requests.push_back(Clock::now());
+			if (!sendAliasRegister(conn, conn->alias)) {
+				fail(conn);
+			}
+		}
+			break;
+
+		case HumblePeer::MessageType::AliasRegistered:
+			measure(conn, REGISTER, conn->requests);
+			conn->state = State::Ready;
+			worker->settled++;
+			break;
+
+		case HumblePeer::MessageType::AliasResolved:
+		{
+			auto resolved = reinterpret_cast<const HumblePeer::AliasResolved*>(msg->message());
+			measure(conn, LOOKUP, conn->requests);
+			if (resolved->peerId() != conn->partner->peerId) {
+				stats.errors++;
+			}
+			conn->partner->forwarded.push_back(Clock::now());
+			if (!sendP2PConnect(conn, conn->partner->peerId, 0, offerSDP, true)) {
+				fail(conn);
+			}
+		}
+			break;
+
+		case HumblePeer::MessageType::P2POffer:
+			measure(conn, OFFER, conn->forwarded);
+			conn->partner->forwarded.push_back(Clock::now());
+			if (!sendP2PResponse(conn, conn->partner->peerId, answerSDP, true)) {
+				fail(conn);
+				break;
+			}
+			sendCandidates(conn);
+			break;
+
+		case HumblePeer::MessageType::P2PAnswer:
+			measure(conn, ANSWER, conn->forwarded);
+			sendCandidates(conn);
+			break;
+
+		case HumblePeer::MessageType::ICECandidate:
+			measure(conn, ICE, conn->forwarded);
+			if (++conn->candidatesReceived == ICE_CANDIDATES && conn->initiator) {
+				// the partner answered before its candidates, everything's here
+				sendRelay(conn);
+			}
+			break;
+
+		case HumblePeer::MessageType::P2PRelayData:
+			measure(conn, RELAY, conn->forwarded);
+			if (++conn->relaysReceived + conn->partner->relaysReceived == RELAY_PACKETS) {
+				sessionDone(conn);
+			} else {
+				sendRelay(conn);
+			}
+			break;
+
+		default:
+			stats.errors++;
+			break;
+	}
+
+	return true;
+}
+
+// the websocket frames in conn->in, the server doesn't mask
+static bool parseFrames(P2PSignalConnection* conn)
+{
+	std::vector<uint8_t>& in = conn->in;
+	size_t offset = 0;
+
+	WebsocketFrame frame;
+	while (nextFrame(in, offset, &frame)) {
+		if (frame.opcode == 0x8) {
+			return false;
+		}
+		// the humblepeer stream doesn't care where frames end, continuations included
+		if (frame.opcode == 0x0 || frame.opcode == 0x2) {
+			if (!parseMessage(conn->recvBuf, frame.payload, frame.length, onMessage, conn)) {
+				return false;
+			}
+			if (conn->state == State::Failed) {
+				return true;
+			}
+		}
+		offset += frame.size;
+	}
+
+	in.erase(in.begin(), in.begin() + offset);
+	return true;
+}
+
+static void sendHandshake(P2PSignalConnection* conn)
+{
+	conn->out.insert(conn->out.end(), WEBSOCKET_REQUEST, WEBSOCKET_REQUEST + strlen(WEBSOCKET_REQUEST));
+	conn->state = State::Handshake;
+	flush(conn);
+}
+
+static void readable(P2PSignalConnection* conn)
+{
+	uint8_t buff[64 * 1024];
+	for (;;) {
+		ssize_t n = recv(conn->fd, buff, sizeof(buff), 0);
+		if (n == 0) {
+			fail(conn);
+			return;
+		}
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				fail(conn);
+			}
+			return;
+		}
+
+		const uint8_t* data = buff;
+		size_t length = n;
+		if (conn->state == State::Handshake) {
+			conn->handshake.append(reinterpret_cast<const char*>(data), length);
+			size_t end = conn->handshake.find("\r\n\r\n");
+			if (end == std::string::npos) {
+				continue;
+			}
+			if (conn->handshake.compare(0, 12, "HTTP/1.1 101") != 0) {
+				fail(conn);
+				return;
+			}
+
+			// whatever came after the response is websocket already
+			size_t rest = conn->handshake.size() - (end + 4);
+			data = buff + n - rest;
+			length = rest;
+			conn->handshake.clear();
+
+			conn->state = State::Hello;
+			std::string token = "loadgen-" + std::to_string(conn->game);
+			std::map<std::string, std::string> attributes;
+			attributes["platform"] = "loadgen";
+			if (!sendHelloServer(conn, HELLO_FLAGS, token, "secret", "", "", attributes)) {
+				fail(conn);
+				return;
+			}
+		}
+
+		conn->in.insert(conn->in.end(), data, data + length);
+		if (!parseFrames(conn)) {
+			fail(conn);
+			return;
+		}
+		if (conn->state == State::Failed) {
+			return;
+		}
+	}
+}
+
+static void startConnecting(Worker* worker)
+{
+	while (worker->connecting < MAX_CONNECTING && worker->nextToConnect < worker->conns.size()) {
+		P2PSignalConnection* conn = worker->conns[worker->nextToConnect++].get();
+		conn->started = Clock::now();
+		worker->connecting++;
+
+		conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (conn->fd < 0) {
+			conn->state = State::Failed;
+			worker->connecting--;
+			worker->settled++;
+			worker->stats.failed++;
+			continue;
+		}
+		int one = 1;
+		setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN | EPOLLOUT;
+		ev.data.ptr = conn;
+		epoll_ctl(worker->epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+		conn->wantWrite = true;
+
+		if (connect(conn->fd, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) != 0 && errno != EINPROGRESS) {
+			fail(conn);
+		}
+	}
+}
+
+static void service(Worker* worker, int timeoutMs)
+{
+	struct epoll_event events[256];
+	int n = epoll_wait(worker->epfd, events, 256, timeoutMs);
+	for (int i = 0; i < n; ++i) {
+		P2PSignalConnection* conn = reinterpret_cast<P2PSignalConnection*>(events[i].data.ptr);
+		if (conn->state == State::Failed) {
+			continue;
+		}
+
+		if (conn->state == State::Connecting) {
+			int error = 0;
+			socklen_t len = sizeof(error);
+			getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+			if (error || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+				fail(conn);
+				continue;
+			}
+			if (events[i].events & EPOLLOUT) {
+				sendHandshake(conn);
+			}
+			continue;
+		}
+
+		if (events[i].events & EPOLLOUT) {
+			flush(conn);
+		}
+		if (conn->state != State::Failed && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+			readable(conn);
+		}
+	}
+}
+
+static void runWorker(Worker* worker)
+{
+	// connect everyone and register their aliases
+	auto giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+	while (worker->settled < worker->conns.size() && Clock::now() < giveUp && !stop) {
+		startConnecting(worker);
+		service(worker, 10);
+	}
+	readyWorkers++;
+
+	while (!go && !stop) {
+		service(worker, 10);
+	}
+
+	worker->deadline = Clock::time_point(Clock::duration(goDeadline.load()));
+	worker->running = true;
+	for (auto& conn : worker->conns) {
+		if (conn->initiator && conn->state == State::Ready && conn->partner->state == State::Ready) {
+			startSession(conn.get());
+		}
+	}
+
+	// the sessions in progress at the deadline get a moment to finish
+	auto end = worker->deadline + std::chrono::seconds(2);
+	while (Clock::now() < end && !stop) {
+		service(worker, 10);
+	}
+
+	for (auto& conn : worker->conns) {
+		if (conn->state != State::Failed) {
+			close(conn->fd);
+		}
+	}
+}
+
+static void printLatencies(const char* name, std::vector<uint32_t>& us)
+{
+	char line[200];
+	if (us.empty()) {
+		snprintf(line, sizeof(line), "  %-9s %9d", name, 0);
+		std::cout << line << std::endl;
+		return;
+	}
+	std::sort(us.begin(), us.end());
+	auto at = [&us](double q) {
+		return us[std::min(us.size() - 1, size_t(q * us.size()))] / 1000.0;
+	};
+	snprintf(line, sizeof(line), "  %-9s %9zu %9.3f %9.3f %9.3f %9.3f %9.3f",
+		name, us.size(), at(0.5), at(0.9), at(0.99), at(0.999), us.back() / 1000.0);
+	std::cout << line << std::endl;
+}
+
+static void usage(const char* prog)
+{
+	std::cout << "usage: " << prog << " [-s peer-server] [-a host:port] [-p pid] [-c connections]\n"
+		<< "        [-t seconds] [-g games] [-j threads] [-T server threads] [-b relay bytes]" << std::endl;
+}
+
+static void sighandler(int)
+{
+	stop = true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char* binary = NULL;
+	std::string address = "127.0.0.1:8080";
+	pid_t serverPid = 0;
+	int connections = DEFAULT_CONNECTIONS;
+	int seconds = DEFAULT_SECONDS;
+	int games = DEFAULT_GAMES;
+	int threads = 1;
+	int serverThreads = 1;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "-h" || i + 1 >= argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		const char* value = argv[++i];
+		if (arg == "-s") {
+			binary = value;
+		} else if (arg == "-a") {
+			address = value;
+		} else if (arg == "-p") {
+			serverPid = std::stoi(value);
+		} else if (arg == "-c") {
+			connections = std::stoi(value);
+		} else if (arg == "-t") {
+			seconds = std::stoi(value);
+		} else if (arg == "-g") {
+			games = std::stoi(value);
+		} else if (arg == "-j") {
+			threads = std::stoi(value);
+		} else if (arg == "-T") {
+			serverThreads = std::stoi(value);
+		} else if (arg == "-b") {
+			relayBytes = std::stoi(value);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (connections < 2 || seconds < 1 || games < 1 || threads < 1 || relayBytes < 1 || relayBytes > 65535) {
+		usage(argv[0]);
+		return 1;
+	}
+	// in pairs, and every thread has whole pairs
+	connections = (connections + 2 * threads - 1) / (2 * threads) * (2 * threads);
+
+	if (binary) {
+		address = "127.0.0.1:" + std::to_string(SERVER_PORT);
+	}
+	size_t colon = address.rfind(':');
+	memset(&serverAddress, 0, sizeof(serverAddress));
+	serverAddress.sin_family = AF_INET;
+	if (colon == std::string::npos || inet_pton(AF_INET, address.substr(0, colon).c_str(), &serverAddress.sin_addr) != 1) {
+		std::cout << "bad address " << address << std::endl;
+		return 1;
+	}
+	serverAddress.sin_port = htons(std::stoi(address.substr(colon + 1)));
+
+	// a descriptor per connection, and the server may be a child
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	signal(SIGINT, sighandler);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (binary) {
+		std::string config = "port=" + std::to_string(SERVER_PORT) + "\nthreads=" + std::to_string(serverThreads)
+			+ "\nlogfile=/dev/null\nloglevel=warning\n";
+		serverPid = startServer(binary, "signal_loadgen", config, serverAddress, TIMEOUT_S);
+		if (serverPid < 0) {
+			std::cout << "couldn't start " << binary << std::endl;
+			return 1;
+		}
+		// every thread has to be listening
+		usleep(100000);
+	}
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	int perWorker = connections / threads;
+	for (int w = 0; w < threads; ++w) {
+		std::unique_ptr<Worker> worker(new Worker);
+		worker->epfd = epoll_create1(0);
+		for (int i = 0; i < perWorker; ++i) {
+			std::unique_ptr<P2PSignalConnection> conn(new P2PSignalConnection);
+			int index = w * perWorker + i;
+			conn->worker = worker.get();
+			conn->game = GameId((index / 2) % games);
+			conn->alias = "loadgen-" + std::to_string(getpid()) + "-" + std::to_string(index);
+			conn->initiator = (i % 2 == 0);
+			worker->conns.push_back(std::move(conn));
+		}
+		for (int i = 0; i < perWorker; i += 2) {
+			worker->conns[i]->partner = worker->conns[i + 1].get();
+			worker->conns[i + 1]->partner = worker->conns[i].get();
+		}
+		workers.push_back(std::move(worker));
+	}
+
+	std::cout << connections << " connections in " << games << " games from " << threads << " threads to " << address << std::endl;
+
+	auto connectStart = Clock::now();
+	std::vector<std::thread> running;
+	for (auto& worker : workers) {
+		running.emplace_back(runWorker, worker.get());
+	}
+
+	while (readyWorkers < threads && !stop) {
+		usleep(1000);
+	}
+
+	// everything from here on is merged at the end
+	double cpuBefore = serverPid > 0 ? processCPU(serverPid) : -1;
+	auto sessionStart = Clock::now();
+	goDeadline = (sessionStart + std::chrono::seconds(seconds)).time_since_epoch().count();
+	go = true;
+
+	while (Clock::now() < sessionStart + std::chrono::seconds(seconds) && !stop) {
+		usleep(10000);
+	}
+	double cpuAfter = serverPid > 0 ? processCPU(serverPid) : -1;
+
+	for (auto& thread : running) {
+		thread.join();
+	}
+
+	Stats total;
+	total.lastConnected = connectStart;
+	for (auto& worker : workers) {
+		Stats& s = worker->stats;
+		total.connected += s.connected;
+		total.failed += s.failed;
+		total.errors += s.errors;
+		total.sessions += s.sessions;
+		total.messages += s.messages;
+		total.lastConnected = std::max(total.lastConnected, s.lastConnected);
+		total.connectLatencies.insert(total.connectLatencies.end(), s.connectLatencies.begin(), s.connectLatencies.end());
+		for (int k = 0; k < KINDS; ++k) {
+			total.latencies[k].insert(total.latencies[k].end(), s.latencies[k].begin(), s.latencies[k].end());
+		}
+	}
+
+	double connectSeconds = std::chrono::duration<double>(total.lastConnected - connectStart).count();
+	std::cout << total.connected << " of " << connections << " connected in " << connectSeconds << " s, "
+		<< (connectSeconds > 0 ? (uint64_t)(total.connected / connectSeconds) : 0) << " connections/s" << std::endl;
+	std::cout << total.sessions << " sessions, " << (uint64_t)(total.sessions / double(seconds)) << " sessions/s, "
+		<< (uint64_t)(total.messages / double(seconds)) << " messages/s received" << std::endl;
+
+	std::cout << "latency (ms)    count       p50       p90       p99     p99.9       max" << std::endl;
+	printLatencies("connect", total.connectLatencies);
+	for (int k = 0; k < KINDS; ++k) {
+		printLatencies(kindNames[k], total.latencies[k]);
+	}
+
+	if (cpuBefore >= 0 && cpuAfter >= 0) {
+		double cpu = cpuAfter - cpuBefore;
+		std::cout << "server CPU " << cpu << " s in " << seconds << " s (" << (int)(100 * cpu / seconds) << "%)";
+		if (total.messages) {
+			std::cout << ", " << cpu * 1e6 / total.messages << " us per message";
+		}
+		std::cout << std::endl;
+	}
+
+	if (binary) {
+		stopServer(serverPid);
+	}
+
+	bool passed = total.failed == 0 && total.errors == 0 && total.connected == uint64_t(connections);
+	if (!passed) {
+		std::cout << total.failed << " connections failed, " << total.errors << " unexpected messages" << std::endl;
+	}
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+// Has a number of peers race to register the same aliases and checks exactly one wins each.
+//
+//   humblenet_test_alias_claim [peers] [rounds]
+//
+// Forks the peers (16 by default), which all connect to the peer server before any of
+// them starts. Then every peer registers claim-test-<pid>-0, -1, ... (50 by default) as
+// fast as it gets answers, so they are all claiming the same alias at about the same time.
+// For every alias exactly one peer must see ALIAS_REGISTERED, and every other one
+// ALIAS_REJECTED naming the winner. Also reports how long a claim took to be answered.
+
+#include "humblenet_p2p.h"
+#include "child_process.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const int DEFAULT_PEERS = 16;
+const int DEFAULT_ROUNDS = 50;
+const int TIMEOUT_S = 60;
+
+const char client_token[] = "hello_world";
+const char client_secret[] = "secret";
+
+typedef std::chrono::steady_clock Clock;
+
+struct Result {
+	int32_t round;
+	int32_t status;
+	uint32_t peerId;
+	uint32_t owner;
+	int64_t micros;
+};
+
+static std::string alias_for(pid_t test, int round)
+{
+	return "claim-test-" + std::to_string(test) + "-" + std::to_string(round);
+}
+
+static void run_peer(pid_t test, int rounds, int readyFd, int goFd, int resultFd)
+{
+	humblenet_init();
+	humblenet_p2p_init(HUMBLENET_SERVER_URL, client_token, client_secret, NULL);
+
+	while (humblenet_p2p_get_my_peer_id() == 0) {
+		humblenet_p2p_wait(10);
+	}
+
+	char c = 'R';
+	if (write(readyFd, &c, 1) != 1 || read(goFd, &c, 1) != 1) {
+		_exit(1);
+	}
+
+	for (int round = 0; round < rounds && parentAlive(); ++round) {
+		std::string alias = alias_for(test, round);
+		auto start = Clock::now();
+
+		Result result;
+		result.round = round;
+		result.peerId = humblenet_p2p_get_my_peer_id();
+		result.owner = 0;
+		result.status = ALIAS_UNKNOWN;
+
+		if (humblenet_p2p_register_alias(alias.c_str())) {
+			PeerId owner = 0;
+			AliasStatus status;
+			while ((status = humblenet_p2p_alias_status(alias.c_str(), &owner)) == ALIAS_PENDING && parentAlive()) {
+				humblenet_p2p_wait(5);
+			}
+			result.status = status;
+			result.owner = owner;
+		}
+		result.micros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+
+		if (write(resultFd, &result, sizeof(result)) != sizeof(result)) {
+			break;
+		}
+	}
+
+	// until the tool kills us, or is gone
+	while (parentAlive()) {
+		humblenet_p2p_wait(50);
+	}
+
+	humblenet_shutdown();
+}
+
+int main(int argc, char *argv[])
+{
+	int peers = argc > 1 ? std::stoi(argv[1]) : DEFAULT_PEERS;
+	int rounds = argc > 2 ? std::stoi(argv[2]) : DEFAULT_ROUNDS;
+	if (peers < 2 || rounds < 1) {
+		std::cout << "need at least 2 peers and 1 round" << std::endl;
+		return 1;
+	}
+
+	int ready[2], go[2], results[2];
+	if (pipe(ready) != 0 || pipe(go) != 0 || pipe(results) != 0) {
+		return 1;
+	}
+
+	pid_t test = getpid();
+	std::vector<pid_t> children;
+	for (int i = 0; i < peers; ++i) {
+		pid_t pid = forkChild();
+		if (pid == 0) {
+			close(ready[0]);
+			close(go[1]);
+			close(results[0]);
+			run_peer(test, rounds, ready[1], go[0], results[1]);
+			_exit(0);
+		}
+		children.push_back(pid);
+	}
+	close(ready[1]);
+	close(go[0]);
+	close(results[1]);
+
+	bool passed = true;
+	auto giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+
+	int connected = 0;
+	while (connected < peers && Clock::now() < giveUp) {
+		struct pollfd pfd = { ready[0], POLLIN, 0 };
+		char c;
+		if (poll(&pfd, 1, 100) > 0 && read(ready[0], &c, 1) == 1) {
+			++connected;
+		}
+	}
+
+	std::vector<std::vector<Result>> byRound(rounds);
+	std::vector<int64_t> latencies;
+
+	if (connected < peers) {
+		std::cout << "only " << connected << " of " << peers << " peers connected within " << TIMEOUT_S << " s" << std::endl;
+		passed = false;
+	} else {
+		// everyone starts at once
+		std::string start(peers, 'G');
+		if (write(go[1], start.data(), start.size()) != (ssize_t)start.size()) {
+			passed = false;
+		}
+
+		size_t expected = (size_t)peers * rounds;
+		while (latencies.size() < expected && Clock::now() < giveUp) {
+			struct pollfd pfd = { results[0], POLLIN, 0 };
+			if (poll(&pfd, 1, 100) <= 0) continue;
+
+			Result result;
+			if (read(results[0], &result, sizeof(result)) != sizeof(result)) break;
+			if (result.round < 0 || result.round >= rounds) continue;
+
+			byRound[result.round].push_back(result);
+			latencies.push_back(result.micros);
+		}
+
+		if (latencies.size() < expected) {
+			std::cout << "only " << latencies.size() << " of " << expected << " claims were answered within " << TIMEOUT_S << " s" << std::endl;
+			passed = false;
+		}
+	}
+
+	for (auto pid : children) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+
+	int contested = 0;
+	for (int round = 0; round < rounds; ++round) {
+		const auto& claims = byRound[round];
+		if (claims.empty()) continue;
+
+		PeerId winner = 0;
+		int winners = 0;
+		for (const auto& claim : claims) {
+			if (claim.status == ALIAS_REGISTERED) {
+				winner = claim.peerId;
+				++winners;
+			}
+		}
+
+		bool ok = winners == 1;
+		for (const auto& claim : claims) {
+			if (claim.status == ALIAS_REJECTED) {
+				ok = ok && claim.owner == winner;
+				++contested;
+			} else if (claim.status != ALIAS_REGISTERED) {
+				ok = false;
+			}
+		}
+
+		if (!ok) {
+			std::cout << alias_for(test, round) << ": " << winners << " peers registered it, expected 1" << std::endl;
+			passed = false;
+		}
+	}
+
+	std::cout << peers << " peers, " << rounds << " aliases, " << contested << " claims rejected" << std::endl;
+	if (!latencies.empty()) {
+		std::sort(latencies.begin(), latencies.end());
+		std::cout << "claim answered after (us): p50 " << latencies[latencies.size() / 2]
+			<< " p99 " << latencies[latencies.size() * 99 / 100] << " max " << latencies.back() << std::endl;
+	}
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+
+	return passed ? 0 : 1;
+}
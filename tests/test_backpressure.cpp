@@ -0,0 +1,349 @@
+// Checks that peers which stop reading can't make the peer server's memory grow.
+//
+//   humblenet_test_backpressure <peer-server> [megabytes]
+//
+// Starts the given peer-server binary on port 28091, with a 1 MB high water mark, a
+// 256 KB low water mark and an 8 MB limit on a websocket's send queue. Then:
+//
+//   1. one peer stops reading while another relays 100 MB (or the given number) to it as
+//      fast as it can. The sender has to be told with P2PBackpressure that its relay data
+//      is being dropped, and the server may not grow by more than 32 MB meanwhile.
+//   2. the peer reads again. The sender has to be told it caught up, and relay data has
+//      to get through again.
+//   3. another peer stops reading while signaling messages, which are never dropped, pile
+//      up for it. It has to be disconnected, again without the server growing.
+//
+// The server's resident memory is sampled from /proc throughout.
+
+#include "humblenet.h"
+#include "humblepeer.h"
+#include "peer_server_fixture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace humblenet;
+
+typedef std::chrono::steady_clock Clock;
+
+const int PORT = 28091;
+const int TIMEOUT_S = 10;
+const int DEFAULT_MEGABYTES = 100;
+const size_t SEND_QUEUE_LIMIT = 8 * 1024 * 1024;
+const size_t MAX_GROWTH = 32 * 1024 * 1024;
+
+const uint16_t RELAY_PACKET = 60000;
+const uint8_t MARKER = 0xee;
+
+struct humblenet::P2PSignalConnection {
+	int fd = -1;
+	bool closed = false;
+	std::vector<uint8_t> out;
+	size_t outOffset = 0;
+	std::vector<uint8_t> in;
+	std::vector<uint8_t> recvBuf;
+
+	PeerId peerId = 0;
+	int congested = 0;	// P2PBackpressure received
+	int flowing = 0;
+	uint64_t relayBytes = 0;
+	bool marker = false;	// the relay packet sent once it's flowing again
+};
+
+static pid_t serverPid = 0;
+static size_t maxRSS = 0;
+
+// bytes, 0 if it can't be read
+static size_t serverRSS()
+{
+	std::ifstream in("/proc/" + std::to_string(serverPid) + "/status");
+	std::string line;
+	while (std::getline(in, line)) {
+		if (line.compare(0, 6, "VmRSS:") == 0) {
+			return std::stoul(line.substr(6)) * 1024;
+		}
+	}
+	return 0;
+}
+
+static void sampleRSS()
+{
+	static Clock::time_point last;
+	auto now = Clock::now();
+	if (now - last >= std::chrono::milliseconds(20)) {
+		last = now;
+		maxRSS = std::max(maxRSS, serverRSS());
+	}
+}
+
+static void flush(P2PSignalConnection* conn)
+{
+	while (!conn->closed && conn->outOffset < conn->out.size()) {
+		ssize_t n = send(conn->fd, conn->out.data() + conn->outOffset, conn->out.size() - conn->outOffset, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				conn->closed = true;
+			}
+			break;
+		}
+		conn->outOffset += n;
+	}
+	if (conn->outOffset == conn->out.size()) {
+		conn->out.clear();
+		conn->outOffset = 0;
+	}
+}
+
+ha_bool humblenet::sendP2PMessage(P2PSignalConnection *conn, const uint8_t *buff, size_t length) {
+	appendFrame(conn->out, buff, length);
+	flush(conn);
+	return !conn->closed;
+}
+
+static ha_bool onMessage(const HumblePeer::Message* msg, void* data)
+{
+	P2PSignalConnection* conn = reinterpret_cast<P2PSignalConnection*>(data);
+
+	switch (msg->message_type()) {
+		case HumblePeer::MessageType::HelloClient:
+			conn->peerId = reinterpret_cast<const HumblePeer::HelloClient*>(msg->message())->peerId();
+			break;
+
+		case HumblePeer::MessageType::P2PBackpressure:
+			if (reinterpret_cast<const HumblePeer::P2PBackpressure*>(msg->message())->congested()) {
+				conn->congested++;
+			} else {
+				conn->flowing++;
+			}
+			break;
+
+		case HumblePeer::MessageType::P2PRelayData:
+		{
+			auto relay = reinterpret_cast<const HumblePeer::P2PRelayData*>(msg->message());
+			conn->relayBytes += relay->data()->size();
+			if (relay->data()->size() && uint8_t(relay->data()->Get(0)) == MARKER) {
+				conn->marker = true;
+			}
+		}
+			break;
+
+		default:
+			break;
+	}
+	return true;
+}
+
+// the server's frames in conn->in, unmasked
+static void parseFrames(P2PSignalConnection* conn)
+{
+	std::vector<uint8_t>& in = conn->in;
+	size_t offset = 0;
+
+	WebsocketFrame frame;
+	while (nextFrame(in, offset, &frame)) {
+		if (frame.opcode == 0x8) {
+			conn->closed = true;
+			return;
+		}
+		if ((frame.opcode == 0x0 || frame.opcode == 0x2) && !parseMessage(conn->recvBuf, frame.payload, frame.length, onMessage, conn)) {
+			conn->closed = true;
+			return;
+		}
+		offset += frame.size;
+	}
+
+	in.erase(in.begin(), in.begin() + offset);
+}
+
+// waits up to timeoutMs for the socket, reading only if asked to
+static void pump(P2PSignalConnection* conn, int timeoutMs, bool read = true)
+{
+	if (conn->closed) {
+		return;
+	}
+
+	struct pollfd pfd = {};
+	pfd.fd = conn->fd;
+	pfd.events = (read ? POLLIN : 0) | (conn->out.empty() ? 0 : POLLOUT);
+	if (poll(&pfd, 1, timeoutMs) <= 0) {
+		return;
+	}
+
+	if (pfd.revents & POLLOUT) {
+		flush(conn);
+	}
+	if (read && (pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+		uint8_t buff[64 * 1024];
+		ssize_t n = recv(conn->fd, buff, sizeof(buff), 0);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+			conn->closed = true;
+			return;
+		}
+		if (n > 0) {
+			conn->in.insert(conn->in.end(), buff, buff + n);
+			parseFrames(conn);
+		}
+	}
+}
+
+// connects and says hello. A small receive buffer makes a peer that stops reading stall quickly
+static bool openPeer(P2PSignalConnection* conn, uint8_t flags, int receiveBuffer = 0)
+{
+	conn->fd = openWebsocket(loopbackAddress(PORT), receiveBuffer);
+	if (conn->fd < 0) {
+		return false;
+	}
+
+	std::map<std::string, std::string> attributes;
+	if (!sendHelloServer(conn, flags, "test-backpressure", "secret", "", "", attributes)) {
+		return false;
+	}
+
+	auto giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+	while (!conn->peerId && !conn->closed && Clock::now() < giveUp) {
+		pump(conn, 10);
+	}
+	return conn->peerId != 0;
+}
+
+static bool check(bool ok, const std::string& what)
+{
+	std::cout << (ok ? "  ok    " : "  FAIL  ") << what << std::endl;
+	return ok;
+}
+
+static std::string megabytes(size_t bytes)
+{
+	char buff[32];
+	snprintf(buff, sizeof(buff), "%.1f MB", bytes / (1024.0 * 1024.0));
+	return buff;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std::cout << "usage: " << argv[0] << " <peer-server> [megabytes]" << std::endl;
+		return 1;
+	}
+	uint64_t total = uint64_t(argc > 2 ? std::stoi(argv[2]) : DEFAULT_MEGABYTES) * 1024 * 1024;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	char config[200];
+	snprintf(config, sizeof(config), "port=%d\nlogfile=/dev/null\nsendQueueHighWater=%d\nsendQueueLowWater=%d\nsendQueueLimit=%d\n",
+		PORT, 1024 * 1024, 256 * 1024, int(SEND_QUEUE_LIMIT));
+	serverPid = startServer(argv[1], "test_backpressure", config, loopbackAddress(PORT), TIMEOUT_S);
+	if (serverPid < 0) {
+		std::cout << "couldn't start " << argv[1] << std::endl;
+		return 1;
+	}
+
+	bool passed = true;
+	const uint8_t flags = 0x1 | HELLO_FLAG_BACKPRESSURE;
+
+	P2PSignalConnection sender, receiver;
+	if (!openPeer(&sender, flags) || !openPeer(&receiver, flags, 4096)) {
+		std::cout << "couldn't connect" << std::endl;
+		stopServer(serverPid);
+		return 1;
+	}
+
+	// 1. the receiver stops reading
+	size_t baseline = serverRSS();
+	maxRSS = baseline;
+	std::vector<uint8_t> packet(RELAY_PACKET, 0x5a);
+	uint64_t sent = 0;
+	auto start = Clock::now();
+	while ((sent < total || !sender.out.empty()) && !sender.closed) {
+		if (sent < total && sender.out.size() < 256 * 1024) {
+			if (!sendP2PRelayData(&sender, receiver.peerId, packet.data(), RELAY_PACKET)) {
+				break;
+			}
+			sent += RELAY_PACKET;
+		}
+		pump(&sender, sender.out.size() < 256 * 1024 ? 0 : 10);
+		sampleRSS();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	// what's still on its way through the server
+	auto settle = Clock::now() + std::chrono::milliseconds(500);
+	while (Clock::now() < settle) {
+		pump(&sender, 10);
+		sampleRSS();
+	}
+
+	std::cout << "relayed " << megabytes(sent) << " to a peer that isn't reading in " << seconds << " s" << std::endl;
+	passed &= check(!sender.closed && sent >= total, "the sender wasn't disconnected");
+	passed &= check(sender.congested == 1, "the sender was told its relay data is dropped");
+	passed &= check(maxRSS - baseline < MAX_GROWTH, "the server grew by " + megabytes(maxRSS - baseline));
+
+	// 2. it reads again
+	auto giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+	while (!sender.flowing && Clock::now() < giveUp) {
+		pump(&receiver, 0);
+		pump(&sender, 1);
+	}
+	passed &= check(sender.flowing == 1, "the sender was told the receiver caught up, it got " + megabytes(receiver.relayBytes));
+
+	packet[0] = MARKER;
+	sendP2PRelayData(&sender, receiver.peerId, packet.data(), RELAY_PACKET);
+	giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+	while (!receiver.marker && !receiver.closed && Clock::now() < giveUp) {
+		pump(&sender, 0);
+		pump(&receiver, 1);
+	}
+	passed &= check(receiver.marker, "relay data gets through again");
+
+	// 3. signaling piles up for a peer that isn't reading, it can't be dropped
+	P2PSignalConnection stalled;
+	if (!openPeer(&stalled, 0x1, 4096)) {
+		std::cout << "couldn't connect" << std::endl;
+		passed = false;
+	} else {
+		baseline = serverRSS();
+		maxRSS = baseline;
+		std::string candidate = "candidate:1467250027 1 udp 2122260223 192.168.1.23 49812 typ host generation 0 " + std::string(900, 'x');
+		uint64_t queued = 0;
+		while (queued < 3 * SEND_QUEUE_LIMIT && !sender.closed) {
+			if (sender.out.size() < 256 * 1024) {
+				sendICECandidate(&sender, stalled.peerId, candidate.c_str());
+				queued += candidate.size();
+			}
+			pump(&sender, sender.out.size() < 256 * 1024 ? 0 : 10);
+			sampleRSS();
+		}
+
+		// everything the kernel holds for it comes first
+		giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+		while (!stalled.closed && Clock::now() < giveUp) {
+			pump(&sender, 0);
+			pump(&stalled, 10);
+			sampleRSS();
+		}
+		std::cout << "sent " << megabytes(queued) << " of ICE candidates to a peer that isn't reading" << std::endl;
+		passed &= check(stalled.closed, "the peer was disconnected");
+		passed &= check(!sender.closed, "the sender wasn't");
+		passed &= check(maxRSS - baseline < MAX_GROWTH, "the server grew by " + megabytes(maxRSS - baseline));
+	}
+
+	close(sender.fd);
+	close(receiver.fd);
+	close(stalled.fd);
+	stopServer(serverPid);
+
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+	return passed ? 0 : 1;
+}
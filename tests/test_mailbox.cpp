@@ -0,0 +1,145 @@
+// Checks that the peer server's shard mailbox never loses a wakeup.
+//
+//   humblenet_test_mailbox [producers] [tasks per producer]
+//
+// 4 producer threads (or the given number) post 200000 tasks each (or the given
+// number), with short random pauses so the consumer keeps running out of work. The
+// consumer sleeps the way a shard does: only until post() says it has to be woken, or
+// a timeout, after which it runs the mailbox. A task that waits longer than the wakeup
+// could have taken was posted without waking the consumer, a lost wakeup.
+//
+// Also checks that every task ran once and in order for its producer.
+
+#include "mailbox.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace humblenet;
+
+typedef std::chrono::steady_clock Clock;
+
+const int DEFAULT_PRODUCERS = 4;
+const int DEFAULT_TASKS = 200000;
+// the consumer wakes up on its own after this, as the shards' maintenance timer does
+const std::chrono::milliseconds TIMEOUT(200);
+// a woken consumer comes long before, a lost wakeup only with the timeout
+const std::chrono::milliseconds LOST(100);
+
+// the eventfd a shard's loop waits on
+class Wake {
+public:
+	void signal()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_signaled = true;
+		m_cond.notify_one();
+	}
+
+	void wait(std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait_for(lock, timeout, [this] { return m_signaled; });
+		m_signaled = false;
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_signaled = false;
+};
+
+static bool check(bool ok, const std::string& what)
+{
+	std::cout << (ok ? "  ok    " : "  FAIL  ") << what << std::endl;
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	int producers = argc > 1 ? std::stoi(argv[1]) : DEFAULT_PRODUCERS;
+	int tasks = argc > 2 ? std::stoi(argv[2]) : DEFAULT_TASKS;
+	if (producers < 1 || tasks < 1) {
+		std::cout << "usage: " << argv[0] << " [producers] [tasks per producer]" << std::endl;
+		return 1;
+	}
+
+	Mailbox mailbox;
+	Wake wake;
+
+	// only touched by the consumer, in the tasks
+	std::vector<int> last(producers, -1);
+	uint64_t ran = 0;
+	uint64_t outOfOrder = 0;
+	uint64_t lost = 0;
+	Clock::duration longest = Clock::duration::zero();
+
+	auto start = Clock::now();
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; ++p) {
+		threads.emplace_back([&, p] {
+			std::mt19937 random(p);
+			std::uniform_int_distribution<int> pause(0, 2000);
+			for (int i = 0; i < tasks; ++i) {
+				Clock::time_point posted = Clock::now();
+				bool woken = mailbox.post([&, p, i, posted] {
+					if (last[p] != i - 1) {
+						++outOfOrder;
+					}
+					last[p] = i;
+					++ran;
+
+					Clock::duration waited = Clock::now() - posted;
+					longest = std::max(longest, waited);
+					if (waited > LOST) {
+						++lost;
+					}
+				});
+				if (woken) {
+					wake.signal();
+				}
+
+				// a few microseconds at most, often enough for the consumer to go to sleep
+				for (int spin = pause(random); spin > 0; --spin) {
+					std::atomic_signal_fence(std::memory_order_seq_cst);
+				}
+				if (i % 64 == 0) {
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	const uint64_t total = uint64_t(producers) * tasks;
+	while (ran < total) {
+		wake.wait(TIMEOUT);
+		mailbox.run();
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	char line[120];
+	snprintf(line, sizeof(line), "%llu tasks from %d threads in %.2f s, the longest waited %.1f ms",
+		static_cast<unsigned long long>(ran), producers, seconds,
+		std::chrono::duration<double, std::milli>(longest).count());
+	std::cout << line << std::endl;
+
+	bool passed = true;
+	passed &= check(ran == total, "every task ran");
+	passed &= check(outOfOrder == 0, "the tasks of each thread ran in order");
+	passed &= check(lost == 0, std::to_string(lost) + " tasks were posted without waking the consumer");
+
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+// Measures the latency of the first message to a peer, with and without pre-connecting.
+//
+//   humblenet_test_preconnect
+//
+// Forks two echo peers with their own aliases. The first one is sent a message straight
+// away, so that message waits for the whole connection setup. The second one is
+// pre-connected with humblenet_p2p_preconnect first, and only once that says it's
+// connected is the message sent. Both times are from sending to getting the echo back.
+
+#include "humblenet_p2p.h"
+#include "child_process.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const uint8_t CHANNEL = 47;
+const int TIMEOUT_S = 30;
+
+const char client_token[] = "hello_world";
+const char client_secret[] = "secret";
+
+typedef std::chrono::steady_clock Clock;
+
+static std::string alias_for(pid_t test, int index)
+{
+	return "preconnect-echo-" + std::to_string(test) + "-" + std::to_string(index);
+}
+
+static double ms_since(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void connect_peer()
+{
+	humblenet_init();
+	humblenet_p2p_init(HUMBLENET_SERVER_URL, client_token, client_secret, NULL);
+
+	while (humblenet_p2p_get_my_peer_id() == 0) {
+		humblenet_p2p_wait(10);
+	}
+}
+
+static void run_echo(const std::string& alias, int readyFd)
+{
+	connect_peer();
+
+	humblenet_p2p_register_alias(alias.c_str());
+	while (humblenet_p2p_alias_status(alias.c_str(), NULL) == ALIAS_PENDING) {
+		humblenet_p2p_wait(5);
+	}
+
+	char c = 'R';
+	if (write(readyFd, &c, 1) != 1) {
+		_exit(1);
+	}
+
+	uint8_t buff[64];
+
+	// until the tool kills us, or is gone
+	while (parentAlive()) {
+		humblenet_p2p_wait(5);
+
+		PeerId fromPeer = 0;
+		int ret;
+		while ((ret = humblenet_p2p_recvfrom(buff, sizeof(buff), &fromPeer, CHANNEL)) > 0) {
+			humblenet_p2p_sendto(buff, ret, fromPeer, SEND_RELIABLE, CHANNEL);
+		}
+	}
+
+	humblenet_shutdown();
+}
+
+// sends a ping and waits for it to come back, returns the round trip in ms or -1
+static double ping(PeerId peer, Clock::time_point giveUp)
+{
+	uint8_t hello[] = "ping";
+	uint8_t buff[64];
+
+	auto start = Clock::now();
+	if (humblenet_p2p_sendto(hello, sizeof(hello), peer, SEND_RELIABLE, CHANNEL) < 0) {
+		std::cout << "send failed: " << humblenet_get_error() << std::endl;
+		return -1;
+	}
+
+	while (Clock::now() < giveUp) {
+		humblenet_p2p_wait(1);
+
+		PeerId fromPeer = 0;
+		if (humblenet_p2p_recvfrom(buff, sizeof(buff), &fromPeer, CHANNEL) > 0 && fromPeer == peer) {
+			return ms_since(start);
+		}
+	}
+
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	int ready[2];
+	if (pipe(ready) != 0) {
+		return 1;
+	}
+
+	pid_t test = getpid();
+	pid_t children[2];
+	for (int i = 0; i < 2; ++i) {
+		children[i] = forkChild();
+		if (children[i] == 0) {
+			close(ready[0]);
+			run_echo(alias_for(test, i), ready[1]);
+			_exit(0);
+		}
+	}
+	close(ready[1]);
+
+	bool passed = true;
+	auto giveUp = Clock::now() + std::chrono::seconds(TIMEOUT_S);
+
+	int echoes = 0;
+	while (echoes < 2 && Clock::now() < giveUp) {
+		struct pollfd pfd = { ready[0], POLLIN, 0 };
+		char c;
+		if (poll(&pfd, 1, 100) > 0 && read(ready[0], &c, 1) == 1) {
+			++echoes;
+		}
+	}
+
+	double cold = -1, warmup = -1, warm = -1;
+
+	if (echoes < 2) {
+		std::cout << "the echo peers didn't come up within " << TIMEOUT_S << " s" << std::endl;
+		passed = false;
+	} else {
+		connect_peer();
+
+		cold = ping(humblenet_p2p_virtual_peer_for_alias(alias_for(test, 0).c_str()), giveUp);
+
+		PeerId other = humblenet_p2p_virtual_peer_for_alias(alias_for(test, 1).c_str());
+		auto start = Clock::now();
+		while (!humblenet_p2p_preconnect(other) && Clock::now() < giveUp) {
+			humblenet_p2p_wait(1);
+		}
+		warmup = ms_since(start);
+
+		warm = ping(other, giveUp);
+
+		humblenet_shutdown();
+	}
+
+	for (auto pid : children) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+
+	if (cold < 0 || warm < 0) {
+		std::cout << "no echo from " << (cold < 0 ? "the first" : "the pre-connected") << " peer" << std::endl;
+		passed = false;
+	} else {
+		std::cout << "first message without pre-connecting: " << cold << " ms" << std::endl;
+		std::cout << "first message after pre-connecting: " << warm << " ms (pre-connecting took " << warmup << " ms)" << std::endl;
+	}
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+
+	return passed ? 0 : 1;
+}
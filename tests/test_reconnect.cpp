@@ -0,0 +1,403 @@
+// Drops the signaling connections of two connected peers and checks they resume their sessions.
+//
+//   humblenet_test_reconnect [drops]
+//
+// Forks two peers which reach the peer server through a proxy in this process. Peer 1
+// connects to peer 0 through its alias and keeps pinging it. Once the pongs flow the
+// proxy closes every connection, which is what a network blip looks like to both ends.
+// A peer has resumed once the server's hello comes back on its new connection, that is
+// measured from the drop. Both must come back with the peer ids they had, and the pings
+// go over the P2P connection so they shouldn't notice.
+
+#include "humblenet_p2p.h"
+#include "child_process.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const int PEERS = 2;
+const uint8_t CHANNEL = 46;
+const int CONNECT_TIMEOUT_S = 30;
+const int RESUME_TIMEOUT_S = 10;
+
+const char client_token[] = "hello_world";
+const char client_secret[] = "secret";
+const char alias[] = "reconnect-test-0";
+
+typedef std::chrono::steady_clock Clock;
+
+// what the peers report back, every few ms
+struct Status {
+	int32_t index;
+	uint32_t peerId;
+	uint32_t pongs;
+};
+
+// Forwards connections to the peer server, and can drop all of them at once.
+struct Proxy {
+	int listenSocket = -1;
+	struct sockaddr_storage server;
+	socklen_t serverLen = 0;
+
+	std::atomic<bool> running;
+	std::atomic<bool> drop;
+
+	struct Pair {
+		int client;
+		int server;
+		bool handshake;    // still in the HTTP upgrade going to the client
+		size_t matched;    // bytes of "\r\n\r\n" matched so far
+		bool resumed;
+	};
+	std::vector<Pair> pairs;
+
+	// time of the first server message on each connection made after the last drop
+	std::mutex lock;
+	Clock::time_point dropped;
+	std::vector<Clock::time_point> resumed;
+
+	Proxy() : running(true), drop(false) {}
+
+	void run()
+	{
+		std::vector<struct pollfd> fds;
+		uint8_t buff[65536];
+
+		while (running) {
+			if (drop) {
+				for (auto& p : pairs) {
+					close(p.client);
+					close(p.server);
+				}
+				pairs.clear();
+
+				std::lock_guard<std::mutex> guard(lock);
+				dropped = Clock::now();
+				resumed.clear();
+				drop = false;
+			}
+
+			fds.clear();
+			fds.push_back({ listenSocket, POLLIN, 0 });
+			for (auto& p : pairs) {
+				fds.push_back({ p.client, POLLIN, 0 });
+				fds.push_back({ p.server, POLLIN, 0 });
+			}
+
+			if (poll(fds.data(), fds.size(), 10) <= 0) continue;
+
+			// pairs accepted below weren't polled yet
+			size_t polled = pairs.size();
+
+			if (fds[0].revents & POLLIN) {
+				int client = accept(listenSocket, NULL, NULL);
+				int upstream = socket(server.ss_family, SOCK_STREAM, 0);
+				if (client >= 0 && upstream >= 0 && connect(upstream, (struct sockaddr*)&server, serverLen) == 0) {
+					pairs.push_back({ client, upstream, true, 0, false });
+				} else {
+					if (client >= 0) close(client);
+					if (upstream >= 0) close(upstream);
+				}
+			}
+
+			std::vector<bool> closed(pairs.size(), false);
+			for (size_t i = 0; i < polled; ++i) {
+				const struct pollfd& c = fds[1 + 2 * i];
+				const struct pollfd& s = fds[2 + 2 * i];
+
+				bool ok = true;
+				if (c.revents & (POLLIN | POLLHUP | POLLERR)) {
+					ok = forward(pairs[i].client, pairs[i].server, NULL, buff, sizeof(buff));
+				}
+				if (ok && (s.revents & (POLLIN | POLLHUP | POLLERR))) {
+					ok = forward(pairs[i].server, pairs[i].client, &pairs[i], buff, sizeof(buff));
+				}
+				closed[i] = !ok;
+			}
+
+			for (size_t i = pairs.size(); i-- > 0; ) {
+				if (closed[i]) {
+					close(pairs[i].client);
+					close(pairs[i].server);
+					pairs.erase(pairs.begin() + i);
+				}
+			}
+		}
+
+		for (auto& p : pairs) {
+			close(p.client);
+			close(p.server);
+		}
+	}
+
+	bool forward(int from, int to, Pair* toClient, uint8_t* buff, size_t size)
+	{
+		ssize_t got = recv(from, buff, size, 0);
+		if (got <= 0) return false;
+
+		if (toClient && !toClient->resumed) {
+			ssize_t i = 0;
+			static const char end[] = "\r\n\r\n";
+			for (; i < got && toClient->handshake; ++i) {
+				toClient->matched = (buff[i] == end[toClient->matched]) ? toClient->matched + 1 : (buff[i] == '\r' ? 1 : 0);
+				toClient->handshake = toClient->matched < 4;
+			}
+			// the first thing the server sends after the upgrade is the hello
+			if (i < got) {
+				toClient->resumed = true;
+				std::lock_guard<std::mutex> guard(lock);
+				resumed.push_back(Clock::now());
+			}
+		}
+
+		for (ssize_t sent = 0; sent < got; ) {
+			ssize_t ret = send(to, buff + sent, got - sent, MSG_NOSIGNAL);
+			if (ret <= 0) return false;
+			sent += ret;
+		}
+		return true;
+	}
+};
+
+// splits ws://host:port/path, returns false if it isn't one
+static bool parse_url(const std::string& url, std::string& host, std::string& port, std::string& path)
+{
+	const std::string scheme = "ws://";
+	if (url.compare(0, scheme.size(), scheme) != 0) return false;
+
+	size_t hostStart = scheme.size();
+	size_t pathStart = url.find('/', hostStart);
+	std::string hostPort = url.substr(hostStart, pathStart == std::string::npos ? std::string::npos : pathStart - hostStart);
+	path = pathStart == std::string::npos ? "/" : url.substr(pathStart);
+
+	size_t colon = hostPort.rfind(':');
+	host = hostPort.substr(0, colon);
+	port = colon == std::string::npos ? "80" : hostPort.substr(colon + 1);
+	return true;
+}
+
+static void run_peer(int index, const std::string& url, int statusFd)
+{
+	humblenet_init();
+	humblenet_p2p_init(url.c_str(), client_token, client_secret, NULL);
+
+	while (humblenet_p2p_get_my_peer_id() == 0) {
+		humblenet_p2p_wait(10);
+	}
+
+	PeerId other = 0;
+	if (index == 0) {
+		humblenet_p2p_register_alias(alias);
+	} else {
+		other = humblenet_p2p_virtual_peer_for_alias(alias);
+	}
+
+	Status status = { index, 0, 0 };
+	uint8_t ping = 'P';
+	uint8_t pong = 'R';
+	uint8_t buff[16];
+
+	auto lastPing = Clock::now();
+	auto lastStatus = Clock::now();
+
+	// until the tool kills us, or is gone
+	while (parentAlive()) {
+		auto now = Clock::now();
+		if (other && now - lastPing > std::chrono::milliseconds(10)) {
+			humblenet_p2p_sendto(&ping, sizeof(ping), other, SEND_RELIABLE, CHANNEL);
+			lastPing = now;
+		}
+
+		humblenet_p2p_wait(5);
+
+		PeerId fromPeer = 0;
+		int ret;
+		while ((ret = humblenet_p2p_recvfrom(buff, sizeof(buff), &fromPeer, CHANNEL)) > 0) {
+			if (buff[0] == ping) {
+				humblenet_p2p_sendto(&pong, sizeof(pong), fromPeer, SEND_RELIABLE, CHANNEL);
+			} else if (buff[0] == pong) {
+				++status.pongs;
+			}
+		}
+
+		if (now - lastStatus > std::chrono::milliseconds(5)) {
+			status.peerId = humblenet_p2p_get_my_peer_id();
+			if (write(statusFd, &status, sizeof(status)) != sizeof(status)) {
+				break;
+			}
+			lastStatus = now;
+		}
+	}
+
+	humblenet_shutdown();
+}
+
+// reads the statuses which arrived, until deadline or done returns true
+template<typename Done>
+static bool read_status(int fd, Status* latest, Clock::time_point deadline, Done done)
+{
+	while (Clock::now() < deadline) {
+		if (done()) return true;
+
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 10) <= 0) continue;
+
+		Status status;
+		if (read(fd, &status, sizeof(status)) != sizeof(status)) return false;
+		if (status.index >= 0 && status.index < PEERS) {
+			latest[status.index] = status;
+		}
+	}
+	return done();
+}
+
+int main(int argc, char *argv[])
+{
+	int drops = argc > 1 ? std::stoi(argv[1]) : 3;
+	if (drops < 1) {
+		return 1;
+	}
+
+	std::string host, port, path;
+	if (!parse_url(HUMBLENET_SERVER_URL, host, port, path)) {
+		std::cout << "Can only proxy ws:// peer servers, not " << HUMBLENET_SERVER_URL << std::endl;
+		return 1;
+	}
+
+	Proxy proxy;
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* res = NULL;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || res == NULL) {
+		std::cout << "Could not resolve " << host << std::endl;
+		return 1;
+	}
+	memcpy(&proxy.server, res->ai_addr, res->ai_addrlen);
+	proxy.serverLen = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t localLen = sizeof(local);
+
+	proxy.listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+	if (proxy.listenSocket < 0
+		|| bind(proxy.listenSocket, (struct sockaddr*)&local, sizeof(local)) != 0
+		|| listen(proxy.listenSocket, 16) != 0
+		|| getsockname(proxy.listenSocket, (struct sockaddr*)&local, &localLen) != 0) {
+		std::cout << "Could not start the proxy" << std::endl;
+		return 1;
+	}
+
+	std::string url = "ws://127.0.0.1:" + std::to_string(ntohs(local.sin_port)) + path;
+
+	int statusPipe[2];
+	if (pipe(statusPipe) != 0) {
+		return 1;
+	}
+
+	// fork before starting the proxy thread, the children only need the listening socket to exist.
+	std::vector<pid_t> children;
+	for (int i = 0; i < PEERS; ++i) {
+		pid_t pid = forkChild();
+		if (pid == 0) {
+			close(proxy.listenSocket);
+			close(statusPipe[0]);
+			run_peer(i, url, statusPipe[1]);
+			_exit(0);
+		}
+		children.push_back(pid);
+	}
+	close(statusPipe[1]);
+
+	std::thread proxyThread(&Proxy::run, &proxy);
+
+	Status latest[PEERS];
+	memset(latest, 0, sizeof(latest));
+
+	bool ok = read_status(statusPipe[0], latest, Clock::now() + std::chrono::seconds(CONNECT_TIMEOUT_S), [&] {
+		return latest[0].peerId != 0 && latest[1].peerId != 0 && latest[1].pongs > 0;
+	});
+
+	if (!ok) {
+		std::cout << "peers didn't connect within " << CONNECT_TIMEOUT_S << " s" << std::endl;
+	} else {
+		std::cout << "peer " << latest[0].peerId << " and peer " << latest[1].peerId << " connected" << std::endl;
+	}
+
+	PeerId ids[PEERS] = { latest[0].peerId, latest[1].peerId };
+	std::vector<int64_t> resumeTimes;
+
+	for (int drop = 0; ok && drop < drops; ++drop) {
+		uint32_t pongsBefore = latest[1].pongs;
+		proxy.drop = true;
+
+		// both new connections got their hello
+		ok = read_status(statusPipe[0], latest, Clock::now() + std::chrono::seconds(RESUME_TIMEOUT_S), [&] {
+			std::lock_guard<std::mutex> guard(proxy.lock);
+			return !proxy.drop && proxy.resumed.size() == PEERS;
+		});
+
+		uint32_t pongsDuring = latest[1].pongs - pongsBefore;
+
+		// and the peers noticed
+		ok = ok && read_status(statusPipe[0], latest, Clock::now() + std::chrono::seconds(1), [&] {
+			return latest[0].peerId != 0 && latest[1].peerId != 0 && latest[1].pongs > pongsBefore + pongsDuring;
+		});
+
+		if (!ok) {
+			std::cout << "drop " << drop + 1 << ": peers did not resume within " << RESUME_TIMEOUT_S << " s" << std::endl;
+			break;
+		}
+
+		std::lock_guard<std::mutex> guard(proxy.lock);
+		int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			*std::max_element(proxy.resumed.begin(), proxy.resumed.end()) - proxy.dropped).count();
+		resumeTimes.push_back(ms);
+
+		std::cout << "drop " << drop + 1 << ": resumed in " << ms << " ms as peer "
+			<< latest[0].peerId << " and peer " << latest[1].peerId << ", "
+			<< pongsDuring << " pongs while signaling was down" << std::endl;
+
+		if (latest[0].peerId != ids[0] || latest[1].peerId != ids[1]) {
+			std::cout << "peer ids changed, the sessions were not resumed" << std::endl;
+			ok = false;
+		}
+	}
+
+	proxy.running = false;
+	proxyThread.join();
+
+	for (auto pid : children) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+
+	if (!resumeTimes.empty()) {
+		std::sort(resumeTimes.begin(), resumeTimes.end());
+		std::cout << "resume time (ms): p50 " << resumeTimes[resumeTimes.size() / 2] << " max " << resumeTimes.back() << std::endl;
+	}
+
+	std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
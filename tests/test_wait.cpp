@@ -0,0 +1,144 @@
+// Measures how long humblenet_p2p_wait takes to return once a packet arrives.
+//
+// Run one instance without arguments (the echo side) and a second one with the
+// peer id printed by the first. Both instances must run on the same machine, the
+// packets carry a steady_clock timestamp of when they were sent and the receiving
+// side records the time between that and humblenet_p2p_wait returning.
+
+#include "humblenet_p2p.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+enum class MessageType : uint8_t {
+	PING = 1,
+	PONG = 2,
+};
+
+struct Message {
+	MessageType type;
+	uint32_t sequence;
+	int64_t sentAt;
+};
+
+const uint8_t CHANNEL = 43;
+const size_t SAMPLES = 500;
+const int PING_INTERVAL_MS = 20;
+
+const char client_token[] = "hello_world";
+const char client_secret[] = "secret";
+
+static int64_t now_us()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void send_message(PeerId peer, MessageType type, uint32_t sequence)
+{
+	Message msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.type = type;
+	msg.sequence = sequence;
+	msg.sentAt = now_us();
+
+	humblenet_p2p_sendto(&msg, sizeof(msg), peer, SEND_RELIABLE, CHANNEL);
+}
+
+static void report(const char* name, std::vector<int64_t>& samples)
+{
+	if (samples.empty()) return;
+
+	std::sort(samples.begin(), samples.end());
+
+	int64_t total = 0;
+	for (auto s : samples) total += s;
+
+	std::cout << name << " (" << samples.size() << " samples, us):"
+		<< " min " << samples.front()
+		<< " avg " << total / (int64_t)samples.size()
+		<< " p50 " << samples[samples.size() / 2]
+		<< " p99 " << samples[samples.size() * 99 / 100]
+		<< " max " << samples.back()
+		<< std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	PeerId remotePeer = 0;
+	if (argc > 1) {
+		remotePeer = std::stol(argv[1]);
+	}
+
+	humblenet_init();
+	humblenet_p2p_init(HUMBLENET_SERVER_URL, client_token, client_secret, NULL);
+
+	PeerId myPeer = 0;
+	while (myPeer == 0) {
+		humblenet_p2p_wait(100);
+		myPeer = humblenet_p2p_get_my_peer_id();
+	}
+
+	std::cout << "We connected to the peer server with peer " << myPeer << std::endl;
+
+	std::vector<int64_t> wakeLatency;
+	std::vector<int64_t> roundTrip;
+	int64_t nextPing = now_us();
+	int64_t lastPing = 0;
+	uint32_t sequence = 0;
+
+	while (wakeLatency.size() < SAMPLES) {
+		int timeout = 1000;
+		if (remotePeer) {
+			int64_t now = now_us();
+			if (now >= nextPing) {
+				send_message(remotePeer, MessageType::PING, ++sequence);
+				lastPing = now;
+				nextPing = now + PING_INTERVAL_MS * 1000;
+			}
+			timeout = (int)((nextPing - now_us() + 999) / 1000);
+		}
+
+		if (!humblenet_p2p_wait(timeout)) {
+			continue;
+		}
+
+		int64_t woke = now_us();
+
+		Message msg;
+		PeerId fromPeer = 0;
+		bool first = true;
+		int ret;
+		while ((ret = humblenet_p2p_recvfrom(&msg, sizeof(msg), &fromPeer, CHANNEL)) > 0) {
+			if (ret != sizeof(msg)) continue;
+
+			// only the first message of a batch measures the wake up.
+			if (first) {
+				wakeLatency.push_back(woke - msg.sentAt);
+				first = false;
+			}
+
+			if (msg.type == MessageType::PING) {
+				send_message(fromPeer, MessageType::PONG, msg.sequence);
+			} else if (msg.type == MessageType::PONG && msg.sequence == sequence) {
+				roundTrip.push_back(now_us() - lastPing);
+			}
+		}
+
+		if (ret < 0 && fromPeer != 0) {
+			std::cout << "Peer " << fromPeer << " disconnected" << std::endl;
+			break;
+		}
+	}
+
+	report("packet arrival to humblenet_p2p_wait return", wakeLatency);
+	report("ping round trip", roundTrip);
+
+	humblenet_shutdown();
+
+	return 0;
+}